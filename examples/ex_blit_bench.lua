@@ -0,0 +1,44 @@
+local al = legato.al
+
+--[[ compares the SSE2 memory bitmap blitter with Allegro's software renderer ]]--
+local iterations = 2000
+
+al.set_new_bitmap_flags({memory_bitmap = true})
+local buffer = al.create_bitmap(640, 480)
+local sprite = al.create_bitmap(64, 64)
+
+-- a sprite with some translucent pixels
+al.set_target_bitmap(sprite)
+al.clear_to_color(al.map_rgb_f(0, 0, 0, 0))
+al.draw_filled_circle(32, 32, 30, al.map_rgb_f(0.5, 0.25, 0, 0.5))
+al.draw_filled_circle(32, 32, 16, al.map_rgb(255, 200, 0))
+
+local tint = al.map_rgb_f(0.5, 1, 0.5, 0.75)
+
+local tests = {
+    {'copy', {'add', 'one', 'zero'}, function(x, y) al.draw_bitmap(sprite, x, y) end},
+    {'premultiplied', {'add', 'one', 'inverse_alpha'}, function(x, y) al.draw_bitmap(sprite, x, y) end},
+    {'premultiplied tinted', {'add', 'one', 'inverse_alpha'}, function(x, y) al.draw_tinted_bitmap(sprite, tint, x, y) end},
+    {'alpha', {'add', 'alpha', 'inverse_alpha'}, function(x, y) al.draw_bitmap(sprite, x, y) end},
+}
+
+local function run(draw)
+    al.set_target_bitmap(buffer)
+    al.clear_to_color(al.map_rgb(0, 0, 64))
+    local start = al.get_time()
+    for i = 1, iterations do
+        draw((i * 37) % (640 - 64), (i * 53) % (480 - 64))
+    end
+    return al.get_time() - start
+end
+
+for _, test in ipairs(tests) do
+    al.set_blender(test[2][1], test[2][2], test[2][3])
+    al.set_software_blitter(false)
+    local stock = run(test[3])
+    al.set_software_blitter(true)
+    local fast = run(test[3])
+    print(string.format('%-22s stock %8.2f ms   blitter %8.2f ms   x%.1f',
+        test[1], stock * 1000, fast * 1000, stock / fast))
+end
+al.set_blender('add', 'one', 'inverse_alpha')
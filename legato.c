@@ -35,6 +35,32 @@
  Chanelog:
  ---------
  
+ 2026-10-16 - 0.3.7
+    * added sprite batches (al.create_sprite_batch)
+    * implemented lock_bitmap / lock_bitmap_region / unlock_bitmap
+    * added al.draw_tilemap to render number maps through a tileset
+    * added texture atlas packer (al.create_atlas)
+    * added vertex arrays for low level primitive drawing (al.create_vertex_array)
+    * added particle emitters (legato.fx.create_emitter)
+    * colors can be passed as packed 0xRRGGBBAA integers (al.pack_rgb, al.pack_rgb_f, al.pack_color)
+    * added recorded draw command lists (al.begin_command_list, al.end_command_list, al.draw_command_list)
+    * added dirty rectangle presentation mode (al.set_dirty_rectangles)
+    * added pre-rendered text objects and a LRU text cache (al.create_text_object, al.draw_cached_text)
+    * implemented al.load_bitmap_font, added al.prewarm_font and al.bake_font
+    * added float buffers (legato.util.create_float_buffer) and al.transform_points
+    * added asynchronous loading of bitmaps, samples and fonts (al.load_bitmap_async etc.)
+    * memory to memory draw_bitmap / draw_tinted_bitmap use a SSE2 blitter (al.set_software_blitter)
+    * added render target pools for temporary offscreen bitmaps (al.create_render_target_pool)
+    * added fixed timestep game loop (legato.core.run), implemented al.wait_for_event_until
+    * added culling of offscreen draw calls (al.set_culling, al.get_culling_stats)
+    * added sprite animations played by animators (al.create_animation, al.create_animator)
+    * added asynchronous frame capture to image files (al.start_capture, al.stop_capture)
+    * event functions can refill a given table instead of creating a new one per event
+    * added al.drain_events and al.drain_events_packed to fetch all pending events in one call
+    * added per queue event filters (al.set_event_filter) and numeric event types (al.set_event_type_codes)
+    * added coalescing of mouse axes and joystick axis events (al.set_event_coalescing)
+    * added input recording and replay (al.start_input_recording, al.start_input_replay)
+    * added input snapshots with pressed/released/held tests and action bindings (al.create_input_snapshot)
  2014-02-13 - 0.3.6
     * added path methods
  2013-12-29 - 0.3.5
@@ -121,6 +147,10 @@
 #include <string.h>
 #include <math.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
 #ifdef ALLEGRO_WINDOWS
 #include <allegro5/allegro_direct3d.h>
 #include <allegro5/allegro_native_dialog.h>
@@ -134,10 +164,15 @@
 /* #define DEBUG_OBJECT_LIFE */ /* activate to see object creation/destruction */
 
 #define NOT_IMPLEMENTED_MACRO luaL_error(L, "Error: not implemented yet!"); return 0;
+#define RECORD_DRAW_COMMAND_MACRO(cmd) if ( recording_command_list ) { return record_draw_command(L, cmd); } \
+    else if ( culling_enabled && cull_draw_command_args(L, cmd) ) { return 0; } \
+    else if ( dirty_rectangles_enabled ) { mark_dirty_draw_command(L, cmd); }
+#define NOT_RECORDABLE_MACRO(name) if ( recording_command_list ) { \
+    return luaL_error(L, name " cannot be recorded into a command list, call it outside of begin/end_command_list"); }
 
 #define LEGATO_VERSION_MAJOR    0
 #define LEGATO_VERSION_MINOR    3
-#define LEGATO_VERSION_PATCH    6
+#define LEGATO_VERSION_PATCH    7
 
 #define LEGATO_LITTLE_ENDIAN    0
 #define LEGATO_BIG_ENDIAN       1
@@ -184,6 +219,37 @@
 #define LEGATO_RAND_LCG "legato_rand_lcg"
 #define LEGATO_RAND_MT "legato_rand_mt"
 #define LEGATO_NUMBER_MAP "legato_number_map"
+#define LEGATO_SPRITE_BATCH "legato_sprite_batch"
+#define LEGATO_LOCKED_REGION "legato_locked_region"
+#define LEGATO_ATLAS "legato_atlas"
+#define LEGATO_VERTEX_ARRAY "legato_vertex_array"
+#define LEGATO_EMITTER "legato_emitter"
+#define LEGATO_COMMAND_LIST "legato_command_list"
+#define LEGATO_TEXT_OBJECT "legato_text_object"
+#define LEGATO_FLOAT_BUFFER "legato_float_buffer"
+#define LEGATO_RENDER_TARGET_POOL "legato_render_target_pool"
+#define LEGATO_ANIMATION "legato_animation"
+#define LEGATO_ANIMATOR "legato_animator"
+#define LEGATO_INPUT_SNAPSHOT "legato_input_snapshot"
+
+#define LEGATO_EMITTER_RAMP_SIZE 8
+#define LEGATO_DIRTY_RECTANGLES_MAX 16
+#define LEGATO_TEXT_CACHE_BUDGET (1024 * 1024 * 4) /* 4mb of cached text bitmaps */
+#define LEGATO_FONT_SHEET_WIDTH 1024 /* maximum width of baked font images */
+
+#define LEGATO_CAPTURE_RING_MAX 64
+#define LEGATO_EVENT_FILTER_MAX 32
+#define LEGATO_EVENT_PENDING_MAX 32
+#define LEGATO_EVENT_POLL 0.0 /* get_queue_event() returns at once */
+#define LEGATO_EVENT_WAIT -1.0 /* get_queue_event() waits forever */
+#define LEGATO_INPUT_MOUSE 256 /* first mouse button in the input bitsets, keys are below */
+#define LEGATO_INPUT_JOYSTICK 288 /* first joystick button, 32 per joystick */
+#define LEGATO_INPUT_JOYSTICKS 4
+#define LEGATO_INPUT_MAX (LEGATO_INPUT_JOYSTICK + LEGATO_INPUT_JOYSTICKS * 32)
+#define LEGATO_INPUT_ACTIONS_MAX 32
+#define LEGATO_INPUT_BINDINGS_MAX 8
+
+#define LEGATO_EVENT_ASYNC_LOADED ALLEGRO_GET_EVENT_TYPE(0, 'L', 'G', 'A') /* small enough to be exact as float */
 
 /*
 ================================================================================
@@ -218,6 +284,223 @@ typedef struct number_map_t {
     lua_Number      cells[1];
 } number_map_t;
 
+typedef struct float_buffer_t {
+    int             size;
+    float           data[1];
+} float_buffer_t;
+
+typedef struct sprite_batch_t {
+    ALLEGRO_BITMAP  *bitmap;    /* NULL after destroy, drawing re-reads the bitmap from bitmap_ref */
+    int             bitmap_ref;
+    int             capacity, count;
+    ALLEGRO_VERTEX  *vertices;  /* 4 vertices per sprite */
+    int             *indices;   /* 6 indices per sprite (2 triangles) */
+} sprite_batch_t;
+
+typedef struct locked_region_t {
+    ALLEGRO_BITMAP          *bitmap;
+    int                     bitmap_ref;
+    ALLEGRO_LOCKED_REGION   *region;
+    int                     width, height;
+    int                     mode; /* ALLEGRO_LOCK_READWRITE, _READONLY or _WRITEONLY */
+} locked_region_t;
+
+typedef struct atlas_node_t {
+    int             x, y, w;
+} atlas_node_t;
+
+typedef struct atlas_t {
+    ALLEGRO_BITMAP  *bitmap;
+    int             bitmap_ref;
+    int             width, height, padding;
+    int             used_area, count;
+    int             skyline_count;
+    atlas_node_t    skyline[1];
+} atlas_t;
+
+typedef struct vertex_array_t {
+    int             capacity, index_capacity;
+    int             count, index_count;
+    int             index_written; /* indices beyond this were never set */
+    ALLEGRO_VERTEX  *vertices;
+    int             *indices;
+} vertex_array_t;
+
+typedef struct emitter_t {
+    ALLEGRO_BITMAP  *bitmap;
+    int             bitmap_ref;
+    float           region[4];
+    int             capacity, count;
+    float           x, y, rate, accumulator;
+    float           direction, spread;
+    float           speed_min, speed_max;
+    float           life_min, life_max;
+    float           scale_start, scale_end;
+    float           gravity_x, gravity_y;
+    int             ramp_count;
+    ALLEGRO_COLOR   ramp[LEGATO_EMITTER_RAMP_SIZE];
+    uint32_t        seed;
+    float           *px, *py, *vx, *vy, *age, *inv_life;
+    float           *scale, *r, *g, *b, *a, *t;
+} emitter_t;
+
+typedef struct command_list_t {
+    char            *data;
+    size_t          size, capacity;
+    int             count;
+    int             objects_ref;
+} command_list_t;
+
+typedef struct text_object_t {
+    ALLEGRO_BITMAP          *bitmap;
+    ALLEGRO_FONT            *font;
+    int                     font_ref;
+    int                     advance, bbx, bby, bbw, bbh;
+    size_t                  bytes;
+    struct text_object_t    *prev, *next; /* LRU list of the text cache */
+    char                    key[1]; /* empty for text objects created from Lua */
+} text_object_t;
+
+typedef struct render_target_t {
+    ALLEGRO_BITMAP  *bitmap;
+    int             bitmap_ref;
+    int             width, height, format, flags;
+    int             in_use, idle_frames;
+    size_t          bytes;
+} render_target_t;
+
+typedef struct render_target_pool_t {
+    render_target_t *targets;
+    int             count, capacity;
+    int             max_idle_frames;
+    int             hits, misses;
+    size_t          resident_bytes;
+    int             destroyed;
+} render_target_pool_t;
+
+typedef struct animation_frame_t {
+    float           x, y, w, h;
+    float           duration;
+    float           ox, oy; /* drawing offset of the frame */
+} animation_frame_t;
+
+typedef struct animation_t {
+    ALLEGRO_BITMAP      *bitmap;
+    int                 bitmap_ref;
+    int                 count, loop;
+    float               total;
+    animation_frame_t   frames[1];
+} animation_t;
+
+typedef struct animator_instance_t {
+    const animation_t   *animation; /* NULL for free slots */
+    int                 frame, finished, flags;
+    float               time, speed;
+    float               x, y;
+    ALLEGRO_COLOR       tint;
+} animator_instance_t;
+
+typedef struct animator_t {
+    int                 capacity, count; /* count is the number of used slots */
+    int                 animations_ref;
+    float               tick;
+    animator_instance_t *instances;
+    ALLEGRO_VERTEX      *vertices; /* 6 vertices per instance */
+} animator_t;
+
+typedef struct action_binding_t {
+    char                name[32];
+    int                 count;
+    int                 inputs[LEGATO_INPUT_BINDINGS_MAX];
+} action_binding_t;
+
+typedef struct input_snapshot_t {
+    uint32_t                bits[2][LEGATO_INPUT_MAX / 32]; /* current and previous frame */
+    int                     mouse_x, mouse_y, mouse_z, mouse_w;
+    int                     mouse_dx, mouse_dy, mouse_dz, mouse_dw;
+    int                     num_joysticks;
+    ALLEGRO_JOYSTICK_STATE  joysticks[LEGATO_INPUT_JOYSTICKS];
+    int                     action_count;
+    action_binding_t        actions[LEGATO_INPUT_ACTIONS_MAX];
+} input_snapshot_t;
+
+enum { ASYNC_BITMAP, ASYNC_SAMPLE, ASYNC_TTF_FONT };
+enum { ASYNC_PENDING, ASYNC_LOADING, ASYNC_DONE, ASYNC_FAILED, ASYNC_CANCELLED };
+
+enum { CAPTURE_FREE, CAPTURE_QUEUED, CAPTURE_WRITING };
+
+typedef struct capture_slot_t {
+    ALLEGRO_BITMAP  *bitmap;
+    int             state, frame;
+} capture_slot_t;
+
+typedef struct event_filter_t {
+    ALLEGRO_EVENT_QUEUE     *queue;
+    int                     count;
+    int                     types[LEGATO_EVENT_FILTER_MAX]; /* dropped event types */
+    int                     coalesce;
+    int                     pending_count;
+    int                     pending_pos;
+    ALLEGRO_EVENT           pending[LEGATO_EVENT_PENDING_MAX]; /* coalesced joystick axis events */
+    struct event_filter_t   *next;
+} event_filter_t;
+
+typedef struct async_request_t {
+    int                     id, kind, status, priority;
+    int                     size, flags; /* font loading parameters */
+    void                    *result;
+    ALLEGRO_EVENT_SOURCE    *source; /* of the queue which receives the completion event */
+    struct async_request_t  *next;
+    char                    filename[1];
+} async_request_t;
+
+typedef struct async_source_t {
+    ALLEGRO_EVENT_QUEUE     *queue;
+    ALLEGRO_EVENT_SOURCE    source;
+    struct async_source_t   *next;
+} async_source_t;
+
+enum {
+    DRAW_CMD_BITMAP,
+    DRAW_CMD_TINTED_BITMAP,
+    DRAW_CMD_BITMAP_REGION,
+    DRAW_CMD_TINTED_BITMAP_REGION,
+    DRAW_CMD_PIXEL,
+    DRAW_CMD_ROTATED_BITMAP,
+    DRAW_CMD_TINTED_ROTATED_BITMAP,
+    DRAW_CMD_SCALED_ROTATED_BITMAP,
+    DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP,
+    DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP_REGION,
+    DRAW_CMD_SCALED_BITMAP,
+    DRAW_CMD_TINTED_SCALED_BITMAP,
+    DRAW_CMD_TEXT,
+    DRAW_CMD_JUSTIFIED_TEXT,
+    DRAW_CMD_LINE,
+    DRAW_CMD_TRIANGLE,
+    DRAW_CMD_FILLED_TRIANGLE,
+    DRAW_CMD_RECTANGLE,
+    DRAW_CMD_FILLED_RECTANGLE,
+    DRAW_CMD_ROUNDED_RECTANGLE,
+    DRAW_CMD_FILLED_ROUNDED_RECTANGLE,
+    DRAW_CMD_PIESLICE,
+    DRAW_CMD_FILLED_PIESLICE,
+    DRAW_CMD_ELLIPSE,
+    DRAW_CMD_FILLED_ELLIPSE,
+    DRAW_CMD_CIRCLE,
+    DRAW_CMD_FILLED_CIRCLE,
+    DRAW_CMD_ARC,
+    DRAW_CMD_ELLIPTICAL_ARC,
+    DRAW_CMD_COUNT
+};
+
+typedef struct draw_command_args_t {
+    void            *object;
+    ALLEGRO_COLOR   color;
+    float           n[16];
+    int             flags;
+    const char      *text;
+} draw_command_args_t;
+
 /*
 ================================================================================
 
@@ -246,6 +529,15 @@ static ALLEGRO_SAMPLE_ID *to_sample_id( lua_State *L, const int idx );
 static ALLEGRO_SAMPLE_INSTANCE *to_sample_instance( lua_State *L, const int idx );
 static ALLEGRO_AUDIO_STREAM *to_audio_stream( lua_State *L, const int idx );
 static ALLEGRO_FONT *to_font( lua_State *L, const int idx );
+static int push_event( lua_State *L, ALLEGRO_EVENT *event );
+static int get_queue_event( ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *event, const double until );
+static int peek_next_queue_event( ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *event );
+static void remove_event_filter( ALLEGRO_EVENT_QUEUE *queue );
+static void record_input_event( ALLEGRO_EVENT_QUEUE *queue, const ALLEGRO_EVENT *event );
+static int replay_input_event( ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *event, double *due, const int peek );
+static int is_input_event( const unsigned int type );
+static void release_input_queue( ALLEGRO_EVENT_QUEUE *queue );
+static lua_Number get_opt_number_field( lua_State *L, const int idx, const char *key, const lua_Number def );
 static PHYSFS_File *to_file( lua_State *L, const int idx );
 static ENetAddress *to_address( lua_State *L, const int idx );
 static ENetHost *to_host( lua_State *L, const int idx );
@@ -253,6 +545,28 @@ static ENetPeer *to_peer( lua_State *L, const int idx );
 static rand_lcg_t *to_rand_lcg( lua_State *L, const int idx );
 static rand_mt_t *to_rand_mt( lua_State *L, const int idx );
 static number_map_t *to_number_map( lua_State *L, const int idx );
+static float_buffer_t *to_float_buffer( lua_State *L, const int idx );
+static emitter_t *to_emitter( lua_State *L, const int idx );
+static command_list_t *to_command_list( lua_State *L, const int idx );
+static text_object_t *to_text_object( lua_State *L, const int idx );
+static void flush_text_cache( lua_State *L, ALLEGRO_FONT *font );
+static int record_draw_command( lua_State *L, const int cmd );
+static void mark_dirty_draw_command( lua_State *L, const int cmd );
+static void mark_draw_command_bounds( const int cmd, const draw_command_args_t *a );
+static void mark_dirty_display( void );
+static int cull_draw_command( const int cmd, const draw_command_args_t *a );
+static int cull_draw_command_args( lua_State *L, const int cmd );
+static void present_dirty_rectangles( void );
+static void flip_display( void );
+static void capture_display_frame( void );
+static sprite_batch_t *to_sprite_batch( lua_State *L, const int idx );
+static locked_region_t *to_locked_region( lua_State *L, const int idx );
+static atlas_t *to_atlas( lua_State *L, const int idx );
+static vertex_array_t *to_vertex_array( lua_State *L, const int idx );
+static render_target_pool_t *to_render_target_pool( lua_State *L, const int idx );
+static animation_t *to_animation( lua_State *L, const int idx );
+static animator_t *to_animator( lua_State *L, const int idx );
+static input_snapshot_t *to_input_snapshot( lua_State *L, const int idx );
 
 /*
 ================================================================================
@@ -261,6 +575,187 @@ static number_map_t *to_number_map( lua_State *L, const int idx );
 
 ================================================================================
 */
+static const mapping_t event_type_mapping[] = {
+    {"joystick_axes", ALLEGRO_EVENT_JOYSTICK_AXIS},
+    {"joystick_button_down", ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN},
+    {"joystick_button_up", ALLEGRO_EVENT_JOYSTICK_BUTTON_UP},
+    {"joystick_configuration", ALLEGRO_EVENT_JOYSTICK_CONFIGURATION},
+    {"key_down", ALLEGRO_EVENT_KEY_DOWN},
+    {"key_up", ALLEGRO_EVENT_KEY_UP},
+    {"key_char", ALLEGRO_EVENT_KEY_CHAR},
+    {"mouse_axes", ALLEGRO_EVENT_MOUSE_AXES},
+    {"mouse_button_down", ALLEGRO_EVENT_MOUSE_BUTTON_DOWN},
+    {"mouse_button_up", ALLEGRO_EVENT_MOUSE_BUTTON_UP},
+    {"mouse_warped", ALLEGRO_EVENT_MOUSE_WARPED},
+    {"mouse_enter_display", ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY},
+    {"mouse_leave_display", ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY},
+    {"timer", ALLEGRO_EVENT_TIMER},
+    {"display_expose", ALLEGRO_EVENT_DISPLAY_EXPOSE},
+    {"display_resize", ALLEGRO_EVENT_DISPLAY_RESIZE},
+    {"display_close", ALLEGRO_EVENT_DISPLAY_CLOSE},
+    {"display_lost", ALLEGRO_EVENT_DISPLAY_LOST},
+    {"display_found", ALLEGRO_EVENT_DISPLAY_FOUND},
+    {"display_switch_out", ALLEGRO_EVENT_DISPLAY_SWITCH_OUT},
+    {"display_switch_in", ALLEGRO_EVENT_DISPLAY_SWITCH_IN},
+    {"display_orientation", ALLEGRO_EVENT_DISPLAY_ORIENTATION},
+    {"async_loaded", LEGATO_EVENT_ASYNC_LOADED},
+    {NULL, 0}
+};
+
+/* columns of drain_events_packed() */
+enum {
+    EVENT_COLUMN_TYPE,
+    EVENT_COLUMN_TIMESTAMP,
+    EVENT_COLUMN_X,
+    EVENT_COLUMN_Y,
+    EVENT_COLUMN_Z,
+    EVENT_COLUMN_W,
+    EVENT_COLUMN_DX,
+    EVENT_COLUMN_DY,
+    EVENT_COLUMN_DZ,
+    EVENT_COLUMN_DW,
+    EVENT_COLUMN_KEYCODE,
+    EVENT_COLUMN_UNICHAR,
+    EVENT_COLUMN_BUTTON,
+    EVENT_COLUMN_STICK,
+    EVENT_COLUMN_AXIS,
+    EVENT_COLUMN_POS,
+    EVENT_COLUMN_COUNT,
+    EVENT_COLUMN_WIDTH,
+    EVENT_COLUMN_HEIGHT,
+    EVENT_COLUMN_ID,
+    EVENT_COLUMN_OK,
+    EVENT_COLUMNS_SIZE
+};
+
+static const mapping_t event_column_mapping[] = {
+    {"type", EVENT_COLUMN_TYPE},
+    {"timestamp", EVENT_COLUMN_TIMESTAMP},
+    {"x", EVENT_COLUMN_X},
+    {"y", EVENT_COLUMN_Y},
+    {"z", EVENT_COLUMN_Z},
+    {"w", EVENT_COLUMN_W},
+    {"dx", EVENT_COLUMN_DX},
+    {"dy", EVENT_COLUMN_DY},
+    {"dz", EVENT_COLUMN_DZ},
+    {"dw", EVENT_COLUMN_DW},
+    {"keycode", EVENT_COLUMN_KEYCODE},
+    {"unichar", EVENT_COLUMN_UNICHAR},
+    {"button", EVENT_COLUMN_BUTTON},
+    {"stick", EVENT_COLUMN_STICK},
+    {"axis", EVENT_COLUMN_AXIS},
+    {"pos", EVENT_COLUMN_POS},
+    {"count", EVENT_COLUMN_COUNT},
+    {"width", EVENT_COLUMN_WIDTH},
+    {"height", EVENT_COLUMN_HEIGHT},
+    {"id", EVENT_COLUMN_ID},
+    {"ok", EVENT_COLUMN_OK},
+    {NULL, 0}
+};
+
+/* field names and type strings of events, interned once in the event string table */
+enum {
+    EVENT_STR_TYPE = 1,
+    EVENT_STR_ID,
+    EVENT_STR_STICK,
+    EVENT_STR_AXIS,
+    EVENT_STR_POS,
+    EVENT_STR_BUTTON,
+    EVENT_STR_KEYCODE,
+    EVENT_STR_DISPLAY,
+    EVENT_STR_UNICHAR,
+    EVENT_STR_REPEAT,
+    EVENT_STR_MODIFIERS,
+    EVENT_STR_X,
+    EVENT_STR_Y,
+    EVENT_STR_Z,
+    EVENT_STR_W,
+    EVENT_STR_DX,
+    EVENT_STR_DY,
+    EVENT_STR_DZ,
+    EVENT_STR_DW,
+    EVENT_STR_TIMER,
+    EVENT_STR_COUNT,
+    EVENT_STR_WIDTH,
+    EVENT_STR_HEIGHT,
+    EVENT_STR_ORIENTATION,
+    EVENT_STR_OK,
+    EVENT_STR_JOYSTICK_AXES,
+    EVENT_STR_JOYSTICK_BUTTON_DOWN,
+    EVENT_STR_JOYSTICK_BUTTON_UP,
+    EVENT_STR_JOYSTICK_CONFIGURATION,
+    EVENT_STR_KEY_DOWN,
+    EVENT_STR_KEY_UP,
+    EVENT_STR_KEY_CHAR,
+    EVENT_STR_MOUSE_AXES,
+    EVENT_STR_MOUSE_BUTTON_DOWN,
+    EVENT_STR_MOUSE_BUTTON_UP,
+    EVENT_STR_MOUSE_WARPED,
+    EVENT_STR_MOUSE_ENTER_DISPLAY,
+    EVENT_STR_MOUSE_LEAVE_DISPLAY,
+    EVENT_STR_DISPLAY_EXPOSE,
+    EVENT_STR_DISPLAY_RESIZE,
+    EVENT_STR_DISPLAY_CLOSE,
+    EVENT_STR_DISPLAY_LOST,
+    EVENT_STR_DISPLAY_FOUND,
+    EVENT_STR_DISPLAY_SWITCH_OUT,
+    EVENT_STR_DISPLAY_SWITCH_IN,
+    EVENT_STR_DISPLAY_ORIENTATION,
+    EVENT_STR_ASYNC_LOADED,
+    EVENT_STRINGS_SIZE
+};
+
+static const char *event_strings[] = {
+    "type",
+    "id",
+    "stick",
+    "axis",
+    "pos",
+    "button",
+    "keycode",
+    "display",
+    "unichar",
+    "repeat",
+    "modifiers",
+    "x",
+    "y",
+    "z",
+    "w",
+    "dx",
+    "dy",
+    "dz",
+    "dw",
+    "timer",
+    "count",
+    "width",
+    "height",
+    "orientation",
+    "ok",
+    "joystick_axes",
+    "joystick_button_down",
+    "joystick_button_up",
+    "joystick_configuration",
+    "key_down",
+    "key_up",
+    "key_char",
+    "mouse_axes",
+    "mouse_button_down",
+    "mouse_button_up",
+    "mouse_warped",
+    "mouse_enter_display",
+    "mouse_leave_display",
+    "display_expose",
+    "display_resize",
+    "display_close",
+    "display_lost",
+    "display_found",
+    "display_switch_out",
+    "display_switch_in",
+    "display_orientation",
+    "async_loaded",
+    NULL
+};
+
 static const mapping_t display_flag_mapping[] = {
     {"windowed", ALLEGRO_WINDOWED},
     {"fullscreen", ALLEGRO_FULLSCREEN},
@@ -349,6 +844,24 @@ static const mapping_t pixel_format_mapping[] = {
     {NULL, 0}
 };
 
+static const mapping_t lock_mode_mapping[] = {
+    {"readwrite", ALLEGRO_LOCK_READWRITE},
+    {"readonly", ALLEGRO_LOCK_READONLY},
+    {"writeonly", ALLEGRO_LOCK_WRITEONLY},
+    {NULL, 0}
+};
+
+static const mapping_t prim_type_mapping[] = {
+    {"point_list", ALLEGRO_PRIM_POINT_LIST},
+    {"line_list", ALLEGRO_PRIM_LINE_LIST},
+    {"line_strip", ALLEGRO_PRIM_LINE_STRIP},
+    {"line_loop", ALLEGRO_PRIM_LINE_LOOP},
+    {"triangle_list", ALLEGRO_PRIM_TRIANGLE_LIST},
+    {"triangle_strip", ALLEGRO_PRIM_TRIANGLE_STRIP},
+    {"triangle_fan", ALLEGRO_PRIM_TRIANGLE_FAN},
+    {NULL, 0}
+};
+
 static const mapping_t bitmap_flag_mapping[] = {
     {"video_bitmap", ALLEGRO_VIDEO_BITMAP},
     {"memory_bitmap", ALLEGRO_MEMORY_BITMAP},
@@ -587,6 +1100,15 @@ static void show_error( const char *message ) {
 ================================================================================
 */
 int global_object_table_ref = LUA_NOREF;
+int locked_region_table_ref = LUA_NOREF;
+command_list_t *recording_command_list = NULL;
+int recording_command_list_ref = LUA_NOREF;
+int dirty_rectangles_enabled = 0;
+int culling_enabled = 0;
+int software_blitter_enabled = 1;
+int text_cache_table_ref = LUA_NOREF;
+int event_string_table_ref = LUA_NOREF;
+int event_type_codes = 0;
 
 static int push_ok( lua_State *L ) {
     lua_pushboolean(L, 1);
@@ -671,6 +1193,15 @@ static void clear_object( lua_State *L, const int idx ) {
     obj->dependency_ref = LUA_NOREF;
 }
 
+/* pointer of the object behind a registry reference, NULL if the object was destroyed meanwhile */
+static void *get_ref_object( lua_State *L, const int ref ) {
+    object_t *obj;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    obj = (object_t*) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return obj ? obj->ptr : NULL;
+}
+
 static void create_meta( lua_State *L, const char *name, const luaL_Reg funcs[] ) {
     luaL_newmetatable(L, name);
     lua_pushvalue(L, -1);
@@ -724,6 +1255,16 @@ static int parse_enum_name( lua_State *L, const int idx, const mapping_t mapping
     return 0;
 }
 
+static const char *find_mapping_name( const mapping_t mapping[], const int value ) {
+    int i;
+    for ( i = 0; mapping[i].name; ++i ) {
+        if ( value == mapping[i].value ) {
+            return mapping[i].name;
+        }
+    }
+    return NULL;
+}
+
 static int push_enum_name( lua_State *L, const int value, const mapping_t mapping[] ) {
     int i;
     for ( i = 0; mapping[i].name; ++i ) {
@@ -754,6 +1295,7 @@ static int push_equal_check( lua_State *L, const char *name ) {
 */
 
 static void create_object_table( lua_State *L ) {
+    int i;
     /* create weak-value table for all created objects */
     lua_newtable(L);
     lua_newtable(L);
@@ -761,6 +1303,23 @@ static void create_object_table( lua_State *L ) {
     lua_setfield(L, -2, "__mode");
     lua_setmetatable(L, -2);
     global_object_table_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    /* create weak-value table for currently locked bitmaps */
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushstring(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    locked_region_table_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    /* create table for the text cache */
+    lua_newtable(L);
+    text_cache_table_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    /* intern the event strings once */
+    lua_createtable(L, EVENT_STRINGS_SIZE - 1, 0);
+    for ( i = 0; event_strings[i]; ++i ) {
+        lua_pushstring(L, event_strings[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    event_string_table_ref = luaL_ref(L, LUA_REGISTRYINDEX);
 }
 
 static int push_object_by_pointer_with_dependency( lua_State *L, const char *name, void *ptr, const int dependency ) {
@@ -790,26 +1349,6 @@ static void set_int( lua_State *L, const char *key, const lua_Integer value ) {
     lua_setfield(L, -2, key);
 }
 
-static void set_ptr( lua_State *L, const char *key, const char *name, const void *ptr ) {
-    push_object_by_pointer(L, name, (void*) ptr);
-    lua_setfield(L, -2, key);
-}
-
-static void set_bool( lua_State *L, const char *key, const int value ) {
-    lua_pushboolean(L, value);
-    lua_setfield(L, -2, key);
-}
-
-static void set_float( lua_State *L, const char *key, const float value ) {
-    lua_pushnumber(L, value);
-    lua_setfield(L, -2, key);
-}
-
-static void set_flags( lua_State *L, const char *key, const int flags, const mapping_t mapping[] ) {
-    push_flag_table(L, flags, mapping);
-    lua_setfield(L, -2, key);
-}
-
 static void register_mapping( lua_State *L, const mapping_t mapping[] ) {
     int i;
     for ( i = 0; mapping[i].name; ++i ) {
@@ -923,6 +1462,116 @@ static int core_get_os_type( lua_State *L ) {
 #endif
     return 1;
 }
+
+/* calls the function below its nargs arguments, returns 0 if it returned false */
+static int call_run_callback( lua_State *L, const int nargs ) {
+    int keep_running;
+    lua_call(L, nargs, 1);
+    keep_running = ! (lua_isboolean(L, -1) && ! lua_toboolean(L, -1));
+    lua_pop(L, 1);
+    return keep_running;
+}
+
+static int dispatch_run_event( lua_State *L, const int callback, ALLEGRO_EVENT *event ) {
+    if ( lua_isnil(L, callback) ) {
+        return event->type != ALLEGRO_EVENT_DISPLAY_CLOSE;
+    }
+    lua_pushvalue(L, callback);
+    push_event(L, event);
+    return call_run_callback(L, 1);
+}
+
+/*
+    run(update, draw, [{hz = 60, max_frame_skip = 5, queue, event}]) -> updates, frames, missed frames
+    Fixed timestep game loop. update(dt) is called hz times per second, draw(alpha) gets
+    the time since the last update as fraction of a step and the display is flipped after it.
+    Events of the queue are passed to event(e) while the loop sleeps. The loop stops when
+    update or event return false (without an event function a display_close event stops it).
+*/
+static int core_run( lua_State *L ) {
+    ALLEGRO_EVENT_QUEUE *queue = NULL;
+    ALLEGRO_EVENT event;
+    double hz, step, next, now, alpha;
+    int max_frame_skip, updates, skipped, got_event, running = 1;
+    lua_Integer total_updates = 0, frames = 0, missed = 0;
+
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    if ( ! lua_isnoneornil(L, 3) ) {
+        luaL_checktype(L, 3, LUA_TTABLE);
+    }
+    lua_settop(L, 3);
+    hz = get_opt_number_field(L, 3, "hz", 60.0);
+    max_frame_skip = (int) get_opt_number_field(L, 3, "max_frame_skip", 5.0);
+    luaL_argcheck(L, hz > 0.0, 3, "invalid hz");
+    luaL_argcheck(L, max_frame_skip >= 0, 3, "invalid max_frame_skip");
+    step = 1.0 / hz;
+    if ( lua_istable(L, 3) ) {
+        lua_getfield(L, 3, "queue"); /* 4 */
+        lua_getfield(L, 3, "event"); /* 5 */
+    } else {
+        lua_pushnil(L);
+        lua_pushnil(L);
+    }
+    if ( ! lua_isnil(L, 4) ) {
+        queue = to_event_queue(L, 4);
+    }
+    if ( ! lua_isnil(L, 5) ) {
+        luaL_checktype(L, 5, LUA_TFUNCTION);
+    }
+
+    next = al_get_time();
+    while ( running ) {
+        /* sleep until the next update is due and handle the events meanwhile */
+        while ( running ) {
+            now = al_get_time();
+            if ( queue == NULL ) {
+                if ( now < next ) {
+                    al_rest(next - now);
+                }
+                break;
+            }
+            got_event = get_queue_event(queue, &event, now < next ? next : LEGATO_EVENT_POLL);
+            if ( ! got_event ) {
+                break;
+            }
+            running = dispatch_run_event(L, 5, &event);
+        }
+
+        for ( updates = 0; running && updates <= max_frame_skip && al_get_time() >= next; ++updates ) {
+            lua_pushvalue(L, 1);
+            lua_pushnumber(L, step);
+            running = call_run_callback(L, 1);
+            next += step;
+            ++total_updates;
+        }
+        if ( ! running ) {
+            break;
+        }
+
+        /* too slow (the frame skip limit was hit), drop the updates we cannot catch up with */
+        now = al_get_time();
+        if ( updates > max_frame_skip && now >= next ) {
+            skipped = (int) ((now - next) / step) + 1;
+            missed += skipped;
+            next += skipped * step;
+        }
+
+        alpha = (now - (next - step)) / step;
+        lua_pushvalue(L, 2);
+        lua_pushnumber(L, alpha < 0.0 ? 0.0 : (alpha > 1.0 ? 1.0 : alpha));
+        lua_call(L, 1, 0);
+        if ( al_get_current_display() ) {
+            flip_display();
+        }
+        ++frames;
+    }
+
+    lua_pushinteger(L, total_updates);
+    lua_pushinteger(L, frames);
+    lua_pushinteger(L, missed);
+    return 3;
+}
     
 static const luaL_Reg core__functions[] = {
     {"get_version", core_get_version},
@@ -933,6 +1582,7 @@ static const luaL_Reg core__functions[] = {
     {"split_UTF8_string", core_split_UTF8_string},
     {"get_licenses", core_get_licenses},
     {"get_os_type", core_get_os_type},
+    {"run", core_run},
     {NULL, NULL}
 };
 
@@ -1106,8 +1756,17 @@ static int lg_get_backbuffer( lua_State *L ) {
     return push_object_by_pointer(L, LEGATO_BITMAP, al_get_backbuffer(to_display(L, 1)));
 }
 
+static void flip_display( void ) {
+    capture_display_frame();
+    if ( dirty_rectangles_enabled ) {
+        present_dirty_rectangles();
+    } else {
+        al_flip_display();
+    }
+}
+
 static int lg_flip_display( lua_State *L ) {
-    al_flip_display();
+    flip_display();
     return 0;
 }
 
@@ -1204,6 +1863,192 @@ static int lg_inhibit_screensaver( lua_State *L ) {
     return 0;
 }
 
+/*
+================================================================================
+
+                Software blitter
+
+================================================================================
+*/
+enum {
+    BLIT_MODE_COPY,
+    BLIT_MODE_PREMULTIPLIED,
+    BLIT_MODE_ALPHA
+};
+
+static int get_blit_mode( void ) {
+    int op, src, dst, alpha_op, alpha_src, alpha_dst;
+    al_get_separate_blender(&op, &src, &dst, &alpha_op, &alpha_src, &alpha_dst);
+    if ( op != ALLEGRO_ADD || alpha_op != ALLEGRO_ADD || src != alpha_src || dst != alpha_dst ) {
+        return -1;
+    }
+    if ( src == ALLEGRO_ONE && dst == ALLEGRO_ZERO ) return BLIT_MODE_COPY;
+    if ( src == ALLEGRO_ONE && dst == ALLEGRO_INVERSE_ALPHA ) return BLIT_MODE_PREMULTIPLIED;
+    if ( src == ALLEGRO_ALPHA && dst == ALLEGRO_INVERSE_ALPHA ) return BLIT_MODE_ALPHA;
+    return -1;
+}
+
+static ALLEGRO_BITMAP *get_root_bitmap( ALLEGRO_BITMAP *bitmap ) {
+    ALLEGRO_BITMAP *parent = al_get_parent_bitmap(bitmap);
+    return parent ? parent : bitmap;
+}
+
+static int div255( const int v ) {
+    const int t = v + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+/* blends one row of 32 bit pixels, alpha is always the highest byte and tint[] is in byte order */
+static void blit_row_scalar( uint32_t *dst, const uint32_t *src, const int count, const int mode, const int *tint ) {
+    int i, j, c[4], a, v;
+    uint32_t s, d, out;
+    for ( i = 0; i < count; ++i ) {
+        s = src[i];
+        for ( j = 0; j < 4; ++j ) {
+            c[j] = (s >> (j * 8)) & 0xFF;
+            if ( tint ) c[j] = div255(c[j] * tint[j]);
+        }
+        a = c[3];
+        if ( mode == BLIT_MODE_COPY || (a == 255 && mode == BLIT_MODE_ALPHA) ) {
+            dst[i] = (uint32_t) c[0] | (c[1] << 8) | (c[2] << 16) | ((uint32_t) c[3] << 24);
+            continue;
+        }
+        d = dst[i];
+        out = 0;
+        for ( j = 0; j < 4; ++j ) {
+            v = (mode == BLIT_MODE_ALPHA ? div255(c[j] * a) : c[j]) + div255(((d >> (j * 8)) & 0xFF) * (255 - a));
+            out |= (uint32_t) (v > 255 ? 255 : v) << (j * 8);
+        }
+        dst[i] = out;
+    }
+}
+
+#ifdef __SSE2__
+static __m128i div255_epi16( const __m128i v ) {
+    const __m128i t = _mm_add_epi16(v, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+/* blends two pixels which are unpacked to 16 bit lanes */
+static __m128i blit_pixels_sse2( __m128i s, const __m128i d, const int mode, const __m128i *tint ) {
+    __m128i a;
+    if ( tint ) s = div255_epi16(_mm_mullo_epi16(s, *tint));
+    if ( mode == BLIT_MODE_COPY ) return s;
+    a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+    if ( mode == BLIT_MODE_ALPHA ) s = div255_epi16(_mm_mullo_epi16(s, a));
+    return _mm_adds_epu16(s, div255_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a))));
+}
+
+static void blit_row_sse2( uint32_t *dst, const uint32_t *src, const int count, const int mode, const int *tint ) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i t, s, d, lo, hi;
+    int i = 0;
+    if ( tint ) t = _mm_set_epi16(tint[3], tint[2], tint[1], tint[0], tint[3], tint[2], tint[1], tint[0]);
+    for ( ; i + 4 <= count; i += 4 ) {
+        s = _mm_loadu_si128((const __m128i*) (src + i));
+        if ( mode == BLIT_MODE_COPY && ! tint ) {
+            _mm_storeu_si128((__m128i*) (dst + i), s);
+            continue;
+        }
+        d = _mm_loadu_si128((const __m128i*) (dst + i));
+        lo = blit_pixels_sse2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), mode, tint ? &t : NULL);
+        hi = blit_pixels_sse2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), mode, tint ? &t : NULL);
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+    }
+    blit_row_scalar(dst + i, src + i, count - i, mode, tint);
+}
+#define BLIT_ROW blit_row_sse2
+#else
+#define BLIT_ROW blit_row_scalar
+#endif /* __SSE2__ */
+
+/*
+    Draws a memory bitmap onto a memory bitmap without going through Allegro's
+    generic software renderer. Only plain copies at integer positions with the
+    default blenders are handled, everything else returns 0 and the caller
+    draws the bitmap the normal way.
+*/
+static int blit_memory_bitmap( ALLEGRO_BITMAP *bitmap, const ALLEGRO_COLOR *tint, float x, float y, const int flags ) {
+    ALLEGRO_BITMAP *target = al_get_target_bitmap();
+    const ALLEGRO_TRANSFORM *t;
+    ALLEGRO_LOCKED_REGION *src_region, *dst_region;
+    int format, mode, sx, sy, dx, dy, w, h, cx, cy, cw, ch, row;
+    int tint_bytes[4], *tint_ptr = NULL;
+    unsigned char r, g, b, a;
+
+    if ( ! software_blitter_enabled || flags != 0 || ! target || target == bitmap ) return 0;
+    if ( ! (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP) || ! (al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) ) return 0;
+    if ( get_root_bitmap(target) == get_root_bitmap(bitmap) || al_is_bitmap_locked(target) || al_is_bitmap_locked(bitmap) ) return 0;
+    format = al_get_bitmap_format(bitmap);
+    if ( format != al_get_bitmap_format(target) ) return 0;
+    if ( format != ALLEGRO_PIXEL_FORMAT_ARGB_8888 && format != ALLEGRO_PIXEL_FORMAT_ABGR_8888 ) return 0;
+    if ( (mode = get_blit_mode()) < 0 ) return 0;
+
+    /* only translations keep the pixels aligned */
+    t = al_get_current_transform();
+    if ( t->m[0][0] != 1.0f || t->m[1][1] != 1.0f || t->m[0][1] != 0.0f || t->m[1][0] != 0.0f ) return 0;
+    x += t->m[3][0]; y += t->m[3][1];
+    if ( x != floorf(x) || y != floorf(y) || fabsf(x) > 1e7f || fabsf(y) > 1e7f ) return 0;
+
+    if ( tint ) {
+        al_unmap_rgba(*tint, &r, &g, &b, &a);
+        if ( (r & g & b & a) != 255 ) {
+            tint_bytes[1] = g; tint_bytes[3] = a;
+            tint_bytes[0] = format == ALLEGRO_PIXEL_FORMAT_ARGB_8888 ? b : r;
+            tint_bytes[2] = format == ALLEGRO_PIXEL_FORMAT_ARGB_8888 ? r : b;
+            tint_ptr = tint_bytes;
+        }
+    }
+
+    /* clip against the clipping rectangle of the target */
+    dx = (int) x; dy = (int) y; sx = 0; sy = 0;
+    w = al_get_bitmap_width(bitmap); h = al_get_bitmap_height(bitmap);
+    al_get_clipping_rectangle(&cx, &cy, &cw, &ch);
+    if ( dx < cx ) { sx = cx - dx; w -= sx; dx = cx; }
+    if ( dy < cy ) { sy = cy - dy; h -= sy; dy = cy; }
+    if ( dx + w > cx + cw ) w = cx + cw - dx;
+    if ( dy + h > cy + ch ) h = cy + ch - dy;
+    if ( w <= 0 || h <= 0 ) return 1;
+
+    src_region = al_lock_bitmap_region(bitmap, sx, sy, w, h, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY);
+    if ( ! src_region ) return 0;
+    dst_region = al_lock_bitmap_region(target, dx, dy, w, h, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READWRITE);
+    if ( ! dst_region ) {
+        al_unlock_bitmap(bitmap);
+        return 0;
+    }
+    for ( row = 0; row < h; ++row ) {
+        BLIT_ROW((uint32_t*) ((char*) dst_region->data + row * dst_region->pitch),
+                (const uint32_t*) ((const char*) src_region->data + row * src_region->pitch), w, mode, tint_ptr);
+    }
+    al_unlock_bitmap(target);
+    al_unlock_bitmap(bitmap);
+    return 1;
+}
+
+static void draw_bitmap( ALLEGRO_BITMAP *bitmap, const float x, const float y, const int flags ) {
+    if ( ! blit_memory_bitmap(bitmap, NULL, x, y, flags) ) {
+        al_draw_bitmap(bitmap, x, y, flags);
+    }
+}
+
+static void draw_tinted_bitmap( ALLEGRO_BITMAP *bitmap, const ALLEGRO_COLOR tint, const float x, const float y, const int flags ) {
+    if ( ! blit_memory_bitmap(bitmap, &tint, x, y, flags) ) {
+        al_draw_tinted_bitmap(bitmap, tint, x, y, flags);
+    }
+}
+
+static int lg_set_software_blitter( lua_State *L ) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    software_blitter_enabled = lua_toboolean(L, 1);
+    return 0;
+}
+
+static int lg_get_software_blitter( lua_State *L ) {
+    lua_pushboolean(L, software_blitter_enabled);
+    return 1;
+}
+
 /*
 ================================================================================
 
@@ -1243,6 +2088,31 @@ static int lg_unmap_rgb_f( lua_State *L ) {
     return 4;
 }
 
+static lua_Unsigned pack_rgba( const unsigned char r, const unsigned char g, const unsigned char b, const unsigned char a ) {
+    return ((lua_Unsigned) r << 24) | ((lua_Unsigned) g << 16) | ((lua_Unsigned) b << 8) | (lua_Unsigned) a;
+}
+
+/* packed colors are plain numbers (0xRRGGBBAA), so they never create garbage */
+static int lg_pack_rgb( lua_State *L ) {
+    lua_pushunsigned(L, pack_rgba(luaL_checkint(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3), luaL_optint(L, 4, 255)));
+    return 1;
+}
+
+static int lg_pack_rgb_f( lua_State *L ) {
+    unsigned char r, g, b, a;
+    al_unmap_rgba(al_map_rgba_f(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
+                luaL_checknumber(L, 3), luaL_optnumber(L, 4, 1.0)), &r, &g, &b, &a);
+    lua_pushunsigned(L, pack_rgba(r, g, b, a));
+    return 1;
+}
+
+static int lg_pack_color( lua_State *L ) {
+    unsigned char r, g, b, a;
+    al_unmap_rgba(to_color(L, 1), &r, &g, &b, &a);
+    lua_pushunsigned(L, pack_rgba(r, g, b, a));
+    return 1;
+}
+
 static int lg_get_pixel_size( lua_State *L ) {
     lua_pushinteger(L, al_get_pixel_size(parse_enum_name(L, 1, pixel_format_mapping)));
     return 1;
@@ -1253,16 +2123,85 @@ static int lg_get_pixel_format_bits( lua_State *L ) {
     return 1;
 }
 
+static int get_lock_format( lua_State *L, const int idx ) {
+    return lua_isnoneornil(L, idx) ? ALLEGRO_PIXEL_FORMAT_ANY : parse_enum_name(L, idx, pixel_format_mapping);
+}
+
+static int get_lock_mode( lua_State *L, const int idx ) {
+    return lua_isnoneornil(L, idx) ? ALLEGRO_LOCK_READWRITE : parse_enum_name(L, idx, lock_mode_mapping);
+}
+
+static int push_locked_region( lua_State *L, ALLEGRO_BITMAP *bitmap, ALLEGRO_LOCKED_REGION *region, const int width, const int height, const int mode ) {
+    locked_region_t *lock;
+    if ( region == NULL ) {
+        return push_error(L, "cannot lock bitmap");
+    }
+    lock = (locked_region_t*) push_data(L, LEGATO_LOCKED_REGION, sizeof(locked_region_t));
+    lock->bitmap = bitmap;
+    lock->region = region;
+    lock->width = width;
+    lock->height = height;
+    lock->mode = mode;
+    lua_pushvalue(L, 1); /* keep the bitmap alive while it is locked */
+    lock->bitmap_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, locked_region_table_ref); /* remember lock, so unlock_bitmap can invalidate it */
+    lua_pushlightuserdata(L, bitmap);
+    lua_pushvalue(L, -3);
+    lua_settable(L, -3);
+    lua_pop(L, 1);
+    return 1;
+}
+
+static void release_locked_region( lua_State *L, locked_region_t *lock ) {
+    luaL_unref(L, LUA_REGISTRYINDEX, lock->bitmap_ref);
+    lock->bitmap_ref = LUA_NOREF;
+    lock->region = NULL;
+    lock->bitmap = NULL;
+}
+
+static void invalidate_locked_region( lua_State *L, ALLEGRO_BITMAP *bitmap ) {
+    locked_region_t *lock;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, locked_region_table_ref);
+    lua_pushlightuserdata(L, bitmap);
+    lua_gettable(L, -2);
+    lock = (locked_region_t*) luaL_testudata(L, -1, LEGATO_LOCKED_REGION);
+    if ( lock ) {
+        release_locked_region(L, lock);
+    }
+    lua_pop(L, 1);
+    lua_pushlightuserdata(L, bitmap);
+    lua_pushnil(L);
+    lua_settable(L, -3);
+    lua_pop(L, 1);
+}
+
 static int lg_lock_bitmap( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+    ALLEGRO_BITMAP *bitmap = to_bitmap(L, 1);
+    const int mode = get_lock_mode(L, 3);
+    return push_locked_region(L, bitmap, al_lock_bitmap(bitmap, get_lock_format(L, 2), mode),
+            al_get_bitmap_width(bitmap), al_get_bitmap_height(bitmap), mode);
 }
 
 static int lg_lock_bitmap_region( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+    int x, y, width, height, mode;
+    ALLEGRO_BITMAP *bitmap = to_bitmap(L, 1);
+    x = luaL_checkint(L, 2); y = luaL_checkint(L, 3);
+    width = luaL_checkint(L, 4); height = luaL_checkint(L, 5);
+    luaL_argcheck(L, x >= 0 && width > 0 && x + width <= al_get_bitmap_width(bitmap), 4, "region out of bounds");
+    luaL_argcheck(L, y >= 0 && height > 0 && y + height <= al_get_bitmap_height(bitmap), 5, "region out of bounds");
+    mode = get_lock_mode(L, 7);
+    return push_locked_region(L, bitmap, al_lock_bitmap_region(bitmap, x, y, width, height,
+                get_lock_format(L, 6), mode), width, height, mode);
 }
 
 static int lg_unlock_bitmap( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+    ALLEGRO_BITMAP *bitmap = to_bitmap(L, 1);
+    if ( ! al_is_bitmap_locked(bitmap) ) {
+        return 0; /* unlocking twice is harmless */
+    }
+    invalidate_locked_region(L, bitmap);
+    al_unlock_bitmap(bitmap);
+    return 0;
 }
 
 static int lg_create_bitmap( lua_State *L ) {
@@ -1281,6 +2220,9 @@ static int lg_clone_bitmap( lua_State *L ) {
 static int lg_destroy_bitmap( lua_State *L ) {
     ALLEGRO_BITMAP *bitmap = (ALLEGRO_BITMAP*) to_object_gc(L, 1, LEGATO_BITMAP);
     if ( bitmap ) {
+        if ( al_is_bitmap_locked(bitmap) ) {
+            invalidate_locked_region(L, bitmap);
+        }
         al_destroy_bitmap(bitmap);
         clear_object(L, 1);
     }
@@ -1365,6 +2307,7 @@ static int lg_get_parent_bitmap( lua_State *L ) {
 
 static int lg_clear_to_color( lua_State *L ) {
     al_clear_to_color(to_color(L, 1));
+    mark_dirty_display();
     return 0;
 }
 
@@ -1373,45 +2316,53 @@ static int get_draw_bitmap_flags( lua_State *L, const int idx ) {
 }
 
 static int lg_draw_bitmap( lua_State *L ) {
-    al_draw_bitmap(to_bitmap(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3), get_draw_bitmap_flags(L, 4));
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_BITMAP);
+    draw_bitmap(to_bitmap(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3), get_draw_bitmap_flags(L, 4));
     return 0;
 }
 
 static int lg_draw_tinted_bitmap( lua_State *L ) {
-    al_draw_tinted_bitmap(to_bitmap(L, 1), to_color(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4), get_draw_bitmap_flags(L, 5));
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_TINTED_BITMAP);
+    draw_tinted_bitmap(to_bitmap(L, 1), to_color(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4), get_draw_bitmap_flags(L, 5));
     return 0;
 }
 
 static int lg_draw_bitmap_region( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_BITMAP_REGION);
     al_draw_bitmap_region(to_bitmap(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
             luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6), luaL_checknumber(L, 7), get_draw_bitmap_flags(L, 8));
     return 0;
 }
 
 static int lg_draw_tinted_bitmap_region( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_TINTED_BITMAP_REGION);
     al_draw_tinted_bitmap_region(to_bitmap(L, 1), to_color(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4),
             luaL_checknumber(L, 5), luaL_checknumber(L, 6), luaL_checknumber(L, 7), luaL_checknumber(L, 8), get_draw_bitmap_flags(L, 9));
     return 0;
 }
 
 static int lg_draw_pixel( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_PIXEL);
     al_draw_pixel(luaL_checknumber(L, 1), luaL_checknumber(L, 2), to_color(L, 3));
     return 0;
 }
 
 static int lg_draw_rotated_bitmap( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_ROTATED_BITMAP);
     al_draw_rotated_bitmap(to_bitmap(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
             luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6), get_draw_bitmap_flags(L, 7));
     return 0;
 }
 
 static int lg_draw_tinted_rotated_bitmap( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_TINTED_ROTATED_BITMAP);
     al_draw_tinted_rotated_bitmap(to_bitmap(L, 1), to_color(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4),
             luaL_checknumber(L, 5), luaL_checknumber(L, 6), luaL_checknumber(L, 7), get_draw_bitmap_flags(L, 8));
     return 0;
 }
 
 static int lg_draw_scaled_rotated_bitmap( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_SCALED_ROTATED_BITMAP);
     al_draw_scaled_rotated_bitmap(to_bitmap(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
             luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6), luaL_checknumber(L, 7),
             luaL_checknumber(L, 8), get_draw_bitmap_flags(L, 9));
@@ -1419,6 +2370,7 @@ static int lg_draw_scaled_rotated_bitmap( lua_State *L ) {
 }
 
 static int lg_draw_tinted_scaled_rotated_bitmap( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP);
     al_draw_tinted_scaled_rotated_bitmap(to_bitmap(L, 1), to_color(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6),
             luaL_checknumber(L, 7), luaL_checknumber(L, 8), luaL_checknumber(L, 9), get_draw_bitmap_flags(L, 10));
@@ -1426,6 +2378,7 @@ static int lg_draw_tinted_scaled_rotated_bitmap( lua_State *L ) {
 }
 
 static int lg_draw_tinted_scaled_rotated_bitmap_region( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP_REGION);
     al_draw_tinted_scaled_rotated_bitmap_region(to_bitmap(L, 1),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6),
             to_color(L, 2),
@@ -1435,6 +2388,7 @@ static int lg_draw_tinted_scaled_rotated_bitmap_region( lua_State *L ) {
 }
 
 static int lg_draw_scaled_bitmap( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_SCALED_BITMAP);
     al_draw_scaled_bitmap(to_bitmap(L, 1),
             luaL_checknumber(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4), luaL_checknumber(L, 5),
             luaL_checknumber(L, 6), luaL_checknumber(L, 7), luaL_checknumber(L, 8), luaL_checknumber(L, 9),
@@ -1443,6 +2397,7 @@ static int lg_draw_scaled_bitmap( lua_State *L ) {
 }
 
 static int lg_draw_tinted_scaled_bitmap( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_TINTED_SCALED_BITMAP);
     al_draw_tinted_scaled_bitmap(to_bitmap(L, 1), to_color(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6),
             luaL_checknumber(L, 7), luaL_checknumber(L, 8), luaL_checknumber(L, 9), luaL_checknumber(L, 10),
@@ -1561,6 +2516,8 @@ static int lg_create_event_queue( lua_State *L ) {
 static int lg_destroy_event_queue( lua_State *L ) {
     ALLEGRO_EVENT_QUEUE *event_queue = (ALLEGRO_EVENT_QUEUE*) to_object_gc(L, 1, LEGATO_EVENT_QUEUE);
     if ( event_queue ) {
+        remove_event_filter(event_queue);
+        release_input_queue(event_queue);
         al_destroy_event_queue(event_queue);
         clear_object(L, 1);
     }
@@ -1600,144 +2557,221 @@ static int lg_unregister_event_source( lua_State *L ) {
 }
 
 static int lg_is_event_queue_empty( lua_State *L ) {
-    lua_pushboolean(L, al_is_event_queue_empty(to_event_queue(L, 1)));
+    ALLEGRO_EVENT event;
+    lua_pushboolean(L, ! peek_next_queue_event(to_event_queue(L, 1), &event));
     return 1;
 }
 
-static int push_event( lua_State *L, ALLEGRO_EVENT *event ) {
-    lua_createtable(L, 0, 10); /* create big table to avoid many rehashed */
+static void clear_table( lua_State *L, const int idx ) {
+    lua_pushnil(L);
+    while ( lua_next(L, idx) ) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, idx);
+    }
+}
+
+static void set_event_type( lua_State *L, const int s, const int type ) {
+    if ( event_type_codes ) {
+        return; /* the numeric type is already set */
+    }
+    lua_rawgeti(L, s, EVENT_STR_TYPE);
+    lua_rawgeti(L, s, type);
+    lua_rawset(L, s - 1);
+}
+
+static void set_event_int( lua_State *L, const int s, const int key, const lua_Integer value ) {
+    lua_rawgeti(L, s, key);
+    lua_pushinteger(L, value);
+    lua_rawset(L, s - 1);
+}
+
+static void set_event_bool( lua_State *L, const int s, const int key, const int value ) {
+    lua_rawgeti(L, s, key);
+    lua_pushboolean(L, value);
+    lua_rawset(L, s - 1);
+}
+
+static void set_event_float( lua_State *L, const int s, const int key, const float value ) {
+    lua_rawgeti(L, s, key);
+    lua_pushnumber(L, value);
+    lua_rawset(L, s - 1);
+}
+
+static void set_event_flags( lua_State *L, const int s, const int key, const int flags, const mapping_t mapping[] ) {
+    lua_rawgeti(L, s, key);
+    push_flag_table(L, flags, mapping);
+    lua_rawset(L, s - 1);
+}
+
+/* looks the object up in the object table at s + 1 before falling back to push_object_by_pointer */
+static void set_event_ptr( lua_State *L, const int s, const int key, const char *name, const void *ptr ) {
+    if ( ptr == NULL ) {
+        return;
+    }
+    lua_rawgeti(L, s, key);
+    lua_pushlightuserdata(L, (void*) ptr);
+    lua_rawget(L, s + 1);
+    if ( lua_isnil(L, -1) ) {
+        lua_pop(L, 1);
+        push_object_by_pointer(L, name, (void*) ptr);
+    }
+    lua_rawset(L, s - 1);
+}
+
+/*
+    Fills the table at idx with the event, or a new table if idx is 0. The field
+    names and type strings are taken from a table of pre-interned strings (at
+    stack index s) and the table of known objects lies above them (at s + 1),
+    so refilling a table does not allocate anything.
+*/
+static int push_event_table( lua_State *L, ALLEGRO_EVENT *event, const int idx ) {
+    int s;
+    if ( idx ) {
+        lua_pushvalue(L, idx);
+        clear_table(L, lua_gettop(L));
+    } else {
+        lua_createtable(L, 0, 10); /* create big table to avoid many rehashed */
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, event_string_table_ref);
+    s = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, global_object_table_ref);
+    if ( event_type_codes ) {
+        set_event_int(L, s, EVENT_STR_TYPE, event->type);
+    }
     switch ( event->type ) {
         case ALLEGRO_EVENT_JOYSTICK_AXIS:
-            set_str(L, "type", "joystick_axes");
-            set_ptr(L, "id", LEGATO_JOYSTICK, event->joystick.id);
-            set_int(L, "stick", event->joystick.stick);
-            set_int(L, "axis", event->joystick.axis);
-            set_float(L, "pos", event->joystick.pos);
-            return 1;
+            set_event_type(L, s, EVENT_STR_JOYSTICK_AXES);
+            set_event_ptr(L, s, EVENT_STR_ID, LEGATO_JOYSTICK, event->joystick.id);
+            set_event_int(L, s, EVENT_STR_STICK, event->joystick.stick);
+            set_event_int(L, s, EVENT_STR_AXIS, event->joystick.axis);
+            set_event_float(L, s, EVENT_STR_POS, event->joystick.pos);
+            break;
         case ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN:
-            set_str(L, "type", "joystick_button_down");
-            set_ptr(L, "id", LEGATO_JOYSTICK, event->joystick.id);
-            set_int(L, "button", event->joystick.button);
-            return 1;
+            set_event_type(L, s, EVENT_STR_JOYSTICK_BUTTON_DOWN);
+            set_event_ptr(L, s, EVENT_STR_ID, LEGATO_JOYSTICK, event->joystick.id);
+            set_event_int(L, s, EVENT_STR_BUTTON, event->joystick.button);
+            break;
         case ALLEGRO_EVENT_JOYSTICK_BUTTON_UP:
-            set_str(L, "type", "joystick_button_up");
-            set_ptr(L, "id", LEGATO_JOYSTICK, event->joystick.id);
-            set_int(L, "button", event->joystick.button);
-            return 1;
+            set_event_type(L, s, EVENT_STR_JOYSTICK_BUTTON_UP);
+            set_event_ptr(L, s, EVENT_STR_ID, LEGATO_JOYSTICK, event->joystick.id);
+            set_event_int(L, s, EVENT_STR_BUTTON, event->joystick.button);
+            break;
         case ALLEGRO_EVENT_JOYSTICK_CONFIGURATION:
-            set_str(L, "type", "joystick_configuration");
-            return 1;
+            set_event_type(L, s, EVENT_STR_JOYSTICK_CONFIGURATION);
+            break;
         case ALLEGRO_EVENT_KEY_DOWN:
-            set_str(L, "type", "key_down");
-            set_int(L, "keycode", event->keyboard.keycode);
-            set_ptr(L, "display", LEGATO_DISPLAY, event->keyboard.display);
-            return 1;
+            set_event_type(L, s, EVENT_STR_KEY_DOWN);
+            set_event_int(L, s, EVENT_STR_KEYCODE, event->keyboard.keycode);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->keyboard.display);
+            break;
         case ALLEGRO_EVENT_KEY_UP:
-            set_str(L, "type", "key_up");
-            set_int(L, "keycode", event->keyboard.keycode);
-            set_ptr(L, "display", LEGATO_DISPLAY, event->keyboard.display);
-            return 1;
+            set_event_type(L, s, EVENT_STR_KEY_UP);
+            set_event_int(L, s, EVENT_STR_KEYCODE, event->keyboard.keycode);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->keyboard.display);
+            break;
         case ALLEGRO_EVENT_KEY_CHAR:
-            set_str(L, "type", "key_char");
-            set_int(L, "keycode", event->keyboard.keycode);
-            set_int(L, "unichar", event->keyboard.unichar);
-            set_bool(L, "repeat", event->keyboard.repeat);
-            set_flags(L, "modifiers", event->keyboard.modifiers, keyboard_modifiers_mapping);
-            set_ptr(L, "display", LEGATO_DISPLAY, event->keyboard.display);
-            return 1;
+            set_event_type(L, s, EVENT_STR_KEY_CHAR);
+            set_event_int(L, s, EVENT_STR_KEYCODE, event->keyboard.keycode);
+            set_event_int(L, s, EVENT_STR_UNICHAR, event->keyboard.unichar);
+            set_event_bool(L, s, EVENT_STR_REPEAT, event->keyboard.repeat);
+            set_event_flags(L, s, EVENT_STR_MODIFIERS, event->keyboard.modifiers, keyboard_modifiers_mapping);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->keyboard.display);
+            break;
         case ALLEGRO_EVENT_MOUSE_AXES:
-            set_str(L, "type", "mouse_axes");
-            set_int(L, "x", event->mouse.x);
-            set_int(L, "y", event->mouse.y);
-            set_int(L, "z", event->mouse.z);
-            set_int(L, "w", event->mouse.w);
-            set_int(L, "dx", event->mouse.dx);
-            set_int(L, "dy", event->mouse.dy);
-            set_int(L, "dz", event->mouse.dz);
-            set_int(L, "dw", event->mouse.dw);
-            set_ptr(L, "display", LEGATO_DISPLAY, event->mouse.display);
-            return 1;
+            set_event_type(L, s, EVENT_STR_MOUSE_AXES);
+            set_event_int(L, s, EVENT_STR_X, event->mouse.x);
+            set_event_int(L, s, EVENT_STR_Y, event->mouse.y);
+            set_event_int(L, s, EVENT_STR_Z, event->mouse.z);
+            set_event_int(L, s, EVENT_STR_W, event->mouse.w);
+            set_event_int(L, s, EVENT_STR_DX, event->mouse.dx);
+            set_event_int(L, s, EVENT_STR_DY, event->mouse.dy);
+            set_event_int(L, s, EVENT_STR_DZ, event->mouse.dz);
+            set_event_int(L, s, EVENT_STR_DW, event->mouse.dw);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->mouse.display);
+            break;
         case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
-            set_str(L, "type", "mouse_button_down");
-            set_int(L, "x", event->mouse.x);
-            set_int(L, "y", event->mouse.y);
-            set_int(L, "z", event->mouse.z);
-            set_int(L, "w", event->mouse.w);
-            set_int(L, "button", event->mouse.button);
-            set_ptr(L, "display", LEGATO_DISPLAY, event->mouse.display);
-            return 1;
+            set_event_type(L, s, EVENT_STR_MOUSE_BUTTON_DOWN);
+            set_event_int(L, s, EVENT_STR_X, event->mouse.x);
+            set_event_int(L, s, EVENT_STR_Y, event->mouse.y);
+            set_event_int(L, s, EVENT_STR_Z, event->mouse.z);
+            set_event_int(L, s, EVENT_STR_W, event->mouse.w);
+            set_event_int(L, s, EVENT_STR_BUTTON, event->mouse.button);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->mouse.display);
+            break;
         case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
-            set_str(L, "type", "mouse_button_up");
-            set_int(L, "x", event->mouse.x);
-            set_int(L, "y", event->mouse.y);
-            set_int(L, "z", event->mouse.z);
-            set_int(L, "w", event->mouse.w);
-            set_int(L, "button", event->mouse.button);
-            set_ptr(L, "display", LEGATO_DISPLAY, event->mouse.display);
-            return 1;
+            set_event_type(L, s, EVENT_STR_MOUSE_BUTTON_UP);
+            set_event_int(L, s, EVENT_STR_X, event->mouse.x);
+            set_event_int(L, s, EVENT_STR_Y, event->mouse.y);
+            set_event_int(L, s, EVENT_STR_Z, event->mouse.z);
+            set_event_int(L, s, EVENT_STR_W, event->mouse.w);
+            set_event_int(L, s, EVENT_STR_BUTTON, event->mouse.button);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->mouse.display);
+            break;
         case ALLEGRO_EVENT_MOUSE_WARPED:
-            set_str(L, "type", "mouse_warped");
-            return 1;
+            set_event_type(L, s, EVENT_STR_MOUSE_WARPED);
+            break;
         case ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY:
-            set_str(L, "type", "mouse_enter_display");
-            set_int(L, "x", event->mouse.x);
-            set_int(L, "y", event->mouse.y);
-            set_int(L, "z", event->mouse.z);
-            set_int(L, "w", event->mouse.w);
-            set_ptr(L, "display", LEGATO_DISPLAY, event->mouse.display);
-            return 1;
+            set_event_type(L, s, EVENT_STR_MOUSE_ENTER_DISPLAY);
+            set_event_int(L, s, EVENT_STR_X, event->mouse.x);
+            set_event_int(L, s, EVENT_STR_Y, event->mouse.y);
+            set_event_int(L, s, EVENT_STR_Z, event->mouse.z);
+            set_event_int(L, s, EVENT_STR_W, event->mouse.w);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->mouse.display);
+            break;
         case ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY:
-            set_str(L, "type", "mouse_leave_display");
-            set_int(L, "x", event->mouse.x);
-            set_int(L, "y", event->mouse.y);
-            set_int(L, "z", event->mouse.z);
-            set_int(L, "w", event->mouse.w);
-            set_ptr(L, "display", LEGATO_DISPLAY, event->mouse.display);
-            return 1;
+            set_event_type(L, s, EVENT_STR_MOUSE_LEAVE_DISPLAY);
+            set_event_int(L, s, EVENT_STR_X, event->mouse.x);
+            set_event_int(L, s, EVENT_STR_Y, event->mouse.y);
+            set_event_int(L, s, EVENT_STR_Z, event->mouse.z);
+            set_event_int(L, s, EVENT_STR_W, event->mouse.w);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->mouse.display);
+            break;
         case ALLEGRO_EVENT_TIMER:
-            set_str(L, "type", "timer");
-            set_int(L, "count", event->timer.count);
-            set_ptr(L, "timer", LEGATO_TIMER, event->timer.source);
-            return 1;
+            set_event_type(L, s, EVENT_STR_TIMER);
+            set_event_int(L, s, EVENT_STR_COUNT, event->timer.count);
+            set_event_ptr(L, s, EVENT_STR_TIMER, LEGATO_TIMER, event->timer.source);
+            break;
         case ALLEGRO_EVENT_DISPLAY_EXPOSE:
-            set_str(L, "type", "display_expose");
-            set_ptr(L, "display", LEGATO_DISPLAY, event->display.source);
-            set_int(L, "x", event->display.x);
-            set_int(L, "y", event->display.y);
-            set_int(L, "width", event->display.width);
-            set_int(L, "height", event->display.height);
-            return 1;
+            set_event_type(L, s, EVENT_STR_DISPLAY_EXPOSE);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->display.source);
+            set_event_int(L, s, EVENT_STR_X, event->display.x);
+            set_event_int(L, s, EVENT_STR_Y, event->display.y);
+            set_event_int(L, s, EVENT_STR_WIDTH, event->display.width);
+            set_event_int(L, s, EVENT_STR_HEIGHT, event->display.height);
+            break;
         case ALLEGRO_EVENT_DISPLAY_RESIZE:
-            set_str(L, "type", "display_resize");
-            set_ptr(L, "display", LEGATO_DISPLAY, event->display.source);
-            set_int(L, "x", event->display.x);
-            set_int(L, "y", event->display.y);
-            set_int(L, "width", event->display.width);
-            set_int(L, "height", event->display.height);
-            return 1;
+            set_event_type(L, s, EVENT_STR_DISPLAY_RESIZE);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->display.source);
+            set_event_int(L, s, EVENT_STR_X, event->display.x);
+            set_event_int(L, s, EVENT_STR_Y, event->display.y);
+            set_event_int(L, s, EVENT_STR_WIDTH, event->display.width);
+            set_event_int(L, s, EVENT_STR_HEIGHT, event->display.height);
+            break;
         case ALLEGRO_EVENT_DISPLAY_CLOSE:
-            set_str(L, "type", "display_close");
-            set_ptr(L, "display", LEGATO_DISPLAY, event->display.source);
-            return 1;
+            set_event_type(L, s, EVENT_STR_DISPLAY_CLOSE);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->display.source);
+            break;
         case ALLEGRO_EVENT_DISPLAY_LOST:
-            set_str(L, "type", "display_lost");
-            set_ptr(L, "display", LEGATO_DISPLAY, event->display.source);
-            return 1;
+            set_event_type(L, s, EVENT_STR_DISPLAY_LOST);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->display.source);
+            break;
         case ALLEGRO_EVENT_DISPLAY_FOUND:
-            set_str(L, "type", "display_found");
-            set_ptr(L, "display", LEGATO_DISPLAY, event->display.source);
-            return 1;
+            set_event_type(L, s, EVENT_STR_DISPLAY_FOUND);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->display.source);
+            break;
         case ALLEGRO_EVENT_DISPLAY_SWITCH_OUT:
-            set_str(L, "type", "display_switch_out");
-            set_ptr(L, "display", LEGATO_DISPLAY, event->display.source);
-            return 1;
+            set_event_type(L, s, EVENT_STR_DISPLAY_SWITCH_OUT);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->display.source);
+            break;
         case ALLEGRO_EVENT_DISPLAY_SWITCH_IN:
-            set_str(L, "type", "display_switch_in");
-            set_ptr(L, "display", LEGATO_DISPLAY, event->display.source);
-            return 1;
+            set_event_type(L, s, EVENT_STR_DISPLAY_SWITCH_IN);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->display.source);
+            break;
         case ALLEGRO_EVENT_DISPLAY_ORIENTATION:
-            set_str(L, "type", "display_orientation");
-            set_ptr(L, "display", LEGATO_DISPLAY, event->display.source);
+            set_event_type(L, s, EVENT_STR_DISPLAY_ORIENTATION);
+            set_event_ptr(L, s, EVENT_STR_DISPLAY, LEGATO_DISPLAY, event->display.source);
             switch ( event->display.orientation ) {
                 case ALLEGRO_DISPLAY_ORIENTATION_0_DEGREES:
                     lua_pushliteral(L, "0"); break;
@@ -1754,1280 +2788,2525 @@ static int push_event( lua_State *L, ALLEGRO_EVENT *event ) {
                 default:
                     lua_pushliteral(L, "unknown"); break;
             }
-            lua_setfield(L, -2, "orientation");
-            return 1;
+            lua_rawgeti(L, s, EVENT_STR_ORIENTATION);
+            lua_insert(L, -2);
+            lua_rawset(L, s - 1);
+            break;
+        case LEGATO_EVENT_ASYNC_LOADED:
+            set_event_type(L, s, EVENT_STR_ASYNC_LOADED);
+            set_event_int(L, s, EVENT_STR_ID, (int) event->user.data1);
+            set_event_bool(L, s, EVENT_STR_OK, (int) event->user.data2);
+            break;
         default:
-            lua_pop(L, 1);
+            lua_pop(L, 3);
             return 0;
     }
+    lua_pop(L, 2);
+    return 1;
 }
 
-static int lg_get_next_event( lua_State *L ) {
-    ALLEGRO_EVENT event;
-    if ( al_get_next_event(to_event_queue(L, 1), &event) ) {
-        return push_event(L, &event);
-    } else {
-        return 0;
-    }
+static int push_event( lua_State *L, ALLEGRO_EVENT *event ) {
+    return push_event_table(L, event, 0);
 }
 
-static int lg_peek_next_event( lua_State *L ) {
-    ALLEGRO_EVENT event;
-    if ( al_peek_next_event(to_event_queue(L, 1), &event) ) {
-        return push_event(L, &event);
-    } else {
+/* index of the optional table to reuse for the event or 0 */
+static int get_reuse_table( lua_State *L, const int idx ) {
+    if ( lua_isnoneornil(L, idx) ) {
         return 0;
     }
+    luaL_checktype(L, idx, LUA_TTABLE);
+    return lua_absindex(L, idx);
 }
 
-static int lg_drop_next_event( lua_State *L ) {
-    lua_pushboolean(L, al_drop_next_event(to_event_queue(L, 1)));
-    return 1;
+/*
+    Event filters are kept per queue in a small list. Filtered events are
+    dropped in C, before any table is built for them. With coalescing enabled
+    a run of mouse axes events is merged into one event and a run of joystick
+    axis events into one event per (joystick, stick, axis), the merged
+    joystick events wait in the pending array until they are fetched.
+*/
+static event_filter_t *event_filters = NULL;
+
+static event_filter_t *find_event_filter( ALLEGRO_EVENT_QUEUE *queue ) {
+    event_filter_t *filter;
+    for ( filter = event_filters; filter && filter->queue != queue; filter = filter->next );
+    return filter;
 }
 
-static int lg_flush_event_queue( lua_State *L ) {
-    al_flush_event_queue(to_event_queue(L, 1));
-    return 0;
+static event_filter_t *add_event_filter( ALLEGRO_EVENT_QUEUE *queue ) {
+    event_filter_t *filter = find_event_filter(queue);
+    if ( filter == NULL ) {
+        filter = (event_filter_t*) calloc(1, sizeof(event_filter_t));
+        filter->queue = queue;
+        filter->next = event_filters;
+        event_filters = filter;
+    }
+    return filter;
 }
 
-static int lg_wait_for_event( lua_State *L ) {
-    ALLEGRO_EVENT event;
-    al_wait_for_event(to_event_queue(L, 1), &event);
-    return push_event(L, &event);
+static void remove_event_filter( ALLEGRO_EVENT_QUEUE *queue ) {
+    event_filter_t **p, *filter;
+    for ( p = &event_filters; *p; p = &(*p)->next ) {
+        if ( (*p)->queue == queue ) {
+            filter = *p;
+            *p = filter->next;
+            free(filter);
+            return;
+        }
+    }
 }
 
-static int lg_wait_for_event_timed( lua_State *L ) {
-    ALLEGRO_EVENT event;
-    al_wait_for_event_timed(to_event_queue(L, 1), &event, luaL_checknumber(L, 2));
-    return push_event(L, &event);
+/* removes the filter of queue when it does nothing anymore */
+static void release_event_filter( ALLEGRO_EVENT_QUEUE *queue ) {
+    const event_filter_t *filter = find_event_filter(queue);
+    if ( filter && filter->count == 0 && ! filter->coalesce && filter->pending_pos >= filter->pending_count ) {
+        remove_event_filter(queue);
+    }
 }
 
-static int lg_wait_for_event_until( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+static int is_type_filtered( const event_filter_t *filter, const int type ) {
+    int i;
+    for ( i = 0; i < filter->count; ++i ) {
+        if ( filter->types[i] == type ) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-/*
-================================================================================
+/* peeks the next unfiltered event, filtered ones are dropped on the way */
+static int peek_queue_event( ALLEGRO_EVENT_QUEUE *queue, const event_filter_t *filter, ALLEGRO_EVENT *event ) {
+    while ( al_peek_next_event(queue, event) ) {
+        if ( ! is_type_filtered(filter, event->type) ) {
+            return 1;
+        }
+        al_drop_next_event(queue);
+    }
+    return 0;
+}
 
-                Fullscreen modes
+static void coalesce_mouse_axes( ALLEGRO_EVENT_QUEUE *queue, const event_filter_t *filter, ALLEGRO_EVENT *event ) {
+    ALLEGRO_EVENT next;
+    while ( peek_queue_event(queue, filter, &next) ) {
+        if ( next.type != ALLEGRO_EVENT_MOUSE_AXES || next.mouse.display != event->mouse.display ) {
+            break;
+        }
+        next.mouse.dx += event->mouse.dx;
+        next.mouse.dy += event->mouse.dy;
+        next.mouse.dz += event->mouse.dz;
+        next.mouse.dw += event->mouse.dw;
+        *event = next;
+        al_drop_next_event(queue);
+    }
+}
 
-================================================================================
-*/
-static int lg_get_display_modes( lua_State *L ) {
-    ALLEGRO_DISPLAY_MODE mode;
-    int i, num_modes;
-    num_modes = al_get_num_display_modes();
-    lua_newtable(L);
-    for ( i = 0; i < num_modes; ++i ) {
-        al_get_display_mode(i, &mode);
-        lua_newtable(L);
-        set_int(L, "width", mode.width);
-        set_int(L, "height", mode.height);
-        set_int(L, "refresh_rate", mode.refresh_rate);
-        set_int(L, "format", mode.format); /* FIXME: use str enums! */
-        lua_rawseti(L, -2, i + 1);
+static void coalesce_joystick_axes( ALLEGRO_EVENT_QUEUE *queue, event_filter_t *filter, ALLEGRO_EVENT *event ) {
+    int i, count = 1;
+    ALLEGRO_EVENT next;
+    filter->pending[0] = *event;
+    while ( count < LEGATO_EVENT_PENDING_MAX && peek_queue_event(queue, filter, &next) ) {
+        if ( next.type != ALLEGRO_EVENT_JOYSTICK_AXIS ) {
+            break;
+        }
+        for ( i = 0; i < count; ++i ) {
+            const ALLEGRO_JOYSTICK_EVENT *j = &filter->pending[i].joystick;
+            if ( j->id == next.joystick.id && j->stick == next.joystick.stick && j->axis == next.joystick.axis ) {
+                break;
+            }
+        }
+        filter->pending[i] = next;
+        if ( i == count ) {
+            ++count;
+        }
+        al_drop_next_event(queue);
     }
-    return 1;
+    *event = filter->pending[0];
+    filter->pending_count = count;
+    filter->pending_pos = 1;
+}
+
+static int fetch_queue_event( ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *event, const double until ) {
+    ALLEGRO_TIMEOUT timeout;
+    double seconds;
+    if ( until == LEGATO_EVENT_POLL ) {
+        return al_get_next_event(queue, event);
+    } else if ( until == LEGATO_EVENT_WAIT ) {
+        al_wait_for_event(queue, event);
+        return 1;
+    }
+    seconds = until - al_get_time();
+    al_init_timeout(&timeout, seconds > 0.0 ? seconds : 0.0);
+    return al_wait_for_event_until(queue, event, &timeout);
 }
 
 /*
-================================================================================
-
-                Joystick
-
-================================================================================
+    Next unfiltered event of queue (replayed input included), until is an
+    absolute get_time() value, LEGATO_EVENT_POLL or LEGATO_EVENT_WAIT.
 */
-static int lg_is_joystick_installed( lua_State *L ) {
-    lua_pushboolean(L, al_is_joystick_installed());
+static int get_queue_event( ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *event, const double until ) {
+    int replay;
+    double due, deadline;
+    event_filter_t *filter = event_filters ? find_event_filter(queue) : NULL;
+    if ( filter && filter->pending_pos < filter->pending_count ) {
+        *event = filter->pending[filter->pending_pos++];
+        record_input_event(queue, event);
+        return 1;
+    }
+    for ( ;; ) {
+        deadline = until;
+        replay = replay_input_event(queue, event, &due, 0);
+        if ( replay == 1 ) {
+            if ( filter && is_type_filtered(filter, event->type) ) {
+                continue;
+            }
+            break;
+        } else if ( replay == 0 && until != LEGATO_EVENT_POLL && (until == LEGATO_EVENT_WAIT || due < until) ) {
+            deadline = due; /* wake up for the next replayed event */
+        }
+        if ( ! fetch_queue_event(queue, event, deadline) ) {
+            if ( deadline != until ) {
+                continue;
+            }
+            return 0;
+        }
+        if ( replay == 0 && is_input_event(event->type) ) {
+            continue; /* live input is ignored during a replay */
+        } else if ( filter == NULL ) {
+            break;
+        } else if ( ! is_type_filtered(filter, event->type) ) {
+            if ( filter->coalesce ) {
+                if ( event->type == ALLEGRO_EVENT_MOUSE_AXES ) {
+                    coalesce_mouse_axes(queue, filter, event);
+                } else if ( event->type == ALLEGRO_EVENT_JOYSTICK_AXIS ) {
+                    coalesce_joystick_axes(queue, filter, event);
+                }
+            }
+            break;
+        }
+    }
+    record_input_event(queue, event);
     return 1;
 }
 
-static int lg_reconfigure_joysticks( lua_State *L ) {
-    lua_pushboolean(L, al_reconfigure_joysticks());
-    return 1;
+/* the event get_queue_event() would return now, without taking it from the queue */
+static int peek_next_queue_event( ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *event ) {
+    int replay;
+    double due;
+    event_filter_t *filter = event_filters ? find_event_filter(queue) : NULL;
+    if ( filter && filter->pending_pos < filter->pending_count ) {
+        *event = filter->pending[filter->pending_pos];
+        return 1;
+    }
+    while ( (replay = replay_input_event(queue, event, &due, 1)) == 1 ) {
+        if ( ! (filter && is_type_filtered(filter, event->type)) ) {
+            return 1;
+        }
+        replay_input_event(queue, event, &due, 0); /* filtered, dropped like in get_queue_event() */
+    }
+    for ( ;; ) {
+        if ( ! (filter ? peek_queue_event(queue, filter, event) : al_peek_next_event(queue, event)) ) {
+            return 0;
+        } else if ( replay == 0 && is_input_event(event->type) ) {
+            al_drop_next_event(queue); /* live input is ignored during a replay */
+        } else {
+            return 1;
+        }
+    }
 }
 
-static int lg_get_num_joysticks( lua_State *L ) {
-    lua_pushinteger(L, al_get_num_joysticks());
-    return 1;
+/* set_event_filter(queue, {mouse_axes = false, ...}) - types set to false are dropped, nil removes the filter */
+static int lg_set_event_filter( lua_State *L ) {
+    int i, count = 0, types[LEGATO_EVENT_FILTER_MAX];
+    event_filter_t *filter;
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    if ( ! lua_isnoneornil(L, 2) ) {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        for ( i = 0; event_type_mapping[i].name && count < LEGATO_EVENT_FILTER_MAX; ++i ) {
+            lua_getfield(L, 2, event_type_mapping[i].name);
+            if ( lua_isboolean(L, -1) && ! lua_toboolean(L, -1) ) {
+                types[count++] = event_type_mapping[i].value;
+            }
+            lua_pop(L, 1);
+        }
+    }
+    filter = count > 0 ? add_event_filter(queue) : find_event_filter(queue);
+    if ( filter ) {
+        filter->count = count;
+        memcpy(filter->types, types, sizeof(int) * count);
+        release_event_filter(queue);
+    }
+    return 0;
 }
 
-static int lg_get_joystick( lua_State *L ) {
-    ALLEGRO_JOYSTICK *joystick = al_get_joystick(luaL_checkint(L, 1));
-    if ( joystick ) {
-        return push_object_by_pointer(L, LEGATO_JOYSTICK, joystick);
+/* set_event_coalescing(queue, enabled) - merges runs of mouse axes and joystick axis events */
+static int lg_set_event_coalescing( lua_State *L ) {
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    luaL_checktype(L, 2, LUA_TBOOLEAN);
+    if ( lua_toboolean(L, 2) ) {
+        add_event_filter(queue)->coalesce = 1;
+    } else if ( find_event_filter(queue) ) {
+        find_event_filter(queue)->coalesce = 0;
+        release_event_filter(queue);
     }
     return 0;
 }
 
-static int lg_release_joystick( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+/* set_event_type_codes(enabled) - event.type becomes a number of al.event_types instead of a string */
+static int lg_set_event_type_codes( lua_State *L ) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    event_type_codes = lua_toboolean(L, 1);
+    return 0;
 }
 
-static int lg_get_joystick_active( lua_State *L ) {
-    lua_pushboolean(L, al_get_joystick_active(to_joystick(L, 1)));
-    return 1;
+/* get_next_event(queue, [reuse_table]) - the event is written into reuse_table if given */
+static int lg_get_next_event( lua_State *L ) {
+    ALLEGRO_EVENT event;
+    const int reuse = get_reuse_table(L, 2); /* check the arguments before an event is taken from the queue */
+    if ( get_queue_event(to_event_queue(L, 1), &event, LEGATO_EVENT_POLL) ) {
+        return push_event_table(L, &event, reuse);
+    } else {
+        return 0;
+    }
 }
 
-static int lg_get_joystick_name( lua_State *L ) {
-    lua_pushstring(L, al_get_joystick_name(to_joystick(L, 1)));
-    return 1;
+static int lg_peek_next_event( lua_State *L ) {
+    ALLEGRO_EVENT event;
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    const int reuse = get_reuse_table(L, 2);
+    if ( peek_next_queue_event(queue, &event) ) {
+        return push_event_table(L, &event, reuse);
+    } else {
+        return 0;
+    }
 }
 
-static int lg_get_joystick_stick_name( lua_State *L ) {
-    lua_pushstring(L, al_get_joystick_stick_name(to_joystick(L, 1), luaL_checkint(L, 2)));
+/* drop_next_event(queue) - drops the event peek_next_event() returns */
+static int lg_drop_next_event( lua_State *L ) {
+    ALLEGRO_EVENT event;
+    double due;
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    event_filter_t *filter = event_filters ? find_event_filter(queue) : NULL;
+    if ( ! peek_next_queue_event(queue, &event) ) {
+        lua_pushboolean(L, 0);
+        return 1;
+    } else if ( filter && filter->pending_pos < filter->pending_count ) {
+        filter->pending_pos++;
+    } else if ( replay_input_event(queue, &event, &due, 0) != 1 ) {
+        al_drop_next_event(queue);
+    }
+    lua_pushboolean(L, 1);
     return 1;
 }
 
-static int lg_get_joystick_axis_name( lua_State *L ) {
-    lua_pushstring(L, al_get_joystick_axis_name(to_joystick(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3)));
-    return 1;
+/*
+    drain_events(queue, [max, events]) -> events, count - the tables of events
+    are refilled if given. Entries after count are left alone (old tables are
+    kept for the next call), so loop from 1 to count instead of using ipairs.
+*/
+static int lg_drain_events( lua_State *L ) {
+    int count = 0, reuse;
+    ALLEGRO_EVENT event;
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    const int max = lua_isnoneornil(L, 2) ? INT_MAX : luaL_checkint(L, 2);
+    if ( lua_isnoneornil(L, 3) ) {
+        lua_settop(L, 2);
+        lua_newtable(L);
+    } else {
+        luaL_checktype(L, 3, LUA_TTABLE);
+        lua_settop(L, 3);
+    }
+    while ( count < max && get_queue_event(queue, &event, LEGATO_EVENT_POLL) ) {
+        lua_rawgeti(L, 3, count + 1);
+        reuse = lua_istable(L, -1) ? lua_gettop(L) : 0;
+        if ( push_event_table(L, &event, reuse) ) {
+            lua_rawseti(L, 3, ++count);
+        }
+        lua_pop(L, 1);
+    }
+    lua_pushinteger(L, count);
+    return 2;
 }
 
-static int lg_get_joystick_button_name( lua_State *L ) {
-    lua_pushstring(L, al_get_joystick_button_name(to_joystick(L, 1), luaL_checkint(L, 2)));
-    return 1;
+static void get_event_columns( const ALLEGRO_EVENT *event, float *v ) {
+    memset(v, 0, sizeof(float) * EVENT_COLUMNS_SIZE);
+    v[EVENT_COLUMN_TYPE] = (float) event->type;
+    v[EVENT_COLUMN_TIMESTAMP] = (float) event->any.timestamp;
+    switch ( event->type ) {
+        case ALLEGRO_EVENT_JOYSTICK_AXIS:
+            v[EVENT_COLUMN_STICK] = (float) event->joystick.stick;
+            v[EVENT_COLUMN_AXIS] = (float) event->joystick.axis;
+            v[EVENT_COLUMN_POS] = event->joystick.pos;
+            break;
+        case ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN: case ALLEGRO_EVENT_JOYSTICK_BUTTON_UP:
+            v[EVENT_COLUMN_BUTTON] = (float) event->joystick.button;
+            break;
+        case ALLEGRO_EVENT_KEY_DOWN: case ALLEGRO_EVENT_KEY_UP: case ALLEGRO_EVENT_KEY_CHAR:
+            v[EVENT_COLUMN_KEYCODE] = (float) event->keyboard.keycode;
+            if ( event->type == ALLEGRO_EVENT_KEY_CHAR ) {
+                v[EVENT_COLUMN_UNICHAR] = (float) event->keyboard.unichar;
+            }
+            break;
+        case ALLEGRO_EVENT_MOUSE_AXES: case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN: case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
+        case ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY: case ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY:
+            v[EVENT_COLUMN_X] = (float) event->mouse.x;
+            v[EVENT_COLUMN_Y] = (float) event->mouse.y;
+            v[EVENT_COLUMN_Z] = (float) event->mouse.z;
+            v[EVENT_COLUMN_W] = (float) event->mouse.w;
+            if ( event->type == ALLEGRO_EVENT_MOUSE_AXES ) {
+                v[EVENT_COLUMN_DX] = (float) event->mouse.dx;
+                v[EVENT_COLUMN_DY] = (float) event->mouse.dy;
+                v[EVENT_COLUMN_DZ] = (float) event->mouse.dz;
+                v[EVENT_COLUMN_DW] = (float) event->mouse.dw;
+            } else if ( event->type != ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY && event->type != ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY ) {
+                v[EVENT_COLUMN_BUTTON] = (float) event->mouse.button;
+            }
+            break;
+        case ALLEGRO_EVENT_TIMER:
+            v[EVENT_COLUMN_COUNT] = (float) event->timer.count;
+            break;
+        case ALLEGRO_EVENT_DISPLAY_EXPOSE: case ALLEGRO_EVENT_DISPLAY_RESIZE:
+            v[EVENT_COLUMN_X] = (float) event->display.x;
+            v[EVENT_COLUMN_Y] = (float) event->display.y;
+            v[EVENT_COLUMN_WIDTH] = (float) event->display.width;
+            v[EVENT_COLUMN_HEIGHT] = (float) event->display.height;
+            break;
+        case LEGATO_EVENT_ASYNC_LOADED:
+            v[EVENT_COLUMN_ID] = (float) event->user.data1;
+            v[EVENT_COLUMN_OK] = (float) event->user.data2;
+            break;
+    }
 }
 
-static int lg_get_joystick_stick_flags( lua_State *L ) {
-    return push_flag_table(L, al_get_joystick_stick_flags(to_joystick(L, 1), luaL_checkint(L, 2)), joyflags_mapping);
+/*
+    drain_events_packed(queue, {type = buffer, x = buffer, ...}, [max]) -> count
+    Writes the pending events as columns into float buffers, event i goes to index i of
+    every given buffer. Stops when the smallest buffer is full, the rest stays in the queue.
+*/
+static int lg_drain_events_packed( lua_State *L ) {
+    int i, count = 0, max;
+    float values[EVENT_COLUMNS_SIZE], *columns[EVENT_COLUMNS_SIZE];
+    float_buffer_t *buffer;
+    ALLEGRO_EVENT event;
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    max = lua_isnoneornil(L, 3) ? INT_MAX : luaL_checkint(L, 3);
+    for ( i = 0; event_column_mapping[i].name; ++i ) {
+        lua_getfield(L, 2, event_column_mapping[i].name);
+        buffer = lua_isnil(L, -1) ? NULL : to_float_buffer(L, -1);
+        columns[event_column_mapping[i].value] = buffer ? buffer->data : NULL;
+        if ( buffer && buffer->size < max ) {
+            max = buffer->size;
+        }
+        lua_pop(L, 1);
+    }
+    while ( count < max && get_queue_event(queue, &event, LEGATO_EVENT_POLL) ) {
+        if ( find_mapping_name(event_type_mapping, event.type) == NULL ) {
+            continue; /* not a event legato knows */
+        }
+        get_event_columns(&event, values);
+        for ( i = 0; i < EVENT_COLUMNS_SIZE; ++i ) {
+            if ( columns[i] ) {
+                columns[i][count] = values[i];
+            }
+        }
+        ++count;
+    }
+    lua_pushinteger(L, count);
+    return 1;
 }
 
-static int lg_get_joystick_num_sticks( lua_State *L ) {
-    lua_pushinteger(L, al_get_joystick_num_sticks(to_joystick(L, 1)));
-    return 1;
+static int lg_flush_event_queue( lua_State *L ) {
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    event_filter_t *filter = event_filters ? find_event_filter(queue) : NULL;
+    if ( filter ) {
+        filter->pending_pos = filter->pending_count = 0;
+    }
+    al_flush_event_queue(queue);
+    return 0;
 }
 
-static int lg_get_joystick_num_axes( lua_State *L ) {
-    lua_pushinteger(L, al_get_joystick_num_axes(to_joystick(L, 1), luaL_checkint(L, 2)));
-    return 1;
+static int lg_wait_for_event( lua_State *L ) {
+    ALLEGRO_EVENT event;
+    const int reuse = get_reuse_table(L, 2);
+    get_queue_event(to_event_queue(L, 1), &event, LEGATO_EVENT_WAIT);
+    return push_event_table(L, &event, reuse);
 }
 
-static int lg_get_joystick_num_buttons( lua_State *L ) {
-    lua_pushinteger(L, al_get_joystick_num_buttons(to_joystick(L, 1)));
-    return 1;
+static int lg_wait_for_event_timed( lua_State *L ) {
+    ALLEGRO_EVENT event;
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    const double seconds = luaL_checknumber(L, 2);
+    const int reuse = get_reuse_table(L, 3);
+    if ( get_queue_event(queue, &event, al_get_time() + seconds) ) {
+        return push_event_table(L, &event, reuse);
+    }
+    return 0;
 }
 
-static int lg_get_joystick_state( lua_State *L ) {
-    ALLEGRO_JOYSTICK_STATE *state = (ALLEGRO_JOYSTICK_STATE*) push_data(L, LEGATO_JOYSTICK_STATE, sizeof(ALLEGRO_JOYSTICK_STATE));
-    al_get_joystick_state(to_joystick(L, 1), state);
-    return 1;
+/* wait_for_event_until(queue, time, [reuse_table]) - time is an absolute get_time() value, returns nil on timeout */
+static int lg_wait_for_event_until( lua_State *L ) {
+    ALLEGRO_EVENT event;
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    const double until = luaL_checknumber(L, 2);
+    const int reuse = get_reuse_table(L, 3);
+    if ( get_queue_event(queue, &event, until > LEGATO_EVENT_POLL ? until : al_get_time()) ) {
+        return push_event_table(L, &event, reuse);
+    }
+    return 0;
 }
 
 /*
 ================================================================================
 
-                Keyboard
+                Asynchronous loading
+
+    A single worker thread loads files through PhysFS. Bitmaps are decoded
+    as memory bitmaps and converted to video bitmaps in get_async_result()
+    on the main thread. When a request is finished, an "async_loaded" event
+    is emitted to the queue that was passed to its load function (every queue
+    has its own user event source).
 
 ================================================================================
 */
-static int lg_is_keyboard_installed( lua_State *L ) {
-    lua_pushboolean(L, al_is_keyboard_installed());
-    return 1;
+static ALLEGRO_THREAD *async_thread = NULL;
+static ALLEGRO_MUTEX *async_mutex = NULL;
+static ALLEGRO_COND *async_cond = NULL;
+static async_source_t *async_sources = NULL; /* only used by the main thread */
+static async_request_t *async_requests = NULL;
+static int async_next_id = 1;
+
+static void destroy_async_result( async_request_t *request ) {
+    if ( request->result ) {
+        switch ( request->kind ) {
+            case ASYNC_BITMAP: al_destroy_bitmap(request->result); break;
+            case ASYNC_SAMPLE: al_destroy_sample(request->result); break;
+            case ASYNC_TTF_FONT: al_destroy_font(request->result); break;
+        }
+        request->result = NULL;
+    }
 }
 
-static int lg_create_keyboard_state( lua_State *L ) {
-    push_data(L, LEGATO_KEYBOARD_STATE, sizeof(ALLEGRO_KEYBOARD_STATE));
-    return 1;
+/* unlinks and frees the request, must be called with the mutex locked */
+static void free_async_request( async_request_t *request ) {
+    async_request_t **r;
+    for ( r = &async_requests; *r; r = &(*r)->next ) {
+        if ( *r == request ) {
+            *r = request->next;
+            break;
+        }
+    }
+    destroy_async_result(request);
+    free(request);
 }
 
-static int lg_get_keyboard_state( lua_State *L ) {
-    al_get_keyboard_state(to_keyboard_state(L, 1));
-    return 0;
+static void *async_loader_thread( ALLEGRO_THREAD *thread, void *arg ) {
+    async_request_t *request, *r;
+    void *result;
+    ALLEGRO_EVENT event;
+    (void) arg;
+    al_set_physfs_file_interface(); /* the file interface is thread local */
+    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+    al_lock_mutex(async_mutex);
+    while ( ! al_get_thread_should_stop(thread) ) {
+        for ( request = NULL, r = async_requests; r; r = r->next ) { /* highest priority first, then oldest */
+            if ( r->status == ASYNC_PENDING && (request == NULL || r->priority > request->priority) ) {
+                request = r;
+            }
+        }
+        if ( request == NULL ) {
+            al_wait_cond(async_cond, async_mutex);
+            continue;
+        }
+        request->status = ASYNC_LOADING;
+        al_unlock_mutex(async_mutex);
+        switch ( request->kind ) {
+            case ASYNC_BITMAP: result = al_load_bitmap(request->filename); break;
+            case ASYNC_SAMPLE: result = al_load_sample(request->filename); break;
+            case ASYNC_TTF_FONT: result = al_load_ttf_font(request->filename, request->size, request->flags); break;
+            default: result = NULL; break;
+        }
+        al_lock_mutex(async_mutex);
+        request->result = result;
+        if ( request->status == ASYNC_CANCELLED ) {
+            free_async_request(request);
+            continue;
+        }
+        request->status = result ? ASYNC_DONE : ASYNC_FAILED;
+        event.user.type = LEGATO_EVENT_ASYNC_LOADED;
+        event.user.data1 = request->id;
+        event.user.data2 = result != NULL;
+        al_emit_user_event(request->source, &event, NULL);
+    }
+    al_unlock_mutex(async_mutex);
+    return NULL;
 }
 
-static int lg_key_down( lua_State *L ) {
-    lua_pushboolean(L, al_key_down(to_keyboard_state(L, 1), luaL_checkint(L, 2)));
-    return 1;
+static void start_async_loader( void ) {
+    if ( async_thread == NULL ) {
+        async_mutex = al_create_mutex();
+        async_cond = al_create_cond();
+        async_thread = al_create_thread(async_loader_thread, NULL);
+        al_start_thread(async_thread);
+    }
 }
 
-static int lg_keycode_to_name( lua_State *L ) {
-    lua_pushstring(L, al_keycode_to_name(luaL_checkint(L, 1)));
-    return 1;
+static void shutdown_async_loader( void ) {
+    if ( async_thread ) {
+        al_lock_mutex(async_mutex);
+        al_set_thread_should_stop(async_thread);
+        al_broadcast_cond(async_cond);
+        al_unlock_mutex(async_mutex);
+        al_destroy_thread(async_thread);
+        while ( async_requests ) {
+            free_async_request(async_requests);
+        }
+        while ( async_sources ) {
+            async_source_t *source = async_sources;
+            async_sources = source->next;
+            al_destroy_user_event_source(&source->source);
+            free(source);
+        }
+        al_destroy_cond(async_cond);
+        al_destroy_mutex(async_mutex);
+        async_thread = NULL;
+    }
 }
 
-static int lg_set_keyboard_leds( lua_State *L ) {
-    lua_pushboolean(L, al_set_keyboard_leds(luaL_checkint(L, 1)));
+/* find a request by id, must be called with the mutex locked */
+static async_request_t *find_async_request( const int id ) {
+    async_request_t *request;
+    for ( request = async_requests; request && request->id != id; request = request->next );
+    return request;
+}
+
+/* the event source of queue, created and registered on first use */
+static ALLEGRO_EVENT_SOURCE *get_async_source( lua_State *L, ALLEGRO_EVENT_QUEUE *queue ) {
+    async_source_t *source;
+    for ( source = async_sources; source && source->queue != queue; source = source->next );
+    if ( source == NULL ) {
+        source = (async_source_t*) malloc(sizeof(async_source_t));
+        if ( source == NULL ) {
+            luaL_error(L, "cannot allocate async event source");
+        }
+        source->queue = queue;
+        al_init_user_event_source(&source->source);
+        source->next = async_sources;
+        async_sources = source;
+    }
+    al_register_event_source(queue, &source->source); /* again, in case a new queue got the address of a destroyed one */
+    return &source->source;
+}
+
+static int push_async_request( lua_State *L, const int kind, const int queue_idx, const int priority_idx, const int size, const int flags ) {
+    size_t length;
+    async_request_t *request, **last;
+    ALLEGRO_EVENT_SOURCE *source;
+    const char *filename = luaL_checklstring(L, 1, &length);
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, queue_idx);
+    int priority = luaL_optint(L, priority_idx, 0);
+    start_async_loader();
+    source = get_async_source(L, queue);
+    request = (async_request_t*) malloc(sizeof(async_request_t) + length);
+    if ( request == NULL ) {
+        return luaL_error(L, "cannot allocate async request");
+    }
+    memset(request, 0, sizeof(async_request_t));
+    request->source = source;
+    memcpy(request->filename, filename, length + 1);
+    request->kind = kind;
+    request->priority = priority;
+    request->size = size;
+    request->flags = flags;
+    request->status = ASYNC_PENDING;
+    al_lock_mutex(async_mutex);
+    request->id = async_next_id++;
+    for ( last = &async_requests; *last; last = &(*last)->next ); /* keep requests in order of arrival */
+    *last = request;
+    al_signal_cond(async_cond);
+    al_unlock_mutex(async_mutex);
+    lua_pushinteger(L, request->id);
     return 1;
 }
 
-/*
-================================================================================
+/* load_bitmap_async(filename, queue, [priority]) -> request id */
+static int lg_load_bitmap_async( lua_State *L ) {
+    return push_async_request(L, ASYNC_BITMAP, 2, 3, 0, 0);
+}
 
-                Monitor
+/* load_sample_async(filename, queue, [priority]) -> request id */
+static int lg_load_sample_async( lua_State *L ) {
+    return push_async_request(L, ASYNC_SAMPLE, 2, 3, 0, 0);
+}
 
-================================================================================
-*/
-static int lg_get_new_display_adapter( lua_State *L ) {
-    int id = al_get_new_display_adapter();
-    if ( id == ALLEGRO_DEFAULT_DISPLAY_ADAPTER ) {
-        return 0; 
-    } else {
-        lua_pushinteger(L, id + 1);
-        return 1;
+/* load_ttf_font_async(filename, size, flags, queue, [priority]) -> request id */
+static int lg_load_ttf_font_async( lua_State *L ) {
+    return push_async_request(L, ASYNC_TTF_FONT, 4, 5, luaL_checkint(L, 2), parse_opt_flag_table(L, 3, ttf_flag_mapping, 0));
+}
+
+static int lg_get_async_status( lua_State *L ) {
+    static const char *names[] = {"pending", "loading", "done", "failed", "cancelled"};
+    async_request_t *request;
+    int id = luaL_checkint(L, 1);
+    if ( async_thread == NULL ) {
+        return 0;
+    }
+    al_lock_mutex(async_mutex);
+    request = find_async_request(id);
+    if ( request ) {
+        lua_pushstring(L, names[request->status]);
     }
+    al_unlock_mutex(async_mutex);
+    return request ? 1 : 0;
 }
 
-static int lg_set_new_display_adapter( lua_State *L ) {
-    al_set_new_display_adapter(luaL_optint(L, 1, ALLEGRO_DEFAULT_DISPLAY_ADAPTER + 1) - 1);
-    return 0;
+static int lg_set_async_priority( lua_State *L ) {
+    async_request_t *request;
+    int id = luaL_checkint(L, 1), priority = luaL_checkint(L, 2);
+    if ( async_thread == NULL ) {
+        return 0;
+    }
+    al_lock_mutex(async_mutex);
+    request = find_async_request(id);
+    if ( request ) {
+        request->priority = priority;
+    }
+    al_unlock_mutex(async_mutex);
+    lua_pushboolean(L, request != NULL);
+    return 1;
 }
 
-static int lg_get_monitor_info( lua_State *L ) {
-    ALLEGRO_MONITOR_INFO monitor;
-    int i, num_monitors;
-    num_monitors = al_get_num_video_adapters();
-    lua_newtable(L);
-    for ( i = 0; i < num_monitors; ++i ) {
-        al_get_monitor_info(i, &monitor);
-        lua_newtable(L);
-        set_int(L, "x1", monitor.x1);
-        set_int(L, "y1", monitor.y1);
-        set_int(L, "x2", monitor.x2);
-        set_int(L, "y2", monitor.y2);
-        lua_rawseti(L, -2, i + 1);
+/* cancel_async_load(id) - drops the request and its result */
+static int lg_cancel_async_load( lua_State *L ) {
+    async_request_t *request;
+    int id = luaL_checkint(L, 1);
+    if ( async_thread == NULL ) {
+        return 0;
+    }
+    al_lock_mutex(async_mutex);
+    request = find_async_request(id);
+    if ( request ) {
+        if ( request->status == ASYNC_LOADING ) {
+            request->status = ASYNC_CANCELLED; /* freed as soon as the worker is done with it */
+        } else {
+            free_async_request(request);
+        }
     }
+    al_unlock_mutex(async_mutex);
+    lua_pushboolean(L, request != NULL);
     return 1;
 }
 
+/* get_async_result(id) -> loaded object, or nil and an error message */
+static int lg_get_async_result( lua_State *L ) {
+    int kind;
+    void *result;
+    ALLEGRO_BITMAP *bitmap;
+    async_request_t *request;
+    int id = luaL_checkint(L, 1);
+    if ( async_thread == NULL ) {
+        return push_error(L, "unknown request %d", id);
+    }
+    al_lock_mutex(async_mutex);
+    request = find_async_request(id);
+    if ( request == NULL || request->status != ASYNC_DONE ) {
+        if ( request && request->status == ASYNC_FAILED ) {
+            push_error(L, "cannot load " LUA_QS, request->filename);
+            free_async_request(request);
+        } else {
+            push_error(L, request ? "request %d is not finished" : "unknown request %d", id);
+        }
+        al_unlock_mutex(async_mutex);
+        return 2;
+    }
+    kind = request->kind;
+    result = request->result;
+    request->result = NULL;
+    free_async_request(request);
+    al_unlock_mutex(async_mutex);
+    switch ( kind ) {
+        case ASYNC_BITMAP:
+            bitmap = al_clone_bitmap(result); /* uses the new bitmap flags of the main thread */
+            if ( bitmap ) {
+                al_destroy_bitmap(result);
+                result = bitmap;
+            }
+            return push_object(L, LEGATO_BITMAP, result, 1);
+        case ASYNC_SAMPLE:
+            return push_object(L, LEGATO_AUDIO_SAMPLE, result, 1);
+        default:
+            return push_object(L, LEGATO_FONT, result, 1);
+    }
+}
+
 /*
 ================================================================================
 
-                Mouse
+                Frame capture
+
+    While capturing, every flip_display() copies the backbuffer into a free
+    memory bitmap of a small ring. A worker thread saves the queued frames
+    through PhysFS in frame order. If no bitmap of the ring is free, the
+    frame is dropped instead of stalling the game.
 
 ================================================================================
 */
-static int lg_is_mouse_installed( lua_State *L ) {
-    lua_pushboolean(L, al_is_mouse_installed());
-    return 1;
+static ALLEGRO_THREAD *capture_thread = NULL;
+static ALLEGRO_MUTEX *capture_mutex = NULL;
+static ALLEGRO_COND *capture_cond = NULL;
+static capture_slot_t capture_slots[LEGATO_CAPTURE_RING_MAX];
+static int capture_ring_size = 0;
+static char capture_prefix[256], capture_extension[16];
+static int capture_next_frame = 0;
+static int capture_frames = 0, capture_dropped = 0, capture_written = 0, capture_failed = 0;
+static double capture_overhead = 0.0;
+
+static void *frame_capture_thread( ALLEGRO_THREAD *thread, void *arg ) {
+    int i;
+    capture_slot_t *slot;
+    char filename[320];
+    (void) arg;
+    al_set_physfs_file_interface(); /* the file interface is thread local */
+    al_lock_mutex(capture_mutex);
+    for ( ;; ) {
+        for ( slot = NULL, i = 0; i < capture_ring_size; ++i ) { /* oldest frame first */
+            if ( capture_slots[i].state == CAPTURE_QUEUED && (slot == NULL || capture_slots[i].frame < slot->frame) ) {
+                slot = &capture_slots[i];
+            }
+        }
+        if ( slot == NULL ) {
+            if ( al_get_thread_should_stop(thread) ) {
+                break;
+            }
+            al_wait_cond(capture_cond, capture_mutex);
+            continue;
+        }
+        slot->state = CAPTURE_WRITING;
+        snprintf(filename, sizeof(filename), "%s%06d%s", capture_prefix, slot->frame, capture_extension);
+        al_unlock_mutex(capture_mutex);
+        i = al_save_bitmap(filename, slot->bitmap);
+        al_lock_mutex(capture_mutex);
+        if ( i ) {
+            ++capture_written;
+        } else {
+            ++capture_failed;
+        }
+        slot->state = CAPTURE_FREE;
+    }
+    al_unlock_mutex(capture_mutex);
+    return NULL;
 }
 
-static int lg_get_mouse_num_axes( lua_State *L ) {
-    lua_pushinteger(L, al_get_mouse_num_axes());
-    return 1;
+/* waits until all queued frames are written */
+static void shutdown_frame_capture( void ) {
+    int i;
+    if ( capture_thread ) {
+        al_lock_mutex(capture_mutex);
+        al_set_thread_should_stop(capture_thread);
+        al_broadcast_cond(capture_cond);
+        al_unlock_mutex(capture_mutex);
+        al_destroy_thread(capture_thread);
+        for ( i = 0; i < capture_ring_size; ++i ) {
+            if ( capture_slots[i].bitmap ) {
+                al_destroy_bitmap(capture_slots[i].bitmap);
+            }
+        }
+        al_destroy_cond(capture_cond);
+        al_destroy_mutex(capture_mutex);
+        capture_thread = NULL;
+        capture_mutex = NULL;
+        capture_cond = NULL;
+        capture_ring_size = 0;
+    }
 }
 
-static int lg_get_mouse_num_buttons( lua_State *L ) {
-    lua_pushinteger(L, al_get_mouse_num_buttons());
-    return 1;
+/* copies the backbuffer of the current display into the capture ring, called by flip_display() */
+static void capture_display_frame( void ) {
+    int i, row, width, height, format, row_size;
+    double start;
+    capture_slot_t *slot = NULL;
+    ALLEGRO_BITMAP *backbuffer;
+    ALLEGRO_LOCKED_REGION *src, *dst;
+    ALLEGRO_STATE state;
+    ALLEGRO_DISPLAY *display = al_get_current_display();
+    if ( capture_thread == NULL || display == NULL ) {
+        return;
+    }
+    start = al_get_time();
+    al_lock_mutex(capture_mutex);
+    for ( i = 0; i < capture_ring_size && slot == NULL; ++i ) {
+        if ( capture_slots[i].state == CAPTURE_FREE ) {
+            slot = &capture_slots[i];
+        }
+    }
+    al_unlock_mutex(capture_mutex);
+    ++capture_frames;
+    if ( slot == NULL ) {
+        ++capture_dropped;
+        capture_overhead += al_get_time() - start;
+        return;
+    }
+
+    /* free slots belong to the main thread, so no locking is needed here */
+    backbuffer = al_get_backbuffer(display);
+    width = al_get_bitmap_width(backbuffer);
+    height = al_get_bitmap_height(backbuffer);
+    format = al_get_bitmap_format(backbuffer);
+    if ( slot->bitmap && (al_get_bitmap_width(slot->bitmap) != width || al_get_bitmap_height(slot->bitmap) != height ||
+                al_get_bitmap_format(slot->bitmap) != format) ) {
+        al_destroy_bitmap(slot->bitmap);
+        slot->bitmap = NULL;
+    }
+    if ( slot->bitmap == NULL ) {
+        al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+        al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+        al_set_new_bitmap_format(format);
+        slot->bitmap = al_create_bitmap(width, height);
+        al_restore_state(&state);
+    }
+    src = slot->bitmap ? al_lock_bitmap(backbuffer, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY) : NULL;
+    if ( src == NULL ) {
+        ++capture_dropped;
+        capture_overhead += al_get_time() - start;
+        return;
+    }
+    dst = al_lock_bitmap(slot->bitmap, src->format, ALLEGRO_LOCK_WRITEONLY);
+    if ( dst ) {
+        row_size = width * src->pixel_size;
+        for ( row = 0; row < height; ++row ) {
+            memcpy((char*) dst->data + row * dst->pitch, (const char*) src->data + row * src->pitch, row_size);
+        }
+        al_unlock_bitmap(slot->bitmap);
+    }
+    al_unlock_bitmap(backbuffer);
+
+    al_lock_mutex(capture_mutex);
+    if ( dst ) {
+        slot->frame = capture_next_frame++;
+        slot->state = CAPTURE_QUEUED;
+        al_signal_cond(capture_cond);
+    } else {
+        ++capture_dropped;
+    }
+    al_unlock_mutex(capture_mutex);
+    capture_overhead += al_get_time() - start;
 }
 
-static int lg_create_mouse_state( lua_State *L) {
-    push_data(L, LEGATO_MOUSE_STATE, sizeof(ALLEGRO_MOUSE_STATE));
-    return 1;
+/* start_capture(prefix, [{ring_size = 4, extension = ".png"}]) - frames are saved as <prefix>000000<extension> */
+static int lg_start_capture( lua_State *L ) {
+    int ring_size;
+    const char *prefix = luaL_checkstring(L, 1);
+    const char *extension = ".png";
+    if ( capture_thread ) {
+        return luaL_error(L, "capture is already running");
+    }
+    ring_size = (int) get_opt_number_field(L, 2, "ring_size", 4.0);
+    luaL_argcheck(L, ring_size > 0 && ring_size <= LEGATO_CAPTURE_RING_MAX, 2, "invalid ring size");
+    if ( lua_istable(L, 2) ) {
+        lua_getfield(L, 2, "extension");
+        extension = lua_isnil(L, -1) ? extension : luaL_checkstring(L, -1);
+        lua_pop(L, 1);
+    }
+    luaL_argcheck(L, strlen(prefix) < sizeof(capture_prefix), 1, "prefix is too long");
+    luaL_argcheck(L, strlen(extension) < sizeof(capture_extension), 2, "extension is too long");
+    strcpy(capture_prefix, prefix);
+    strcpy(capture_extension, extension);
+    memset(capture_slots, 0, sizeof(capture_slots));
+    capture_ring_size = ring_size;
+    capture_next_frame = 0;
+    capture_frames = capture_dropped = capture_written = capture_failed = 0;
+    capture_overhead = 0.0;
+    capture_mutex = al_create_mutex();
+    capture_cond = al_create_cond();
+    capture_thread = al_create_thread(frame_capture_thread, NULL);
+    al_start_thread(capture_thread);
+    return 0;
+}
+
+/* get_capture_stats() -> captured frames, dropped frames, written files, failed files, average overhead per frame */
+static int lg_get_capture_stats( lua_State *L ) {
+    if ( capture_thread ) {
+        al_lock_mutex(capture_mutex);
+    }
+    lua_pushinteger(L, capture_frames - capture_dropped);
+    lua_pushinteger(L, capture_dropped);
+    lua_pushinteger(L, capture_written);
+    lua_pushinteger(L, capture_failed);
+    if ( capture_thread ) {
+        al_unlock_mutex(capture_mutex);
+    }
+    lua_pushnumber(L, capture_frames > 0 ? capture_overhead / capture_frames : 0.0);
+    return 5;
 }
 
-static int lg_get_mouse_state( lua_State *L ) {
-    al_get_mouse_state(to_mouse_state(L, 1));
-    return 0;
+/* stop_capture() - waits until the queued frames are written, returns the same values as get_capture_stats() */
+static int lg_stop_capture( lua_State *L ) {
+    shutdown_frame_capture();
+    return lg_get_capture_stats(L);
 }
 
-static int lg_get_mouse_state_axis( lua_State *L ) {
-    lua_pushinteger(L, al_get_mouse_state_axis(to_mouse_state(L, 1), luaL_checkint(L, 2)));
+static int lg_is_capturing( lua_State *L ) {
+    lua_pushboolean(L, capture_thread != NULL);
     return 1;
 }
 
-static int lg_mouse_button_down( lua_State *L ) {
-    lua_pushboolean(L, al_mouse_button_down(to_mouse_state(L, 1), luaL_checkint(L, 2)));
-    return 1;
+/*
+================================================================================
+
+                Input recording
+
+================================================================================
+*/
+/*
+    Input events fetched from a queue are written into a binary log:
+    "LGIR" and a version number, then one record per event with the time since
+    the start of the recording (double), the event type and a few 32 bit
+    words of payload, all little endian. A replay feeds these events back into
+    get_queue_event() of its queue, live input of that queue is ignored.
+*/
+#define INPUT_LOG_MAGIC "LGIR"
+#define INPUT_LOG_VERSION 1
+
+static PHYSFS_File *input_recording_file = NULL;
+static ALLEGRO_EVENT_QUEUE *input_recording_queue = NULL;
+static double input_recording_start = 0.0;
+static int input_recording_count = 0;
+
+static ALLEGRO_EVENT_QUEUE *input_replay_queue = NULL;
+static unsigned char *input_replay_data = NULL;
+static size_t input_replay_size = 0;
+static size_t input_replay_pos = 0;
+static double input_replay_start = 0.0;
+static int input_replay_realtime = 1;
+
+typedef union input_word_t {
+    uint32_t    u;
+    int32_t     i;
+    float       f;
+} input_word_t;
+
+/* number of payload words of a recorded event type, -1 for types which are not recorded */
+static int get_input_payload_size( const unsigned int type ) {
+    switch ( type ) {
+        case ALLEGRO_EVENT_KEY_DOWN:
+        case ALLEGRO_EVENT_KEY_CHAR:
+        case ALLEGRO_EVENT_KEY_UP:
+            return 4;
+        case ALLEGRO_EVENT_MOUSE_AXES:
+        case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
+        case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
+        case ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY:
+        case ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY:
+        case ALLEGRO_EVENT_MOUSE_WARPED:
+            return 10;
+        case ALLEGRO_EVENT_JOYSTICK_AXIS:
+        case ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN:
+        case ALLEGRO_EVENT_JOYSTICK_BUTTON_UP:
+            return 5;
+        case ALLEGRO_EVENT_JOYSTICK_CONFIGURATION:
+        case ALLEGRO_EVENT_DISPLAY_CLOSE:
+            return 0;
+        default:
+            return -1;
+    }
 }
 
-static int lg_set_mouse_xy( lua_State *L ) {
-    lua_pushboolean(L, al_set_mouse_xy(to_display(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3)));
-    return 1;
+static void put_le32( unsigned char *p, const uint32_t v ) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
 }
 
-static int lg_set_mouse_z( lua_State *L ) {
-    lua_pushboolean(L, al_set_mouse_z(luaL_checkint(L, 1)));
-    return 1;
+static uint32_t get_le32( const unsigned char *p ) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
 }
 
-static int lg_set_mouse_w( lua_State *L ) {
-    lua_pushboolean(L, al_set_mouse_w(luaL_checkint(L, 1)));
-    return 1;
+static int get_joystick_index( ALLEGRO_JOYSTICK *joystick ) {
+    int i;
+    for ( i = al_get_num_joysticks() - 1; i >= 0 && al_get_joystick(i) != joystick; --i );
+    return i;
+}
+
+/* appends event to the log if queue is recorded, called by get_queue_event() */
+static void record_input_event( ALLEGRO_EVENT_QUEUE *queue, const ALLEGRO_EVENT *event ) {
+    int i, size;
+    union { double d; uint64_t u; } time;
+    input_word_t w[10];
+    unsigned char record[4 * 13];
+    if ( queue != input_recording_queue || (size = get_input_payload_size(event->type)) < 0 ) {
+        return;
+    }
+    switch ( event->type ) {
+        case ALLEGRO_EVENT_KEY_DOWN:
+        case ALLEGRO_EVENT_KEY_CHAR:
+        case ALLEGRO_EVENT_KEY_UP:
+            w[0].i = event->keyboard.keycode;
+            w[1].i = event->keyboard.unichar;
+            w[2].u = event->keyboard.modifiers;
+            w[3].i = event->keyboard.repeat;
+            break;
+        case ALLEGRO_EVENT_JOYSTICK_AXIS:
+        case ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN:
+        case ALLEGRO_EVENT_JOYSTICK_BUTTON_UP:
+            w[0].i = get_joystick_index(event->joystick.id);
+            w[1].i = event->joystick.stick;
+            w[2].i = event->joystick.axis;
+            w[3].i = event->joystick.button;
+            w[4].f = event->joystick.pos;
+            break;
+        case ALLEGRO_EVENT_JOYSTICK_CONFIGURATION:
+        case ALLEGRO_EVENT_DISPLAY_CLOSE:
+            break;
+        default:
+            w[0].i = event->mouse.x;
+            w[1].i = event->mouse.y;
+            w[2].i = event->mouse.z;
+            w[3].i = event->mouse.w;
+            w[4].i = event->mouse.dx;
+            w[5].i = event->mouse.dy;
+            w[6].i = event->mouse.dz;
+            w[7].i = event->mouse.dw;
+            w[8].u = event->mouse.button;
+            w[9].f = event->mouse.pressure;
+            break;
+    }
+    time.d = event->any.timestamp - input_recording_start;
+    put_le32(record, (uint32_t) time.u);
+    put_le32(record + 4, (uint32_t) (time.u >> 32));
+    put_le32(record + 8, event->type);
+    for ( i = 0; i < size; ++i ) {
+        put_le32(record + 12 + i * 4, w[i].u);
+    }
+    PHYSFS_write(input_recording_file, record, 1, 12 + size * 4);
+    ++input_recording_count;
 }
 
-static int lg_set_mouse_axis( lua_State *L ) {
-    lua_pushboolean(L, al_set_mouse_axis(luaL_checkint(L, 1), luaL_checkint(L, 2)));
-    return 1;
+static void stop_input_replay( void ) {
+    free(input_replay_data);
+    input_replay_data = NULL;
+    input_replay_queue = NULL;
+    input_replay_size = input_replay_pos = 0;
 }
 
-static int lg_create_mouse_cursor( lua_State *L ) {
-    return push_object(L, LEGATO_MOUSE_CURSOR, al_create_mouse_cursor(to_bitmap(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3)), 1);
+/*
+    Replays the next event of the log into event, called by get_queue_event().
+    Returns -1 if queue is not replayed, 1 if an event is due and 0 otherwise
+    (due is set to the absolute time of the next event then). With peek the
+    event stays in the log.
+*/
+static int replay_input_event( ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *event, double *due, const int peek ) {
+    int i, size;
+    const unsigned char *p;
+    union { double d; uint64_t u; } time;
+    input_word_t w[10];
+    ALLEGRO_DISPLAY *display;
+    if ( queue != input_replay_queue ) {
+        return -1;
+    }
+    p = input_replay_data + input_replay_pos;
+    if ( input_replay_pos + 12 > input_replay_size ||
+            (size = get_input_payload_size(get_le32(p + 8))) < 0 ||
+            input_replay_pos + 12 + size * 4 > input_replay_size ) {
+        stop_input_replay(); /* end of the log (or a broken record) */
+        return -1;
+    }
+    time.u = (uint64_t) get_le32(p) | ((uint64_t) get_le32(p + 4) << 32);
+    *due = input_replay_start + time.d;
+    if ( input_replay_realtime && *due > al_get_time() ) {
+        return 0;
+    }
+    for ( i = 0; i < size; ++i ) {
+        w[i].u = get_le32(p + 12 + i * 4);
+    }
+    if ( ! peek ) {
+        input_replay_pos += 12 + size * 4;
+    }
+
+    memset(event, 0, sizeof(ALLEGRO_EVENT));
+    display = al_get_current_display();
+    event->type = get_le32(p + 8);
+    event->any.timestamp = input_replay_realtime ? *due : al_get_time();
+    switch ( event->type ) {
+        case ALLEGRO_EVENT_KEY_DOWN:
+        case ALLEGRO_EVENT_KEY_CHAR:
+        case ALLEGRO_EVENT_KEY_UP:
+            event->keyboard.display = display;
+            event->keyboard.keycode = w[0].i;
+            event->keyboard.unichar = w[1].i;
+            event->keyboard.modifiers = w[2].u;
+            event->keyboard.repeat = w[3].i;
+            break;
+        case ALLEGRO_EVENT_JOYSTICK_AXIS:
+        case ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN:
+        case ALLEGRO_EVENT_JOYSTICK_BUTTON_UP:
+            event->joystick.id = w[0].i >= 0 && w[0].i < al_get_num_joysticks() ? al_get_joystick(w[0].i) : NULL;
+            event->joystick.stick = w[1].i;
+            event->joystick.axis = w[2].i;
+            event->joystick.button = w[3].i;
+            event->joystick.pos = w[4].f;
+            break;
+        case ALLEGRO_EVENT_JOYSTICK_CONFIGURATION:
+            break;
+        case ALLEGRO_EVENT_DISPLAY_CLOSE:
+            event->display.source = display;
+            break;
+        default:
+            event->mouse.display = display;
+            event->mouse.x = w[0].i;
+            event->mouse.y = w[1].i;
+            event->mouse.z = w[2].i;
+            event->mouse.w = w[3].i;
+            event->mouse.dx = w[4].i;
+            event->mouse.dy = w[5].i;
+            event->mouse.dz = w[6].i;
+            event->mouse.dw = w[7].i;
+            event->mouse.button = w[8].u;
+            event->mouse.pressure = w[9].f;
+            break;
+    }
+    return 1;
 }
 
-static int lg_destroy_mouse_cursor( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+static int is_input_event( const unsigned int type ) {
+    return type != ALLEGRO_EVENT_DISPLAY_CLOSE && get_input_payload_size(type) >= 0;
 }
 
-static int lg_set_mouse_cursor( lua_State *L ) {
-    al_set_mouse_cursor(to_display(L, 1), to_mouse_cursor(L, 2));
-    return 0;
+static int stop_input_recording( void ) {
+    int count = input_recording_count;
+    if ( input_recording_file ) {
+        PHYSFS_close(input_recording_file);
+    }
+    input_recording_file = NULL;
+    input_recording_queue = NULL;
+    input_recording_count = 0;
+    return count;
 }
 
-static int lg_set_system_mouse_cursor( lua_State *L ) {
-    lua_pushboolean(L, al_set_system_mouse_cursor(to_display(L, 1), parse_enum_name(L, 2, mouse_cursor_mapping)));
-    return 1;
+/* stops recording and replay of a destroyed queue */
+static void release_input_queue( ALLEGRO_EVENT_QUEUE *queue ) {
+    if ( queue == input_recording_queue ) {
+        stop_input_recording();
+    }
+    if ( queue == input_replay_queue ) {
+        stop_input_replay();
+    }
 }
 
-static int lg_get_mouse_cursor_position( lua_State *L ) {
-    int x, y;
-    if ( al_get_mouse_cursor_position(&x, &y) ) {
-        lua_pushinteger(L, x); lua_pushinteger(L, y);
-        return 2;
-    } else {
-        return 0;
+/* start_input_recording(queue, filename) - records the input events fetched from queue into filename */
+static int lg_start_input_recording( lua_State *L ) {
+    unsigned char header[8];
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    const char *filename = luaL_checkstring(L, 2);
+    PHYSFS_File *fp;
+    if ( input_recording_file ) {
+        return luaL_error(L, "input recording is already running");
+    }
+    fp = PHYSFS_openWrite(filename);
+    if ( fp == NULL ) {
+        return push_error(L, "cannot open '%s': %s", filename, PHYSFS_getLastError());
     }
+    memcpy(header, INPUT_LOG_MAGIC, 4);
+    put_le32(header + 4, INPUT_LOG_VERSION);
+    PHYSFS_write(fp, header, 1, sizeof(header));
+    input_recording_file = fp;
+    input_recording_queue = queue;
+    input_recording_start = al_get_time();
+    input_recording_count = 0;
+    return push_ok(L);
 }
 
-static int lg_hide_mouse_cursor( lua_State *L ) {
-    lua_pushboolean(L, al_hide_mouse_cursor(to_display(L, 1)));
+/* stop_input_recording() -> number of recorded events */
+static int lg_stop_input_recording( lua_State *L ) {
+    lua_pushinteger(L, stop_input_recording());
     return 1;
 }
 
-static int lg_show_mouse_cursor( lua_State *L ) {
-    lua_pushboolean(L, al_show_mouse_cursor(to_display(L, 1)));
-    return 1;
+/* start_input_replay(queue, filename, [realtime = true]) - without realtime the events are replayed as fast as possible */
+static int lg_start_input_replay( lua_State *L ) {
+    PHYSFS_sint64 size;
+    unsigned char *data;
+    ALLEGRO_EVENT_QUEUE *queue = to_event_queue(L, 1);
+    const char *filename = luaL_checkstring(L, 2);
+    PHYSFS_File *fp = PHYSFS_openRead(filename);
+    if ( fp == NULL ) {
+        return push_error(L, "cannot open '%s': %s", filename, PHYSFS_getLastError());
+    }
+    size = PHYSFS_fileLength(fp);
+    data = size >= 8 ? (unsigned char*) malloc((size_t) size) : NULL;
+    if ( data == NULL || PHYSFS_read(fp, data, 1, (PHYSFS_uint32) size) != size ||
+            memcmp(data, INPUT_LOG_MAGIC, 4) != 0 || get_le32(data + 4) != INPUT_LOG_VERSION ) {
+        PHYSFS_close(fp);
+        free(data);
+        return push_error(L, "'%s' is not an input log", filename);
+    }
+    PHYSFS_close(fp);
+    stop_input_replay();
+    input_replay_queue = queue;
+    input_replay_data = data;
+    input_replay_size = (size_t) size;
+    input_replay_pos = 8;
+    input_replay_start = al_get_time();
+    input_replay_realtime = lua_isnoneornil(L, 3) ? 1 : lua_toboolean(L, 3);
+    return push_ok(L);
 }
 
-static int lg_grab_mouse( lua_State *L ) {
-    lua_pushboolean(L, al_grab_mouse(to_display(L, 1)));
-    return 1;
+static int lg_stop_input_replay( lua_State *L ) {
+    stop_input_replay();
+    return 0;
 }
 
-static int lg_ungrab_mouse( lua_State *L ) {
-    lua_pushboolean(L, al_ungrab_mouse());
+static int lg_is_replaying_input( lua_State *L ) {
+    lua_pushboolean(L, input_replay_queue != NULL);
     return 1;
 }
 
 /*
 ================================================================================
 
-                Path
+                Fullscreen modes
 
 ================================================================================
 */
-static int lg_create_path( lua_State *L ) {
-    return push_object(L, LEGATO_PATH, al_create_path(luaL_checkstring(L, 1)), 1);
-}
-
-static int lg_create_path_for_directory( lua_State *L ) {
-    return push_object(L, LEGATO_PATH, al_create_path_for_directory(luaL_checkstring(L, 1)), 1);
-}
-
-static int lg_destroy_path( lua_State *L ) {
-    ALLEGRO_PATH *path = (ALLEGRO_PATH*) to_object_gc(L, 1, LEGATO_PATH);
-    if ( path ) {
-        al_destroy_path(path);
-        clear_object(L, 1);
+static int lg_get_display_modes( lua_State *L ) {
+    ALLEGRO_DISPLAY_MODE mode;
+    int i, num_modes;
+    num_modes = al_get_num_display_modes();
+    lua_newtable(L);
+    for ( i = 0; i < num_modes; ++i ) {
+        al_get_display_mode(i, &mode);
+        lua_newtable(L);
+        set_int(L, "width", mode.width);
+        set_int(L, "height", mode.height);
+        set_int(L, "refresh_rate", mode.refresh_rate);
+        set_int(L, "format", mode.format); /* FIXME: use str enums! */
+        lua_rawseti(L, -2, i + 1);
     }
-    return 0;
+    return 1;
 }
 
-static int lg_clone_path( lua_State *L ) {
-    return push_object(L, LEGATO_PATH, al_clone_path(to_path(L, 1)), 1);
-}
+/*
+================================================================================
 
-static int lg_join_paths( lua_State *L ) {
-    lua_pushboolean(L, al_join_paths(to_path(L, 1), to_path(L, 2)));
-    return 1;
-}
+                Joystick
 
-static int lg_rebase_path( lua_State *L ) {
-    lua_pushboolean(L, al_rebase_path(to_path(L, 1), to_path(L, 2)));
+================================================================================
+*/
+static int lg_is_joystick_installed( lua_State *L ) {
+    lua_pushboolean(L, al_is_joystick_installed());
     return 1;
 }
 
-static int lg_get_path_drive( lua_State *L ) {
-    lua_pushstring(L, al_get_path_drive(to_path(L, 1)));
+static int lg_reconfigure_joysticks( lua_State *L ) {
+    lua_pushboolean(L, al_reconfigure_joysticks());
     return 1;
 }
 
-static int lg_get_path_num_components( lua_State *L ) {
-    lua_pushinteger(L, al_get_path_num_components(to_path(L, 1)));
+static int lg_get_num_joysticks( lua_State *L ) {
+    lua_pushinteger(L, al_get_num_joysticks());
     return 1;
 }
 
-static int lg_get_path_components( lua_State *L ) {
-    int i, num_components;
-    ALLEGRO_PATH *path = to_path(L, 1);
-    lua_newtable(L);
-    num_components = al_get_path_num_components(path);
-    for ( i = 0; i < num_components; ++i ) {
-        lua_pushstring(L, al_get_path_component(path, i));
-        lua_rawgeti(L, -2, i + 1);
+static int lg_get_joystick( lua_State *L ) {
+    ALLEGRO_JOYSTICK *joystick = al_get_joystick(luaL_checkint(L, 1));
+    if ( joystick ) {
+        return push_object_by_pointer(L, LEGATO_JOYSTICK, joystick);
     }
+    return 0;
+}
+
+static int lg_release_joystick( lua_State *L ) {
+    NOT_IMPLEMENTED_MACRO;
+}
+
+static int lg_get_joystick_active( lua_State *L ) {
+    lua_pushboolean(L, al_get_joystick_active(to_joystick(L, 1)));
     return 1;
 }
 
-static int lg_get_path_tail( lua_State *L ) {
-    lua_pushstring(L, al_get_path_tail(to_path(L, 1)));
+static int lg_get_joystick_name( lua_State *L ) {
+    lua_pushstring(L, al_get_joystick_name(to_joystick(L, 1)));
     return 1;
 }
 
-static int lg_get_path_filename( lua_State *L ) {
-    lua_pushstring(L, al_get_path_filename(to_path(L, 1)));
+static int lg_get_joystick_stick_name( lua_State *L ) {
+    lua_pushstring(L, al_get_joystick_stick_name(to_joystick(L, 1), luaL_checkint(L, 2)));
     return 1;
 }
 
-static int lg_get_path_basename( lua_State *L ) {
-    lua_pushstring(L, al_get_path_basename(to_path(L, 1)));
+static int lg_get_joystick_axis_name( lua_State *L ) {
+    lua_pushstring(L, al_get_joystick_axis_name(to_joystick(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3)));
     return 1;
 }
 
-static int lg_get_path_extension( lua_State *L ) {
-    lua_pushstring(L, al_get_path_extension(to_path(L, 1)));
+static int lg_get_joystick_button_name( lua_State *L ) {
+    lua_pushstring(L, al_get_joystick_button_name(to_joystick(L, 1), luaL_checkint(L, 2)));
     return 1;
 }
 
-static int lg_set_path_drive( lua_State *L ) {
-    al_set_path_drive(to_path(L, 1), luaL_checkstring(L, 2));
+static int lg_get_joystick_stick_flags( lua_State *L ) {
+    return push_flag_table(L, al_get_joystick_stick_flags(to_joystick(L, 1), luaL_checkint(L, 2)), joyflags_mapping);
+}
+
+static int lg_get_joystick_num_sticks( lua_State *L ) {
+    lua_pushinteger(L, al_get_joystick_num_sticks(to_joystick(L, 1)));
     return 1;
 }
 
-static int lg_append_path_component( lua_State *L ) {
-    al_append_path_component(to_path(L, 1), luaL_checkstring(L, 2));
-    return 0;
+static int lg_get_joystick_num_axes( lua_State *L ) {
+    lua_pushinteger(L, al_get_joystick_num_axes(to_joystick(L, 1), luaL_checkint(L, 2)));
+    return 1;
 }
 
-static int lg_insert_path_component( lua_State *L ) {
-    al_insert_path_component(to_path(L, 1), luaL_checkint(L, 2), luaL_checkstring(L, 3));
-    return 0;
+static int lg_get_joystick_num_buttons( lua_State *L ) {
+    lua_pushinteger(L, al_get_joystick_num_buttons(to_joystick(L, 1)));
+    return 1;
 }
 
-static int lg_replace_path_component( lua_State *L ) {
-    al_replace_path_component(to_path(L, 1), luaL_checkint(L, 2), luaL_checkstring(L, 3));
-    return 0;
+static int lg_get_joystick_state( lua_State *L ) {
+    ALLEGRO_JOYSTICK_STATE *state = (ALLEGRO_JOYSTICK_STATE*) push_data(L, LEGATO_JOYSTICK_STATE, sizeof(ALLEGRO_JOYSTICK_STATE));
+    al_get_joystick_state(to_joystick(L, 1), state);
+    return 1;
 }
 
-static int lg_remove_path_component( lua_State *L ) {
-    al_remove_path_component(to_path(L, 1), luaL_checkint(L, 2));
-    return 0;
+/*
+================================================================================
+
+                Keyboard
+
+================================================================================
+*/
+static int lg_is_keyboard_installed( lua_State *L ) {
+    lua_pushboolean(L, al_is_keyboard_installed());
+    return 1;
 }
 
-static int lg_drop_path_tail( lua_State *L ) {
-    al_drop_path_tail(to_path(L, 1));
-    return 0;
+static int lg_create_keyboard_state( lua_State *L ) {
+    push_data(L, LEGATO_KEYBOARD_STATE, sizeof(ALLEGRO_KEYBOARD_STATE));
+    return 1;
 }
 
-static int lg_set_path_filename( lua_State *L ) {
-    al_set_path_filename(to_path(L, 1), luaL_checkstring(L, 2));
+static int lg_get_keyboard_state( lua_State *L ) {
+    al_get_keyboard_state(to_keyboard_state(L, 1));
     return 0;
 }
 
-static int lg_set_path_extension( lua_State *L ) {
-    lua_pushboolean(L, al_set_path_extension(to_path(L, 1), luaL_checkstring(L, 2)));
+static int lg_key_down( lua_State *L ) {
+    lua_pushboolean(L, al_key_down(to_keyboard_state(L, 1), luaL_checkint(L, 2)));
     return 1;
 }
 
-static int lg_path_str( lua_State *L ) {
-    static char default_delim[2] = { ALLEGRO_NATIVE_PATH_SEP, 0 };
-    const char *delim = luaL_optstring(L, 2, default_delim);
-    luaL_argcheck(L, strlen(delim) == 1, 2, "path delimiter must be one character");
-    lua_pushstring(L, al_path_cstr(to_path(L, 1), delim[0]));
+static int lg_keycode_to_name( lua_State *L ) {
+    lua_pushstring(L, al_keycode_to_name(luaL_checkint(L, 1)));
     return 1;
 }
 
-static int lg_make_path_canonical( lua_State *L ) {
-    lua_pushboolean(L, al_make_path_canonical(to_path(L, 1)));
+static int lg_set_keyboard_leds( lua_State *L ) {
+    lua_pushboolean(L, al_set_keyboard_leds(luaL_checkint(L, 1)));
     return 1;
 }
 
 /*
 ================================================================================
 
-                State
+                Monitor
 
 ================================================================================
 */
-static int lg_restore_state( lua_State *L ) {
-    al_restore_state(to_state(L, 1));
-    return 0;
+static int lg_get_new_display_adapter( lua_State *L ) {
+    int id = al_get_new_display_adapter();
+    if ( id == ALLEGRO_DEFAULT_DISPLAY_ADAPTER ) {
+        return 0; 
+    } else {
+        lua_pushinteger(L, id + 1);
+        return 1;
+    }
 }
 
-static int lg_store_state( lua_State *L ) {
-    al_store_state(
-            (ALLEGRO_STATE*) push_data(L, LEGATO_STATE, sizeof(ALLEGRO_STATE)),
-            parse_flag_table(L, 2, state_flag_mapping));
-    return 1;
+static int lg_set_new_display_adapter( lua_State *L ) {
+    al_set_new_display_adapter(luaL_optint(L, 1, ALLEGRO_DEFAULT_DISPLAY_ADAPTER + 1) - 1);
+    return 0;
 }
 
-static int lg_get_errno( lua_State *L ) {
-    lua_pushinteger(L, al_get_errno());
+static int lg_get_monitor_info( lua_State *L ) {
+    ALLEGRO_MONITOR_INFO monitor;
+    int i, num_monitors;
+    num_monitors = al_get_num_video_adapters();
+    lua_newtable(L);
+    for ( i = 0; i < num_monitors; ++i ) {
+        al_get_monitor_info(i, &monitor);
+        lua_newtable(L);
+        set_int(L, "x1", monitor.x1);
+        set_int(L, "y1", monitor.y1);
+        set_int(L, "x2", monitor.x2);
+        set_int(L, "y2", monitor.y2);
+        lua_rawseti(L, -2, i + 1);
+    }
     return 1;
 }
 
-static int lg_set_errno( lua_State *L ) {
-    al_set_errno(luaL_checkint(L, 1));
-    return 0;
-}
-
-
 /*
 ================================================================================
 
-                System
+                Mouse
 
 ================================================================================
 */
-static int lg_get_allegro_version( lua_State *L ) {
-    uint32_t version = al_get_allegro_version();
-    lua_pushinteger(L, version >> 24);
-    lua_pushinteger(L, (version >> 16) & 255);
-    lua_pushinteger(L, (version >> 8) & 255);
-    lua_pushinteger(L, version & 255);
-    return 4;
+static int lg_is_mouse_installed( lua_State *L ) {
+    lua_pushboolean(L, al_is_mouse_installed());
+    return 1;
 }
 
-static int lg_get_standard_path( lua_State *L ) {
-    ALLEGRO_PATH *path = al_get_standard_path(parse_enum_name(L, 1, standard_path_mapping));
-    if ( path ) {
-        lua_pushstring(L, al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
-        al_destroy_path(path);
-        return 1;
-    } else {
-        return push_error(L, "cannot get standard path");
-    }
+static int lg_get_mouse_num_axes( lua_State *L ) {
+    lua_pushinteger(L, al_get_mouse_num_axes());
+    return 1;
 }
 
-static int lg_set_exe_name( lua_State *L ) {
-    al_set_exe_name(luaL_checkstring(L, 1));
-    return 0;
+static int lg_get_mouse_num_buttons( lua_State *L ) {
+    lua_pushinteger(L, al_get_mouse_num_buttons());
+    return 1;
 }
 
-static int lg_set_app_name( lua_State *L ) {
-    al_set_app_name(luaL_checkstring(L, 1));
-    return 0;
+static int lg_create_mouse_state( lua_State *L) {
+    push_data(L, LEGATO_MOUSE_STATE, sizeof(ALLEGRO_MOUSE_STATE));
+    return 1;
 }
 
-static int lg_set_org_name( lua_State *L ) {
-    al_set_org_name(luaL_checkstring(L, 1));
+static int lg_get_mouse_state( lua_State *L ) {
+    al_get_mouse_state(to_mouse_state(L, 1));
     return 0;
 }
 
-static int lg_get_app_name( lua_State *L ) {
-    lua_pushstring(L, al_get_app_name());
+static int lg_get_mouse_state_axis( lua_State *L ) {
+    lua_pushinteger(L, al_get_mouse_state_axis(to_mouse_state(L, 1), luaL_checkint(L, 2)));
     return 1;
 }
 
-static int lg_get_org_name( lua_State *L ) {
-    lua_pushstring(L, al_get_org_name());
+static int lg_mouse_button_down( lua_State *L ) {
+    lua_pushboolean(L, al_mouse_button_down(to_mouse_state(L, 1), luaL_checkint(L, 2)));
     return 1;
 }
 
-static int lg_get_system_config( lua_State *L ) {
-    return push_object(L, LEGATO_CONFIG, al_get_system_config(), 0);
+static int lg_set_mouse_xy( lua_State *L ) {
+    lua_pushboolean(L, al_set_mouse_xy(to_display(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3)));
+    return 1;
 }
 
-/*
-================================================================================
-
-                Time
-
-================================================================================
-*/
-static int lg_get_time( lua_State *L ) {
-    lua_pushnumber(L, al_get_time());
+static int lg_set_mouse_z( lua_State *L ) {
+    lua_pushboolean(L, al_set_mouse_z(luaL_checkint(L, 1)));
     return 1;
 }
 
-static int lg_rest( lua_State *L ) {
-    al_rest(luaL_checknumber(L, 1));
-    return 0;
+static int lg_set_mouse_w( lua_State *L ) {
+    lua_pushboolean(L, al_set_mouse_w(luaL_checkint(L, 1)));
+    return 1;
 }
 
-/*
-================================================================================
-
-                Timer
+static int lg_set_mouse_axis( lua_State *L ) {
+    lua_pushboolean(L, al_set_mouse_axis(luaL_checkint(L, 1), luaL_checkint(L, 2)));
+    return 1;
+}
 
-================================================================================
-*/
-static int lg_create_timer( lua_State *L ) {
-    return push_object(L, LEGATO_TIMER, al_create_timer(luaL_checknumber(L, 1)), 1);
+static int lg_create_mouse_cursor( lua_State *L ) {
+    return push_object(L, LEGATO_MOUSE_CURSOR, al_create_mouse_cursor(to_bitmap(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3)), 1);
 }
 
-static int lg_start_timer( lua_State *L ) {
-    al_start_timer(to_timer(L, 1));
-    return 0;
+static int lg_destroy_mouse_cursor( lua_State *L ) {
+    NOT_IMPLEMENTED_MACRO;
 }
 
-static int lg_stop_timer( lua_State *L ) {
-    al_stop_timer(to_timer(L, 1));
+static int lg_set_mouse_cursor( lua_State *L ) {
+    al_set_mouse_cursor(to_display(L, 1), to_mouse_cursor(L, 2));
     return 0;
 }
 
-static int lg_get_timer_started( lua_State *L ) {
-    lua_pushboolean(L, al_get_timer_started(to_timer(L, 1)));
+static int lg_set_system_mouse_cursor( lua_State *L ) {
+    lua_pushboolean(L, al_set_system_mouse_cursor(to_display(L, 1), parse_enum_name(L, 2, mouse_cursor_mapping)));
     return 1;
 }
 
-static int lg_destroy_timer( lua_State *L ) {
-    ALLEGRO_TIMER *timer = (ALLEGRO_TIMER*) to_object_gc(L, 1, LEGATO_TIMER);
-    if ( timer ) {
-        al_destroy_timer(timer);
-        clear_object(L, 1);
+static int lg_get_mouse_cursor_position( lua_State *L ) {
+    int x, y;
+    if ( al_get_mouse_cursor_position(&x, &y) ) {
+        lua_pushinteger(L, x); lua_pushinteger(L, y);
+        return 2;
+    } else {
+        return 0;
     }
-    return 0;
 }
 
-static int lg_get_timer_count( lua_State *L ) {
-    lua_pushinteger(L, al_get_timer_count(to_timer(L, 1)));
+static int lg_hide_mouse_cursor( lua_State *L ) {
+    lua_pushboolean(L, al_hide_mouse_cursor(to_display(L, 1)));
     return 1;
 }
 
-static int lg_set_timer_count( lua_State *L ) {
-    al_set_timer_count(to_timer(L, 1), luaL_checkinteger(L, 2));
-    return 0;
-}
-
-static int lg_add_timer_count( lua_State *L ) {
-    al_add_timer_count(to_timer(L, 1), luaL_checkinteger(L, 2));
-    return 0;
+static int lg_show_mouse_cursor( lua_State *L ) {
+    lua_pushboolean(L, al_show_mouse_cursor(to_display(L, 1)));
+    return 1;
 }
 
-static int lg_get_timer_speed( lua_State *L ) {
-    lua_pushnumber(L, al_get_timer_speed(to_timer(L, 1)));
+static int lg_grab_mouse( lua_State *L ) {
+    lua_pushboolean(L, al_grab_mouse(to_display(L, 1)));
     return 1;
 }
 
-static int lg_set_timer_speed( lua_State *L ) {
-    al_set_timer_speed(to_timer(L, 1), luaL_checknumber(L, 2));
-    return 0;
+static int lg_ungrab_mouse( lua_State *L ) {
+    lua_pushboolean(L, al_ungrab_mouse());
+    return 1;
 }
 
 /*
 ================================================================================
 
-                Transformations
+                Path
 
 ================================================================================
 */
-static int lg_create_transform( lua_State *L ) {
-    al_identity_transform((ALLEGRO_TRANSFORM*) push_data(L, LEGATO_TRANSFORM, sizeof(ALLEGRO_TRANSFORM)));
+static int lg_create_path( lua_State *L ) {
+    return push_object(L, LEGATO_PATH, al_create_path(luaL_checkstring(L, 1)), 1);
+}
+
+static int lg_create_path_for_directory( lua_State *L ) {
+    return push_object(L, LEGATO_PATH, al_create_path_for_directory(luaL_checkstring(L, 1)), 1);
+}
+
+static int lg_destroy_path( lua_State *L ) {
+    ALLEGRO_PATH *path = (ALLEGRO_PATH*) to_object_gc(L, 1, LEGATO_PATH);
+    if ( path ) {
+        al_destroy_path(path);
+        clear_object(L, 1);
+    }
+    return 0;
+}
+
+static int lg_clone_path( lua_State *L ) {
+    return push_object(L, LEGATO_PATH, al_clone_path(to_path(L, 1)), 1);
+}
+
+static int lg_join_paths( lua_State *L ) {
+    lua_pushboolean(L, al_join_paths(to_path(L, 1), to_path(L, 2)));
     return 1;
 }
 
-static int lg_copy_transform( lua_State *L ) {
-    al_copy_transform((ALLEGRO_TRANSFORM*) push_data(L, LEGATO_TRANSFORM, sizeof(ALLEGRO_TRANSFORM)), to_transform(L, 1));
+static int lg_rebase_path( lua_State *L ) {
+    lua_pushboolean(L, al_rebase_path(to_path(L, 1), to_path(L, 2)));
     return 1;
 }
 
-static int lg_use_transform( lua_State *L ) {
-    al_use_transform(to_transform(L, 1));
-    return 0;
+static int lg_get_path_drive( lua_State *L ) {
+    lua_pushstring(L, al_get_path_drive(to_path(L, 1)));
+    return 1;
 }
 
-static int lg_get_current_transform( lua_State *L ) {
-    al_copy_transform((ALLEGRO_TRANSFORM*) push_data(L, LEGATO_TRANSFORM, sizeof(ALLEGRO_TRANSFORM)), al_get_current_transform());
+static int lg_get_path_num_components( lua_State *L ) {
+    lua_pushinteger(L, al_get_path_num_components(to_path(L, 1)));
     return 1;
 }
 
-static int lg_invert_transform( lua_State *L ) {
-    al_invert_transform(to_transform(L, 1));
-    return 0;
+static int lg_get_path_components( lua_State *L ) {
+    int i, num_components;
+    ALLEGRO_PATH *path = to_path(L, 1);
+    lua_newtable(L);
+    num_components = al_get_path_num_components(path);
+    for ( i = 0; i < num_components; ++i ) {
+        lua_pushstring(L, al_get_path_component(path, i));
+        lua_rawgeti(L, -2, i + 1);
+    }
+    return 1;
 }
 
-static int lg_check_inverse( lua_State *L ) {
-    lua_pushboolean(L, al_check_inverse(to_transform(L, 1), luaL_checknumber(L, 2)));
+static int lg_get_path_tail( lua_State *L ) {
+    lua_pushstring(L, al_get_path_tail(to_path(L, 1)));
     return 1;
 }
 
-static int lg_identity_transform( lua_State *L ) {
-    al_identity_transform(to_transform(L, 1));
-    return 0;
+static int lg_get_path_filename( lua_State *L ) {
+    lua_pushstring(L, al_get_path_filename(to_path(L, 1)));
+    return 1;
 }
 
-static int lg_build_transform( lua_State *L ) {
-    ALLEGRO_TRANSFORM *transform = (ALLEGRO_TRANSFORM*) push_data(L, LEGATO_TRANSFORM, sizeof(ALLEGRO_TRANSFORM));
-    al_build_transform(transform, luaL_checknumber(L, 1), luaL_checknumber(L, 2),
-            luaL_checknumber(L, 3), luaL_checknumber(L, 4), luaL_checknumber(L, 5));
+static int lg_get_path_basename( lua_State *L ) {
+    lua_pushstring(L, al_get_path_basename(to_path(L, 1)));
     return 1;
 }
 
-static int lg_translate_transform( lua_State *L ) {
-    al_translate_transform(to_transform(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3));
-    return 0;
+static int lg_get_path_extension( lua_State *L ) {
+    lua_pushstring(L, al_get_path_extension(to_path(L, 1)));
+    return 1;
 }
 
-static int lg_rotate_transform( lua_State *L ) {
-    al_rotate_transform(to_transform(L, 1), luaL_checknumber(L, 2));
-    return 0;
+static int lg_set_path_drive( lua_State *L ) {
+    al_set_path_drive(to_path(L, 1), luaL_checkstring(L, 2));
+    return 1;
 }
 
-static int lg_scale_transform( lua_State *L ) {
-    al_scale_transform(to_transform(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3));
+static int lg_append_path_component( lua_State *L ) {
+    al_append_path_component(to_path(L, 1), luaL_checkstring(L, 2));
     return 0;
 }
 
-static int lg_transform_coordinates( lua_State *L ) {
-    float x, y;
-    x = luaL_checknumber(L, 2); y = luaL_checknumber(L, 3);
-    al_transform_coordinates(to_transform(L, 1), &x, &y);
-    lua_pushnumber(L, x); lua_pushnumber(L, y);
-    return 2;
+static int lg_insert_path_component( lua_State *L ) {
+    al_insert_path_component(to_path(L, 1), luaL_checkint(L, 2), luaL_checkstring(L, 3));
+    return 0;
 }
 
-static int lg_compose_transform( lua_State *L ) {
-    al_compose_transform(to_transform(L, 1), to_transform(L, 2));
+static int lg_replace_path_component( lua_State *L ) {
+    al_replace_path_component(to_path(L, 1), luaL_checkint(L, 2), luaL_checkstring(L, 3));
     return 0;
 }
 
-/*
-================================================================================
+static int lg_remove_path_component( lua_State *L ) {
+    al_remove_path_component(to_path(L, 1), luaL_checkint(L, 2));
+    return 0;
+}
 
-                Audio addons
+static int lg_drop_path_tail( lua_State *L ) {
+    al_drop_path_tail(to_path(L, 1));
+    return 0;
+}
 
-================================================================================
-*/
-static int lg_is_audio_installed( lua_State *L ) {
-    lua_pushboolean(L, al_is_audio_installed());
-    return 1;
+static int lg_set_path_filename( lua_State *L ) {
+    al_set_path_filename(to_path(L, 1), luaL_checkstring(L, 2));
+    return 0;
 }
 
-static int lg_reserve_samples( lua_State *L ) {
-    lua_pushboolean(L, al_reserve_samples(luaL_checkint(L, 1)));
+static int lg_set_path_extension( lua_State *L ) {
+    lua_pushboolean(L, al_set_path_extension(to_path(L, 1), luaL_checkstring(L, 2)));
     return 1;
 }
 
-static int lg_get_audio_depth_size( lua_State *L ) {
-    lua_pushinteger(L, al_get_audio_depth_size((ALLEGRO_AUDIO_DEPTH) parse_flag_table(L, 1, audio_depth_mapping)));
+static int lg_path_str( lua_State *L ) {
+    static char default_delim[2] = { ALLEGRO_NATIVE_PATH_SEP, 0 };
+    const char *delim = luaL_optstring(L, 2, default_delim);
+    luaL_argcheck(L, strlen(delim) == 1, 2, "path delimiter must be one character");
+    lua_pushstring(L, al_path_cstr(to_path(L, 1), delim[0]));
     return 1;
 }
 
-static int lg_get_channel_count( lua_State *L ) {
-    lua_pushinteger(L, al_get_channel_count((ALLEGRO_CHANNEL_CONF) parse_enum_name(L, 1, channel_conf_mapping)));
+static int lg_make_path_canonical( lua_State *L ) {
+    lua_pushboolean(L, al_make_path_canonical(to_path(L, 1)));
     return 1;
 }
 
 /*
 ================================================================================
 
-                Voice
+                State
 
 ================================================================================
 */
-static int lg_create_voice( lua_State *L ) {
-    return push_object(L, LEGATO_VOICE, al_create_voice(luaL_checkint(L, 1),
-                (ALLEGRO_AUDIO_DEPTH) parse_flag_table(L, 2, audio_depth_mapping), (ALLEGRO_CHANNEL_CONF) parse_enum_name(L, 3, channel_conf_mapping)), 1);
-}
-
-static int lg_destroy_voice( lua_State *L ) {
-    ALLEGRO_VOICE *voice = (ALLEGRO_VOICE*) to_object_gc(L, 1, LEGATO_VOICE);
-    if ( voice ) {
-        al_destroy_voice(voice);
-        clear_object(L, 1);
-    }
-    return 0;
-}
-
-static int lg_detach_voice( lua_State *L ) {
-    al_detach_voice(to_voice(L, 1));
+static int lg_restore_state( lua_State *L ) {
+    al_restore_state(to_state(L, 1));
     return 0;
 }
 
-static int lg_attach_audio_stream_to_voice( lua_State *L ) {
-    lua_pushboolean(L, al_attach_audio_stream_to_voice(to_audio_stream(L, 1), to_voice(L, 2)));
+static int lg_store_state( lua_State *L ) {
+    al_store_state(
+            (ALLEGRO_STATE*) push_data(L, LEGATO_STATE, sizeof(ALLEGRO_STATE)),
+            parse_flag_table(L, 2, state_flag_mapping));
     return 1;
 }
 
-static int lg_attach_mixer_to_voice( lua_State *L ) {
-    lua_pushboolean(L, al_attach_mixer_to_voice(to_mixer(L, 1), to_voice(L, 2)));
+static int lg_get_errno( lua_State *L ) {
+    lua_pushinteger(L, al_get_errno());
     return 1;
 }
 
-static int lg_attach_sample_instance_to_voice( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+static int lg_set_errno( lua_State *L ) {
+    al_set_errno(luaL_checkint(L, 1));
+    return 0;
 }
 
-static int lg_get_voice_frequency( lua_State *L ) {
-    lua_pushinteger(L, al_get_voice_frequency(to_voice(L, 1)));
-    return 1;
-}
 
-static int lg_get_voice_channels( lua_State *L ) {
-    return push_enum_name(L, al_get_voice_channels(to_voice(L, 1)), channel_conf_mapping);
-}
+/*
+================================================================================
 
-static int lg_get_voice_depth( lua_State *L ) {
-    return push_flag_table(L, al_get_voice_depth(to_voice(L, 1)), audio_depth_mapping);
+                System
+
+================================================================================
+*/
+static int lg_get_allegro_version( lua_State *L ) {
+    uint32_t version = al_get_allegro_version();
+    lua_pushinteger(L, version >> 24);
+    lua_pushinteger(L, (version >> 16) & 255);
+    lua_pushinteger(L, (version >> 8) & 255);
+    lua_pushinteger(L, version & 255);
+    return 4;
 }
 
-static int lg_get_voice_playing( lua_State *L ) {
-    lua_pushboolean(L, al_get_voice_playing(to_voice(L, 1)));
-    return 1;
-}
-
-static int lg_set_voice_playing( lua_State *L ) {
-    luaL_checktype(L, 2, LUA_TBOOLEAN);
-    lua_pushboolean(L, al_set_voice_playing(to_voice(L, 1), lua_toboolean(L, 2)));
-    return 1;
+static int lg_get_standard_path( lua_State *L ) {
+    ALLEGRO_PATH *path = al_get_standard_path(parse_enum_name(L, 1, standard_path_mapping));
+    if ( path ) {
+        lua_pushstring(L, al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+        al_destroy_path(path);
+        return 1;
+    } else {
+        return push_error(L, "cannot get standard path");
+    }
 }
 
-static int lg_get_voice_position( lua_State *L ) {
-    lua_pushinteger(L, al_get_voice_position(to_voice(L, 1)));
-    return 1;
+static int lg_set_exe_name( lua_State *L ) {
+    al_set_exe_name(luaL_checkstring(L, 1));
+    return 0;
 }
 
-static int lg_set_voice_position( lua_State *L ) {
-    lua_pushboolean(L, al_set_voice_position(to_voice(L, 1), luaL_checkint(L, 2)));
-    return 1;
+static int lg_set_app_name( lua_State *L ) {
+    al_set_app_name(luaL_checkstring(L, 1));
+    return 0;
 }
 
-/*
-================================================================================
-
-                Sample
-
-================================================================================
-*/
-static int lg_destroy_sample( lua_State *L ) {
-    ALLEGRO_SAMPLE *sample = (ALLEGRO_SAMPLE*) to_object(L, 1, LEGATO_AUDIO_SAMPLE);
-    if ( sample ) {
-        al_destroy_sample(sample);
-        clear_object(L, 1);
-    }
+static int lg_set_org_name( lua_State *L ) {
+    al_set_org_name(luaL_checkstring(L, 1));
     return 0;
 }
 
-static int lg_play_sample( lua_State *L ) {
-    int success;
-    ALLEGRO_SAMPLE_ID *ret_id = (ALLEGRO_SAMPLE_ID*) push_data(L, LEGATO_SAMPLE_ID, sizeof(ALLEGRO_SAMPLE_ID));
-    success = al_play_sample(to_audio_sample(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
-            luaL_checknumber(L, 4), (ALLEGRO_PLAYMODE) parse_enum_name(L, 5, playmode_mapping), ret_id);
-    lua_pushboolean(L, success);
-    return success ? 2 : 1;
+static int lg_get_app_name( lua_State *L ) {
+    lua_pushstring(L, al_get_app_name());
+    return 1;
 }
 
-static int lg_stop_sample( lua_State *L ) {
-    al_stop_sample(to_sample_id(L, 1));
-    return 0;
+static int lg_get_org_name( lua_State *L ) {
+    lua_pushstring(L, al_get_org_name());
+    return 1;
 }
 
-static int lg_stop_samples( lua_State *L ) {
-    al_stop_samples();
-    return 0;
+static int lg_get_system_config( lua_State *L ) {
+    return push_object(L, LEGATO_CONFIG, al_get_system_config(), 0);
 }
 
-static int lg_get_sample_channels( lua_State *L ) {
-    return push_enum_name(L, al_get_sample_channels(to_audio_sample(L, 1)), channel_conf_mapping);
-}
+/*
+================================================================================
 
-static int lg_get_sample_depth( lua_State *L ) {
-    return push_flag_table(L, al_get_sample_depth(to_audio_sample(L, 1)), audio_depth_mapping);
-}
+                Time
 
-static int lg_get_sample_frequency( lua_State *L ) {
-    lua_pushinteger(L, al_get_sample_frequency(to_audio_sample(L, 1)));
+================================================================================
+*/
+static int lg_get_time( lua_State *L ) {
+    lua_pushnumber(L, al_get_time());
     return 1;
 }
 
-static int lg_get_sample_length( lua_State *L ) {
-    lua_pushinteger(L, al_get_sample_length(to_audio_sample(L, 1)));
-    return 1;
+static int lg_rest( lua_State *L ) {
+    al_rest(luaL_checknumber(L, 1));
+    return 0;
 }
 
 /*
 ================================================================================
 
-                Sample Instance
+                Timer
 
 ================================================================================
 */
-static int lg_create_sample_instance( lua_State *L ) {
-    return push_object_with_dependency(L, LEGATO_SAMPLE_INSTANCE, al_create_sample_instance(to_audio_sample(L, 1)), 1, 1);
+static int lg_create_timer( lua_State *L ) {
+    return push_object(L, LEGATO_TIMER, al_create_timer(luaL_checknumber(L, 1)), 1);
 }
 
-static int lg_destroy_sample_instance( lua_State *L ) {
-    ALLEGRO_SAMPLE_INSTANCE *si = (ALLEGRO_SAMPLE_INSTANCE*) to_object_gc(L, 1, LEGATO_SAMPLE_INSTANCE);
-    if ( si ) {
-        al_destroy_sample_instance(si);
-        clear_object(L, 1);
-    }
+static int lg_start_timer( lua_State *L ) {
+    al_start_timer(to_timer(L, 1));
     return 0;
 }
 
-static int lg_play_sample_instance( lua_State *L ) {
-    lua_pushboolean(L, al_play_sample_instance(to_sample_instance(L, 1)));
+static int lg_stop_timer( lua_State *L ) {
+    al_stop_timer(to_timer(L, 1));
+    return 0;
+}
+
+static int lg_get_timer_started( lua_State *L ) {
+    lua_pushboolean(L, al_get_timer_started(to_timer(L, 1)));
     return 1;
 }
 
-static int lg_stop_sample_instance( lua_State *L ) {
-    lua_pushboolean(L, al_stop_sample_instance(to_sample_instance(L, 1)));
+static int lg_destroy_timer( lua_State *L ) {
+    ALLEGRO_TIMER *timer = (ALLEGRO_TIMER*) to_object_gc(L, 1, LEGATO_TIMER);
+    if ( timer ) {
+        al_destroy_timer(timer);
+        clear_object(L, 1);
+    }
+    return 0;
+}
+
+static int lg_get_timer_count( lua_State *L ) {
+    lua_pushinteger(L, al_get_timer_count(to_timer(L, 1)));
     return 1;
 }
 
-static int lg_get_sample_instance_channels( lua_State *L ) {
-    return push_enum_name(L, al_get_sample_instance_channels(to_sample_instance(L, 1)), channel_conf_mapping);
+static int lg_set_timer_count( lua_State *L ) {
+    al_set_timer_count(to_timer(L, 1), luaL_checkinteger(L, 2));
+    return 0;
 }
 
-static int lg_get_sample_instance_depth( lua_State *L ) {
-    return push_flag_table(L, al_get_sample_instance_channels(to_sample_instance(L, 1)), audio_depth_mapping);
+static int lg_add_timer_count( lua_State *L ) {
+    al_add_timer_count(to_timer(L, 1), luaL_checkinteger(L, 2));
+    return 0;
 }
 
-static int lg_get_sample_instance_frequency( lua_State *L ) {
-    lua_pushinteger(L, al_get_sample_instance_frequency(to_sample_instance(L, 1)));
+static int lg_get_timer_speed( lua_State *L ) {
+    lua_pushnumber(L, al_get_timer_speed(to_timer(L, 1)));
     return 1;
 }
 
-static int lg_get_sample_instance_length( lua_State *L ) {
-    lua_pushinteger(L, al_get_sample_instance_length(to_sample_instance(L, 1)));
-    return 1;
+static int lg_set_timer_speed( lua_State *L ) {
+    al_set_timer_speed(to_timer(L, 1), luaL_checknumber(L, 2));
+    return 0;
 }
 
-static int lg_set_sample_instance_length( lua_State *L ) {
-    lua_pushboolean(L, al_set_sample_instance_length(to_sample_instance(L, 1), luaL_checkinteger(L, 2)));
+/*
+================================================================================
+
+                Transformations
+
+================================================================================
+*/
+static int lg_create_transform( lua_State *L ) {
+    al_identity_transform((ALLEGRO_TRANSFORM*) push_data(L, LEGATO_TRANSFORM, sizeof(ALLEGRO_TRANSFORM)));
     return 1;
 }
 
-static int lg_get_sample_instance_position( lua_State *L ) {
-    lua_pushinteger(L, al_get_sample_instance_position(to_sample_instance(L, 1)));
+static int lg_copy_transform( lua_State *L ) {
+    al_copy_transform((ALLEGRO_TRANSFORM*) push_data(L, LEGATO_TRANSFORM, sizeof(ALLEGRO_TRANSFORM)), to_transform(L, 1));
     return 1;
 }
 
-static int lg_set_sample_instance_position( lua_State *L ) {
-    lua_pushboolean(L, al_set_sample_instance_position(to_sample_instance(L, 1), luaL_checkinteger(L, 2)));
-    return 1;
+static int lg_use_transform( lua_State *L ) {
+    al_use_transform(to_transform(L, 1));
+    return 0;
 }
 
-static int lg_get_sample_instance_speed( lua_State *L ) {
-    lua_pushnumber(L, al_get_sample_instance_speed(to_sample_instance(L, 1)));
+static int lg_get_current_transform( lua_State *L ) {
+    al_copy_transform((ALLEGRO_TRANSFORM*) push_data(L, LEGATO_TRANSFORM, sizeof(ALLEGRO_TRANSFORM)), al_get_current_transform());
     return 1;
 }
 
-static int lg_set_sample_instance_speed( lua_State *L ) {
-    lua_pushboolean(L, al_set_sample_instance_speed(to_sample_instance(L, 1), luaL_checknumber(L, 2)));
-    return 1;
+static int lg_invert_transform( lua_State *L ) {
+    al_invert_transform(to_transform(L, 1));
+    return 0;
 }
 
-static int lg_get_sample_instance_gain( lua_State *L ) {
-    lua_pushnumber(L, al_get_sample_instance_gain(to_sample_instance(L, 1)));
+static int lg_check_inverse( lua_State *L ) {
+    lua_pushboolean(L, al_check_inverse(to_transform(L, 1), luaL_checknumber(L, 2)));
     return 1;
 }
 
-static int lg_set_sample_instance_gain( lua_State *L ) {
-    lua_pushboolean(L, al_set_sample_instance_gain(to_sample_instance(L, 1), luaL_checknumber(L, 2)));
-    return 1;
+static int lg_identity_transform( lua_State *L ) {
+    al_identity_transform(to_transform(L, 1));
+    return 0;
 }
 
-static int lg_get_sample_instance_pan( lua_State *L ) {
-    lua_pushnumber(L, al_get_sample_instance_pan(to_sample_instance(L, 1)));
+static int lg_build_transform( lua_State *L ) {
+    ALLEGRO_TRANSFORM *transform = (ALLEGRO_TRANSFORM*) push_data(L, LEGATO_TRANSFORM, sizeof(ALLEGRO_TRANSFORM));
+    al_build_transform(transform, luaL_checknumber(L, 1), luaL_checknumber(L, 2),
+            luaL_checknumber(L, 3), luaL_checknumber(L, 4), luaL_checknumber(L, 5));
     return 1;
 }
 
-static int lg_set_sample_instance_pan( lua_State *L ) {
-    lua_pushboolean(L, al_set_sample_instance_pan(to_sample_instance(L, 1), luaL_checknumber(L, 2)));
-    return 1;
+static int lg_translate_transform( lua_State *L ) {
+    al_translate_transform(to_transform(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3));
+    return 0;
 }
 
-static int lg_get_sample_instance_time( lua_State *L ) {
-    lua_pushnumber(L, al_get_sample_instance_time(to_sample_instance(L, 1)));
-    return 1;
+static int lg_rotate_transform( lua_State *L ) {
+    al_rotate_transform(to_transform(L, 1), luaL_checknumber(L, 2));
+    return 0;
 }
 
-static int lg_get_sample_instance_playmode( lua_State *L ) {
-    return push_enum_name(L, al_get_sample_instance_playmode(to_sample_instance(L, 1)), playmode_mapping);
+static int lg_scale_transform( lua_State *L ) {
+    al_scale_transform(to_transform(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3));
+    return 0;
 }
 
-static int lg_set_sample_instance_playmode( lua_State *L ) {
-    lua_pushboolean(L, al_set_sample_instance_playmode(to_sample_instance(L, 1), (ALLEGRO_PLAYMODE) parse_enum_name(L, 2, playmode_mapping)));
-    return 1;
+static int lg_transform_coordinates( lua_State *L ) {
+    float x, y;
+    x = luaL_checknumber(L, 2); y = luaL_checknumber(L, 3);
+    al_transform_coordinates(to_transform(L, 1), &x, &y);
+    lua_pushnumber(L, x); lua_pushnumber(L, y);
+    return 2;
 }
 
-static int lg_get_sample_instance_playing( lua_State *L ) {
-    lua_pushboolean(L, al_get_sample_instance_playing(to_sample_instance(L, 1)));
-    return 1;
+/* transform_points(transform, buffer, [count, dest]) - transforms count interleaved x/y pairs */
+static int lg_transform_points( lua_State *L ) {
+    int i, count;
+    float x, y, m00, m01, m10, m11, m30, m31;
+    const float *src;
+    float *dst;
+    const ALLEGRO_TRANSFORM *transform = to_transform(L, 1);
+    float_buffer_t *buffer = to_float_buffer(L, 2);
+    float_buffer_t *dest = lua_isnoneornil(L, 4) ? buffer : to_float_buffer(L, 4);
+    count = luaL_optint(L, 3, buffer->size / 2);
+    luaL_argcheck(L, count >= 0 && count * 2 <= buffer->size, 3, "count exceeds buffer size");
+    luaL_argcheck(L, count * 2 <= dest->size, 4, "count exceeds destination size");
+    m00 = transform->m[0][0]; m01 = transform->m[0][1];
+    m10 = transform->m[1][0]; m11 = transform->m[1][1];
+    m30 = transform->m[3][0]; m31 = transform->m[3][1];
+    src = buffer->data;
+    dst = dest->data;
+    for ( i = 0; i < count * 2; i += 2 ) {
+        x = src[i]; y = src[i+1];
+        dst[i] = x * m00 + y * m10 + m30;
+        dst[i+1] = x * m01 + y * m11 + m31;
+    }
+    return 0;
 }
 
-static int lg_set_sample_instance_playing( lua_State *L ) {
-    luaL_checktype(L, 2, LUA_TBOOLEAN);
-    lua_pushboolean(L, al_set_sample_instance_playing(to_sample_instance(L, 1), lua_toboolean(L, 2)));
-    return 1;
+static int lg_compose_transform( lua_State *L ) {
+    al_compose_transform(to_transform(L, 1), to_transform(L, 2));
+    return 0;
 }
 
-static int lg_get_sample_instance_attached( lua_State *L ) {
-    lua_pushboolean(L, al_get_sample_instance_attached(to_sample_instance(L, 1)));
+/*
+================================================================================
+
+                Audio addons
+
+================================================================================
+*/
+static int lg_is_audio_installed( lua_State *L ) {
+    lua_pushboolean(L, al_is_audio_installed());
     return 1;
 }
 
-static int lg_detach_sample_instance( lua_State *L ) {
-    lua_pushboolean(L, al_detach_sample_instance(to_sample_instance(L, 1)));
+static int lg_reserve_samples( lua_State *L ) {
+    lua_pushboolean(L, al_reserve_samples(luaL_checkint(L, 1)));
     return 1;
 }
 
-static int lg_get_sample( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+static int lg_get_audio_depth_size( lua_State *L ) {
+    lua_pushinteger(L, al_get_audio_depth_size((ALLEGRO_AUDIO_DEPTH) parse_flag_table(L, 1, audio_depth_mapping)));
+    return 1;
 }
 
-static int lg_set_sample( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+static int lg_get_channel_count( lua_State *L ) {
+    lua_pushinteger(L, al_get_channel_count((ALLEGRO_CHANNEL_CONF) parse_enum_name(L, 1, channel_conf_mapping)));
+    return 1;
 }
 
 /*
 ================================================================================
 
-                Mixer
+                Voice
 
 ================================================================================
 */
-static int lg_create_mixer( lua_State *L ) {
-    return push_object(L, LEGATO_MIXER, al_create_mixer(luaL_checkint(L, 1),
+static int lg_create_voice( lua_State *L ) {
+    return push_object(L, LEGATO_VOICE, al_create_voice(luaL_checkint(L, 1),
                 (ALLEGRO_AUDIO_DEPTH) parse_flag_table(L, 2, audio_depth_mapping), (ALLEGRO_CHANNEL_CONF) parse_enum_name(L, 3, channel_conf_mapping)), 1);
 }
 
-static int lg_destroy_mixer( lua_State *L ) {
-    ALLEGRO_MIXER *mixer = (ALLEGRO_MIXER*) to_object_gc(L, 1, LEGATO_MIXER);
-    if ( mixer ) {
-        al_destroy_mixer(mixer);
+static int lg_destroy_voice( lua_State *L ) {
+    ALLEGRO_VOICE *voice = (ALLEGRO_VOICE*) to_object_gc(L, 1, LEGATO_VOICE);
+    if ( voice ) {
+        al_destroy_voice(voice);
         clear_object(L, 1);
     }
     return 0;
 }
 
-static int lg_get_default_mixer( lua_State *L ) {
-    ALLEGRO_MIXER *mixer = al_get_default_mixer();
-    if ( mixer ) {
-        return push_object_by_pointer(L, LEGATO_MIXER, mixer);
-    } else {
-        return 0;
-    }
+static int lg_detach_voice( lua_State *L ) {
+    al_detach_voice(to_voice(L, 1));
+    return 0;
 }
 
-static int lg_set_default_mixer( lua_State *L ) {
-    lua_pushboolean(L, al_set_default_mixer(to_mixer(L, 1)));
+static int lg_attach_audio_stream_to_voice( lua_State *L ) {
+    lua_pushboolean(L, al_attach_audio_stream_to_voice(to_audio_stream(L, 1), to_voice(L, 2)));
     return 1;
 }
 
-static int lg_restore_default_mixer( lua_State *L ) {
-    lua_pushboolean(L, al_restore_default_mixer());
+static int lg_attach_mixer_to_voice( lua_State *L ) {
+    lua_pushboolean(L, al_attach_mixer_to_voice(to_mixer(L, 1), to_voice(L, 2)));
     return 1;
 }
 
-static int lg_attach_mixer_to_mixer( lua_State *L ) {
-    lua_pushboolean(L, al_attach_mixer_to_mixer(to_mixer(L, 1), to_mixer(L, 2)));
+static int lg_attach_sample_instance_to_voice( lua_State *L ) {
+    NOT_IMPLEMENTED_MACRO;
+}
+
+static int lg_get_voice_frequency( lua_State *L ) {
+    lua_pushinteger(L, al_get_voice_frequency(to_voice(L, 1)));
     return 1;
 }
 
-static int lg_attach_sample_instance_to_mixer( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+static int lg_get_voice_channels( lua_State *L ) {
+    return push_enum_name(L, al_get_voice_channels(to_voice(L, 1)), channel_conf_mapping);
 }
 
-static int lg_attach_audio_stream_to_mixer( lua_State *L ) {
-    lua_pushboolean(L, al_attach_audio_stream_to_mixer(to_audio_stream(L, 1), to_mixer(L, 2)));
-    return 1;
+static int lg_get_voice_depth( lua_State *L ) {
+    return push_flag_table(L, al_get_voice_depth(to_voice(L, 1)), audio_depth_mapping);
 }
 
-static int lg_get_mixer_frequency( lua_State *L ) {
-    lua_pushinteger(L, al_get_mixer_frequency(to_mixer(L, 1)));
+static int lg_get_voice_playing( lua_State *L ) {
+    lua_pushboolean(L, al_get_voice_playing(to_voice(L, 1)));
     return 1;
 }
 
-static int lg_set_mixer_frequency( lua_State *L ) {
-    lua_pushboolean(L, al_set_mixer_frequency(to_mixer(L, 1), luaL_checkint(L, 2)));
+static int lg_set_voice_playing( lua_State *L ) {
+    luaL_checktype(L, 2, LUA_TBOOLEAN);
+    lua_pushboolean(L, al_set_voice_playing(to_voice(L, 1), lua_toboolean(L, 2)));
     return 1;
 }
 
-static int lg_get_mixer_channels( lua_State *L ) {
-    return push_enum_name(L, al_get_mixer_channels(to_mixer(L, 1)), channel_conf_mapping);
+static int lg_get_voice_position( lua_State *L ) {
+    lua_pushinteger(L, al_get_voice_position(to_voice(L, 1)));
+    return 1;
 }
 
-static int lg_get_mixer_depth( lua_State *L ) {
-    return push_flag_table(L, al_get_mixer_depth(to_mixer(L, 1)), audio_depth_mapping);
+static int lg_set_voice_position( lua_State *L ) {
+    lua_pushboolean(L, al_set_voice_position(to_voice(L, 1), luaL_checkint(L, 2)));
+    return 1;
 }
 
-static int lg_get_mixer_gain( lua_State *L ) {
-    lua_pushnumber(L, al_get_mixer_gain(to_mixer(L, 1)));
-    return 1;
+/*
+================================================================================
+
+                Sample
+
+================================================================================
+*/
+static int lg_destroy_sample( lua_State *L ) {
+    ALLEGRO_SAMPLE *sample = (ALLEGRO_SAMPLE*) to_object(L, 1, LEGATO_AUDIO_SAMPLE);
+    if ( sample ) {
+        al_destroy_sample(sample);
+        clear_object(L, 1);
+    }
+    return 0;
 }
 
-static int lg_set_mixer_gain( lua_State *L ) {
-    lua_pushboolean(L, al_set_mixer_gain(to_mixer(L, 1), luaL_checknumber(L, 2)));
-    return 1;
+static int lg_play_sample( lua_State *L ) {
+    int success;
+    ALLEGRO_SAMPLE_ID *ret_id = (ALLEGRO_SAMPLE_ID*) push_data(L, LEGATO_SAMPLE_ID, sizeof(ALLEGRO_SAMPLE_ID));
+    success = al_play_sample(to_audio_sample(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
+            luaL_checknumber(L, 4), (ALLEGRO_PLAYMODE) parse_enum_name(L, 5, playmode_mapping), ret_id);
+    lua_pushboolean(L, success);
+    return success ? 2 : 1;
 }
 
-static int lg_get_mixer_quality( lua_State *L ) {
-    return push_enum_name(L, al_get_mixer_quality(to_mixer(L, 1)), mixer_quality_mapping);
+static int lg_stop_sample( lua_State *L ) {
+    al_stop_sample(to_sample_id(L, 1));
+    return 0;
 }
 
-static int lg_set_mixer_quality( lua_State *L ) {
-    lua_pushboolean(L, al_set_mixer_quality(to_mixer(L, 1), (ALLEGRO_MIXER_QUALITY) parse_enum_name(L, 2, mixer_quality_mapping)));
-    return 1;
+static int lg_stop_samples( lua_State *L ) {
+    al_stop_samples();
+    return 0;
 }
 
-static int lg_get_mixer_playing( lua_State *L ) {
-    lua_pushboolean(L, al_get_mixer_playing(to_mixer(L, 1)));
-    return 1;
+static int lg_get_sample_channels( lua_State *L ) {
+    return push_enum_name(L, al_get_sample_channels(to_audio_sample(L, 1)), channel_conf_mapping);
 }
 
-static int lg_set_mixer_playing( lua_State *L ) {
-    luaL_checktype(L, 2, LUA_TBOOLEAN);
-    lua_pushboolean(L, al_set_mixer_playing(to_mixer(L, 1), lua_toboolean(L, 2)));
-    return 1;
+static int lg_get_sample_depth( lua_State *L ) {
+    return push_flag_table(L, al_get_sample_depth(to_audio_sample(L, 1)), audio_depth_mapping);
 }
 
-static int lg_get_mixer_attached( lua_State *L ) {
-    lua_pushboolean(L, al_get_mixer_attached(to_mixer(L, 1)));
+static int lg_get_sample_frequency( lua_State *L ) {
+    lua_pushinteger(L, al_get_sample_frequency(to_audio_sample(L, 1)));
     return 1;
 }
 
-static int lg_detach_mixer( lua_State *L ) {
-    lua_pushboolean(L, al_detach_mixer(to_mixer(L, 1)));
+static int lg_get_sample_length( lua_State *L ) {
+    lua_pushinteger(L, al_get_sample_length(to_audio_sample(L, 1)));
     return 1;
 }
 
 /*
 ================================================================================
 
-                Audio Stream
+                Sample Instance
 
 ================================================================================
 */
-static int lg_destroy_audio_stream( lua_State *L ) {
-    ALLEGRO_AUDIO_STREAM *stream = (ALLEGRO_AUDIO_STREAM*) to_object_gc(L, 1, LEGATO_AUDIO_STREAM);
-    if ( stream ) {
-        al_destroy_audio_stream(stream);
-        clear_object(L, 1);
-    }
-    return 0;
+static int lg_create_sample_instance( lua_State *L ) {
+    return push_object_with_dependency(L, LEGATO_SAMPLE_INSTANCE, al_create_sample_instance(to_audio_sample(L, 1)), 1, 1);
 }
 
-static int lg_drain_audio_stream( lua_State *L ) {
-    al_drain_audio_stream(to_audio_stream(L, 1));
+static int lg_destroy_sample_instance( lua_State *L ) {
+    ALLEGRO_SAMPLE_INSTANCE *si = (ALLEGRO_SAMPLE_INSTANCE*) to_object_gc(L, 1, LEGATO_SAMPLE_INSTANCE);
+    if ( si ) {
+        al_destroy_sample_instance(si);
+        clear_object(L, 1);
+    }
     return 0;
 }
 
-static int lg_rewind_audio_stream( lua_State *L ) {
-    lua_pushboolean(L, al_rewind_audio_stream(to_audio_stream(L, 1)));
+static int lg_play_sample_instance( lua_State *L ) {
+    lua_pushboolean(L, al_play_sample_instance(to_sample_instance(L, 1)));
     return 1;
 }
 
-static int lg_get_audio_stream_frequency( lua_State *L ) {
-    lua_pushinteger(L, al_get_audio_stream_frequency(to_audio_stream(L, 1)));
+static int lg_stop_sample_instance( lua_State *L ) {
+    lua_pushboolean(L, al_stop_sample_instance(to_sample_instance(L, 1)));
     return 1;
 }
 
-static int lg_get_audio_stream_channels( lua_State *L ) {
-    return push_enum_name(L, al_get_audio_stream_channels(to_audio_stream(L, 1)), channel_conf_mapping);
+static int lg_get_sample_instance_channels( lua_State *L ) {
+    return push_enum_name(L, al_get_sample_instance_channels(to_sample_instance(L, 1)), channel_conf_mapping);
 }
 
-static int lg_get_audio_stream_depth( lua_State *L ) {
-    return push_flag_table(L, al_get_audio_stream_depth(to_audio_stream(L, 1)), audio_depth_mapping);
+static int lg_get_sample_instance_depth( lua_State *L ) {
+    return push_flag_table(L, al_get_sample_instance_channels(to_sample_instance(L, 1)), audio_depth_mapping);
 }
 
-static int lg_get_audio_stream_length( lua_State *L ) {
-    lua_pushinteger(L, al_get_audio_stream_length(to_audio_stream(L, 1)));
+static int lg_get_sample_instance_frequency( lua_State *L ) {
+    lua_pushinteger(L, al_get_sample_instance_frequency(to_sample_instance(L, 1)));
     return 1;
 }
 
-static int lg_get_audio_stream_speed( lua_State *L ) {
-    lua_pushnumber(L, al_get_audio_stream_speed(to_audio_stream(L, 1)));
+static int lg_get_sample_instance_length( lua_State *L ) {
+    lua_pushinteger(L, al_get_sample_instance_length(to_sample_instance(L, 1)));
     return 1;
 }
 
-static int lg_set_audio_stream_speed( lua_State *L ) {
-    lua_pushboolean(L, al_set_audio_stream_speed(to_audio_stream(L, 1), luaL_checknumber(L, 2)));
+static int lg_set_sample_instance_length( lua_State *L ) {
+    lua_pushboolean(L, al_set_sample_instance_length(to_sample_instance(L, 1), luaL_checkinteger(L, 2)));
     return 1;
 }
 
-static int lg_get_audio_stream_gain( lua_State *L ) {
-    lua_pushnumber(L, al_get_audio_stream_gain(to_audio_stream(L, 1)));
+static int lg_get_sample_instance_position( lua_State *L ) {
+    lua_pushinteger(L, al_get_sample_instance_position(to_sample_instance(L, 1)));
     return 1;
 }
 
-static int lg_set_audio_stream_gain( lua_State *L ) {
-    lua_pushboolean(L, al_set_audio_stream_gain(to_audio_stream(L, 1), luaL_checknumber(L, 2)));
+static int lg_set_sample_instance_position( lua_State *L ) {
+    lua_pushboolean(L, al_set_sample_instance_position(to_sample_instance(L, 1), luaL_checkinteger(L, 2)));
     return 1;
 }
 
-static int lg_get_audio_stream_pan( lua_State *L ) {
-    lua_pushnumber(L, al_get_audio_stream_pan(to_audio_stream(L, 1)));
+static int lg_get_sample_instance_speed( lua_State *L ) {
+    lua_pushnumber(L, al_get_sample_instance_speed(to_sample_instance(L, 1)));
     return 1;
 }
 
-static int lg_set_audio_stream_pan( lua_State *L ) {
-    lua_pushboolean(L, al_set_audio_stream_pan(to_audio_stream(L, 1), luaL_checknumber(L, 2)));
+static int lg_set_sample_instance_speed( lua_State *L ) {
+    lua_pushboolean(L, al_set_sample_instance_speed(to_sample_instance(L, 1), luaL_checknumber(L, 2)));
     return 1;
 }
 
-static int lg_get_audio_stream_playing( lua_State *L ) {
-    lua_pushboolean(L, al_get_audio_stream_playing(to_audio_stream(L, 1)));
+static int lg_get_sample_instance_gain( lua_State *L ) {
+    lua_pushnumber(L, al_get_sample_instance_gain(to_sample_instance(L, 1)));
     return 1;
 }
 
-static int lg_set_audio_stream_playing( lua_State *L ) {
-    luaL_checktype(L, 2, LUA_TBOOLEAN);
-    lua_pushboolean(L, al_set_audio_stream_playing(to_audio_stream(L, 1), lua_toboolean(L, 2)));
+static int lg_set_sample_instance_gain( lua_State *L ) {
+    lua_pushboolean(L, al_set_sample_instance_gain(to_sample_instance(L, 1), luaL_checknumber(L, 2)));
     return 1;
 }
 
-static int lg_get_audio_stream_playmode( lua_State *L ) {
-    return push_enum_name(L, al_get_audio_stream_playmode(to_audio_stream(L, 1)), playmode_mapping);
+static int lg_get_sample_instance_pan( lua_State *L ) {
+    lua_pushnumber(L, al_get_sample_instance_pan(to_sample_instance(L, 1)));
+    return 1;
 }
 
-static int lg_set_audio_stream_playmode( lua_State *L ) {
-    lua_pushboolean(L, al_set_audio_stream_playmode(to_audio_stream(L, 1), (ALLEGRO_PLAYMODE) parse_enum_name(L, 2, playmode_mapping)));
+static int lg_set_sample_instance_pan( lua_State *L ) {
+    lua_pushboolean(L, al_set_sample_instance_pan(to_sample_instance(L, 1), luaL_checknumber(L, 2)));
     return 1;
 }
 
-static int lg_get_audio_stream_attached( lua_State *L ) {
-    lua_pushboolean(L, al_get_audio_stream_attached(to_audio_stream(L, 1)));
+static int lg_get_sample_instance_time( lua_State *L ) {
+    lua_pushnumber(L, al_get_sample_instance_time(to_sample_instance(L, 1)));
     return 1;
 }
 
-static int lg_detach_audio_stream( lua_State *L ) {
-    lua_pushboolean(L, al_detach_audio_stream(to_audio_stream(L, 1)));
-    return 1;
+static int lg_get_sample_instance_playmode( lua_State *L ) {
+    return push_enum_name(L, al_get_sample_instance_playmode(to_sample_instance(L, 1)), playmode_mapping);
 }
 
-static int lg_seek_audio_stream_secs( lua_State *L ) {
-    lua_pushboolean(L, al_seek_audio_stream_secs(to_audio_stream(L, 1), luaL_checknumber(L, 2)));
+static int lg_set_sample_instance_playmode( lua_State *L ) {
+    lua_pushboolean(L, al_set_sample_instance_playmode(to_sample_instance(L, 1), (ALLEGRO_PLAYMODE) parse_enum_name(L, 2, playmode_mapping)));
     return 1;
 }
 
-static int lg_get_audio_stream_position_secs( lua_State *L ) {
-    lua_pushnumber(L, al_get_audio_stream_position_secs(to_audio_stream(L, 1)));
+static int lg_get_sample_instance_playing( lua_State *L ) {
+    lua_pushboolean(L, al_get_sample_instance_playing(to_sample_instance(L, 1)));
     return 1;
 }
 
-static int lg_get_audio_stream_length_secs( lua_State *L ) {
-    lua_pushnumber(L, al_get_audio_stream_length_secs(to_audio_stream(L, 1)));
+static int lg_set_sample_instance_playing( lua_State *L ) {
+    luaL_checktype(L, 2, LUA_TBOOLEAN);
+    lua_pushboolean(L, al_set_sample_instance_playing(to_sample_instance(L, 1), lua_toboolean(L, 2)));
     return 1;
 }
 
-static int lg_set_audio_stream_loop_secs( lua_State *L ) {
-    lua_pushboolean(L, al_set_audio_stream_loop_secs(to_audio_stream(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3)));
+static int lg_get_sample_instance_attached( lua_State *L ) {
+    lua_pushboolean(L, al_get_sample_instance_attached(to_sample_instance(L, 1)));
     return 1;
 }
 
-/*
-================================================================================
-
-                Audio Loaders
+static int lg_detach_sample_instance( lua_State *L ) {
+    lua_pushboolean(L, al_detach_sample_instance(to_sample_instance(L, 1)));
+    return 1;
+}
 
-================================================================================
-*/
-static int lg_load_sample( lua_State *L ) {
-    return push_object(L, LEGATO_AUDIO_SAMPLE, al_load_sample(luaL_checkstring(L, 1)), 1);
+static int lg_get_sample( lua_State *L ) {
+    NOT_IMPLEMENTED_MACRO;
 }
 
-static int lg_load_audio_stream( lua_State *L ) {
-    return push_object(L, LEGATO_AUDIO_STREAM, al_load_audio_stream(luaL_checkstring(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3)), 1);
+static int lg_set_sample( lua_State *L ) {
+    NOT_IMPLEMENTED_MACRO;
 }
 
 /*
 ================================================================================
 
-                Color addon
+                Mixer
 
 ================================================================================
 */
-static int lg_color_cmyk( lua_State *L ) {
-    return push_color(L, al_color_cmyk(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4)));
+static int lg_create_mixer( lua_State *L ) {
+    return push_object(L, LEGATO_MIXER, al_create_mixer(luaL_checkint(L, 1),
+                (ALLEGRO_AUDIO_DEPTH) parse_flag_table(L, 2, audio_depth_mapping), (ALLEGRO_CHANNEL_CONF) parse_enum_name(L, 3, channel_conf_mapping)), 1);
 }
 
-static int lg_color_hsl( lua_State *L ) {
-    return push_color(L, al_color_hsl(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3)));
-}
+static int lg_destroy_mixer( lua_State *L ) {
+    ALLEGRO_MIXER *mixer = (ALLEGRO_MIXER*) to_object_gc(L, 1, LEGATO_MIXER);
+    if ( mixer ) {
+        al_destroy_mixer(mixer);
+        clear_object(L, 1);
+    }
+    return 0;
+}
+
+static int lg_get_default_mixer( lua_State *L ) {
+    ALLEGRO_MIXER *mixer = al_get_default_mixer();
+    if ( mixer ) {
+        return push_object_by_pointer(L, LEGATO_MIXER, mixer);
+    } else {
+        return 0;
+    }
+}
+
+static int lg_set_default_mixer( lua_State *L ) {
+    lua_pushboolean(L, al_set_default_mixer(to_mixer(L, 1)));
+    return 1;
+}
+
+static int lg_restore_default_mixer( lua_State *L ) {
+    lua_pushboolean(L, al_restore_default_mixer());
+    return 1;
+}
+
+static int lg_attach_mixer_to_mixer( lua_State *L ) {
+    lua_pushboolean(L, al_attach_mixer_to_mixer(to_mixer(L, 1), to_mixer(L, 2)));
+    return 1;
+}
+
+static int lg_attach_sample_instance_to_mixer( lua_State *L ) {
+    NOT_IMPLEMENTED_MACRO;
+}
+
+static int lg_attach_audio_stream_to_mixer( lua_State *L ) {
+    lua_pushboolean(L, al_attach_audio_stream_to_mixer(to_audio_stream(L, 1), to_mixer(L, 2)));
+    return 1;
+}
+
+static int lg_get_mixer_frequency( lua_State *L ) {
+    lua_pushinteger(L, al_get_mixer_frequency(to_mixer(L, 1)));
+    return 1;
+}
+
+static int lg_set_mixer_frequency( lua_State *L ) {
+    lua_pushboolean(L, al_set_mixer_frequency(to_mixer(L, 1), luaL_checkint(L, 2)));
+    return 1;
+}
+
+static int lg_get_mixer_channels( lua_State *L ) {
+    return push_enum_name(L, al_get_mixer_channels(to_mixer(L, 1)), channel_conf_mapping);
+}
+
+static int lg_get_mixer_depth( lua_State *L ) {
+    return push_flag_table(L, al_get_mixer_depth(to_mixer(L, 1)), audio_depth_mapping);
+}
+
+static int lg_get_mixer_gain( lua_State *L ) {
+    lua_pushnumber(L, al_get_mixer_gain(to_mixer(L, 1)));
+    return 1;
+}
+
+static int lg_set_mixer_gain( lua_State *L ) {
+    lua_pushboolean(L, al_set_mixer_gain(to_mixer(L, 1), luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static int lg_get_mixer_quality( lua_State *L ) {
+    return push_enum_name(L, al_get_mixer_quality(to_mixer(L, 1)), mixer_quality_mapping);
+}
+
+static int lg_set_mixer_quality( lua_State *L ) {
+    lua_pushboolean(L, al_set_mixer_quality(to_mixer(L, 1), (ALLEGRO_MIXER_QUALITY) parse_enum_name(L, 2, mixer_quality_mapping)));
+    return 1;
+}
+
+static int lg_get_mixer_playing( lua_State *L ) {
+    lua_pushboolean(L, al_get_mixer_playing(to_mixer(L, 1)));
+    return 1;
+}
+
+static int lg_set_mixer_playing( lua_State *L ) {
+    luaL_checktype(L, 2, LUA_TBOOLEAN);
+    lua_pushboolean(L, al_set_mixer_playing(to_mixer(L, 1), lua_toboolean(L, 2)));
+    return 1;
+}
+
+static int lg_get_mixer_attached( lua_State *L ) {
+    lua_pushboolean(L, al_get_mixer_attached(to_mixer(L, 1)));
+    return 1;
+}
+
+static int lg_detach_mixer( lua_State *L ) {
+    lua_pushboolean(L, al_detach_mixer(to_mixer(L, 1)));
+    return 1;
+}
+
+/*
+================================================================================
+
+                Audio Stream
+
+================================================================================
+*/
+static int lg_destroy_audio_stream( lua_State *L ) {
+    ALLEGRO_AUDIO_STREAM *stream = (ALLEGRO_AUDIO_STREAM*) to_object_gc(L, 1, LEGATO_AUDIO_STREAM);
+    if ( stream ) {
+        al_destroy_audio_stream(stream);
+        clear_object(L, 1);
+    }
+    return 0;
+}
+
+static int lg_drain_audio_stream( lua_State *L ) {
+    al_drain_audio_stream(to_audio_stream(L, 1));
+    return 0;
+}
+
+static int lg_rewind_audio_stream( lua_State *L ) {
+    lua_pushboolean(L, al_rewind_audio_stream(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_get_audio_stream_frequency( lua_State *L ) {
+    lua_pushinteger(L, al_get_audio_stream_frequency(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_get_audio_stream_channels( lua_State *L ) {
+    return push_enum_name(L, al_get_audio_stream_channels(to_audio_stream(L, 1)), channel_conf_mapping);
+}
+
+static int lg_get_audio_stream_depth( lua_State *L ) {
+    return push_flag_table(L, al_get_audio_stream_depth(to_audio_stream(L, 1)), audio_depth_mapping);
+}
+
+static int lg_get_audio_stream_length( lua_State *L ) {
+    lua_pushinteger(L, al_get_audio_stream_length(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_get_audio_stream_speed( lua_State *L ) {
+    lua_pushnumber(L, al_get_audio_stream_speed(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_set_audio_stream_speed( lua_State *L ) {
+    lua_pushboolean(L, al_set_audio_stream_speed(to_audio_stream(L, 1), luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static int lg_get_audio_stream_gain( lua_State *L ) {
+    lua_pushnumber(L, al_get_audio_stream_gain(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_set_audio_stream_gain( lua_State *L ) {
+    lua_pushboolean(L, al_set_audio_stream_gain(to_audio_stream(L, 1), luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static int lg_get_audio_stream_pan( lua_State *L ) {
+    lua_pushnumber(L, al_get_audio_stream_pan(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_set_audio_stream_pan( lua_State *L ) {
+    lua_pushboolean(L, al_set_audio_stream_pan(to_audio_stream(L, 1), luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static int lg_get_audio_stream_playing( lua_State *L ) {
+    lua_pushboolean(L, al_get_audio_stream_playing(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_set_audio_stream_playing( lua_State *L ) {
+    luaL_checktype(L, 2, LUA_TBOOLEAN);
+    lua_pushboolean(L, al_set_audio_stream_playing(to_audio_stream(L, 1), lua_toboolean(L, 2)));
+    return 1;
+}
+
+static int lg_get_audio_stream_playmode( lua_State *L ) {
+    return push_enum_name(L, al_get_audio_stream_playmode(to_audio_stream(L, 1)), playmode_mapping);
+}
+
+static int lg_set_audio_stream_playmode( lua_State *L ) {
+    lua_pushboolean(L, al_set_audio_stream_playmode(to_audio_stream(L, 1), (ALLEGRO_PLAYMODE) parse_enum_name(L, 2, playmode_mapping)));
+    return 1;
+}
+
+static int lg_get_audio_stream_attached( lua_State *L ) {
+    lua_pushboolean(L, al_get_audio_stream_attached(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_detach_audio_stream( lua_State *L ) {
+    lua_pushboolean(L, al_detach_audio_stream(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_seek_audio_stream_secs( lua_State *L ) {
+    lua_pushboolean(L, al_seek_audio_stream_secs(to_audio_stream(L, 1), luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static int lg_get_audio_stream_position_secs( lua_State *L ) {
+    lua_pushnumber(L, al_get_audio_stream_position_secs(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_get_audio_stream_length_secs( lua_State *L ) {
+    lua_pushnumber(L, al_get_audio_stream_length_secs(to_audio_stream(L, 1)));
+    return 1;
+}
+
+static int lg_set_audio_stream_loop_secs( lua_State *L ) {
+    lua_pushboolean(L, al_set_audio_stream_loop_secs(to_audio_stream(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3)));
+    return 1;
+}
+
+/*
+================================================================================
+
+                Audio Loaders
+
+================================================================================
+*/
+static int lg_load_sample( lua_State *L ) {
+    return push_object(L, LEGATO_AUDIO_SAMPLE, al_load_sample(luaL_checkstring(L, 1)), 1);
+}
+
+static int lg_load_audio_stream( lua_State *L ) {
+    return push_object(L, LEGATO_AUDIO_STREAM, al_load_audio_stream(luaL_checkstring(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3)), 1);
+}
+
+/*
+================================================================================
+
+                Color addon
+
+================================================================================
+*/
+static int lg_color_cmyk( lua_State *L ) {
+    return push_color(L, al_color_cmyk(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4)));
+}
+
+static int lg_color_hsl( lua_State *L ) {
+    return push_color(L, al_color_hsl(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3)));
+}
 
 static int lg_color_hsv( lua_State *L ) {
     return push_color(L, al_color_hsv(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3)));
@@ -3059,6 +5338,7 @@ static int lg_load_font( lua_State *L ) {
 static int lg_destroy_font( lua_State *L ) {
     ALLEGRO_FONT *font = (ALLEGRO_FONT*) to_object_gc(L, 1, LEGATO_FONT);
     if ( font ) {
+        flush_text_cache(L, font);
         al_destroy_font(font);
         clear_object(L, 1);
     }
@@ -3090,12 +5370,14 @@ static int get_draw_text_flags( lua_State *L, const int idx ) {
 }
 
 static int lg_draw_text( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_TEXT);
     al_draw_text(to_font(L, 1), to_color(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4),
             get_draw_text_flags(L, 6), luaL_checkstring(L, 5));
     return 0;
 }
 
 static int lg_draw_justified_text( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_JUSTIFIED_TEXT);
     al_draw_justified_text(to_font(L, 1), to_color(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4),
             luaL_checknumber(L, 5), luaL_checknumber(L, 6), get_draw_text_flags(L, 8), luaL_checkstring(L, 7));
     return 0;
@@ -3109,13 +5391,12 @@ static int lg_get_text_dimensions( lua_State *L ) {
     return 4;
 }
 
-static int lg_grab_font_from_bitmap( lua_State *L ) {
+/* reads up to 32 {first, last} codepoint ranges, returns the number of ranges */
+static int get_font_ranges( lua_State *L, const int idx, int ranges[64] ) {
     int i, ranges_n;
-    int ranges[64*2];
-
-    luaL_checktype(L, 2, LUA_TTABLE);
+    luaL_checktype(L, idx, LUA_TTABLE);
     for ( i = 1, ranges_n = 0; i < 64; ++i ) {
-        lua_rawgeti(L, 2, i);
+        lua_rawgeti(L, idx, i);
         if ( lua_type(L, -1) == LUA_TTABLE ) {
             lua_rawgeti(L, -1, 1);
             ranges[ranges_n*2] = luaL_checkint(L, -1);
@@ -3130,6 +5411,12 @@ static int lg_grab_font_from_bitmap( lua_State *L ) {
             break;
         }
     }
+    return ranges_n;
+}
+
+static int lg_grab_font_from_bitmap( lua_State *L ) {
+    int ranges_n, ranges[64];
+    ranges_n = get_font_ranges(L, 2, ranges);
     if ( ranges_n > 0 ) {
         return push_object(L, LEGATO_FONT, al_grab_font_from_bitmap(to_bitmap(L, 1), ranges_n, ranges), 1);
     } else {
@@ -3137,8 +5424,167 @@ static int lg_grab_font_from_bitmap( lua_State *L ) {
     }
 }
 
+/* load_bitmap_font(filename, [ranges]) - without ranges Allegro's default glyph ranges are used */
 static int lg_load_bitmap_font( lua_State *L ) {
-    NOT_IMPLEMENTED_MACRO;
+    int ranges_n, ranges[64];
+    ALLEGRO_FONT *font;
+    ALLEGRO_BITMAP *bitmap;
+    const char *filename = luaL_checkstring(L, 1);
+    if ( lua_isnoneornil(L, 2) ) {
+        return push_object(L, LEGATO_FONT, al_load_bitmap_font(filename), 1);
+    }
+    ranges_n = get_font_ranges(L, 2, ranges);
+    luaL_argcheck(L, ranges_n > 0, 2, "no glyph ranges given");
+    bitmap = al_load_bitmap(filename);
+    if ( bitmap == NULL ) {
+        return push_error(L, "cannot load font image " LUA_QS, filename);
+    }
+    font = al_grab_font_from_bitmap(bitmap, ranges_n, ranges);
+    al_destroy_bitmap(bitmap);
+    return push_object(L, LEGATO_FONT, font, 1);
+}
+
+/* text of a single codepoint, returns NULL for invalid codepoints */
+static const char *get_glyph_text( char text[5], const int codepoint ) {
+    size_t size = al_utf8_encode(text, codepoint);
+    text[size] = '\0';
+    return size > 0 ? text : NULL;
+}
+
+/* prewarm_font(font, ranges) - renders all glyphs once, so lazy rasterizing fonts will not stall later */
+static int lg_prewarm_font( lua_State *L ) {
+    int i, c, count = 0, ranges_n, ranges[64];
+    char text[5];
+    ALLEGRO_STATE state;
+    ALLEGRO_BITMAP *bitmap;
+    ALLEGRO_FONT *font = to_font(L, 1);
+    ranges_n = get_font_ranges(L, 2, ranges);
+    bitmap = al_create_bitmap(al_get_font_line_height(font) * 2 + 1, al_get_font_line_height(font) + 1);
+    if ( bitmap == NULL ) {
+        return push_error(L, "cannot create glyph bitmap");
+    }
+    al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+    al_set_target_bitmap(bitmap);
+    for ( i = 0; i < ranges_n; ++i ) {
+        for ( c = ranges[i*2]; c <= ranges[i*2+1]; ++c ) {
+            if ( get_glyph_text(text, c) ) {
+                al_draw_text(font, al_map_rgb(255, 255, 255), 0.0f, 0.0f, 0, text);
+                count++;
+            }
+        }
+    }
+    al_restore_state(&state);
+    al_destroy_bitmap(bitmap);
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+/*
+    bake_font(font, ranges, [filename]) - renders all glyphs into a font image (the format used by
+    grab_font_from_bitmap) and returns a bitmap font made of it. The image is saved if a filename is given
+    and can be loaded with load_bitmap_font(filename, ranges) later.
+*/
+/*
+    Bitmaps are premultiplied in memory, but al_load_bitmap premultiplies
+    the loaded image again. So the image is saved from an unpremultiplied copy.
+*/
+static int save_unpremultiplied_bitmap( const char *filename, ALLEGRO_BITMAP *bitmap ) {
+    int x, y, ok;
+    unsigned char *src, *dst;
+    ALLEGRO_STATE state;
+    ALLEGRO_BITMAP *copy;
+    ALLEGRO_LOCKED_REGION *from, *to;
+    const int width = al_get_bitmap_width(bitmap), height = al_get_bitmap_height(bitmap);
+    al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+    al_set_new_bitmap_format(ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE);
+    copy = al_create_bitmap(width, height);
+    al_restore_state(&state);
+    if ( copy == NULL ) {
+        return 0;
+    }
+    from = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+    to = from ? al_lock_bitmap(copy, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY) : NULL;
+    if ( to ) {
+        for ( y = 0; y < height; ++y ) {
+            src = (unsigned char*) from->data + y * from->pitch;
+            dst = (unsigned char*) to->data + y * to->pitch;
+            for ( x = 0; x < width; ++x, src += 4, dst += 4 ) { /* r, g, b, a */
+                dst[0] = src[3] ? (unsigned char) ((src[0] * 255 + src[3] / 2) / src[3]) : 0;
+                dst[1] = src[3] ? (unsigned char) ((src[1] * 255 + src[3] / 2) / src[3]) : 0;
+                dst[2] = src[3] ? (unsigned char) ((src[2] * 255 + src[3] / 2) / src[3]) : 0;
+                dst[3] = src[3];
+            }
+        }
+        al_unlock_bitmap(copy);
+    }
+    if ( from ) {
+        al_unlock_bitmap(bitmap);
+    }
+    ok = to && al_save_bitmap(filename, copy);
+    al_destroy_bitmap(copy);
+    return ok;
+}
+
+static int lg_bake_font( lua_State *L ) {
+    int i, c, x, y, w, width = 1, height, line_height, ranges_n, ranges[64];
+    char text[5];
+    ALLEGRO_STATE state;
+    ALLEGRO_BITMAP *sheet;
+    ALLEGRO_FONT *baked, *font = to_font(L, 1);
+    const char *filename = luaL_optstring(L, 3, NULL);
+    ranges_n = get_font_ranges(L, 2, ranges);
+    luaL_argcheck(L, ranges_n > 0, 2, "no glyph ranges given");
+    line_height = al_get_font_line_height(font);
+
+    /* first pass only measures the sheet */
+    for ( i = 0, x = 1, y = 1; i < ranges_n; ++i ) {
+        for ( c = ranges[i*2]; c <= ranges[i*2+1]; ++c ) {
+            w = get_glyph_text(text, c) ? al_get_text_width(font, text) : 0;
+            w = w > 0 ? w : 1;
+            if ( x + w + 1 > LEGATO_FONT_SHEET_WIDTH && x > 1 ) {
+                x = 1;
+                y += line_height + 1;
+            }
+            x += w + 1;
+            width = x > width ? x : width;
+        }
+    }
+    height = y + line_height + 1;
+    sheet = al_create_bitmap(width, height);
+    if ( sheet == NULL ) {
+        return push_error(L, "cannot create font image (%dx%d)", width, height);
+    }
+    al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+    al_set_target_bitmap(sheet);
+    al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+    al_clear_to_color(al_map_rgb(255, 255, 0)); /* glyph separator color */
+    for ( i = 0, x = 1, y = 1; i < ranges_n; ++i ) {
+        for ( c = ranges[i*2]; c <= ranges[i*2+1]; ++c ) {
+            w = get_glyph_text(text, c) ? al_get_text_width(font, text) : 0;
+            w = w > 0 ? w : 1;
+            if ( x + w + 1 > LEGATO_FONT_SHEET_WIDTH && x > 1 ) {
+                x = 1;
+                y += line_height + 1;
+            }
+            al_set_clipping_rectangle(x, y, w, line_height); /* clear and draw only the glyph cell */
+            al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+            if ( get_glyph_text(text, c) ) {
+                al_draw_text(font, al_map_rgb(255, 255, 255), (float) x, (float) y, 0, text);
+            }
+            x += w + 1;
+        }
+    }
+    al_set_clipping_rectangle(0, 0, width, height);
+    al_restore_state(&state);
+
+    if ( filename && ! save_unpremultiplied_bitmap(filename, sheet) ) {
+        al_destroy_bitmap(sheet);
+        return push_error(L, "cannot save font image " LUA_QS, filename);
+    }
+    baked = al_grab_font_from_bitmap(sheet, ranges_n, ranges);
+    al_destroy_bitmap(sheet);
+    return push_object(L, LEGATO_FONT, baked, 1);
 }
 
 static int lg_create_builtin_font( lua_State *L ) {
@@ -3162,12 +5608,14 @@ static int lg_load_ttf_font_stretch( lua_State *L ) {
 ================================================================================
 */
 static int lg_draw_line( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_LINE);
     al_draw_line(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3), luaL_checknumber(L, 4),
             to_color(L, 5), luaL_optnumber(L, 6, 1.0));
     return 0;
 }
 
 static int lg_draw_triangle( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_TRIANGLE);
     al_draw_triangle(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4),
             luaL_checknumber(L, 5), luaL_checknumber(L, 6), to_color(L, 7), luaL_optnumber(L, 8, 1.0));
@@ -3175,6 +5623,7 @@ static int lg_draw_triangle( lua_State *L ) {
 }
 
 static int lg_draw_filled_triangle( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_FILLED_TRIANGLE);
     al_draw_filled_triangle(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4),
             luaL_checknumber(L, 5), luaL_checknumber(L, 6), to_color(L, 7));
@@ -3182,18 +5631,21 @@ static int lg_draw_filled_triangle( lua_State *L ) {
 }
 
 static int lg_draw_rectangle( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_RECTANGLE);
     al_draw_rectangle(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4), to_color(L, 5), luaL_optnumber(L, 6, 1.0));
     return 0;
 }
 
 static int lg_draw_filled_rectangle( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_FILLED_RECTANGLE);
     al_draw_filled_rectangle(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4), to_color(L, 5));
     return 0;
 }
 
 static int lg_draw_rounded_rectangle( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_ROUNDED_RECTANGLE);
     al_draw_rounded_rectangle(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6),
             to_color(L, 7), luaL_optnumber(L, 8, 1.0));
@@ -3201,6 +5653,7 @@ static int lg_draw_rounded_rectangle( lua_State *L ) {
 }
 
 static int lg_draw_filled_rounded_rectangle( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_FILLED_ROUNDED_RECTANGLE);
     al_draw_filled_rounded_rectangle(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6),
             to_color(L, 7));
@@ -3208,230 +5661,2528 @@ static int lg_draw_filled_rounded_rectangle( lua_State *L ) {
 }
 
 static int lg_draw_pieslice( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_PIESLICE);
     al_draw_pieslice(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
             luaL_checknumber(L, 4), luaL_checknumber(L, 5), to_color(L, 6), luaL_optnumber(L, 7, 1.0));
     return 0;
 }
 
 static int lg_draw_filled_pieslice( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_FILLED_PIESLICE);
     al_draw_filled_pieslice(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
             luaL_checknumber(L, 4), luaL_checknumber(L, 5), to_color(L, 6));
     return 0;
 }
 
 static int lg_draw_ellipse( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_ELLIPSE);
     al_draw_ellipse(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4), to_color(L, 5), luaL_optnumber(L, 6, 1.0));
     return 0;
 }
 
 static int lg_draw_filled_ellipse( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_FILLED_ELLIPSE);
     al_draw_filled_ellipse(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
             luaL_checknumber(L, 3), luaL_checknumber(L, 4), to_color(L, 5));
     return 0;
 }
 
 static int lg_draw_circle( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_CIRCLE);
     al_draw_circle(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
             to_color(L, 4), luaL_optnumber(L, 5, 1.0));
     return 0;
 }
 
 static int lg_draw_filled_circle( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_FILLED_CIRCLE);
     al_draw_filled_circle(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
             luaL_checknumber(L, 3), to_color(L, 4));
     return 0;
 }
 
 static int lg_draw_arc( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_ARC);
     al_draw_arc(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
             luaL_checknumber(L, 4), luaL_checknumber(L, 5), to_color(L, 6), luaL_optnumber(L, 7, 1.0));
     return 0;
 }
 
 static int lg_draw_elliptical_arc( lua_State *L ) {
+    RECORD_DRAW_COMMAND_MACRO(DRAW_CMD_ELLIPTICAL_ARC);
     al_draw_elliptical_arc(luaL_checknumber(L, 1), luaL_checknumber(L, 2), luaL_checknumber(L, 3),
             luaL_checknumber(L, 4), luaL_checknumber(L, 5), luaL_checknumber(L, 6), to_color(L, 7), luaL_optnumber(L, 8, 1.0));
     return 0;
 }
 
-
 /*
 ================================================================================
 
-                FUNCTION DEFS
+                Command lists
+
+    While a command list is recorded the drawing bindings do not draw, but
+    append their already checked arguments to a binary buffer instead.
+    Each command is one opcode byte followed by its arguments in the order
+    given by the signature below:
+        b = bitmap, f = font, c = color, n = number, o = optional thickness,
+        d = bitmap drawing flags, t = text drawing flags, s = string
+    Bitmaps and fonts are stored as an index into the objects table of the
+    list, so a replay can skip the commands whose object was destroyed.
 
 ================================================================================
 */
-static const luaL_Reg lg__functions[] = {
+static const char *draw_command_signatures[DRAW_CMD_COUNT] = {
+    "bnnd",             /* DRAW_CMD_BITMAP */
+    "bcnnd",            /* DRAW_CMD_TINTED_BITMAP */
+    "bnnnnnnd",         /* DRAW_CMD_BITMAP_REGION */
+    "bcnnnnnnd",        /* DRAW_CMD_TINTED_BITMAP_REGION */
+    "nnc",              /* DRAW_CMD_PIXEL */
+    "bnnnnnd",          /* DRAW_CMD_ROTATED_BITMAP */
+    "bcnnnnnd",         /* DRAW_CMD_TINTED_ROTATED_BITMAP */
+    "bnnnnnnnd",        /* DRAW_CMD_SCALED_ROTATED_BITMAP */
+    "bcnnnnnnnd",       /* DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP */
+    "bcnnnnnnnnnnnd",   /* DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP_REGION */
+    "bnnnnnnnnd",       /* DRAW_CMD_SCALED_BITMAP */
+    "bcnnnnnnnnd",      /* DRAW_CMD_TINTED_SCALED_BITMAP */
+    "fcnnst",           /* DRAW_CMD_TEXT */
+    "fcnnnnst",         /* DRAW_CMD_JUSTIFIED_TEXT */
+    "nnnnco",           /* DRAW_CMD_LINE */
+    "nnnnnnco",         /* DRAW_CMD_TRIANGLE */
+    "nnnnnnc",          /* DRAW_CMD_FILLED_TRIANGLE */
+    "nnnnco",           /* DRAW_CMD_RECTANGLE */
+    "nnnnc",            /* DRAW_CMD_FILLED_RECTANGLE */
+    "nnnnnnco",         /* DRAW_CMD_ROUNDED_RECTANGLE */
+    "nnnnnnc",          /* DRAW_CMD_FILLED_ROUNDED_RECTANGLE */
+    "nnnnnco",          /* DRAW_CMD_PIESLICE */
+    "nnnnnc",           /* DRAW_CMD_FILLED_PIESLICE */
+    "nnnnco",           /* DRAW_CMD_ELLIPSE */
+    "nnnnc",            /* DRAW_CMD_FILLED_ELLIPSE */
+    "nnnco",            /* DRAW_CMD_CIRCLE */
+    "nnnc",             /* DRAW_CMD_FILLED_CIRCLE */
+    "nnnnnco",          /* DRAW_CMD_ARC */
+    "nnnnnnco",         /* DRAW_CMD_ELLIPTICAL_ARC */
+};
 
-    {"create_config", lg_create_config},
-    {"destroy_config", lg_destroy_config},
-    {"load_config_file", lg_load_config_file},
-    {"save_config_file", lg_save_config_file},
-    {"add_config_section", lg_add_config_section},
-    {"add_config_comment", lg_add_config_comment},
-    {"get_config_value", lg_get_config_value},
-    {"set_config_value", lg_set_config_value},
-    {"get_config_sections", lg_get_config_sections},
-    {"get_config_entries", lg_get_config_entries},
-    {"merge_config", lg_merge_config},
-    {"merge_config_into", lg_merge_config_into},
+static void write_command_data( lua_State *L, command_list_t *list, const void *data, const size_t size ) {
+    char *buffer;
+    size_t capacity;
+    if ( list->size + size > list->capacity ) {
+        for ( capacity = list->capacity ? list->capacity : 256; capacity < list->size + size; capacity *= 2 );
+        buffer = (char*) realloc(list->data, capacity);
+        if ( buffer == NULL ) {
+            luaL_error(L, "cannot grow command list to %d bytes", (int) capacity);
+        }
+        list->data = buffer;
+        list->capacity = capacity;
+    }
+    memcpy(list->data + list->size, data, size);
+    list->size += size;
+}
 
-    {"create_display", lg_create_display},
-    {"destroy_display", lg_destroy_display},
-    {"get_new_display_flags", lg_get_new_display_flags},
-    {"set_new_display_flags", lg_set_new_display_flags},
-    {"get_new_display_option", lg_get_new_display_option},
-    {"set_new_display_option", lg_set_new_display_option},
-    {"reset_new_display_options", lg_reset_new_display_options},
-    {"get_new_window_position", lg_get_new_window_position},
-    {"set_new_window_position", lg_set_new_window_position},
-    {"get_new_display_refresh_rate", lg_get_new_display_refresh_rate},
-    {"set_new_display_refresh_rate", lg_set_new_display_refresh_rate},
-    {"get_backbuffer", lg_get_backbuffer},
-    {"flip_display", lg_flip_display},
-    {"update_display_region", lg_update_display_region},
-    {"wait_for_vsync", lg_wait_for_vsync},
-    {"get_display_width", lg_get_display_width},
-    {"get_display_height", lg_get_display_height},
-    {"get_display_size", lg_get_display_size},
-    {"resize_display", lg_resize_display},
-    {"acknowledge_display", lg_acknowledge_resize},
-    {"get_window_position", lg_get_window_position},
-    {"set_window_position", lg_set_window_position},
-    {"get_display_flags", lg_get_display_flags},
-    {"set_display_flag", lg_set_display_flag},
-    {"get_display_option", lg_get_display_option},
-    {"get_display_format", lg_get_display_format},
-    {"get_dsplay_refresh_rate", lg_get_display_refresh_rate},
-    {"set_window_title", lg_set_window_title},
-    {"set_display_icon", lg_set_display_icon},
-    {"set_display_icons", lg_set_display_icons},
-    {"inhibit_screensaver", lg_inhibit_screensaver},
+/*
+    remember the object at idx in the list, so it stays alive as long as the list,
+    and return its index in the objects table (which also maps objects to indices)
+*/
+static int keep_command_object( lua_State *L, command_list_t *list, const int idx ) {
+    int index;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, list->objects_ref);
+    lua_pushvalue(L, idx);
+    lua_rawget(L, -2);
+    index = (int) lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if ( index == 0 ) {
+        index = (int) lua_rawlen(L, -1) + 1;
+        lua_pushvalue(L, idx);
+        lua_rawseti(L, -2, index);
+        lua_pushvalue(L, idx);
+        lua_pushinteger(L, index);
+        lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);
+    return index;
+}
+
+/* reads the arguments of a drawing binding as described by its signature */
+static void check_draw_command_args( lua_State *L, const int cmd, draw_command_args_t *args ) {
+    int i, n = 0;
+    const char *s;
+    for ( s = draw_command_signatures[cmd], i = 1; *s; ++s, ++i ) {
+        switch ( *s ) {
+            case 'b': args->object = to_bitmap(L, i); break;
+            case 'f': args->object = to_font(L, i); break;
+            case 'c': args->color = to_color(L, i); break;
+            case 'n': args->n[n++] = (float) luaL_checknumber(L, i); break;
+            case 'o': args->n[n++] = (float) luaL_optnumber(L, i, 1.0); break;
+            case 'd': args->flags = get_draw_bitmap_flags(L, i); break;
+            case 't': args->flags = get_draw_text_flags(L, i); break;
+            case 's': args->text = luaL_checkstring(L, i); break;
+        }
+    }
+}
 
-    {"create_event_queue", lg_create_event_queue},
-    {"destroy_event_queue", lg_destroy_event_queue},
-    {"register_event_source", lg_register_event_source},
-    {"unregister_event_source", lg_unregister_event_source},
-    {"is_event_queue_empty", lg_is_event_queue_empty},
-    {"get_next_event", lg_get_next_event},
-    {"peek_next_event", lg_peek_next_event},
-    {"drop_next_event", lg_drop_next_event},
-    {"flush_event_queue", lg_flush_event_queue},
-    {"wait_for_event", lg_wait_for_event},
-    {"wait_for_event_timed", lg_wait_for_event_timed},
-    {"wait_for_event_until", lg_wait_for_event_until},
+static int record_draw_command( lua_State *L, const int cmd ) {
+    int i, n = 0, length, index;
+    const char *s;
+    draw_command_args_t args;
+    unsigned char opcode = (unsigned char) cmd;
+    command_list_t *list = recording_command_list;
+    check_draw_command_args(L, cmd, &args);
+    write_command_data(L, list, &opcode, sizeof(opcode));
+    for ( s = draw_command_signatures[cmd], i = 1; *s; ++s, ++i ) {
+        switch ( *s ) {
+            case 'b': case 'f':
+                index = keep_command_object(L, list, i);
+                write_command_data(L, list, &index, sizeof(index));
+                break;
+            case 'c':
+                write_command_data(L, list, &args.color, sizeof(args.color));
+                break;
+            case 'n': case 'o':
+                write_command_data(L, list, &args.n[n++], sizeof(float));
+                break;
+            case 'd': case 't':
+                write_command_data(L, list, &args.flags, sizeof(args.flags));
+                break;
+            case 's':
+                length = (int) strlen(args.text);
+                write_command_data(L, list, &length, sizeof(length));
+                write_command_data(L, list, args.text, length + 1);
+                break;
+        }
+    }
+    list->count++;
+    return 0;
+}
 
-    {"get_display_modes", lg_get_display_modes},
+/*
+    decodes the arguments of one command and returns the position of the next command,
+    objects are looked up in the table at objects and are NULL once destroyed
+*/
+static const char *read_draw_command( lua_State *L, const int objects, const char *p,
+        const char *signature, draw_command_args_t *args ) {
+    int n = 0, length, index;
+    object_t *obj;
+    for ( ; *signature; ++signature ) {
+        switch ( *signature ) {
+            case 'b': case 'f':
+                memcpy(&index, p, sizeof(int)); p += sizeof(int);
+                lua_rawgeti(L, objects, index);
+                obj = (object_t*) lua_touserdata(L, -1);
+                lua_pop(L, 1);
+                args->object = obj ? obj->ptr : NULL;
+                break;
+            case 'c':
+                memcpy(&args->color, p, sizeof(args->color)); p += sizeof(args->color);
+                break;
+            case 'n': case 'o':
+                memcpy(&args->n[n++], p, sizeof(float)); p += sizeof(float);
+                break;
+            case 'd': case 't':
+                memcpy(&args->flags, p, sizeof(int)); p += sizeof(int);
+                break;
+            case 's':
+                memcpy(&length, p, sizeof(int)); p += sizeof(int);
+                args->text = p; p += length + 1;
+                break;
+        }
+    }
+    return p;
+}
+
+static void replay_command_list( lua_State *L, const command_list_t *list ) {
+    int cmd, objects;
+    draw_command_args_t a;
+    const float *n = a.n;
+    const char *p = list->data, *end = list->data + list->size;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, list->objects_ref);
+    objects = lua_gettop(L);
+    while ( p < end ) {
+        cmd = (unsigned char) *p++;
+        a.object = NULL;
+        p = read_draw_command(L, objects, p, draw_command_signatures[cmd], &a);
+        if ( a.object == NULL && strpbrk(draw_command_signatures[cmd], "bf") ) {
+            continue; /* its bitmap or font was destroyed after recording */
+        }
+        if ( culling_enabled && cull_draw_command(cmd, &a) ) {
+            continue;
+        }
+        if ( dirty_rectangles_enabled ) {
+            mark_draw_command_bounds(cmd, &a);
+        }
+        switch ( cmd ) {
+            case DRAW_CMD_BITMAP:
+                draw_bitmap(a.object, n[0], n[1], a.flags); break;
+            case DRAW_CMD_TINTED_BITMAP:
+                draw_tinted_bitmap(a.object, a.color, n[0], n[1], a.flags); break;
+            case DRAW_CMD_BITMAP_REGION:
+                al_draw_bitmap_region(a.object, n[0], n[1], n[2], n[3], n[4], n[5], a.flags); break;
+            case DRAW_CMD_TINTED_BITMAP_REGION:
+                al_draw_tinted_bitmap_region(a.object, a.color, n[0], n[1], n[2], n[3], n[4], n[5], a.flags); break;
+            case DRAW_CMD_PIXEL:
+                al_draw_pixel(n[0], n[1], a.color); break;
+            case DRAW_CMD_ROTATED_BITMAP:
+                al_draw_rotated_bitmap(a.object, n[0], n[1], n[2], n[3], n[4], a.flags); break;
+            case DRAW_CMD_TINTED_ROTATED_BITMAP:
+                al_draw_tinted_rotated_bitmap(a.object, a.color, n[0], n[1], n[2], n[3], n[4], a.flags); break;
+            case DRAW_CMD_SCALED_ROTATED_BITMAP:
+                al_draw_scaled_rotated_bitmap(a.object, n[0], n[1], n[2], n[3], n[4], n[5], n[6], a.flags); break;
+            case DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP:
+                al_draw_tinted_scaled_rotated_bitmap(a.object, a.color, n[0], n[1], n[2], n[3], n[4], n[5], n[6], a.flags); break;
+            case DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP_REGION:
+                al_draw_tinted_scaled_rotated_bitmap_region(a.object, n[0], n[1], n[2], n[3], a.color,
+                        n[4], n[5], n[6], n[7], n[8], n[9], n[10], a.flags); break;
+            case DRAW_CMD_SCALED_BITMAP:
+                al_draw_scaled_bitmap(a.object, n[0], n[1], n[2], n[3], n[4], n[5], n[6], n[7], a.flags); break;
+            case DRAW_CMD_TINTED_SCALED_BITMAP:
+                al_draw_tinted_scaled_bitmap(a.object, a.color, n[0], n[1], n[2], n[3], n[4], n[5], n[6], n[7], a.flags); break;
+            case DRAW_CMD_TEXT:
+                al_draw_text(a.object, a.color, n[0], n[1], a.flags, a.text); break;
+            case DRAW_CMD_JUSTIFIED_TEXT:
+                al_draw_justified_text(a.object, a.color, n[0], n[1], n[2], n[3], a.flags, a.text); break;
+            case DRAW_CMD_LINE:
+                al_draw_line(n[0], n[1], n[2], n[3], a.color, n[4]); break;
+            case DRAW_CMD_TRIANGLE:
+                al_draw_triangle(n[0], n[1], n[2], n[3], n[4], n[5], a.color, n[6]); break;
+            case DRAW_CMD_FILLED_TRIANGLE:
+                al_draw_filled_triangle(n[0], n[1], n[2], n[3], n[4], n[5], a.color); break;
+            case DRAW_CMD_RECTANGLE:
+                al_draw_rectangle(n[0], n[1], n[2], n[3], a.color, n[4]); break;
+            case DRAW_CMD_FILLED_RECTANGLE:
+                al_draw_filled_rectangle(n[0], n[1], n[2], n[3], a.color); break;
+            case DRAW_CMD_ROUNDED_RECTANGLE:
+                al_draw_rounded_rectangle(n[0], n[1], n[2], n[3], n[4], n[5], a.color, n[6]); break;
+            case DRAW_CMD_FILLED_ROUNDED_RECTANGLE:
+                al_draw_filled_rounded_rectangle(n[0], n[1], n[2], n[3], n[4], n[5], a.color); break;
+            case DRAW_CMD_PIESLICE:
+                al_draw_pieslice(n[0], n[1], n[2], n[3], n[4], a.color, n[5]); break;
+            case DRAW_CMD_FILLED_PIESLICE:
+                al_draw_filled_pieslice(n[0], n[1], n[2], n[3], n[4], a.color); break;
+            case DRAW_CMD_ELLIPSE:
+                al_draw_ellipse(n[0], n[1], n[2], n[3], a.color, n[4]); break;
+            case DRAW_CMD_FILLED_ELLIPSE:
+                al_draw_filled_ellipse(n[0], n[1], n[2], n[3], a.color); break;
+            case DRAW_CMD_CIRCLE:
+                al_draw_circle(n[0], n[1], n[2], a.color, n[3]); break;
+            case DRAW_CMD_FILLED_CIRCLE:
+                al_draw_filled_circle(n[0], n[1], n[2], a.color); break;
+            case DRAW_CMD_ARC:
+                al_draw_arc(n[0], n[1], n[2], n[3], n[4], a.color, n[5]); break;
+            case DRAW_CMD_ELLIPTICAL_ARC:
+                al_draw_elliptical_arc(n[0], n[1], n[2], n[3], n[4], n[5], a.color, n[6]); break;
+        }
+    }
+    lua_pop(L, 1);
+}
 
-    {"is_joystick_installed", lg_is_joystick_installed},
-    {"reconfigure_joysticks", lg_reconfigure_joysticks},
-    {"get_num_joysticks", lg_get_num_joysticks},
-    {"get_joystick", lg_get_joystick},
-    {"release_joystick", lg_release_joystick},
-    {"get_joystick_active", lg_get_joystick_active},
-    {"get_joystick_name", lg_get_joystick_name},
-    {"get_joystick_stick_name", lg_get_joystick_stick_name},
-    {"get_joystick_axis_name", lg_get_joystick_axis_name},
-    {"get_joystick_button_name", lg_get_joystick_button_name},
-    {"get_joystick_stick_flags", lg_get_joystick_stick_flags},
-    {"get_joystick_num_sticks", lg_get_joystick_num_sticks},
-    {"get_joystick_num_axes", lg_get_joystick_num_axes},
-    {"get_joystick_num_buttons", lg_get_joystick_num_buttons},
-    {"get_joystick_state", lg_get_joystick_state},
+/*
+    begin_command_list([list]) - records into a new list or reuses an existing one.
+    A recording which was not ended (e.g. because of an error) is abandoned.
+*/
+static int lg_begin_command_list( lua_State *L ) {
+    command_list_t *list;
+    if ( recording_command_list ) {
+        luaL_unref(L, LUA_REGISTRYINDEX, recording_command_list_ref);
+        recording_command_list_ref = LUA_NOREF;
+        recording_command_list = NULL;
+    }
+    if ( lua_isnoneornil(L, 1) ) {
+        list = (command_list_t*) push_data(L, LEGATO_COMMAND_LIST, sizeof(command_list_t));
+        memset(list, 0, sizeof(command_list_t));
+        lua_newtable(L);
+        list->objects_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    } else {
+        list = to_command_list(L, 1);
+        list->size = 0;
+        list->count = 0;
+        lua_newtable(L);
+        lua_rawseti(L, LUA_REGISTRYINDEX, list->objects_ref);
+        lua_pushvalue(L, 1);
+    }
+    recording_command_list = list;
+    recording_command_list_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return 0;
+}
 
-    {"map_rgb", lg_map_rgb},
-    {"map_rgb_f", lg_map_rgb_f},
-    {"unmap_rgb", lg_unmap_rgb},
-    {"unmap_rgb_f", lg_unmap_rgb_f},
-    {"get_pixel_size", lg_get_pixel_size},
-    {"get_pixel_format_bits", lg_get_pixel_format_bits},
-    {"lock_bitmap", lg_lock_bitmap},
-    {"lock_bitmap_region", lg_lock_bitmap_region},
-    {"unlock_bitmap", lg_unlock_bitmap},
-    {"create_bitmap", lg_create_bitmap},
-    {"create_sub_bitmap", lg_create_sub_bitmap},
-    {"clone_bitmap", lg_clone_bitmap},
-    {"destroy_bitmap", lg_destroy_bitmap},
-    {"get_new_bitmap_flags", lg_get_new_bitmap_flags},
-    {"get_new_bitmap_format", lg_get_new_bitmap_format},
-    {"set_new_bitmap_flags", lg_set_new_bitmap_flags},
-    {"add_new_bitmap_flag", lg_add_new_bitmap_flag},
-    {"set_new_bitmap_format", lg_set_new_bitmap_format},
-    {"get_bitmap_flags", lg_get_bitmap_flags},
-    {"get_bitmap_format", lg_get_bitmap_format},
-    {"get_bitmap_height", lg_get_bitmap_height},
-    {"get_bitmap_width", lg_get_bitmap_width},
-    {"get_bitmap_size", lg_get_bitmap_size},
-    {"get_pixel", lg_get_pixel},
-    {"is_bitmap_locked", lg_is_bitmap_locked},
-    {"is_compatible_bitmap", lg_is_compatible_bitmap},
-    {"is_sub_bitmap", lg_is_sub_bitmap},
-    {"get_parent_bitmap", lg_get_parent_bitmap},
-    {"clear_to_color", lg_clear_to_color},
-    {"draw_bitmap", lg_draw_bitmap},
-    {"draw_tinted_bitmap", lg_draw_tinted_bitmap},
-    {"draw_bitmap_region", lg_draw_bitmap_region},
-    {"draw_tinted_bitmap_region", lg_draw_tinted_bitmap_region},
-    {"draw_pixel", lg_draw_pixel},
-    {"draw_rotated_bitmap", lg_draw_rotated_bitmap},
-    {"draw_tinted_rotated_bitmap", lg_draw_tinted_rotated_bitmap},
-    {"draw_scaled_rotated_bitmap", lg_draw_scaled_rotated_bitmap},
-    {"draw_tinted_scaled_rotated_bitmap", lg_draw_tinted_scaled_rotated_bitmap},
-    {"draw_tinted_scaled_rotated_bitmap_region", lg_draw_tinted_scaled_rotated_bitmap_region},
-    {"draw_scaled_bitmap", lg_draw_scaled_bitmap},
-    {"draw_tinted_scaled_bitmap", lg_draw_tinted_scaled_bitmap},
-    {"get_target_bitmap", lg_get_target_bitmap},
-    {"put_pixel", lg_put_pixel},
-    {"put_blended_pixel", lg_put_blended_pixel},
-    {"set_target_bitmap", lg_set_target_bitmap},
-    {"set_target_backbuffer", lg_set_target_backbuffer},
-    {"get_current_display", lg_get_current_display},
-    {"get_blender", lg_get_blender},
-    {"get_separate_blender", lg_get_separate_blender},
-    {"set_blender", lg_set_blender},
-    {"set_separate_blender", lg_set_separate_blender},
-    {"get_clipping_rectangle", lg_get_clipping_rectangle},
-    {"set_clipping_rectangle", lg_set_clipping_rectangle},
-    {"reset_clipping_rectangle", lg_reset_clipping_rectangle},
-    {"convert_mask_to_alpha", lg_convert_mask_to_alpha},
-    {"hold_bitmap_drawing", lg_hold_bitmap_drawing},
-    {"is_bitmap_drawing_held", lg_is_bitmap_drawing_held},
-    {"load_bitmap", lg_load_bitmap},
-    {"save_bitmap", lg_save_bitmap},
+static int lg_end_command_list( lua_State *L ) {
+    if ( recording_command_list == NULL ) {
+        return luaL_error(L, "not recording a command list");
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, recording_command_list_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, recording_command_list_ref);
+    recording_command_list_ref = LUA_NOREF;
+    recording_command_list = NULL;
+    return 1;
+}
 
-    {"is_keyboard_installed", lg_is_keyboard_installed},
-    {"create_keyboard_state", lg_create_keyboard_state},
-    {"get_keyboard_state", lg_get_keyboard_state},
-    {"key_down", lg_key_down},
-    {"keycode_to_name", lg_keycode_to_name},
-    {"set_keyboard_leds", lg_set_keyboard_leds},
+static int lg_is_recording_command_list( lua_State *L ) {
+    lua_pushboolean(L, recording_command_list != NULL);
+    return 1;
+}
 
-    {"get_new_display_adapter", lg_get_new_display_adapter},
-    {"set_new_display_adapter", lg_set_new_display_adapter},
-    {"get_monitor_info", lg_get_monitor_info},
+/* draw_command_list(list, [transform]) - the transform is applied on top of the current one */
+static int lg_draw_command_list( lua_State *L ) {
+    ALLEGRO_TRANSFORM backup, transform;
+    command_list_t *list = to_command_list(L, 1);
+    NOT_RECORDABLE_MACRO("draw_command_list");
+    if ( lua_isnoneornil(L, 2) ) {
+        replay_command_list(L, list);
+    } else {
+        al_copy_transform(&backup, al_get_current_transform());
+        al_copy_transform(&transform, to_transform(L, 2));
+        al_compose_transform(&transform, &backup);
+        al_use_transform(&transform);
+        replay_command_list(L, list);
+        al_use_transform(&backup);
+    }
+    return 0;
+}
 
-    {"is_mouse_installed", lg_is_mouse_installed},
-    {"get_mouse_num_axes", lg_get_mouse_num_axes},
-    {"get_mouse_num_buttons", lg_get_mouse_num_buttons},
-    {"create_mouse_state", lg_create_mouse_state},
-    {"get_mouse_state", lg_get_mouse_state},
-    {"get_mouse_state_axis", lg_get_mouse_state_axis},
-    {"mouse_button_down", lg_mouse_button_down},
-    {"set_mouse_xy", lg_set_mouse_xy},
-    {"set_mouse_z", lg_set_mouse_z},
-    {"set_mouse_w", lg_set_mouse_w},
-    {"set_mouse_axis", lg_set_mouse_axis},
-    {"create_mouse_cursor", lg_create_mouse_cursor},
-    {"destroy_mouse_cursor", lg_destroy_mouse_cursor},
-    {"set_mouse_cursor", lg_set_mouse_cursor},
-    {"set_system_mouse_cursor", lg_set_system_mouse_cursor},
-    {"get_mouse_cursor_position", lg_get_mouse_cursor_position},
-    {"hide_mouse_cursor", lg_hide_mouse_cursor},
-    {"show_mouse_cursor", lg_show_mouse_cursor},
-    {"grab_mouse", lg_grab_mouse},
-    {"ungrab_mouse", lg_ungrab_mouse},
+static int lg_destroy_command_list( lua_State *L ) {
+    command_list_t *list = (command_list_t*) luaL_checkudata(L, 1, LEGATO_COMMAND_LIST);
+    if ( list == recording_command_list ) {
+        return 0; /* still referenced by the recording, cannot be collected */
+    }
+    free(list->data);
+    list->data = NULL;
+    list->size = list->capacity = 0;
+    list->count = 0;
+    luaL_unref(L, LUA_REGISTRYINDEX, list->objects_ref);
+    list->objects_ref = LUA_NOREF;
+    return 0;
+}
+
+/* get_command_list_size(list) -> number of commands, size in bytes */
+static int lg_get_command_list_size( lua_State *L ) {
+    command_list_t *list = to_command_list(L, 1);
+    lua_pushinteger(L, list->count);
+    lua_pushinteger(L, (lua_Integer) list->size);
+    return 2;
+}
+
+/*
+================================================================================
+
+                Dirty rectangles
+
+    When enabled, drawing to the backbuffer through the bindings marks the
+    transformed bounding box of every call. Overlapping boxes are merged and
+    flip_display() presents only these regions with al_update_display_region.
+
+================================================================================
+*/
+static float dirty_rectangles[LEGATO_DIRTY_RECTANGLES_MAX][4]; /* x1, y1, x2, y2 */
+static int dirty_rectangle_count = 0;
+
+static int is_dirty_tracking_target( void ) {
+    ALLEGRO_DISPLAY *display = al_get_current_display();
+    return display != NULL && al_get_target_bitmap() == al_get_backbuffer(display);
+}
+
+static void remove_dirty_rectangle( const int i ) {
+    memcpy(dirty_rectangles[i], dirty_rectangles[--dirty_rectangle_count], sizeof(dirty_rectangles[i]));
+}
+
+static void add_dirty_rectangle( float x1, float y1, float x2, float y2 ) {
+    int i, best = -1;
+    float *r, growth, best_growth = 0.0f;
+    for ( i = 0; i < dirty_rectangle_count; ) { /* swallow everything we touch */
+        r = dirty_rectangles[i];
+        if ( x1 <= r[2] && r[0] <= x2 && y1 <= r[3] && r[1] <= y2 ) {
+            x1 = r[0] < x1 ? r[0] : x1; y1 = r[1] < y1 ? r[1] : y1;
+            x2 = r[2] > x2 ? r[2] : x2; y2 = r[3] > y2 ? r[3] : y2;
+            remove_dirty_rectangle(i);
+            i = 0;
+        } else {
+            ++i;
+        }
+    }
+    if ( dirty_rectangle_count < LEGATO_DIRTY_RECTANGLES_MAX ) {
+        r = dirty_rectangles[dirty_rectangle_count++];
+        r[0] = x1; r[1] = y1; r[2] = x2; r[3] = y2;
+        return;
+    }
+    for ( i = 0; i < dirty_rectangle_count; ++i ) { /* no room left, merge with the cheapest one */
+        r = dirty_rectangles[i];
+        growth = ((r[2] > x2 ? r[2] : x2) - (r[0] < x1 ? r[0] : x1)) * ((r[3] > y2 ? r[3] : y2) - (r[1] < y1 ? r[1] : y1)) -
+            (r[2] - r[0]) * (r[3] - r[1]);
+        if ( best < 0 || growth < best_growth ) {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    r = dirty_rectangles[best];
+    x1 = r[0] < x1 ? r[0] : x1; y1 = r[1] < y1 ? r[1] : y1;
+    x2 = r[2] > x2 ? r[2] : x2; y2 = r[3] > y2 ? r[3] : y2;
+    remove_dirty_rectangle(best);
+    add_dirty_rectangle(x1, y1, x2, y2);
+}
+
+/* bounding box of the box (x1, y1) - (x2, y2) after applying the current transform */
+static void transform_box( const float x1, const float y1, const float x2, const float y2, const float pad, float *out ) {
+    int i;
+    float x[4], y[4], min_x, min_y, max_x, max_y;
+    const ALLEGRO_TRANSFORM *transform = al_get_current_transform();
+    x[0] = x1; y[0] = y1; x[1] = x2; y[1] = y1;
+    x[2] = x2; y[2] = y2; x[3] = x1; y[3] = y2;
+    for ( i = 0; i < 4; ++i ) {
+        al_transform_coordinates(transform, &x[i], &y[i]);
+    }
+    min_x = max_x = x[0]; min_y = max_y = y[0];
+    for ( i = 1; i < 4; ++i ) {
+        min_x = x[i] < min_x ? x[i] : min_x; max_x = x[i] > max_x ? x[i] : max_x;
+        min_y = y[i] < min_y ? y[i] : min_y; max_y = y[i] > max_y ? y[i] : max_y;
+    }
+    out[0] = min_x - pad; out[1] = min_y - pad;
+    out[2] = max_x + pad; out[3] = max_y + pad;
+}
+
+/* marks the box (x1, y1) - (x2, y2) after applying the current transform */
+static void mark_dirty_box( const float x1, const float y1, const float x2, const float y2, const float pad ) {
+    float box[4];
+    transform_box(x1, y1, x2, y2, pad, box);
+    add_dirty_rectangle(box[0], box[1], box[2], box[3]);
+}
+
+static void mark_dirty_display( void ) {
+    ALLEGRO_DISPLAY *display = al_get_current_display();
+    if ( dirty_rectangles_enabled && is_dirty_tracking_target() ) {
+        add_dirty_rectangle(0.0f, 0.0f, (float) al_get_display_width(display), (float) al_get_display_height(display));
+    }
+}
+
+static void mark_dirty_vertices( const ALLEGRO_VERTEX *v, const int count ) {
+    int i;
+    float min_x, min_y, max_x, max_y;
+    if ( ! dirty_rectangles_enabled || count <= 0 || ! is_dirty_tracking_target() ) {
+        return;
+    }
+    min_x = max_x = v[0].x; min_y = max_y = v[0].y;
+    for ( i = 1; i < count; ++i ) {
+        min_x = v[i].x < min_x ? v[i].x : min_x; max_x = v[i].x > max_x ? v[i].x : max_x;
+        min_y = v[i].y < min_y ? v[i].y : min_y; max_y = v[i].y > max_y ? v[i].y : max_y;
+    }
+    mark_dirty_box(min_x, min_y, max_x, max_y, 1.0f);
+}
+
+/* radius of the circle around the rotation center (cx, cy) which contains the whole w*h image */
+static float get_rotated_radius( const float w, const float h, const float cx, const float cy, const float sx, const float sy ) {
+    float dx = (cx > w - cx ? cx : w - cx) * fabsf(sx);
+    float dy = (cy > h - cy ? cy : h - cy) * fabsf(sy);
+    return sqrtf(dx * dx + dy * dy);
+}
+
+static void set_box( float *box, const float x1, const float y1, const float x2, const float y2, const float pad ) {
+    box[0] = x1; box[1] = y1; box[2] = x2; box[3] = y2; box[4] = pad;
+}
+
+/* untransformed bounding box x1, y1, x2, y2 and the padding of a draw command, returns 0 if unknown */
+static int get_draw_command_box( const int cmd, const draw_command_args_t *a, float *box ) {
+    float w = 0.0f, h = 0.0f, r;
+    const float *n = a->n;
+    if ( draw_command_signatures[cmd][0] == 'b' ) {
+        w = (float) al_get_bitmap_width(a->object);
+        h = (float) al_get_bitmap_height(a->object);
+    } else if ( draw_command_signatures[cmd][0] == 'f' ) {
+        w = (float) al_get_text_width(a->object, a->text);
+        h = (float) al_get_font_line_height(a->object);
+    }
+    switch ( cmd ) {
+        case DRAW_CMD_BITMAP: case DRAW_CMD_TINTED_BITMAP:
+            set_box(box, n[0], n[1], n[0] + w, n[1] + h, 1.0f); break;
+        case DRAW_CMD_BITMAP_REGION: case DRAW_CMD_TINTED_BITMAP_REGION:
+            set_box(box, n[4], n[5], n[4] + n[2], n[5] + n[3], 1.0f); break;
+        case DRAW_CMD_PIXEL:
+            set_box(box, n[0], n[1], n[0] + 1.0f, n[1] + 1.0f, 1.0f); break;
+        case DRAW_CMD_ROTATED_BITMAP: case DRAW_CMD_TINTED_ROTATED_BITMAP:
+            r = get_rotated_radius(w, h, n[0], n[1], 1.0f, 1.0f);
+            set_box(box, n[2] - r, n[3] - r, n[2] + r, n[3] + r, 1.0f); break;
+        case DRAW_CMD_SCALED_ROTATED_BITMAP: case DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP:
+            r = get_rotated_radius(w, h, n[0], n[1], n[4], n[5]);
+            set_box(box, n[2] - r, n[3] - r, n[2] + r, n[3] + r, 1.0f); break;
+        case DRAW_CMD_TINTED_SCALED_ROTATED_BITMAP_REGION:
+            r = get_rotated_radius(n[2], n[3], n[4], n[5], n[8], n[9]);
+            set_box(box, n[6] - r, n[7] - r, n[6] + r, n[7] + r, 1.0f); break;
+        case DRAW_CMD_SCALED_BITMAP: case DRAW_CMD_TINTED_SCALED_BITMAP:
+            set_box(box, n[4], n[5], n[4] + n[6], n[5] + n[7], 1.0f); break;
+        case DRAW_CMD_TEXT:
+            if ( a->flags & ALLEGRO_ALIGN_CENTRE ) {
+                set_box(box, n[0] - w * 0.5f, n[1], n[0] + w * 0.5f, n[1] + h, 1.0f);
+            } else if ( a->flags & ALLEGRO_ALIGN_RIGHT ) {
+                set_box(box, n[0] - w, n[1], n[0], n[1] + h, 1.0f);
+            } else {
+                set_box(box, n[0], n[1], n[0] + w, n[1] + h, 1.0f);
+            }
+            break;
+        case DRAW_CMD_JUSTIFIED_TEXT:
+            set_box(box, n[0], n[2], n[1], n[2] + h, 1.0f); break;
+        case DRAW_CMD_LINE: case DRAW_CMD_RECTANGLE:
+            set_box(box, n[0], n[1], n[2], n[3], n[4] * 0.5f + 1.0f); break;
+        case DRAW_CMD_FILLED_RECTANGLE:
+            set_box(box, n[0], n[1], n[2], n[3], 1.0f); break;
+        case DRAW_CMD_ROUNDED_RECTANGLE:
+            set_box(box, n[0], n[1], n[2], n[3], n[6] * 0.5f + 1.0f); break;
+        case DRAW_CMD_FILLED_ROUNDED_RECTANGLE:
+            set_box(box, n[0], n[1], n[2], n[3], 1.0f); break;
+        case DRAW_CMD_TRIANGLE: case DRAW_CMD_FILLED_TRIANGLE:
+            set_box(box, fminf(n[0], fminf(n[2], n[4])), fminf(n[1], fminf(n[3], n[5])),
+                    fmaxf(n[0], fmaxf(n[2], n[4])), fmaxf(n[1], fmaxf(n[3], n[5])),
+                    cmd == DRAW_CMD_TRIANGLE ? n[6] * 0.5f + 1.0f : 1.0f);
+            break;
+        case DRAW_CMD_PIESLICE: case DRAW_CMD_ARC:
+            set_box(box, n[0] - n[2], n[1] - n[2], n[0] + n[2], n[1] + n[2], n[5] * 0.5f + 1.0f); break;
+        case DRAW_CMD_FILLED_PIESLICE: case DRAW_CMD_FILLED_CIRCLE:
+            set_box(box, n[0] - n[2], n[1] - n[2], n[0] + n[2], n[1] + n[2], 1.0f); break;
+        case DRAW_CMD_CIRCLE:
+            set_box(box, n[0] - n[2], n[1] - n[2], n[0] + n[2], n[1] + n[2], n[3] * 0.5f + 1.0f); break;
+        case DRAW_CMD_ELLIPSE:
+            set_box(box, n[0] - n[2], n[1] - n[3], n[0] + n[2], n[1] + n[3], n[4] * 0.5f + 1.0f); break;
+        case DRAW_CMD_FILLED_ELLIPSE:
+            set_box(box, n[0] - n[2], n[1] - n[3], n[0] + n[2], n[1] + n[3], 1.0f); break;
+        case DRAW_CMD_ELLIPTICAL_ARC:
+            set_box(box, n[0] - n[2], n[1] - n[3], n[0] + n[2], n[1] + n[3], n[6] * 0.5f + 1.0f); break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+static void mark_draw_command_bounds( const int cmd, const draw_command_args_t *a ) {
+    float box[5];
+    if ( get_draw_command_box(cmd, a, box) ) {
+        mark_dirty_box(box[0], box[1], box[2], box[3], box[4]);
+    }
+}
+
+static void mark_dirty_draw_command( lua_State *L, const int cmd ) {
+    draw_command_args_t args;
+    if ( is_dirty_tracking_target() ) {
+        check_draw_command_args(L, cmd, &args);
+        mark_draw_command_bounds(cmd, &args);
+    }
+}
+
+static void present_dirty_rectangles( void ) {
+    int i, x1, y1, x2, y2, width, height;
+    ALLEGRO_DISPLAY *display = al_get_current_display();
+    if ( dirty_rectangle_count == 0 ) {
+        return;
+    }
+    if ( ! al_get_display_option(display, ALLEGRO_UPDATE_DISPLAY_REGION) ) {
+        /* without driver support every region update is a full flip, so flip only once */
+        al_flip_display();
+        dirty_rectangle_count = 0;
+        return;
+    }
+    width = al_get_display_width(display);
+    height = al_get_display_height(display);
+    for ( i = 0; i < dirty_rectangle_count; ++i ) {
+        x1 = (int) floorf(dirty_rectangles[i][0]); x1 = x1 < 0 ? 0 : x1;
+        y1 = (int) floorf(dirty_rectangles[i][1]); y1 = y1 < 0 ? 0 : y1;
+        x2 = (int) ceilf(dirty_rectangles[i][2]); x2 = x2 > width ? width : x2;
+        y2 = (int) ceilf(dirty_rectangles[i][3]); y2 = y2 > height ? height : y2;
+        if ( x2 > x1 && y2 > y1 ) {
+            al_update_display_region(x1, y1, x2 - x1, y2 - y1);
+        }
+    }
+    dirty_rectangle_count = 0;
+}
+
+/* set_dirty_rectangles(enabled) - flip_display() will only present the regions drawn to */
+static int lg_set_dirty_rectangles( lua_State *L ) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    dirty_rectangles_enabled = lua_toboolean(L, 1);
+    dirty_rectangle_count = 0;
+    return 0;
+}
+
+static int lg_get_dirty_rectangles( lua_State *L ) {
+    int i;
+    float *r;
+    lua_createtable(L, dirty_rectangle_count, 0);
+    for ( i = 0; i < dirty_rectangle_count; ++i ) {
+        r = dirty_rectangles[i];
+        lua_createtable(L, 4, 0);
+        lua_pushnumber(L, r[0]); lua_rawseti(L, -2, 1);
+        lua_pushnumber(L, r[1]); lua_rawseti(L, -2, 2);
+        lua_pushnumber(L, r[2] - r[0]); lua_rawseti(L, -2, 3);
+        lua_pushnumber(L, r[3] - r[1]); lua_rawseti(L, -2, 4);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+/* mark_dirty_rectangle(x, y, w, h) - in display coordinates, for drawing the bindings cannot track */
+static int lg_mark_dirty_rectangle( lua_State *L ) {
+    float x = (float) luaL_checknumber(L, 1), y = (float) luaL_checknumber(L, 2);
+    if ( dirty_rectangles_enabled ) {
+        add_dirty_rectangle(x, y, x + (float) luaL_checknumber(L, 3), y + (float) luaL_checknumber(L, 4));
+    }
+    return 0;
+}
+
+/*
+================================================================================
+
+                Culling
+
+    When enabled, the draw bindings compare the bounding box of every call
+    with the view rectangle and skip the calls which are completely outside.
+    Without an explicit view rectangle the transformed box is tested against
+    the clipping rectangle of the target bitmap.
+
+================================================================================
+*/
+static float culling_view[4]; /* x1, y1, x2, y2 in untransformed coordinates */
+static int culling_has_view = 0;
+static lua_Integer culled_calls = 0, drawn_calls = 0;
+
+/* returns 1 if the draw command is completely outside the view */
+static int cull_draw_command( const int cmd, const draw_command_args_t *a ) {
+    float box[5], view[4];
+    int cx, cy, cw, ch;
+    if ( ! get_draw_command_box(cmd, a, box) ) {
+        ++drawn_calls;
+        return 0;
+    }
+    if ( culling_has_view ) {
+        box[0] -= box[4]; box[1] -= box[4];
+        box[2] += box[4]; box[3] += box[4];
+        memcpy(view, culling_view, sizeof(view));
+    } else {
+        transform_box(box[0], box[1], box[2], box[3], box[4], box);
+        al_get_clipping_rectangle(&cx, &cy, &cw, &ch);
+        view[0] = (float) cx; view[1] = (float) cy;
+        view[2] = (float) (cx + cw); view[3] = (float) (cy + ch);
+    }
+    /* boxes may be flipped by negative sizes */
+    if ( fmaxf(box[0], box[2]) < view[0] || fminf(box[0], box[2]) > view[2] ||
+            fmaxf(box[1], box[3]) < view[1] || fminf(box[1], box[3]) > view[3] ) {
+        ++culled_calls;
+        return 1;
+    }
+    ++drawn_calls;
+    return 0;
+}
+
+static int cull_draw_command_args( lua_State *L, const int cmd ) {
+    draw_command_args_t args;
+    check_draw_command_args(L, cmd, &args);
+    return cull_draw_command(cmd, &args);
+}
+
+/* set_culling(enabled, [x, y, w, h]) - the optional view rectangle is in the coordinates passed to the draw calls */
+static int lg_set_culling( lua_State *L ) {
+    float x, y;
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    culling_enabled = lua_toboolean(L, 1);
+    culling_has_view = ! lua_isnoneornil(L, 2);
+    if ( culling_has_view ) {
+        x = (float) luaL_checknumber(L, 2);
+        y = (float) luaL_checknumber(L, 3);
+        culling_view[0] = x; culling_view[1] = y;
+        culling_view[2] = x + (float) luaL_checknumber(L, 4);
+        culling_view[3] = y + (float) luaL_checknumber(L, 5);
+    }
+    return 0;
+}
+
+/* get_culling_stats() -> number of culled calls, number of drawn calls */
+static int lg_get_culling_stats( lua_State *L ) {
+    lua_pushinteger(L, culled_calls);
+    lua_pushinteger(L, drawn_calls);
+    return 2;
+}
+
+static int lg_reset_culling_stats( lua_State *L ) {
+    culled_calls = drawn_calls = 0;
+    return 0;
+}
+
+/*
+================================================================================
+
+                Text objects and text cache
+
+    The text is rendered once in white into its own bitmap and drawn later
+    as a tinted bitmap. draw_cached_text() does the same for arbitrary
+    strings, keeps the most recently used ones and evicts the least
+    recently used ones once the cache exceeds its byte budget.
+
+================================================================================
+*/
+static text_object_t *text_cache_head = NULL, *text_cache_tail = NULL;
+static size_t text_cache_bytes = 0, text_cache_budget = LEGATO_TEXT_CACHE_BUDGET;
+static int text_cache_count = 0, text_cache_hits = 0, text_cache_misses = 0;
+
+static int render_text_object( text_object_t *obj, ALLEGRO_FONT *font, const char *text ) {
+    ALLEGRO_STATE state;
+    ALLEGRO_TRANSFORM identity;
+    if ( obj->bitmap ) {
+        al_destroy_bitmap(obj->bitmap);
+        obj->bitmap = NULL;
+    }
+    obj->font = font;
+    obj->advance = al_get_text_width(font, text);
+    al_get_text_dimensions(font, text, &obj->bbx, &obj->bby, &obj->bbw, &obj->bbh);
+    obj->bytes = 0;
+    if ( obj->bbw <= 0 || obj->bbh <= 0 ) {
+        return 1; /* nothing visible */
+    }
+    obj->bitmap = al_create_bitmap(obj->bbw, obj->bbh);
+    if ( obj->bitmap == NULL ) {
+        return 0;
+    }
+    obj->bytes = (size_t) obj->bbw * obj->bbh * 4;
+    al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER | ALLEGRO_STATE_TRANSFORM);
+    al_set_target_bitmap(obj->bitmap);
+    al_identity_transform(&identity);
+    al_use_transform(&identity);
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+    al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+    al_draw_text(font, al_map_rgb(255, 255, 255), (float) -obj->bbx, (float) -obj->bby, 0, text);
+    al_restore_state(&state);
+    return 1;
+}
+
+static void draw_text_object( const text_object_t *obj, ALLEGRO_COLOR color, float x, float y, const int flags ) {
+    if ( flags & ALLEGRO_ALIGN_CENTRE ) {
+        x -= obj->advance * 0.5f;
+    } else if ( flags & ALLEGRO_ALIGN_RIGHT ) {
+        x -= obj->advance;
+    }
+    if ( flags & ALLEGRO_ALIGN_INTEGER ) {
+        x = floorf(x);
+        y = floorf(y);
+    }
+    if ( obj->bitmap == NULL ) {
+        return;
+    }
+    x += obj->bbx;
+    y += obj->bby;
+    if ( dirty_rectangles_enabled && is_dirty_tracking_target() ) {
+        mark_dirty_box(x, y, x + obj->bbw, y + obj->bbh, 1.0f);
+    }
+    al_draw_tinted_bitmap(obj->bitmap, color, x, y, 0);
+}
+
+static void release_text_object( lua_State *L, text_object_t *obj ) {
+    if ( obj->bitmap ) {
+        al_destroy_bitmap(obj->bitmap);
+        obj->bitmap = NULL;
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, obj->font_ref);
+    obj->font_ref = LUA_NOREF;
+    obj->font = NULL;
+}
+
+static void unlink_text_cache_entry( text_object_t *entry ) {
+    if ( entry->prev ) entry->prev->next = entry->next; else text_cache_head = entry->next;
+    if ( entry->next ) entry->next->prev = entry->prev; else text_cache_tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void link_text_cache_entry( text_object_t *entry ) {
+    entry->prev = NULL;
+    entry->next = text_cache_head;
+    if ( text_cache_head ) text_cache_head->prev = entry; else text_cache_tail = entry;
+    text_cache_head = entry;
+}
+
+static void evict_text_cache_entry( lua_State *L, text_object_t *entry ) {
+    unlink_text_cache_entry(entry);
+    text_cache_bytes -= entry->bytes;
+    text_cache_count--;
+    release_text_object(L, entry);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, text_cache_table_ref);
+    lua_pushstring(L, entry->key);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+}
+
+/* evicts all entries of the given font, or the whole cache if font is NULL */
+static void flush_text_cache( lua_State *L, ALLEGRO_FONT *font ) {
+    text_object_t *entry, *next;
+    for ( entry = text_cache_head; entry; entry = next ) {
+        next = entry->next;
+        if ( font == NULL || entry->font == font ) {
+            evict_text_cache_entry(L, entry);
+        }
+    }
+}
+
+static void trim_text_cache( lua_State *L ) {
+    while ( text_cache_bytes > text_cache_budget && text_cache_tail && text_cache_tail != text_cache_head ) {
+        evict_text_cache_entry(L, text_cache_tail);
+    }
+}
+
+/* draw_cached_text(font, color, x, y, text, [flags]) */
+static int lg_draw_cached_text( lua_State *L ) {
+    size_t length;
+    const char *key;
+    text_object_t *entry;
+    ALLEGRO_FONT *font = to_font(L, 1);
+    ALLEGRO_COLOR color = to_color(L, 2);
+    float x = (float) luaL_checknumber(L, 3), y = (float) luaL_checknumber(L, 4);
+    const char *text = luaL_checkstring(L, 5);
+    int flags = get_draw_text_flags(L, 6);
+    NOT_RECORDABLE_MACRO("draw_cached_text");
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, text_cache_table_ref);
+    key = lua_pushfstring(L, "%p:%s", (void*) font, text);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -3);
+    entry = (text_object_t*) lua_touserdata(L, -1);
+    if ( entry ) {
+        text_cache_hits++;
+        unlink_text_cache_entry(entry);
+        link_text_cache_entry(entry);
+    } else {
+        text_cache_misses++;
+        lua_pop(L, 1);
+        length = strlen(key);
+        entry = (text_object_t*) push_data(L, LEGATO_TEXT_OBJECT, sizeof(text_object_t) + length);
+        memset(entry, 0, sizeof(text_object_t));
+        memcpy(entry->key, key, length + 1);
+        lua_pushvalue(L, 1);
+        entry->font_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        if ( ! render_text_object(entry, font, text) ) {
+            release_text_object(L, entry);
+            return luaL_error(L, "cannot create text bitmap");
+        }
+        lua_pushvalue(L, -2);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -5);
+        link_text_cache_entry(entry);
+        text_cache_bytes += entry->bytes;
+        text_cache_count++;
+        trim_text_cache(L);
+    }
+    draw_text_object(entry, color, x, y, flags);
+    lua_pop(L, 3);
+    return 0;
+}
+
+static int lg_set_text_cache_budget( lua_State *L ) {
+    lua_Integer budget = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, budget >= 0, 1, "invalid budget");
+    text_cache_budget = (size_t) budget;
+    trim_text_cache(L);
+    return 0;
+}
+
+/* get_text_cache_stats() -> entries, bytes, hits, misses */
+static int lg_get_text_cache_stats( lua_State *L ) {
+    lua_pushinteger(L, text_cache_count);
+    lua_pushinteger(L, (lua_Integer) text_cache_bytes);
+    lua_pushinteger(L, text_cache_hits);
+    lua_pushinteger(L, text_cache_misses);
+    return 4;
+}
+
+static int lg_clear_text_cache( lua_State *L ) {
+    flush_text_cache(L, NULL);
+    text_cache_hits = text_cache_misses = 0;
+    return 0;
+}
+
+/* create_text_object(font, text) - pre-rendered label */
+static int lg_create_text_object( lua_State *L ) {
+    text_object_t *obj;
+    ALLEGRO_FONT *font = to_font(L, 1);
+    const char *text = luaL_checkstring(L, 2);
+    obj = (text_object_t*) push_data(L, LEGATO_TEXT_OBJECT, sizeof(text_object_t));
+    memset(obj, 0, sizeof(text_object_t));
+    lua_pushvalue(L, 1);
+    obj->font_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    if ( ! render_text_object(obj, font, text) ) {
+        release_text_object(L, obj);
+        return push_error(L, "cannot create text bitmap");
+    }
+    return 1;
+}
+
+static int lg_destroy_text_object( lua_State *L ) {
+    release_text_object(L, (text_object_t*) luaL_checkudata(L, 1, LEGATO_TEXT_OBJECT));
+    return 0;
+}
+
+static int lg_set_text_object_text( lua_State *L ) {
+    ALLEGRO_FONT *font;
+    text_object_t *obj = to_text_object(L, 1);
+    const char *text = luaL_checkstring(L, 2);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, obj->font_ref);
+    font = to_font(L, -1);
+    if ( ! render_text_object(obj, font, text) ) {
+        return luaL_error(L, "cannot create text bitmap");
+    }
+    return 0;
+}
+
+/* draw_text_object(obj, color, x, y, [flags]) */
+static int lg_draw_text_object( lua_State *L ) {
+    NOT_RECORDABLE_MACRO("draw_text_object");
+    draw_text_object(to_text_object(L, 1), to_color(L, 2), (float) luaL_checknumber(L, 3),
+            (float) luaL_checknumber(L, 4), get_draw_text_flags(L, 5));
+    return 0;
+}
+
+static int lg_get_text_object_width( lua_State *L ) {
+    lua_pushinteger(L, to_text_object(L, 1)->advance);
+    return 1;
+}
+
+static int lg_get_text_object_dimensions( lua_State *L ) {
+    text_object_t *obj = to_text_object(L, 1);
+    lua_pushinteger(L, obj->bbx); lua_pushinteger(L, obj->bby);
+    lua_pushinteger(L, obj->bbw); lua_pushinteger(L, obj->bbh);
+    return 4;
+}
+
+/*
+================================================================================
+
+                Sprite batch
+
+================================================================================
+*/
+static int lg_create_sprite_batch( lua_State *L ) {
+    int i, capacity;
+    sprite_batch_t *batch;
+    ALLEGRO_BITMAP *bitmap = to_bitmap(L, 1);
+    capacity = luaL_checkint(L, 2);
+    luaL_argcheck(L, capacity > 0, 2, "invalid capacity");
+    batch = (sprite_batch_t*) push_data(L, LEGATO_SPRITE_BATCH, sizeof(sprite_batch_t) +
+            (sizeof(ALLEGRO_VERTEX) * 4 + sizeof(int) * 6) * capacity);
+    batch->bitmap = bitmap;
+    lua_pushvalue(L, 1); /* keep the bitmap alive as long as the batch */
+    batch->bitmap_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    batch->capacity = capacity;
+    batch->count = 0;
+    batch->vertices = (ALLEGRO_VERTEX*) (batch + 1);
+    batch->indices = (int*) (batch->vertices + capacity * 4);
+    for ( i = 0; i < capacity; ++i ) { /* indices never change, so build them only once */
+        batch->indices[i*6+0] = i*4+0; batch->indices[i*6+1] = i*4+1; batch->indices[i*6+2] = i*4+2;
+        batch->indices[i*6+3] = i*4+0; batch->indices[i*6+4] = i*4+2; batch->indices[i*6+5] = i*4+3;
+    }
+    return 1;
+}
+
+static int lg_destroy_sprite_batch( lua_State *L ) {
+    sprite_batch_t *batch = (sprite_batch_t*) luaL_checkudata(L, 1, LEGATO_SPRITE_BATCH);
+    luaL_unref(L, LUA_REGISTRYINDEX, batch->bitmap_ref);
+    batch->bitmap_ref = LUA_NOREF;
+    batch->bitmap = NULL;
+    batch->count = 0;
+    return 0;
+}
+
+/* appends a quad centered at (x, y) showing the bitmap region (rx, ry, rw, rh) */
+static int push_sprite_batch_quad( sprite_batch_t *batch, float x, float y, float sx, float sy, float angle,
+        ALLEGRO_COLOR tint, float rx, float ry, float rw, float rh ) {
+    int i;
+    float c, s, px, py;
+    ALLEGRO_VERTEX *v;
+    static const float corners[4][2] = {{-0.5f, -0.5f}, {0.5f, -0.5f}, {0.5f, 0.5f}, {-0.5f, 0.5f}};
+    if ( batch->count >= batch->capacity ) {
+        return 0;
+    }
+    c = cosf(angle); s = sinf(angle);
+    v = batch->vertices + batch->count * 4;
+    for ( i = 0; i < 4; ++i ) {
+        px = corners[i][0] * rw * sx;
+        py = corners[i][1] * rh * sy;
+        v[i].x = x + px * c - py * s;
+        v[i].y = y + px * s + py * c;
+        v[i].z = 0.0f;
+        v[i].u = rx + (corners[i][0] + 0.5f) * rw;
+        v[i].v = ry + (corners[i][1] + 0.5f) * rh;
+        v[i].color = tint;
+    }
+    batch->count++;
+    return 1;
+}
+
+static void get_region( lua_State *L, const int idx, ALLEGRO_BITMAP *bitmap, float region[4] ) {
+    int i;
+    if ( lua_isnoneornil(L, idx) ) {
+        region[0] = 0.0f; region[1] = 0.0f;
+        region[2] = (float) al_get_bitmap_width(bitmap);
+        region[3] = (float) al_get_bitmap_height(bitmap);
+    } else {
+        luaL_checktype(L, idx, LUA_TTABLE);
+        for ( i = 0; i < 4; ++i ) {
+            lua_rawgeti(L, idx, i + 1);
+            region[i] = (float) luaL_checknumber(L, -1);
+            lua_pop(L, 1);
+        }
+    }
+}
+
+/* the bitmap of the batch can be destroyed by bitmap:destroy(), the registry reference only prevents collection */
+static ALLEGRO_BITMAP *get_sprite_batch_bitmap( lua_State *L, sprite_batch_t *batch ) {
+    ALLEGRO_BITMAP *bitmap = (ALLEGRO_BITMAP*) get_ref_object(L, batch->bitmap_ref);
+    if ( bitmap == NULL ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_BITMAP);
+    }
+    return bitmap;
+}
+
+static int lg_add_sprite( lua_State *L ) {
+    float region[4];
+    ALLEGRO_COLOR tint;
+    sprite_batch_t *batch = to_sprite_batch(L, 1);
+    tint = lua_isnoneornil(L, 7) ? al_map_rgba_f(1.0, 1.0, 1.0, 1.0) : to_color(L, 7);
+    get_region(L, 8, get_sprite_batch_bitmap(L, batch), region);
+    if ( ! push_sprite_batch_quad(batch, luaL_checknumber(L, 2), luaL_checknumber(L, 3),
+                luaL_optnumber(L, 4, 1.0), luaL_optnumber(L, 5, 1.0), luaL_optnumber(L, 6, 0.0),
+                tint, region[0], region[1], region[2], region[3]) ) {
+        return luaL_error(L, "sprite batch is full (capacity %d)", batch->capacity);
+    }
+    return 0;
+}
+
+static int lg_clear_sprite_batch( lua_State *L ) {
+    to_sprite_batch(L, 1)->count = 0;
+    return 0;
+}
+
+static int lg_draw_sprite_batch( lua_State *L ) {
+    sprite_batch_t *batch = to_sprite_batch(L, 1);
+    NOT_RECORDABLE_MACRO("draw_sprite_batch");
+    if ( batch->count > 0 ) {
+        ALLEGRO_BITMAP *bitmap = get_sprite_batch_bitmap(L, batch);
+        mark_dirty_vertices(batch->vertices, batch->count * 4);
+        al_draw_indexed_prim(batch->vertices, NULL, bitmap, batch->indices, batch->count * 6, ALLEGRO_PRIM_TRIANGLE_LIST);
+    }
+    return 0;
+}
+
+static int lg_get_sprite_batch_count( lua_State *L ) {
+    lua_pushinteger(L, to_sprite_batch(L, 1)->count);
+    return 1;
+}
+
+static int lg_get_sprite_batch_capacity( lua_State *L ) {
+    lua_pushinteger(L, to_sprite_batch(L, 1)->capacity);
+    return 1;
+}
+
+/*
+================================================================================
+
+                Tilemap
+
+================================================================================
+*/
+static ALLEGRO_VERTEX *scratch_vertices = NULL;
+static int scratch_vertices_size = 0;
+
+/* returns a shared vertex buffer with room for at least count vertices */
+static ALLEGRO_VERTEX *get_scratch_vertices( lua_State *L, const int count ) {
+    ALLEGRO_VERTEX *vertices;
+    if ( count > scratch_vertices_size ) {
+        vertices = (ALLEGRO_VERTEX*) realloc(scratch_vertices, sizeof(ALLEGRO_VERTEX) * count);
+        if ( vertices == NULL ) {
+            luaL_error(L, "cannot allocate %d vertices", count);
+        }
+        scratch_vertices = vertices;
+        scratch_vertices_size = count;
+    }
+    return scratch_vertices;
+}
+
+/* writes an axis aligned quad as two triangles (6 vertices) */
+static void set_quad_vertices( ALLEGRO_VERTEX *v, float x1, float y1, float x2, float y2,
+        float u1, float v1, float u2, float v2, ALLEGRO_COLOR color ) {
+    v[0].x = x1; v[0].y = y1; v[0].u = u1; v[0].v = v1;
+    v[1].x = x2; v[1].y = y1; v[1].u = u2; v[1].v = v1;
+    v[2].x = x2; v[2].y = y2; v[2].u = u2; v[2].v = v2;
+    v[3] = v[0];
+    v[4] = v[2];
+    v[5].x = x1; v[5].y = y2; v[5].u = u1; v[5].v = v2;
+    v[0].z = v[1].z = v[2].z = v[3].z = v[4].z = v[5].z = 0.0f;
+    v[0].color = v[1].color = v[2].color = v[3].color = v[4].color = v[5].color = color;
+}
+
+static lua_Number get_opt_number_field( lua_State *L, const int idx, const char *key, const lua_Number def ) {
+    lua_Number value = def;
+    if ( lua_istable(L, idx) ) {
+        lua_getfield(L, idx, key);
+        if ( ! lua_isnil(L, -1) ) {
+            value = luaL_checknumber(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+    return value;
+}
+
+/* draw_tilemap(map, tileset, tile_w, tile_h, cam_x, cam_y, cam_w, cam_h, [{tint, parallax_x, parallax_y, x, y}]) */
+static int lg_draw_tilemap( lua_State *L ) {
+    int tile_w, tile_h, columns, tiles, tile, x, y, x1, y1, x2, y2, count;
+    float cam_x, cam_y, cam_w, cam_h, ox, oy, dx, dy, u, v;
+    lua_Number cell;
+    ALLEGRO_COLOR tint;
+    ALLEGRO_VERTEX *vertices;
+    number_map_t *map = to_number_map(L, 1);
+    ALLEGRO_BITMAP *tileset = to_bitmap(L, 2);
+    NOT_RECORDABLE_MACRO("draw_tilemap");
+    tile_w = luaL_checkint(L, 3); tile_h = luaL_checkint(L, 4);
+    luaL_argcheck(L, tile_w > 0, 3, "invalid tile width");
+    luaL_argcheck(L, tile_h > 0, 4, "invalid tile height");
+    cam_x = luaL_checknumber(L, 5); cam_y = luaL_checknumber(L, 6);
+    cam_w = luaL_checknumber(L, 7); cam_h = luaL_checknumber(L, 8);
+    cam_x *= get_opt_number_field(L, 9, "parallax_x", 1.0);
+    cam_y *= get_opt_number_field(L, 9, "parallax_y", 1.0);
+    ox = get_opt_number_field(L, 9, "x", 0.0) - cam_x;
+    oy = get_opt_number_field(L, 9, "y", 0.0) - cam_y;
+    tint = al_map_rgba_f(1.0, 1.0, 1.0, 1.0);
+    if ( lua_istable(L, 9) ) {
+        lua_getfield(L, 9, "tint");
+        if ( ! lua_isnil(L, -1) ) {
+            tint = to_color(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+    columns = al_get_bitmap_width(tileset) / tile_w;
+    tiles = columns * (al_get_bitmap_height(tileset) / tile_h);
+    luaL_argcheck(L, columns > 0, 3, "tileset is smaller than one tile");
+    luaL_argcheck(L, tiles > 0, 4, "tileset is smaller than one tile");
+
+    /* cull to the visible cells (0-based, inclusive) */
+    x1 = (int) floor(cam_x / tile_w); y1 = (int) floor(cam_y / tile_h);
+    x2 = (int) floor((cam_x + cam_w) / tile_w); y2 = (int) floor((cam_y + cam_h) / tile_h);
+    if ( x1 < 0 ) x1 = 0;
+    if ( y1 < 0 ) y1 = 0;
+    if ( x2 >= map->width ) x2 = map->width - 1;
+    if ( y2 >= map->height ) y2 = map->height - 1;
+    if ( x2 < x1 || y2 < y1 ) {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+
+    vertices = get_scratch_vertices(L, (x2 - x1 + 1) * (y2 - y1 + 1) * 6);
+    for ( count = 0, y = y1; y <= y2; ++y ) {
+        for ( x = x1; x <= x2; ++x ) {
+            cell = map->cells[y * map->width + x];
+            if ( cell >= 1 && cell < tiles + 1 ) { /* tile 0 is empty, tile 1 is the top-left tile of the tileset */
+                tile = (int) cell - 1; /* ids past the tileset (and NaN) are skipped like empty cells */
+                u = (float) ((tile % columns) * tile_w);
+                v = (float) ((tile / columns) * tile_h);
+                dx = ox + x * tile_w;
+                dy = oy + y * tile_h;
+                set_quad_vertices(vertices + count * 6, dx, dy, dx + tile_w, dy + tile_h, u, v, u + tile_w, v + tile_h, tint);
+                count++;
+            }
+        }
+    }
+    if ( count > 0 ) {
+        mark_dirty_vertices(vertices, count * 6);
+        al_draw_prim(vertices, NULL, tileset, 0, count * 6, ALLEGRO_PRIM_TRIANGLE_LIST);
+    }
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+/*
+================================================================================
+
+                Atlas
+
+    Skyline bottom-left packer. Every added image becomes a sub-bitmap of
+    one big texture, so drawing them does not need texture switches.
+
+================================================================================
+*/
+static int lg_create_atlas( lua_State *L ) {
+    int width, height, padding;
+    atlas_t *atlas;
+    ALLEGRO_BITMAP *bitmap;
+    ALLEGRO_STATE state;
+    width = luaL_checkint(L, 1);
+    height = luaL_checkint(L, 2);
+    padding = luaL_optint(L, 3, 1);
+    luaL_argcheck(L, width > 0, 1, "invalid width");
+    luaL_argcheck(L, height > 0, 2, "invalid height");
+    luaL_argcheck(L, padding >= 0, 3, "invalid padding");
+    bitmap = al_create_bitmap(width, height);
+    if ( bitmap == NULL ) {
+        return push_error(L, "cannot create atlas bitmap (%dx%d)", width, height);
+    }
+    al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+    al_set_target_bitmap(bitmap);
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+    al_restore_state(&state);
+
+    atlas = (atlas_t*) push_data(L, LEGATO_ATLAS, sizeof(atlas_t) + sizeof(atlas_node_t) * width);
+    atlas->bitmap = bitmap;
+    push_object(L, LEGATO_BITMAP, bitmap, 1);
+    atlas->bitmap_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    atlas->width = width;
+    atlas->height = height;
+    atlas->padding = padding;
+    atlas->used_area = 0;
+    atlas->count = 0;
+    atlas->skyline_count = 1;
+    atlas->skyline[0].x = 0;
+    atlas->skyline[0].y = 0;
+    atlas->skyline[0].w = width;
+    return 1;
+}
+
+static int lg_destroy_atlas( lua_State *L ) {
+    atlas_t *atlas = (atlas_t*) luaL_checkudata(L, 1, LEGATO_ATLAS);
+    luaL_unref(L, LUA_REGISTRYINDEX, atlas->bitmap_ref);
+    atlas->bitmap_ref = LUA_NOREF;
+    atlas->bitmap = NULL;
+    return 0;
+}
+
+/* returns the y position where a w*h rectangle fits on top of skyline node i, or -1 */
+static int fit_atlas_skyline( const atlas_t *atlas, int i, const int w, const int h ) {
+    int y, width_left;
+    if ( atlas->skyline[i].x + w > atlas->width ) {
+        return -1;
+    }
+    for ( y = 0, width_left = w; width_left > 0; ++i ) {
+        if ( i >= atlas->skyline_count ) {
+            return -1;
+        }
+        if ( atlas->skyline[i].y > y ) {
+            y = atlas->skyline[i].y;
+        }
+        if ( y + h > atlas->height ) {
+            return -1;
+        }
+        width_left -= atlas->skyline[i].w;
+    }
+    return y;
+}
+
+static int pack_atlas_rect( atlas_t *atlas, const int w, const int h, int *rx, int *ry ) {
+    int i, y, best = -1, best_y = 0, best_bottom = INT_MAX, best_width = INT_MAX, shrink;
+    atlas_node_t *node, *prev;
+    for ( i = 0; i < atlas->skyline_count; ++i ) {
+        y = fit_atlas_skyline(atlas, i, w, h);
+        if ( y >= 0 && (y + h < best_bottom || (y + h == best_bottom && atlas->skyline[i].w < best_width)) ) {
+            best = i;
+            best_y = y;
+            best_bottom = y + h;
+            best_width = atlas->skyline[i].w;
+        }
+    }
+    if ( best < 0 ) {
+        return 0;
+    }
+    *rx = atlas->skyline[best].x;
+    *ry = best_y;
+
+    /* insert new skyline node and cut away the nodes it covers */
+    memmove(atlas->skyline + best + 1, atlas->skyline + best, sizeof(atlas_node_t) * (atlas->skyline_count - best));
+    atlas->skyline_count++;
+    atlas->skyline[best].x = *rx;
+    atlas->skyline[best].y = best_y + h;
+    atlas->skyline[best].w = w;
+    for ( i = best + 1; i < atlas->skyline_count; ) {
+        node = atlas->skyline + i;
+        prev = node - 1;
+        if ( node->x >= prev->x + prev->w ) {
+            break;
+        }
+        shrink = prev->x + prev->w - node->x;
+        node->x += shrink;
+        node->w -= shrink;
+        if ( node->w > 0 ) {
+            break;
+        }
+        memmove(node, node + 1, sizeof(atlas_node_t) * (atlas->skyline_count - i - 1));
+        atlas->skyline_count--;
+    }
+    for ( i = 0; i < atlas->skyline_count - 1; ) { /* merge neighbours on the same level */
+        if ( atlas->skyline[i].y == atlas->skyline[i+1].y ) {
+            atlas->skyline[i].w += atlas->skyline[i+1].w;
+            memmove(atlas->skyline + i + 1, atlas->skyline + i + 2, sizeof(atlas_node_t) * (atlas->skyline_count - i - 2));
+            atlas->skyline_count--;
+        } else {
+            ++i;
+        }
+    }
+    return 1;
+}
+
+/* add(bitmap or filename) -> sub-bitmap inside the atlas */
+static int lg_add_to_atlas( lua_State *L ) {
+    int x, y, w, h, loaded = 0;
+    ALLEGRO_BITMAP *bitmap, *target;
+    ALLEGRO_STATE state;
+    atlas_t *atlas = to_atlas(L, 1);
+    target = (ALLEGRO_BITMAP*) get_ref_object(L, atlas->bitmap_ref); /* get_bitmap() hands it out, it may be destroyed */
+    if ( target == NULL ) {
+        return luaL_error(L, "attempt to operate on destroyed atlas bitmap");
+    }
+    if ( lua_type(L, 2) == LUA_TSTRING ) {
+        bitmap = al_load_bitmap(lua_tostring(L, 2));
+        if ( bitmap == NULL ) {
+            return push_error(L, "cannot load bitmap " LUA_QS, lua_tostring(L, 2));
+        }
+        loaded = 1;
+    } else {
+        bitmap = to_bitmap(L, 2);
+    }
+    w = al_get_bitmap_width(bitmap);
+    h = al_get_bitmap_height(bitmap);
+    if ( ! pack_atlas_rect(atlas, w + atlas->padding, h + atlas->padding, &x, &y) ) {
+        if ( loaded ) {
+            al_destroy_bitmap(bitmap);
+        }
+        return push_error(L, "atlas is full");
+    }
+    al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+    al_set_target_bitmap(target);
+    al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO); /* plain copy, keep alpha as it is */
+    al_draw_bitmap(bitmap, x, y, 0);
+    al_restore_state(&state);
+    if ( loaded ) {
+        al_destroy_bitmap(bitmap);
+    }
+    atlas->used_area += w * h;
+    atlas->count++;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, atlas->bitmap_ref);
+    return push_object_with_dependency(L, LEGATO_BITMAP, al_create_sub_bitmap(target, x, y, w, h), 1, lua_gettop(L));
+}
+
+static int lg_get_atlas_bitmap( lua_State *L ) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, to_atlas(L, 1)->bitmap_ref);
+    return 1;
+}
+
+/* get_atlas_occupancy(atlas) -> used fraction of the texture, number of images, used pixels */
+static int lg_get_atlas_occupancy( lua_State *L ) {
+    atlas_t *atlas = to_atlas(L, 1);
+    lua_pushnumber(L, (lua_Number) atlas->used_area / ((lua_Number) atlas->width * atlas->height));
+    lua_pushinteger(L, atlas->count);
+    lua_pushinteger(L, atlas->used_area);
+    return 3;
+}
+
+/*
+================================================================================
+
+                Vertex array
+
+    Low level primitives. Vertices are stored as ALLEGRO_VERTEX structs and
+    indices as plain ints, so filling them does not create any Lua values.
+    Vertex and index numbers are 1-based like everything else in Lua.
+
+================================================================================
+*/
+static int lg_create_vertex_array( lua_State *L ) {
+    int capacity, index_capacity;
+    vertex_array_t *array;
+    capacity = luaL_checkint(L, 1);
+    index_capacity = luaL_optint(L, 2, 0);
+    luaL_argcheck(L, capacity > 0, 1, "invalid capacity");
+    luaL_argcheck(L, index_capacity >= 0, 2, "invalid index capacity");
+    array = (vertex_array_t*) push_data(L, LEGATO_VERTEX_ARRAY, sizeof(vertex_array_t) +
+            sizeof(ALLEGRO_VERTEX) * capacity + sizeof(int) * index_capacity);
+    array->capacity = capacity;
+    array->index_capacity = index_capacity;
+    array->count = 0;
+    array->index_count = 0;
+    array->index_written = 0;
+    array->vertices = (ALLEGRO_VERTEX*) (array + 1);
+    array->indices = (int*) (array->vertices + capacity);
+    memset(array->vertices, 0, sizeof(ALLEGRO_VERTEX) * capacity);
+    memset(array->indices, 0, sizeof(int) * index_capacity);
+    return 1;
+}
+
+static int lg_destroy_vertex_array( lua_State *L ) {
+    vertex_array_t *array = (vertex_array_t*) luaL_checkudata(L, 1, LEGATO_VERTEX_ARRAY);
+    array->vertices = NULL;
+    array->indices = NULL;
+    array->count = array->index_count = 0;
+    return 0;
+}
+
+static ALLEGRO_VERTEX *check_vertex( lua_State *L, vertex_array_t *array, const int idx ) {
+    int i = luaL_checkint(L, idx);
+    luaL_argcheck(L, i >= 1 && i <= array->capacity, idx, "vertex out of range");
+    if ( i > array->count ) {
+        array->count = i;
+    }
+    return array->vertices + i - 1;
+}
+
+/* set_vertex(array, i, x, y, [u, v, color]) */
+static int lg_set_vertex( lua_State *L ) {
+    vertex_array_t *array = to_vertex_array(L, 1);
+    ALLEGRO_VERTEX *v = check_vertex(L, array, 2);
+    v->x = (float) luaL_checknumber(L, 3);
+    v->y = (float) luaL_checknumber(L, 4);
+    v->z = 0.0f;
+    v->u = (float) luaL_optnumber(L, 5, 0.0);
+    v->v = (float) luaL_optnumber(L, 6, 0.0);
+    v->color = lua_isnoneornil(L, 7) ? al_map_rgba_f(1.0, 1.0, 1.0, 1.0) : to_color(L, 7);
+    return 0;
+}
+
+static int lg_get_vertex( lua_State *L ) {
+    int i;
+    vertex_array_t *array = to_vertex_array(L, 1);
+    i = luaL_checkint(L, 2);
+    luaL_argcheck(L, i >= 1 && i <= array->capacity, 2, "vertex out of range");
+    lua_pushnumber(L, array->vertices[i-1].x);
+    lua_pushnumber(L, array->vertices[i-1].y);
+    lua_pushnumber(L, array->vertices[i-1].u);
+    lua_pushnumber(L, array->vertices[i-1].v);
+    return 4;
+}
+
+static int lg_set_vertex_color( lua_State *L ) {
+    vertex_array_t *array = to_vertex_array(L, 1);
+    check_vertex(L, array, 2)->color = to_color(L, 3);
+    return 0;
+}
+
+/* set_vertices(array, first, {x1, y1, u1, v1, x2, y2, u2, v2, ...}, [color]) -> number of vertices written */
+static int lg_set_vertices( lua_State *L ) {
+    int first, i, n;
+    ALLEGRO_COLOR color;
+    ALLEGRO_VERTEX *v;
+    vertex_array_t *array = to_vertex_array(L, 1);
+    first = luaL_checkint(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    color = lua_isnoneornil(L, 4) ? al_map_rgba_f(1.0, 1.0, 1.0, 1.0) : to_color(L, 4);
+    n = (int) lua_rawlen(L, 3) / 4;
+    luaL_argcheck(L, first >= 1 && first - 1 + n <= array->capacity, 2, "vertices out of range");
+    for ( i = 0, v = array->vertices + first - 1; i < n; ++i, ++v ) {
+        lua_rawgeti(L, 3, i * 4 + 1); v->x = (float) lua_tonumber(L, -1);
+        lua_rawgeti(L, 3, i * 4 + 2); v->y = (float) lua_tonumber(L, -1);
+        lua_rawgeti(L, 3, i * 4 + 3); v->u = (float) lua_tonumber(L, -1);
+        lua_rawgeti(L, 3, i * 4 + 4); v->v = (float) lua_tonumber(L, -1);
+        lua_pop(L, 4);
+        v->z = 0.0f;
+        v->color = color;
+    }
+    if ( first - 1 + n > array->count ) {
+        array->count = first - 1 + n;
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+/* set_indices(array, first, {v1, v2, v3, ...}) -> number of indices written */
+static int lg_set_indices( lua_State *L ) {
+    int first, i, n, index;
+    vertex_array_t *array = to_vertex_array(L, 1);
+    first = luaL_checkint(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    n = (int) lua_rawlen(L, 3);
+    luaL_argcheck(L, first >= 1 && first - 1 + n <= array->index_capacity, 2, "indices out of range");
+    for ( i = 0; i < n; ++i ) {
+        lua_rawgeti(L, 3, i + 1);
+        index = (int) lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        if ( index < 1 || index > array->capacity ) {
+            return luaL_error(L, "invalid vertex index %d at position %d", index, i + 1);
+        }
+        array->indices[first - 1 + i] = index - 1;
+    }
+    if ( first - 1 + n > array->index_count ) {
+        array->index_count = first - 1 + n;
+    }
+    if ( array->index_count > array->index_written ) {
+        array->index_written = array->index_count;
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+/* set_vertex_count(array, vertices, [indices]) - shrink or grow the used range (indices only up to the written ones) */
+static int lg_set_vertex_count( lua_State *L ) {
+    int count, index_count;
+    vertex_array_t *array = to_vertex_array(L, 1);
+    count = luaL_checkint(L, 2);
+    index_count = luaL_optint(L, 3, array->index_count);
+    luaL_argcheck(L, count >= 0 && count <= array->capacity, 2, "invalid vertex count");
+    luaL_argcheck(L, index_count >= 0 && index_count <= array->index_written, 3, "invalid index count");
+    array->count = count;
+    array->index_count = index_count;
+    return 0;
+}
+
+static int lg_get_vertex_count( lua_State *L ) {
+    vertex_array_t *array = to_vertex_array(L, 1);
+    lua_pushinteger(L, array->count);
+    lua_pushinteger(L, array->index_count);
+    return 2;
+}
+
+static int lg_get_vertex_capacity( lua_State *L ) {
+    vertex_array_t *array = to_vertex_array(L, 1);
+    lua_pushinteger(L, array->capacity);
+    lua_pushinteger(L, array->index_capacity);
+    return 2;
+}
+
+/* resolves the optional 1-based [first, last] range to a 0-based [start, end) range */
+static void get_prim_range( lua_State *L, const int idx, const int count, int *start, int *end ) {
+    *start = luaL_optint(L, idx, 1) - 1;
+    *end = luaL_optint(L, idx + 1, count);
+    luaL_argcheck(L, *start >= 0, idx, "invalid first element");
+    luaL_argcheck(L, *end <= count, idx + 1, "invalid last element");
+}
+
+/* draw_vertex_array(array, [type, texture, first, last]) -> number of drawn primitives */
+static int lg_draw_vertex_array( lua_State *L ) {
+    int type, start, end;
+    ALLEGRO_BITMAP *texture;
+    vertex_array_t *array = to_vertex_array(L, 1);
+    NOT_RECORDABLE_MACRO("draw_vertex_array");
+    type = lua_isnoneornil(L, 2) ? ALLEGRO_PRIM_TRIANGLE_LIST : parse_enum_name(L, 2, prim_type_mapping);
+    texture = lua_isnoneornil(L, 3) ? NULL : to_bitmap(L, 3);
+    get_prim_range(L, 4, array->count, &start, &end);
+    mark_dirty_vertices(array->vertices + start, end - start);
+    lua_pushinteger(L, end > start ? al_draw_prim(array->vertices, NULL, texture, start, end, type) : 0);
+    return 1;
+}
+
+/* draw_indexed_vertex_array(array, [type, texture, first, last]) -> number of drawn primitives */
+static int lg_draw_indexed_vertex_array( lua_State *L ) {
+    int type, start, end, i;
+    ALLEGRO_BITMAP *texture;
+    vertex_array_t *array = to_vertex_array(L, 1);
+    NOT_RECORDABLE_MACRO("draw_indexed_vertex_array");
+    type = lua_isnoneornil(L, 2) ? ALLEGRO_PRIM_TRIANGLE_LIST : parse_enum_name(L, 2, prim_type_mapping);
+    texture = lua_isnoneornil(L, 3) ? NULL : to_bitmap(L, 3);
+    get_prim_range(L, 4, array->index_count, &start, &end);
+    for ( i = start; i < end; ++i ) { /* the vertex count may have been shrunk after the indices were set */
+        if ( array->indices[i] >= array->count ) {
+            return luaL_error(L, "index %d points to vertex %d beyond the vertex count %d", i + 1, array->indices[i] + 1, array->count);
+        }
+    }
+    mark_dirty_vertices(array->vertices, array->count); /* indices may point anywhere */
+    lua_pushinteger(L, end > start ? al_draw_indexed_prim(array->vertices, NULL, texture,
+                array->indices + start, end - start, type) : 0);
+    return 1;
+}
+
+/*
+================================================================================
+
+                Render target pool
+
+    Temporary render targets are kept alive and handed out again when a
+    bitmap with the same size, format and flags is requested. Released
+    targets are destroyed after they were not used for some frames.
+
+================================================================================
+*/
+/* create_render_target_pool([max_idle_frames = 2]) */
+static int lg_create_render_target_pool( lua_State *L ) {
+    const int max_idle_frames = luaL_optint(L, 1, 2);
+    render_target_pool_t *pool;
+    luaL_argcheck(L, max_idle_frames >= 0, 1, "invalid number of frames");
+    pool = (render_target_pool_t*) push_data(L, LEGATO_RENDER_TARGET_POOL, sizeof(render_target_pool_t));
+    pool->targets = NULL;
+    pool->count = pool->capacity = 0;
+    pool->max_idle_frames = max_idle_frames;
+    pool->hits = pool->misses = 0;
+    pool->resident_bytes = 0;
+    pool->destroyed = 0;
+    return 1;
+}
+
+/* returns the bitmap object of a pooled target or NULL if it was destroyed by hand */
+static object_t *push_render_target_object( lua_State *L, const render_target_t *target ) {
+    object_t *obj;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, target->bitmap_ref);
+    obj = (object_t*) lua_touserdata(L, -1);
+    return obj && obj->ptr == target->bitmap ? obj : NULL;
+}
+
+/* removes target i from the pool, the bitmap is only destroyed if destroy is set */
+static void remove_render_target( lua_State *L, render_target_pool_t *pool, const int i, const int destroy ) {
+    render_target_t *target = &pool->targets[i];
+    if ( push_render_target_object(L, target) && destroy ) {
+        if ( al_is_bitmap_locked(target->bitmap) ) {
+            invalidate_locked_region(L, target->bitmap);
+        }
+        al_destroy_bitmap(target->bitmap);
+        clear_object(L, -1);
+    }
+    lua_pop(L, 1);
+    luaL_unref(L, LUA_REGISTRYINDEX, target->bitmap_ref);
+    pool->resident_bytes -= target->bytes;
+    pool->targets[i] = pool->targets[--pool->count];
+}
+
+static int lg_destroy_render_target_pool( lua_State *L ) {
+    render_target_pool_t *pool = (render_target_pool_t*) luaL_checkudata(L, 1, LEGATO_RENDER_TARGET_POOL);
+    while ( pool->count > 0 ) {
+        /* targets still in use belong to the script now */
+        remove_render_target(L, pool, pool->count - 1, ! pool->targets[pool->count - 1].in_use);
+    }
+    free(pool->targets);
+    pool->targets = NULL;
+    pool->capacity = 0;
+    pool->destroyed = 1;
+    return 0;
+}
+
+/* acquire_render_target(pool, width, height, [flags, format]) -> bitmap */
+static int lg_acquire_render_target( lua_State *L ) {
+    int i, width, height, flags, format;
+    render_target_t *target;
+    ALLEGRO_BITMAP *bitmap;
+    ALLEGRO_STATE state;
+    render_target_pool_t *pool = to_render_target_pool(L, 1);
+    width = luaL_checkint(L, 2);
+    height = luaL_checkint(L, 3);
+    flags = lua_isnoneornil(L, 4) ? al_get_new_bitmap_flags() : parse_flag_table(L, 4, bitmap_flag_mapping);
+    format = lua_isnoneornil(L, 5) ? al_get_new_bitmap_format() : parse_enum_name(L, 5, pixel_format_mapping);
+    luaL_argcheck(L, width > 0, 2, "invalid width");
+    luaL_argcheck(L, height > 0, 3, "invalid height");
+
+    for ( i = 0; i < pool->count; ++i ) {
+        target = &pool->targets[i];
+        if ( target->in_use || target->width != width || target->height != height ||
+                target->format != format || target->flags != flags ) {
+            continue;
+        }
+        if ( push_render_target_object(L, target) == NULL ) {
+            lua_pop(L, 1);
+            remove_render_target(L, pool, i--, 0);
+            continue;
+        }
+        target->in_use = 1;
+        target->idle_frames = 0;
+        ++pool->hits;
+        return 1;
+    }
+
+    al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+    al_set_new_bitmap_flags(flags);
+    al_set_new_bitmap_format(format);
+    bitmap = al_create_bitmap(width, height);
+    al_restore_state(&state);
+    if ( bitmap == NULL ) {
+        return push_error(L, "cannot create render target (%dx%d)", width, height);
+    }
+    if ( pool->count >= pool->capacity ) {
+        pool->capacity = pool->capacity ? pool->capacity * 2 : 8;
+        pool->targets = (render_target_t*) realloc(pool->targets, sizeof(render_target_t) * pool->capacity);
+    }
+    target = &pool->targets[pool->count++];
+    target->bitmap = bitmap;
+    target->width = width;
+    target->height = height;
+    target->format = format;
+    target->flags = flags;
+    target->in_use = 1;
+    target->idle_frames = 0;
+    target->bytes = width * height * al_get_pixel_size(al_get_bitmap_format(bitmap));
+    pool->resident_bytes += target->bytes;
+    ++pool->misses;
+    push_object(L, LEGATO_BITMAP, bitmap, 1);
+    lua_pushvalue(L, -1);
+    target->bitmap_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return 1;
+}
+
+/* release_render_target(pool, bitmap) - the bitmap can be acquired again in the same frame */
+static int lg_release_render_target( lua_State *L ) {
+    int i;
+    render_target_pool_t *pool = to_render_target_pool(L, 1);
+    ALLEGRO_BITMAP *bitmap = to_bitmap(L, 2);
+    for ( i = 0; i < pool->count; ++i ) {
+        if ( pool->targets[i].bitmap == bitmap && pool->targets[i].in_use ) {
+            pool->targets[i].in_use = 0;
+            return 0;
+        }
+    }
+    return luaL_argerror(L, 2, "bitmap is not an acquired render target of this pool");
+}
+
+/* update_render_target_pool(pool) - call once per frame, destroys targets which were not used for too long */
+static int lg_update_render_target_pool( lua_State *L ) {
+    int i;
+    render_target_t *target;
+    render_target_pool_t *pool = to_render_target_pool(L, 1);
+    for ( i = pool->count - 1; i >= 0; --i ) {
+        target = &pool->targets[i];
+        if ( push_render_target_object(L, target) == NULL ) {
+            remove_render_target(L, pool, i, 0); /* destroyed by the script */
+        } else if ( ! target->in_use && ++target->idle_frames > pool->max_idle_frames ) {
+            remove_render_target(L, pool, i, 1);
+        }
+        lua_pop(L, 1);
+    }
+    return 0;
+}
+
+/* clear_render_target_pool(pool) - destroys all released targets */
+static int lg_clear_render_target_pool( lua_State *L ) {
+    int i;
+    render_target_pool_t *pool = to_render_target_pool(L, 1);
+    for ( i = pool->count - 1; i >= 0; --i ) {
+        if ( ! pool->targets[i].in_use ) {
+            remove_render_target(L, pool, i, 1);
+        }
+    }
+    return 0;
+}
+
+/* get_render_target_pool_stats(pool) -> hits, misses, resident bytes, number of targets, targets in use */
+static int lg_get_render_target_pool_stats( lua_State *L ) {
+    int i, in_use = 0;
+    render_target_pool_t *pool = to_render_target_pool(L, 1);
+    for ( i = 0; i < pool->count; ++i ) {
+        in_use += pool->targets[i].in_use;
+    }
+    lua_pushinteger(L, pool->hits);
+    lua_pushinteger(L, pool->misses);
+    lua_pushinteger(L, (lua_Integer) pool->resident_bytes);
+    lua_pushinteger(L, pool->count);
+    lua_pushinteger(L, in_use);
+    return 5;
+}
+
+
+/*
+================================================================================
+
+                Animation
+
+    An animation is a sequence of bitmap regions with durations. An
+    animator holds many playing instances, advances all of them in C and
+    draws their current frames with one al_draw_prim call per texture.
+    Instance ids are 1-based slots and are reused after remove().
+
+================================================================================
+*/
+/* create_animation(bitmap, {{x, y, w, h, duration, [ox, oy]}, ...}, [loop = true]) */
+static int lg_create_animation( lua_State *L ) {
+    int i, j, count;
+    float values[7];
+    animation_t *animation;
+    animation_frame_t *frame;
+    ALLEGRO_BITMAP *bitmap = to_bitmap(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    count = (int) lua_rawlen(L, 2);
+    luaL_argcheck(L, count > 0, 2, "no frames");
+    animation = (animation_t*) push_data(L, LEGATO_ANIMATION, sizeof(animation_t) + sizeof(animation_frame_t) * (count - 1));
+    animation->bitmap = bitmap;
+    animation->bitmap_ref = LUA_NOREF;
+    animation->count = count;
+    animation->loop = lua_isnoneornil(L, 3) ? 1 : lua_toboolean(L, 3);
+    animation->total = 0.0f;
+    for ( i = 0; i < count; ++i ) {
+        lua_rawgeti(L, 2, i + 1);
+        luaL_argcheck(L, lua_istable(L, -1), 2, "frames must be tables");
+        for ( j = 0; j < 7; ++j ) {
+            lua_rawgeti(L, -1, j + 1);
+            values[j] = (float) (j < 5 ? luaL_checknumber(L, -1) : luaL_optnumber(L, -1, 0.0));
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+        luaL_argcheck(L, values[4] > 0.0f, 2, "frame durations must be positive");
+        frame = &animation->frames[i];
+        frame->x = values[0]; frame->y = values[1];
+        frame->w = values[2]; frame->h = values[3];
+        frame->duration = values[4];
+        frame->ox = values[5]; frame->oy = values[6];
+        animation->total += frame->duration;
+    }
+    lua_pushvalue(L, 1); /* keep the bitmap alive as long as the animation */
+    animation->bitmap_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return 1;
+}
+
+static int lg_destroy_animation( lua_State *L ) {
+    animation_t *animation = (animation_t*) luaL_checkudata(L, 1, LEGATO_ANIMATION);
+    luaL_unref(L, LUA_REGISTRYINDEX, animation->bitmap_ref);
+    animation->bitmap_ref = LUA_NOREF;
+    animation->bitmap = NULL;
+    return 0;
+}
+
+/* get_animation_length(animation) -> number of frames, duration of one pass */
+static int lg_get_animation_length( lua_State *L ) {
+    animation_t *animation = to_animation(L, 1);
+    lua_pushinteger(L, animation->count);
+    lua_pushnumber(L, animation->total);
+    return 2;
+}
+
+/* create_animator(capacity, [tick_duration = 1/60]) */
+static int lg_create_animator( lua_State *L ) {
+    animator_t *animator;
+    const int capacity = luaL_checkint(L, 1);
+    const lua_Number tick = luaL_optnumber(L, 2, 1.0 / 60.0);
+    luaL_argcheck(L, capacity > 0, 1, "invalid capacity");
+    luaL_argcheck(L, tick > 0.0, 2, "invalid tick duration");
+    animator = (animator_t*) push_data(L, LEGATO_ANIMATOR, sizeof(animator_t) +
+            (sizeof(animator_instance_t) + sizeof(ALLEGRO_VERTEX) * 6) * capacity);
+    animator->capacity = capacity;
+    animator->count = 0;
+    animator->tick = (float) tick;
+    animator->instances = (animator_instance_t*) (animator + 1);
+    animator->vertices = (ALLEGRO_VERTEX*) (animator->instances + capacity);
+    memset(animator->instances, 0, sizeof(animator_instance_t) * capacity);
+    lua_newtable(L); /* animations of the instances */
+    animator->animations_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return 1;
+}
+
+static int lg_destroy_animator( lua_State *L ) {
+    animator_t *animator = (animator_t*) luaL_checkudata(L, 1, LEGATO_ANIMATOR);
+    luaL_unref(L, LUA_REGISTRYINDEX, animator->animations_ref);
+    animator->animations_ref = LUA_NOREF;
+    animator->count = 0;
+    return 0;
+}
+
+static animator_instance_t *to_animator_instance( lua_State *L, animator_t *animator, const int idx ) {
+    const int id = luaL_checkint(L, idx);
+    luaL_argcheck(L, id >= 1 && id <= animator->count && animator->instances[id - 1].animation, idx, "invalid instance id");
+    return &animator->instances[id - 1];
+}
+
+static void set_animator_animation( lua_State *L, animator_t *animator, const int id, const int idx ) {
+    animator_instance_t *instance = &animator->instances[id - 1];
+    instance->animation = to_animation(L, idx);
+    instance->frame = 0;
+    instance->time = 0.0f;
+    instance->finished = 0;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, animator->animations_ref);
+    lua_pushvalue(L, idx);
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 1);
+}
+
+/* add_to_animator(animator, animation, x, y, [flags, tint]) -> instance id */
+static int lg_add_to_animator( lua_State *L ) {
+    int i = 0, flags;
+    float x, y;
+    ALLEGRO_COLOR tint;
+    animator_instance_t *instance;
+    animator_t *animator = to_animator(L, 1);
+    x = (float) luaL_checknumber(L, 3);
+    y = (float) luaL_checknumber(L, 4);
+    flags = get_draw_bitmap_flags(L, 5);
+    tint = lua_isnoneornil(L, 6) ? al_map_rgba_f(1.0f, 1.0f, 1.0f, 1.0f) : to_color(L, 6);
+    while ( i < animator->capacity && animator->instances[i].animation ) {
+        ++i;
+    }
+    if ( i >= animator->capacity ) {
+        return luaL_error(L, "animator is full (capacity %d)", animator->capacity);
+    }
+    set_animator_animation(L, animator, i + 1, 2);
+    instance = &animator->instances[i];
+    instance->x = x;
+    instance->y = y;
+    instance->flags = flags;
+    instance->tint = tint;
+    instance->speed = 1.0f;
+    if ( i >= animator->count ) {
+        animator->count = i + 1;
+    }
+    lua_pushinteger(L, i + 1);
+    return 1;
+}
+
+static int lg_remove_from_animator( lua_State *L ) {
+    animator_t *animator = to_animator(L, 1);
+    animator_instance_t *instance = to_animator_instance(L, animator, 2);
+    const int id = (int) (instance - animator->instances) + 1;
+    instance->animation = NULL;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, animator->animations_ref);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 1);
+    while ( animator->count > 0 && animator->instances[animator->count - 1].animation == NULL ) {
+        animator->count--;
+    }
+    return 0;
+}
+
+static int lg_clear_animator( lua_State *L ) {
+    animator_t *animator = to_animator(L, 1);
+    memset(animator->instances, 0, sizeof(animator_instance_t) * animator->count);
+    animator->count = 0;
+    lua_newtable(L);
+    lua_rawseti(L, LUA_REGISTRYINDEX, animator->animations_ref);
+    return 0;
+}
+
+/* set_animator_animation(animator, id, animation) - restarts the instance with another animation */
+static int lg_set_animator_animation( lua_State *L ) {
+    animator_t *animator = to_animator(L, 1);
+    animator_instance_t *instance = to_animator_instance(L, animator, 2);
+    set_animator_animation(L, animator, (int) (instance - animator->instances) + 1, 3);
+    return 0;
+}
+
+static int lg_set_animator_position( lua_State *L ) {
+    animator_instance_t *instance = to_animator_instance(L, to_animator(L, 1), 2);
+    instance->x = (float) luaL_checknumber(L, 3);
+    instance->y = (float) luaL_checknumber(L, 4);
+    return 0;
+}
+
+/* set_animator_speed(animator, id, speed) - 0 pauses the instance */
+static int lg_set_animator_speed( lua_State *L ) {
+    animator_instance_t *instance = to_animator_instance(L, to_animator(L, 1), 2);
+    instance->speed = (float) luaL_checknumber(L, 3);
+    return 0;
+}
+
+static int lg_set_animator_flags( lua_State *L ) {
+    animator_instance_t *instance = to_animator_instance(L, to_animator(L, 1), 2);
+    instance->flags = get_draw_bitmap_flags(L, 3);
+    return 0;
+}
+
+static int lg_set_animator_tint( lua_State *L ) {
+    animator_instance_t *instance = to_animator_instance(L, to_animator(L, 1), 2);
+    instance->tint = to_color(L, 3);
+    return 0;
+}
+
+/* get_animator_frame(animator, id) -> current frame (1-based), finished */
+static int lg_get_animator_frame( lua_State *L ) {
+    animator_instance_t *instance = to_animator_instance(L, to_animator(L, 1), 2);
+    lua_pushinteger(L, instance->frame + 1);
+    lua_pushboolean(L, instance->finished);
+    return 2;
+}
+
+static int lg_get_animator_count( lua_State *L ) {
+    int i, count = 0;
+    animator_t *animator = to_animator(L, 1);
+    for ( i = 0; i < animator->count; ++i ) {
+        count += animator->instances[i].animation != NULL;
+    }
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+static void advance_animator( animator_t *animator, const float dt ) {
+    int i, j;
+    animator_instance_t *instance;
+    const animation_t *animation;
+    for ( i = 0; i < animator->count; ++i ) {
+        instance = &animator->instances[i];
+        animation = instance->animation;
+        if ( animation == NULL || instance->finished ) {
+            continue;
+        }
+        instance->time += dt * instance->speed;
+        if ( animation->loop && instance->time >= animation->total ) {
+            for ( j = 0; j < instance->frame; ++j ) { /* time is relative to the current frame, make it absolute */
+                instance->time += animation->frames[j].duration;
+            }
+            instance->time = fmodf(instance->time, animation->total);
+            instance->frame = 0;
+        }
+        while ( instance->time >= animation->frames[instance->frame].duration ) {
+            instance->time -= animation->frames[instance->frame].duration;
+            if ( ++instance->frame >= animation->count ) {
+                if ( animation->loop ) {
+                    instance->frame = 0;
+                } else {
+                    instance->frame = animation->count - 1;
+                    instance->time = 0.0f;
+                    instance->finished = 1;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/* update_animator(animator, dt) */
+static int lg_update_animator( lua_State *L ) {
+    animator_t *animator = to_animator(L, 1);
+    advance_animator(animator, (float) luaL_checknumber(L, 2));
+    return 0;
+}
+
+/* update_animator_ticks(animator, count, [timer]) - count is the count of timer events */
+static int lg_update_animator_ticks( lua_State *L ) {
+    animator_t *animator = to_animator(L, 1);
+    const lua_Number count = luaL_checknumber(L, 2);
+    const double tick = lua_isnoneornil(L, 3) ? animator->tick : al_get_timer_speed(to_timer(L, 3));
+    advance_animator(animator, (float) (count * tick));
+    return 0;
+}
+
+/* draw_animator(animator) -> number of drawn instances */
+static int lg_draw_animator( lua_State *L ) {
+    int i, count = 0, drawn = 0;
+    float u1, v1, u2, v2, x, y;
+    ALLEGRO_BITMAP *texture = NULL, *bitmap = NULL;
+    const animation_t *animation = NULL;
+    const animator_instance_t *instance;
+    const animation_frame_t *frame;
+    animator_t *animator = to_animator(L, 1);
+    NOT_RECORDABLE_MACRO("draw_animator");
+    for ( i = 0; i < animator->count; ++i ) {
+        instance = &animator->instances[i];
+        if ( instance->animation == NULL || instance->animation->bitmap == NULL ) {
+            continue;
+        }
+        if ( instance->animation != animation ) { /* bitmap:destroy() frees the bitmap despite the reference */
+            animation = instance->animation;
+            bitmap = (ALLEGRO_BITMAP*) get_ref_object(L, animation->bitmap_ref);
+        }
+        if ( bitmap == NULL ) {
+            continue;
+        }
+        if ( bitmap != texture && count > 0 ) {
+            mark_dirty_vertices(animator->vertices, count * 6);
+            al_draw_prim(animator->vertices, NULL, texture, 0, count * 6, ALLEGRO_PRIM_TRIANGLE_LIST);
+            count = 0;
+        }
+        texture = bitmap;
+        frame = &instance->animation->frames[instance->frame];
+        u1 = frame->x; u2 = frame->x + frame->w;
+        v1 = frame->y; v2 = frame->y + frame->h;
+        if ( instance->flags & ALLEGRO_FLIP_HORIZONTAL ) { u1 = u2; u2 = frame->x; }
+        if ( instance->flags & ALLEGRO_FLIP_VERTICAL ) { v1 = v2; v2 = frame->y; }
+        x = instance->x - frame->ox;
+        y = instance->y - frame->oy;
+        set_quad_vertices(animator->vertices + count * 6, x, y, x + frame->w, y + frame->h, u1, v1, u2, v2, instance->tint);
+        ++count;
+        ++drawn;
+    }
+    if ( count > 0 ) {
+        mark_dirty_vertices(animator->vertices, count * 6);
+        al_draw_prim(animator->vertices, NULL, texture, 0, count * 6, ALLEGRO_PRIM_TRIANGLE_LIST);
+    }
+    lua_pushinteger(L, drawn);
+    return 1;
+}
+
+/*
+================================================================================
+
+                Input snapshot
+
+================================================================================
+*/
+/*
+    Keys, mouse buttons and joystick buttons share one bit index space
+    (keys use their keycode, see mouse_input() and joystick_input()), so
+    pressed/released/held are bit tests of the current and previous frame.
+*/
+#define INPUT_BIT(bits, input) (((bits)[(input) >> 5] >> ((input) & 31)) & 1)
+
+/* input code or action name at idx -> index of the action or -1 for an input code */
+static int get_snapshot_input( lua_State *L, input_snapshot_t *snapshot, const int idx, int *input ) {
+    int i;
+    const char *name;
+    if ( lua_type(L, idx) == LUA_TSTRING ) {
+        name = lua_tostring(L, idx);
+        for ( i = 0; i < snapshot->action_count && strcmp(snapshot->actions[i].name, name) != 0; ++i );
+        if ( i == snapshot->action_count ) {
+            return luaL_error(L, "unknown action " LUA_QS, name);
+        }
+        return i;
+    }
+    *input = luaL_checkint(L, idx);
+    luaL_argcheck(L, *input >= 0 && *input < LEGATO_INPUT_MAX, idx, "invalid input");
+    return -1;
+}
+
+/* state of an input or action, frame 0 is the current and 1 the previous frame */
+static int get_snapshot_state( const input_snapshot_t *snapshot, const int action, const int input, const int frame ) {
+    int i;
+    const uint32_t *bits = snapshot->bits[frame];
+    if ( action < 0 ) {
+        return INPUT_BIT(bits, input);
+    }
+    for ( i = 0; i < snapshot->actions[action].count; ++i ) {
+        if ( INPUT_BIT(bits, snapshot->actions[action].inputs[i]) ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* create_input_snapshot() */
+static int lg_create_input_snapshot( lua_State *L ) {
+    input_snapshot_t *snapshot = (input_snapshot_t*) push_data(L, LEGATO_INPUT_SNAPSHOT, sizeof(input_snapshot_t));
+    memset(snapshot, 0, sizeof(input_snapshot_t));
+    return 1;
+}
+
+/* update_input_snapshot(snapshot) - reads the keyboard, mouse and joystick state, call it once per frame */
+static int lg_update_input_snapshot( lua_State *L ) {
+    int i, j, num_joysticks;
+    ALLEGRO_KEYBOARD_STATE keyboard;
+    ALLEGRO_MOUSE_STATE mouse;
+    input_snapshot_t *snapshot = to_input_snapshot(L, 1);
+    uint32_t *bits = snapshot->bits[0];
+    memcpy(snapshot->bits[1], bits, sizeof(snapshot->bits[1]));
+    memset(bits, 0, sizeof(snapshot->bits[0]));
+    if ( al_is_keyboard_installed() ) {
+        al_get_keyboard_state(&keyboard);
+        for ( i = 1; i < ALLEGRO_KEY_MAX; ++i ) {
+            if ( al_key_down(&keyboard, i) ) {
+                bits[i >> 5] |= 1u << (i & 31);
+            }
+        }
+    }
+    if ( al_is_mouse_installed() ) {
+        al_get_mouse_state(&mouse);
+        bits[LEGATO_INPUT_MOUSE >> 5] = (uint32_t) mouse.buttons;
+        snapshot->mouse_dx = mouse.x - snapshot->mouse_x;
+        snapshot->mouse_dy = mouse.y - snapshot->mouse_y;
+        snapshot->mouse_dz = mouse.z - snapshot->mouse_z;
+        snapshot->mouse_dw = mouse.w - snapshot->mouse_w;
+        snapshot->mouse_x = mouse.x;
+        snapshot->mouse_y = mouse.y;
+        snapshot->mouse_z = mouse.z;
+        snapshot->mouse_w = mouse.w;
+    }
+    num_joysticks = al_is_joystick_installed() ? al_get_num_joysticks() : 0;
+    snapshot->num_joysticks = num_joysticks < LEGATO_INPUT_JOYSTICKS ? num_joysticks : LEGATO_INPUT_JOYSTICKS;
+    for ( i = 0; i < snapshot->num_joysticks; ++i ) {
+        al_get_joystick_state(al_get_joystick(i), &snapshot->joysticks[i]);
+        for ( j = 0; j < _AL_MAX_JOYSTICK_BUTTONS; ++j ) {
+            if ( snapshot->joysticks[i].button[j] ) {
+                bits[(LEGATO_INPUT_JOYSTICK >> 5) + i] |= 1u << j;
+            }
+        }
+    }
+    return 0;
+}
+
+/* input_snapshot_pressed(snapshot, input or action) - down now, but not in the previous frame */
+static int lg_input_snapshot_pressed( lua_State *L ) {
+    int input = 0, action;
+    input_snapshot_t *snapshot = to_input_snapshot(L, 1);
+    action = get_snapshot_input(L, snapshot, 2, &input);
+    lua_pushboolean(L, get_snapshot_state(snapshot, action, input, 0) && ! get_snapshot_state(snapshot, action, input, 1));
+    return 1;
+}
+
+/* input_snapshot_released(snapshot, input or action) - down in the previous frame, but not now */
+static int lg_input_snapshot_released( lua_State *L ) {
+    int input = 0, action;
+    input_snapshot_t *snapshot = to_input_snapshot(L, 1);
+    action = get_snapshot_input(L, snapshot, 2, &input);
+    lua_pushboolean(L, ! get_snapshot_state(snapshot, action, input, 0) && get_snapshot_state(snapshot, action, input, 1));
+    return 1;
+}
+
+/* input_snapshot_held(snapshot, input or action) */
+static int lg_input_snapshot_held( lua_State *L ) {
+    int input = 0, action;
+    input_snapshot_t *snapshot = to_input_snapshot(L, 1);
+    action = get_snapshot_input(L, snapshot, 2, &input);
+    lua_pushboolean(L, get_snapshot_state(snapshot, action, input, 0));
+    return 1;
+}
+
+/* bind_input_action(snapshot, action, {input, ...}) - an empty table or nil removes the action */
+static int lg_bind_input_action( lua_State *L ) {
+    int i, count = 0, inputs[LEGATO_INPUT_BINDINGS_MAX];
+    action_binding_t *action;
+    input_snapshot_t *snapshot = to_input_snapshot(L, 1);
+    const char *name = luaL_checkstring(L, 2);
+    luaL_argcheck(L, strlen(name) < sizeof(action->name), 2, "action name is too long");
+    if ( ! lua_isnoneornil(L, 3) ) {
+        luaL_checktype(L, 3, LUA_TTABLE);
+        count = (int) lua_rawlen(L, 3);
+        luaL_argcheck(L, count <= LEGATO_INPUT_BINDINGS_MAX, 3, "too many inputs");
+        for ( i = 0; i < count; ++i ) {
+            lua_rawgeti(L, 3, i + 1);
+            inputs[i] = luaL_checkint(L, -1);
+            luaL_argcheck(L, inputs[i] >= 0 && inputs[i] < LEGATO_INPUT_MAX, 3, "invalid input");
+            lua_pop(L, 1);
+        }
+    }
+    for ( i = 0; i < snapshot->action_count && strcmp(snapshot->actions[i].name, name) != 0; ++i );
+    if ( count == 0 ) {
+        if ( i < snapshot->action_count ) {
+            snapshot->actions[i] = snapshot->actions[--snapshot->action_count];
+        }
+        return 0;
+    }
+    luaL_argcheck(L, i < LEGATO_INPUT_ACTIONS_MAX, 2, "too many actions");
+    action = &snapshot->actions[i];
+    memcpy(action->inputs, inputs, sizeof(int) * count);
+    if ( i == snapshot->action_count ) {
+        strcpy(action->name, name);
+        ++snapshot->action_count;
+    }
+    action->count = count;
+    return 0;
+}
+
+/* get_input_snapshot_mouse(snapshot) -> x, y, z, w, dx, dy, dz, dw */
+static int lg_get_input_snapshot_mouse( lua_State *L ) {
+    input_snapshot_t *snapshot = to_input_snapshot(L, 1);
+    lua_pushinteger(L, snapshot->mouse_x);
+    lua_pushinteger(L, snapshot->mouse_y);
+    lua_pushinteger(L, snapshot->mouse_z);
+    lua_pushinteger(L, snapshot->mouse_w);
+    lua_pushinteger(L, snapshot->mouse_dx);
+    lua_pushinteger(L, snapshot->mouse_dy);
+    lua_pushinteger(L, snapshot->mouse_dz);
+    lua_pushinteger(L, snapshot->mouse_dw);
+    return 8;
+}
+
+/* get_input_snapshot_axis(snapshot, joystick, stick, axis) - indices start at 0 like al.get_joystick() */
+static int lg_get_input_snapshot_axis( lua_State *L ) {
+    input_snapshot_t *snapshot = to_input_snapshot(L, 1);
+    const int joystick = luaL_checkint(L, 2);
+    const int stick = luaL_checkint(L, 3);
+    const int axis = luaL_checkint(L, 4);
+    luaL_argcheck(L, stick >= 0 && stick < _AL_MAX_JOYSTICK_STICKS, 3, "invalid stick");
+    luaL_argcheck(L, axis >= 0 && axis < _AL_MAX_JOYSTICK_AXES, 4, "invalid axis");
+    if ( joystick < 0 || joystick >= snapshot->num_joysticks ) {
+        lua_pushnumber(L, 0.0);
+    } else {
+        lua_pushnumber(L, snapshot->joysticks[joystick].stick[stick].axis[axis]);
+    }
+    return 1;
+}
+
+/* mouse_input(button) -> input code of a mouse button (1 is the first button) */
+static int lg_mouse_input( lua_State *L ) {
+    const int button = luaL_checkint(L, 1);
+    luaL_argcheck(L, button >= 1 && button <= 32, 1, "invalid button");
+    lua_pushinteger(L, LEGATO_INPUT_MOUSE + button - 1);
+    return 1;
+}
+
+/* joystick_input(joystick, button) -> input code of a joystick button (both start at 0) */
+static int lg_joystick_input( lua_State *L ) {
+    const int joystick = luaL_checkint(L, 1);
+    const int button = luaL_checkint(L, 2);
+    luaL_argcheck(L, joystick >= 0 && joystick < LEGATO_INPUT_JOYSTICKS, 1, "invalid joystick");
+    luaL_argcheck(L, button >= 0 && button < _AL_MAX_JOYSTICK_BUTTONS, 2, "invalid button");
+    lua_pushinteger(L, LEGATO_INPUT_JOYSTICK + joystick * 32 + button);
+    return 1;
+}
+
+/*
+================================================================================
+
+                FUNCTION DEFS
+
+================================================================================
+*/
+static const luaL_Reg lg__functions[] = {
+
+    {"create_config", lg_create_config},
+    {"destroy_config", lg_destroy_config},
+    {"load_config_file", lg_load_config_file},
+    {"save_config_file", lg_save_config_file},
+    {"add_config_section", lg_add_config_section},
+    {"add_config_comment", lg_add_config_comment},
+    {"get_config_value", lg_get_config_value},
+    {"set_config_value", lg_set_config_value},
+    {"get_config_sections", lg_get_config_sections},
+    {"get_config_entries", lg_get_config_entries},
+    {"merge_config", lg_merge_config},
+    {"merge_config_into", lg_merge_config_into},
+
+    {"create_display", lg_create_display},
+    {"destroy_display", lg_destroy_display},
+    {"get_new_display_flags", lg_get_new_display_flags},
+    {"set_new_display_flags", lg_set_new_display_flags},
+    {"get_new_display_option", lg_get_new_display_option},
+    {"set_new_display_option", lg_set_new_display_option},
+    {"reset_new_display_options", lg_reset_new_display_options},
+    {"get_new_window_position", lg_get_new_window_position},
+    {"set_new_window_position", lg_set_new_window_position},
+    {"get_new_display_refresh_rate", lg_get_new_display_refresh_rate},
+    {"set_new_display_refresh_rate", lg_set_new_display_refresh_rate},
+    {"get_backbuffer", lg_get_backbuffer},
+    {"flip_display", lg_flip_display},
+    {"update_display_region", lg_update_display_region},
+    {"start_capture", lg_start_capture},
+    {"stop_capture", lg_stop_capture},
+    {"is_capturing", lg_is_capturing},
+    {"get_capture_stats", lg_get_capture_stats},
+    {"set_dirty_rectangles", lg_set_dirty_rectangles},
+    {"get_dirty_rectangles", lg_get_dirty_rectangles},
+    {"mark_dirty_rectangle", lg_mark_dirty_rectangle},
+    {"set_culling", lg_set_culling},
+    {"get_culling_stats", lg_get_culling_stats},
+    {"reset_culling_stats", lg_reset_culling_stats},
+    {"wait_for_vsync", lg_wait_for_vsync},
+    {"get_display_width", lg_get_display_width},
+    {"get_display_height", lg_get_display_height},
+    {"get_display_size", lg_get_display_size},
+    {"resize_display", lg_resize_display},
+    {"acknowledge_display", lg_acknowledge_resize},
+    {"get_window_position", lg_get_window_position},
+    {"set_window_position", lg_set_window_position},
+    {"get_display_flags", lg_get_display_flags},
+    {"set_display_flag", lg_set_display_flag},
+    {"get_display_option", lg_get_display_option},
+    {"get_display_format", lg_get_display_format},
+    {"get_dsplay_refresh_rate", lg_get_display_refresh_rate},
+    {"set_window_title", lg_set_window_title},
+    {"set_display_icon", lg_set_display_icon},
+    {"set_display_icons", lg_set_display_icons},
+    {"inhibit_screensaver", lg_inhibit_screensaver},
+
+    {"create_event_queue", lg_create_event_queue},
+    {"destroy_event_queue", lg_destroy_event_queue},
+    {"register_event_source", lg_register_event_source},
+    {"unregister_event_source", lg_unregister_event_source},
+    {"is_event_queue_empty", lg_is_event_queue_empty},
+    {"get_next_event", lg_get_next_event},
+    {"peek_next_event", lg_peek_next_event},
+    {"drop_next_event", lg_drop_next_event},
+    {"flush_event_queue", lg_flush_event_queue},
+    {"drain_events", lg_drain_events},
+    {"drain_events_packed", lg_drain_events_packed},
+    {"set_event_filter", lg_set_event_filter},
+    {"set_event_coalescing", lg_set_event_coalescing},
+    {"start_input_recording", lg_start_input_recording},
+    {"stop_input_recording", lg_stop_input_recording},
+    {"start_input_replay", lg_start_input_replay},
+    {"stop_input_replay", lg_stop_input_replay},
+    {"is_replaying_input", lg_is_replaying_input},
+    {"set_event_type_codes", lg_set_event_type_codes},
+    {"wait_for_event", lg_wait_for_event},
+    {"wait_for_event_timed", lg_wait_for_event_timed},
+    {"wait_for_event_until", lg_wait_for_event_until},
+
+    {"load_bitmap_async", lg_load_bitmap_async},
+    {"load_sample_async", lg_load_sample_async},
+    {"load_ttf_font_async", lg_load_ttf_font_async},
+    {"get_async_status", lg_get_async_status},
+    {"set_async_priority", lg_set_async_priority},
+    {"cancel_async_load", lg_cancel_async_load},
+    {"get_async_result", lg_get_async_result},
+
+    {"get_display_modes", lg_get_display_modes},
+
+    {"is_joystick_installed", lg_is_joystick_installed},
+    {"reconfigure_joysticks", lg_reconfigure_joysticks},
+    {"get_num_joysticks", lg_get_num_joysticks},
+    {"get_joystick", lg_get_joystick},
+    {"release_joystick", lg_release_joystick},
+    {"get_joystick_active", lg_get_joystick_active},
+    {"get_joystick_name", lg_get_joystick_name},
+    {"get_joystick_stick_name", lg_get_joystick_stick_name},
+    {"get_joystick_axis_name", lg_get_joystick_axis_name},
+    {"get_joystick_button_name", lg_get_joystick_button_name},
+    {"get_joystick_stick_flags", lg_get_joystick_stick_flags},
+    {"get_joystick_num_sticks", lg_get_joystick_num_sticks},
+    {"get_joystick_num_axes", lg_get_joystick_num_axes},
+    {"get_joystick_num_buttons", lg_get_joystick_num_buttons},
+    {"get_joystick_state", lg_get_joystick_state},
+
+    {"map_rgb", lg_map_rgb},
+    {"map_rgb_f", lg_map_rgb_f},
+    {"unmap_rgb", lg_unmap_rgb},
+    {"unmap_rgb_f", lg_unmap_rgb_f},
+    {"pack_rgb", lg_pack_rgb},
+    {"pack_rgb_f", lg_pack_rgb_f},
+    {"pack_color", lg_pack_color},
+    {"get_pixel_size", lg_get_pixel_size},
+    {"get_pixel_format_bits", lg_get_pixel_format_bits},
+    {"lock_bitmap", lg_lock_bitmap},
+    {"lock_bitmap_region", lg_lock_bitmap_region},
+    {"unlock_bitmap", lg_unlock_bitmap},
+    {"create_bitmap", lg_create_bitmap},
+    {"create_sub_bitmap", lg_create_sub_bitmap},
+    {"clone_bitmap", lg_clone_bitmap},
+    {"destroy_bitmap", lg_destroy_bitmap},
+    {"get_new_bitmap_flags", lg_get_new_bitmap_flags},
+    {"get_new_bitmap_format", lg_get_new_bitmap_format},
+    {"set_new_bitmap_flags", lg_set_new_bitmap_flags},
+    {"add_new_bitmap_flag", lg_add_new_bitmap_flag},
+    {"set_new_bitmap_format", lg_set_new_bitmap_format},
+    {"get_bitmap_flags", lg_get_bitmap_flags},
+    {"get_bitmap_format", lg_get_bitmap_format},
+    {"get_bitmap_height", lg_get_bitmap_height},
+    {"get_bitmap_width", lg_get_bitmap_width},
+    {"get_bitmap_size", lg_get_bitmap_size},
+    {"get_pixel", lg_get_pixel},
+    {"is_bitmap_locked", lg_is_bitmap_locked},
+    {"is_compatible_bitmap", lg_is_compatible_bitmap},
+    {"is_sub_bitmap", lg_is_sub_bitmap},
+    {"get_parent_bitmap", lg_get_parent_bitmap},
+    {"clear_to_color", lg_clear_to_color},
+    {"draw_bitmap", lg_draw_bitmap},
+    {"draw_tinted_bitmap", lg_draw_tinted_bitmap},
+    {"set_software_blitter", lg_set_software_blitter},
+    {"get_software_blitter", lg_get_software_blitter},
+    {"draw_bitmap_region", lg_draw_bitmap_region},
+    {"draw_tinted_bitmap_region", lg_draw_tinted_bitmap_region},
+    {"draw_pixel", lg_draw_pixel},
+    {"draw_rotated_bitmap", lg_draw_rotated_bitmap},
+    {"draw_tinted_rotated_bitmap", lg_draw_tinted_rotated_bitmap},
+    {"draw_scaled_rotated_bitmap", lg_draw_scaled_rotated_bitmap},
+    {"draw_tinted_scaled_rotated_bitmap", lg_draw_tinted_scaled_rotated_bitmap},
+    {"draw_tinted_scaled_rotated_bitmap_region", lg_draw_tinted_scaled_rotated_bitmap_region},
+    {"draw_scaled_bitmap", lg_draw_scaled_bitmap},
+    {"draw_tinted_scaled_bitmap", lg_draw_tinted_scaled_bitmap},
+    {"get_target_bitmap", lg_get_target_bitmap},
+    {"put_pixel", lg_put_pixel},
+    {"put_blended_pixel", lg_put_blended_pixel},
+    {"set_target_bitmap", lg_set_target_bitmap},
+    {"set_target_backbuffer", lg_set_target_backbuffer},
+    {"get_current_display", lg_get_current_display},
+    {"get_blender", lg_get_blender},
+    {"get_separate_blender", lg_get_separate_blender},
+    {"set_blender", lg_set_blender},
+    {"set_separate_blender", lg_set_separate_blender},
+    {"get_clipping_rectangle", lg_get_clipping_rectangle},
+    {"set_clipping_rectangle", lg_set_clipping_rectangle},
+    {"reset_clipping_rectangle", lg_reset_clipping_rectangle},
+    {"convert_mask_to_alpha", lg_convert_mask_to_alpha},
+    {"hold_bitmap_drawing", lg_hold_bitmap_drawing},
+    {"is_bitmap_drawing_held", lg_is_bitmap_drawing_held},
+    {"load_bitmap", lg_load_bitmap},
+    {"save_bitmap", lg_save_bitmap},
+
+    {"is_keyboard_installed", lg_is_keyboard_installed},
+    {"create_keyboard_state", lg_create_keyboard_state},
+    {"get_keyboard_state", lg_get_keyboard_state},
+    {"key_down", lg_key_down},
+    {"keycode_to_name", lg_keycode_to_name},
+    {"set_keyboard_leds", lg_set_keyboard_leds},
+
+    {"get_new_display_adapter", lg_get_new_display_adapter},
+    {"set_new_display_adapter", lg_set_new_display_adapter},
+    {"get_monitor_info", lg_get_monitor_info},
+
+    {"is_mouse_installed", lg_is_mouse_installed},
+    {"get_mouse_num_axes", lg_get_mouse_num_axes},
+    {"get_mouse_num_buttons", lg_get_mouse_num_buttons},
+    {"create_mouse_state", lg_create_mouse_state},
+    {"get_mouse_state", lg_get_mouse_state},
+    {"get_mouse_state_axis", lg_get_mouse_state_axis},
+    {"mouse_button_down", lg_mouse_button_down},
+    {"set_mouse_xy", lg_set_mouse_xy},
+    {"set_mouse_z", lg_set_mouse_z},
+    {"set_mouse_w", lg_set_mouse_w},
+    {"set_mouse_axis", lg_set_mouse_axis},
+    {"create_mouse_cursor", lg_create_mouse_cursor},
+    {"destroy_mouse_cursor", lg_destroy_mouse_cursor},
+    {"set_mouse_cursor", lg_set_mouse_cursor},
+    {"set_system_mouse_cursor", lg_set_system_mouse_cursor},
+    {"get_mouse_cursor_position", lg_get_mouse_cursor_position},
+    {"hide_mouse_cursor", lg_hide_mouse_cursor},
+    {"show_mouse_cursor", lg_show_mouse_cursor},
+    {"grab_mouse", lg_grab_mouse},
+    {"ungrab_mouse", lg_ungrab_mouse},
 
     {"create_path", lg_create_path},
     {"create_path_for_directory", lg_create_path_for_directory},
@@ -3457,958 +8208,1570 @@ static const luaL_Reg lg__functions[] = {
     {"path_str", lg_path_str},
     {"make_path_canonical", lg_make_path_canonical},
 
-    {"restore_state", lg_restore_state},
-    {"store_state", lg_store_state},
-    {"get_errno", lg_get_errno},
-    {"set_errno", lg_set_errno},
+    {"restore_state", lg_restore_state},
+    {"store_state", lg_store_state},
+    {"get_errno", lg_get_errno},
+    {"set_errno", lg_set_errno},
+
+    {"get_allegro_version", lg_get_allegro_version},
+    {"get_standard_path", lg_get_standard_path},
+    {"set_exe_name", lg_set_exe_name},
+    {"set_app_name", lg_set_app_name},
+    {"set_org_name", lg_set_org_name},
+    {"get_app_name", lg_get_app_name},
+    {"get_org_name", lg_get_org_name},
+    {"get_system_config", lg_get_system_config},
+
+    {"get_time", lg_get_time},
+    {"rest", lg_rest},
+
+    {"create_timer", lg_create_timer},
+    {"start_timer", lg_start_timer},
+    {"stop_timer", lg_stop_timer},
+    {"get_timer_started", lg_get_timer_started},
+    {"destroy_timer", lg_destroy_timer},
+    {"get_timer_count", lg_get_timer_count},
+    {"set_timer_count", lg_set_timer_count},
+    {"add_timer_count", lg_add_timer_count},
+    {"get_timer_speed", lg_get_timer_speed},
+    {"set_timer_speed", lg_set_timer_speed},
+
+    {"create_transform", lg_create_transform},
+    {"copy_transform", lg_copy_transform},
+    {"use_transform", lg_use_transform},
+    {"get_current_transform", lg_get_current_transform},
+    {"invert_transform", lg_invert_transform},
+    {"check_inverse", lg_check_inverse},
+    {"identity_transform", lg_identity_transform},
+    {"build_transform", lg_build_transform},
+    {"translate_transform", lg_translate_transform},
+    {"rotate_transform", lg_rotate_transform},
+    {"scale_transform", lg_scale_transform},
+    {"transform_coordinates", lg_transform_coordinates},
+    {"transform_points", lg_transform_points},
+    {"compose_transform", lg_compose_transform},
+
+    {"is_audio_installed", lg_is_audio_installed},
+    {"reserve_samples", lg_reserve_samples},
+    {"get_audio_depth_size", lg_get_audio_depth_size},
+    {"get_channel_count", lg_get_channel_count},
+    {"create_voice", lg_create_voice},
+    {"destroy_voice", lg_destroy_voice},
+    {"detach_voice", lg_detach_voice},
+    {"attach_audio_stream_to_voice", lg_attach_audio_stream_to_voice},
+    {"attach_mixer_to_voice", lg_attach_mixer_to_voice},
+    {"attach_sample_instance_to_voice", lg_attach_sample_instance_to_voice},
+    {"get_voice_frequency", lg_get_voice_frequency},
+    {"get_voice_channels", lg_get_voice_channels},
+    {"get_voice_depth", lg_get_voice_depth},
+    {"get_voice_playing", lg_get_voice_playing},
+    {"set_voice_playing", lg_set_voice_playing},
+    {"get_voice_position", lg_get_voice_position},
+    {"set_voice_position", lg_set_voice_position},
+    
+    {"destroy_sample", lg_destroy_sample},
+    {"play_sample", lg_play_sample},
+    {"stop_sample", lg_stop_sample},
+    {"stop_samples", lg_stop_samples},
+    {"get_sample_channels", lg_get_sample_channels},
+    {"get_sample_depth", lg_get_sample_depth},
+    {"get_sample_frequency", lg_get_sample_frequency},
+    {"get_sample_length", lg_get_sample_length},
+
+    {"create_sample_instance", lg_create_sample_instance},
+    {"destroy_sample_instance", lg_destroy_sample_instance},
+    {"play_sample_instance", lg_play_sample_instance},
+    {"stop_sample_instance", lg_stop_sample_instance},
+    {"get_sample_instance_channels", lg_get_sample_instance_channels},
+    {"get_sample_instance_depth", lg_get_sample_instance_depth},
+    {"get_sample_instance_frequency", lg_get_sample_instance_frequency},
+    {"get_sample_instance_length", lg_get_sample_instance_length},
+    {"set_sample_instance_length", lg_set_sample_instance_length},
+    {"get_sample_instance_position", lg_get_sample_instance_position},
+    {"set_sample_instance_position", lg_set_sample_instance_position},
+    {"get_sample_instance_position", lg_get_sample_instance_position},
+    {"get_sample_instance_speed", lg_get_sample_instance_speed},
+    {"set_sample_instance_speed", lg_set_sample_instance_speed},
+    {"get_sample_instance_gain", lg_get_sample_instance_gain},
+    {"set_sample_instance_gain", lg_set_sample_instance_gain},
+    {"get_sample_instance_pan", lg_get_sample_instance_pan},
+    {"set_sample_instance_pan", lg_set_sample_instance_pan},
+    {"get_sample_instance_time", lg_get_sample_instance_time},
+    {"get_sample_instance_playmode", lg_get_sample_instance_playmode},
+    {"set_sample_instance_playmode", lg_set_sample_instance_playmode},
+    {"get_sample_instance_playing", lg_get_sample_instance_playing},
+    {"set_sample_instance_playing", lg_set_sample_instance_playing},
+    {"get_sample_instance_attached", lg_get_sample_instance_attached},
+    {"detach_sample_instance", lg_detach_sample_instance},
+    {"get_sample", lg_get_sample},
+    {"set_sample", lg_set_sample},
+    
+    {"create_mixer", lg_create_mixer},
+    {"destroy_mixer", lg_destroy_mixer},
+    {"get_default_mixer", lg_get_default_mixer},
+    {"set_default_mixer", lg_set_default_mixer},
+    {"restore_default_mixer", lg_restore_default_mixer},
+    {"attach_mixer_to_mixer", lg_attach_mixer_to_mixer},
+    {"attach_sample_instance_to_mixer", lg_attach_sample_instance_to_mixer},
+    {"attach_audio_stream_to_mixer", lg_attach_audio_stream_to_mixer},
+    {"get_mixer_frequency", lg_get_mixer_frequency},
+    {"set_mixer_frequency", lg_set_mixer_frequency},
+    {"get_mixer_channels", lg_get_mixer_channels},
+    {"get_mixer_depth", lg_get_mixer_depth},
+    {"get_mixer_gain", lg_get_mixer_gain},
+    {"set_mixer_gain", lg_set_mixer_gain},
+    {"get_mixer_quality", lg_get_mixer_quality},
+    {"set_mixer_quality", lg_set_mixer_quality},
+    {"get_mixer_playing", lg_get_mixer_playing},
+    {"set_mixer_playing", lg_set_mixer_playing},
+    {"get_mixer_attached", lg_get_mixer_attached},
+    {"detach_mixer", lg_detach_mixer},
+
+    {"destroy_audio_stream", lg_destroy_audio_stream},
+    {"drain_audio_stream", lg_drain_audio_stream},
+    {"rewind_audio_stream", lg_rewind_audio_stream},
+    {"get_audio_stream_frequency", lg_get_audio_stream_frequency},
+    {"get_audio_stream_channels", lg_get_audio_stream_channels},
+    {"get_audio_stream_depth", lg_get_audio_stream_depth},
+    {"get_audio_stream_length", lg_get_audio_stream_length},
+    {"get_audio_stream_speed", lg_get_audio_stream_speed},
+    {"set_audio_stream_speed", lg_set_audio_stream_speed},
+    {"get_audio_stream_gain", lg_get_audio_stream_gain},
+    {"set_audio_stream_gain", lg_set_audio_stream_gain},
+    {"get_audio_stream_pan", lg_get_audio_stream_pan},
+    {"set_audio_stream_pan", lg_set_audio_stream_pan},
+    {"get_audio_stream_playing", lg_get_audio_stream_playing},
+    {"set_audio_stream_playing", lg_set_audio_stream_playing},
+    {"get_audio_stream_playmode", lg_get_audio_stream_playmode},
+    {"set_audio_stream_playmode", lg_set_audio_stream_playmode},
+    {"get_audio_stream_attached", lg_get_audio_stream_attached},
+    {"get_detach_audio_stream", lg_detach_audio_stream},
+    {"seek_audio_stream_secs", lg_seek_audio_stream_secs},
+    {"get_audio_stream_position_secs", lg_get_audio_stream_position_secs},
+    {"get_audio_stream_length_secs", lg_get_audio_stream_length_secs},
+    {"set_audio_stream_loop_secs", lg_set_audio_stream_loop_secs},
+
+    {"load_sample", lg_load_sample},
+    {"load_audio_stream", lg_load_audio_stream},
+
+    {"color_cmyk", lg_color_cmyk},
+    {"color_hsl", lg_color_hsl},
+    {"color_hsv", lg_color_hsv},
+    {"color_html", lg_color_html},
+    {"color_name", lg_color_name},
+    {"color_yuv", lg_color_yuv},
+
+    {"load_font", lg_load_font},
+    {"destroy_font", lg_destroy_font},
+    {"get_font_line_height", lg_get_font_line_height},
+    {"get_font_ascent", lg_get_font_ascent},
+    {"get_font_descent", lg_get_font_descent},
+    {"get_text_width", lg_get_text_width},
+    {"draw_text", lg_draw_text},
+    {"draw_justified_text", lg_draw_justified_text},
+    {"get_text_dimensions", lg_get_text_dimensions},
+    {"draw_cached_text", lg_draw_cached_text},
+    {"set_text_cache_budget", lg_set_text_cache_budget},
+    {"get_text_cache_stats", lg_get_text_cache_stats},
+    {"clear_text_cache", lg_clear_text_cache},
+    {"create_text_object", lg_create_text_object},
+    {"destroy_text_object", lg_destroy_text_object},
+    {"set_text_object_text", lg_set_text_object_text},
+    {"draw_text_object", lg_draw_text_object},
+    {"get_text_object_width", lg_get_text_object_width},
+    {"get_text_object_dimensions", lg_get_text_object_dimensions},
+    {"grab_font_from_bitmap", lg_grab_font_from_bitmap},
+    {"load_bitmap_font", lg_load_bitmap_font},
+    {"prewarm_font", lg_prewarm_font},
+    {"bake_font", lg_bake_font},
+    {"create_builtin_font", lg_create_builtin_font},
+    {"load_ttf_font", lg_load_ttf_font},
+    {"load_ttf_font_stretch", lg_load_ttf_font_stretch},
+
+    {"draw_line", lg_draw_line},
+    {"draw_triangle", lg_draw_triangle},
+    {"draw_filled_triangle", lg_draw_filled_triangle},
+    {"draw_rectangle", lg_draw_rectangle},
+    {"draw_filled_rectangle", lg_draw_filled_rectangle},
+    {"draw_rounded_rectangle", lg_draw_rounded_rectangle},
+    {"draw_filled_rounded_rectangle", lg_draw_filled_rounded_rectangle},
+    {"draw_pieslice", lg_draw_pieslice},
+    {"draw_filled_pieslice", lg_draw_filled_pieslice},
+    {"draw_ellipse", lg_draw_ellipse},
+    {"draw_filled_ellipse", lg_draw_filled_ellipse},
+    {"draw_circle", lg_draw_circle},
+    {"draw_filled_circle", lg_draw_filled_circle},
+    {"draw_arc", lg_draw_arc},
+    {"draw_elliptical_arc", lg_draw_elliptical_arc},
+
+    {"create_sprite_batch", lg_create_sprite_batch},
+    {"destroy_sprite_batch", lg_destroy_sprite_batch},
+    {"add_sprite", lg_add_sprite},
+    {"clear_sprite_batch", lg_clear_sprite_batch},
+    {"draw_sprite_batch", lg_draw_sprite_batch},
+    {"get_sprite_batch_count", lg_get_sprite_batch_count},
+    {"get_sprite_batch_capacity", lg_get_sprite_batch_capacity},
+
+    {"draw_tilemap", lg_draw_tilemap},
+
+    {"create_atlas", lg_create_atlas},
+    {"destroy_atlas", lg_destroy_atlas},
+    {"add_to_atlas", lg_add_to_atlas},
+    {"get_atlas_bitmap", lg_get_atlas_bitmap},
+    {"get_atlas_occupancy", lg_get_atlas_occupancy},
+
+    {"begin_command_list", lg_begin_command_list},
+    {"end_command_list", lg_end_command_list},
+    {"is_recording_command_list", lg_is_recording_command_list},
+    {"draw_command_list", lg_draw_command_list},
+    {"destroy_command_list", lg_destroy_command_list},
+    {"get_command_list_size", lg_get_command_list_size},
+
+    {"create_vertex_array", lg_create_vertex_array},
+    {"destroy_vertex_array", lg_destroy_vertex_array},
+    {"set_vertex", lg_set_vertex},
+    {"get_vertex", lg_get_vertex},
+    {"set_vertex_color", lg_set_vertex_color},
+    {"set_vertices", lg_set_vertices},
+    {"set_indices", lg_set_indices},
+    {"set_vertex_count", lg_set_vertex_count},
+    {"get_vertex_count", lg_get_vertex_count},
+    {"get_vertex_capacity", lg_get_vertex_capacity},
+    {"draw_vertex_array", lg_draw_vertex_array},
+    {"draw_indexed_vertex_array", lg_draw_indexed_vertex_array},
+
+    {"create_render_target_pool", lg_create_render_target_pool},
+    {"destroy_render_target_pool", lg_destroy_render_target_pool},
+    {"acquire_render_target", lg_acquire_render_target},
+    {"release_render_target", lg_release_render_target},
+    {"update_render_target_pool", lg_update_render_target_pool},
+    {"clear_render_target_pool", lg_clear_render_target_pool},
+    {"get_render_target_pool_stats", lg_get_render_target_pool_stats},
+
+    {"create_animation", lg_create_animation},
+    {"destroy_animation", lg_destroy_animation},
+    {"get_animation_length", lg_get_animation_length},
+    {"create_animator", lg_create_animator},
+    {"destroy_animator", lg_destroy_animator},
+    {"add_to_animator", lg_add_to_animator},
+    {"remove_from_animator", lg_remove_from_animator},
+    {"clear_animator", lg_clear_animator},
+    {"set_animator_animation", lg_set_animator_animation},
+    {"set_animator_position", lg_set_animator_position},
+    {"set_animator_speed", lg_set_animator_speed},
+    {"set_animator_flags", lg_set_animator_flags},
+    {"set_animator_tint", lg_set_animator_tint},
+    {"get_animator_frame", lg_get_animator_frame},
+    {"get_animator_count", lg_get_animator_count},
+    {"update_animator", lg_update_animator},
+    {"update_animator_ticks", lg_update_animator_ticks},
+    {"draw_animator", lg_draw_animator},
+
+    {"create_input_snapshot", lg_create_input_snapshot},
+    {"update_input_snapshot", lg_update_input_snapshot},
+    {"input_snapshot_pressed", lg_input_snapshot_pressed},
+    {"input_snapshot_released", lg_input_snapshot_released},
+    {"input_snapshot_held", lg_input_snapshot_held},
+    {"bind_input_action", lg_bind_input_action},
+    {"get_input_snapshot_mouse", lg_get_input_snapshot_mouse},
+    {"get_input_snapshot_axis", lg_get_input_snapshot_axis},
+    {"mouse_input", lg_mouse_input},
+    {"joystick_input", lg_joystick_input},
+
+    {NULL, NULL}
+};
+
+/*
+================================================================================
+
+                ALLEGRO 5 - OBJECTS
+
+================================================================================
+*/
+/*
+================================================================================
+
+                Configuration files
+
+================================================================================
+*/
+static ALLEGRO_CONFIG *to_config( lua_State *L, const int idx ) {
+    return (ALLEGRO_CONFIG*) to_object(L, idx, LEGATO_CONFIG);
+}
+
+static int config__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_CONFIG, to_object_gc(L, 1, LEGATO_CONFIG));
+    return 1;
+}
+
+/*
+static int config__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_CONFIG);
+}
+*/
+
+static const luaL_Reg config__methods[] = {
+    {"__gc", lg_destroy_config},
+    {"__tostring", config__tostring},
+    /*{"__eq", config__eq},*/
+    {"destroy", lg_destroy_config},
+    {"save_file", lg_save_config_file},
+    {"add_section", lg_add_config_section},
+    {"add_comment", lg_add_config_comment},
+    {"get_value", lg_get_config_value},
+    {"set_value", lg_set_config_value},
+    {"get_sections", lg_get_config_sections},
+    {"get_entries", lg_get_config_entries},
+    {"merge", lg_merge_config},
+    {"merge_into", lg_merge_config_into},
+    {NULL, NULL}
+};
+
+/*
+================================================================================
+
+                Display
+
+================================================================================
+*/
+static ALLEGRO_DISPLAY *to_display( lua_State *L, const int idx ) {
+    return (ALLEGRO_DISPLAY*) to_object(L, idx, LEGATO_DISPLAY);
+}
+
+static int display__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_DISPLAY, to_object_gc(L, 1, LEGATO_DISPLAY));
+    return 1;
+}
+
+/*
+static int display__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_DISPLAY);
+}
+*/
+
+static const luaL_Reg display__methods[] = {
+    {"__gc", lg_destroy_display},
+    {"__tostring", display__tostring},
+    /*{"__eq", display__eq},*/
+    {"get_backbuffer", lg_get_backbuffer},
+    {"get_width", lg_get_display_width},
+    {"get_height", lg_get_display_height},
+    {"get_size", lg_get_display_size},
+    {"resize", lg_resize_display},
+    {"acknowledge_resize", lg_acknowledge_resize},
+    {"get_position", lg_get_window_position},
+    {"set_position", lg_set_window_position},
+    {"get_flags", lg_get_display_flags},
+    {"set_flag", lg_set_display_flag},
+    {"get_option", lg_get_display_option},
+    {"get_format", lg_get_display_format},
+    {"get_refresh_rate", lg_get_display_refresh_rate},
+    {"set_title", lg_set_window_title},
+    {"set_icon", lg_set_display_icon},
+    {"set_icons", lg_set_display_icons},
+    {"set_target", lg_set_target_backbuffer},
+    {NULL, NULL}
+};
+
+/*
+================================================================================
+
+                Color
+
+================================================================================
+*/
+static ALLEGRO_COLOR to_color( lua_State *L, const int idx ) {
+    lua_Unsigned rgba;
+    if ( lua_type(L, idx) == LUA_TNUMBER ) { /* packed 0xRRGGBBAA color */
+        rgba = lua_tounsigned(L, idx);
+        return al_map_rgba((rgba >> 24) & 0xff, (rgba >> 16) & 0xff, (rgba >> 8) & 0xff, rgba & 0xff);
+    }
+    return *((ALLEGRO_COLOR*) luaL_checkudata(L, idx, LEGATO_COLOR));
+}
+
+static int color__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s", LEGATO_COLOR);
+    return 1;
+}
+
+static const luaL_Reg color__methods[] = {
+    {"__tostring", color__tostring},
+    {"unmap_rgb", lg_unmap_rgb},
+    {"unmap_rgb_f", lg_unmap_rgb_f},
+    {"pack", lg_pack_color},
+    {NULL, NULL}
+};
+
+/*
+================================================================================
+
+                Bitmap
+
+================================================================================
+*/
+static ALLEGRO_BITMAP *to_bitmap( lua_State *L, const int idx ) {
+    return (ALLEGRO_BITMAP*) to_object(L, idx, LEGATO_BITMAP);
+}
+
+static int bitmap__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_BITMAP, to_object_gc(L, 1, LEGATO_BITMAP));
+    return 1;
+}
+
+/*
+static int bitmap__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_BITMAP);
+}
+*/
+
+static const luaL_Reg bitmap__methods[] = {
+    {"__gc", lg_destroy_bitmap},
+    {"__tostring", bitmap__tostring},
+    /*{"__eq", bitmap__eq},*/
+    {"lock", lg_lock_bitmap},
+    {"lock_region", lg_lock_bitmap_region},
+    {"unlock", lg_unlock_bitmap},
+    {"create_sub_bitmap", lg_create_sub_bitmap},
+    {"clone", lg_clone_bitmap},
+    {"destroy", lg_destroy_bitmap},
+    {"get_flags", lg_get_bitmap_flags},
+    {"get_format", lg_get_bitmap_format},
+    {"get_height", lg_get_bitmap_height},
+    {"get_width", lg_get_bitmap_width},
+    {"get_size", lg_get_bitmap_size},
+    {"get_pixel", lg_get_pixel},
+    {"is_locked", lg_is_bitmap_locked},
+    {"is_compatible", lg_is_compatible_bitmap},
+    {"is_sub_bitmap", lg_is_sub_bitmap},
+    {"get_parent", lg_get_parent_bitmap},
+    {"draw", lg_draw_bitmap},
+    {"draw_tinted", lg_draw_tinted_bitmap},
+    {"draw_region", lg_draw_bitmap_region},
+    {"draw_tinted_region", lg_draw_tinted_bitmap_region},
+    {"draw_rotated", lg_draw_rotated_bitmap},
+    {"draw_tinted_rotated", lg_draw_tinted_rotated_bitmap},
+    {"draw_scaled_rotated", lg_draw_scaled_rotated_bitmap},
+    {"draw_tinted_scaled_rotated", lg_draw_tinted_scaled_rotated_bitmap},
+    {"draw_tinted_scaled_rotated_region", lg_draw_tinted_scaled_rotated_bitmap_region},
+    {"draw_scaled", lg_draw_scaled_bitmap},
+    {"draw_tinted_scaled", lg_draw_tinted_scaled_bitmap},
+    {"set_target", lg_set_target_bitmap},
+    {"convert_mask_to_alpha", lg_convert_mask_to_alpha},
+    {NULL, NULL}
+};
+
+/*
+================================================================================
 
-    {"get_allegro_version", lg_get_allegro_version},
-    {"get_standard_path", lg_get_standard_path},
-    {"set_exe_name", lg_set_exe_name},
-    {"set_app_name", lg_set_app_name},
-    {"set_org_name", lg_set_org_name},
-    {"get_app_name", lg_get_app_name},
-    {"get_org_name", lg_get_org_name},
-    {"get_system_config", lg_get_system_config},
+                Event queue
 
-    {"get_time", lg_get_time},
-    {"rest", lg_rest},
+================================================================================
+*/
+static ALLEGRO_EVENT_QUEUE *to_event_queue( lua_State *L, const int idx ) {
+    return (ALLEGRO_EVENT_QUEUE*) to_object(L, idx, LEGATO_EVENT_QUEUE);
+}
 
-    {"create_timer", lg_create_timer},
-    {"start_timer", lg_start_timer},
-    {"stop_timer", lg_stop_timer},
-    {"get_timer_started", lg_get_timer_started},
-    {"destroy_timer", lg_destroy_timer},
-    {"get_timer_count", lg_get_timer_count},
-    {"set_timer_count", lg_set_timer_count},
-    {"add_timer_count", lg_add_timer_count},
-    {"get_timer_speed", lg_get_timer_speed},
-    {"set_timer_speed", lg_set_timer_speed},
+static int event_queue__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_EVENT_QUEUE, to_object_gc(L, 1, LEGATO_EVENT_QUEUE));
+    return 1;
+}
 
-    {"create_transform", lg_create_transform},
-    {"copy_transform", lg_copy_transform},
-    {"use_transform", lg_use_transform},
-    {"get_current_transform", lg_get_current_transform},
-    {"invert_transform", lg_invert_transform},
-    {"check_inverse", lg_check_inverse},
-    {"identity_transform", lg_identity_transform},
-    {"build_transform", lg_build_transform},
-    {"translate_transform", lg_translate_transform},
-    {"rotate_transform", lg_rotate_transform},
-    {"scale_transform", lg_scale_transform},
-    {"transform_coordinates", lg_transform_coordinates},
-    {"compose_transform", lg_compose_transform},
+/*
+static int event_queue__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_EVENT_QUEUE);
+}
+*/
 
-    {"is_audio_installed", lg_is_audio_installed},
-    {"reserve_samples", lg_reserve_samples},
-    {"get_audio_depth_size", lg_get_audio_depth_size},
-    {"get_channel_count", lg_get_channel_count},
-    {"create_voice", lg_create_voice},
-    {"destroy_voice", lg_destroy_voice},
-    {"detach_voice", lg_detach_voice},
-    {"attach_audio_stream_to_voice", lg_attach_audio_stream_to_voice},
-    {"attach_mixer_to_voice", lg_attach_mixer_to_voice},
-    {"attach_sample_instance_to_voice", lg_attach_sample_instance_to_voice},
-    {"get_voice_frequency", lg_get_voice_frequency},
-    {"get_voice_channels", lg_get_voice_channels},
-    {"get_voice_depth", lg_get_voice_depth},
-    {"get_voice_playing", lg_get_voice_playing},
-    {"set_voice_playing", lg_set_voice_playing},
-    {"get_voice_position", lg_get_voice_position},
-    {"set_voice_position", lg_set_voice_position},
-    
-    {"destroy_sample", lg_destroy_sample},
-    {"play_sample", lg_play_sample},
-    {"stop_sample", lg_stop_sample},
-    {"stop_samples", lg_stop_samples},
-    {"get_sample_channels", lg_get_sample_channels},
-    {"get_sample_depth", lg_get_sample_depth},
-    {"get_sample_frequency", lg_get_sample_frequency},
-    {"get_sample_length", lg_get_sample_length},
+static const luaL_Reg event_queue__methods[] = {
+    {"__gc", lg_destroy_event_queue},
+    {"__tostring", event_queue__tostring},
+    /*{"__eq", event_queue__eq},*/
+    {"register", lg_register_event_source},
+    {"unregister", lg_unregister_event_source},
+    {"is_empty", lg_is_event_queue_empty},
+    {"get_next_event", lg_get_next_event},
+    {"peek_next_event", lg_peek_next_event},
+    {"drop_next_event", lg_drop_next_event},
+    {"flush", lg_flush_event_queue},
+    {"drain", lg_drain_events},
+    {"drain_packed", lg_drain_events_packed},
+    {"set_filter", lg_set_event_filter},
+    {"set_coalescing", lg_set_event_coalescing},
+    {"wait_for_event", lg_wait_for_event},
+    {"wait_for_event_timed", lg_wait_for_event_timed},
+    {"wait_for_event_until", lg_wait_for_event_until},
+    {NULL, NULL}
+};
 
-    {"create_sample_instance", lg_create_sample_instance},
-    {"destroy_sample_instance", lg_destroy_sample_instance},
-    {"play_sample_instance", lg_play_sample_instance},
-    {"stop_sample_instance", lg_stop_sample_instance},
-    {"get_sample_instance_channels", lg_get_sample_instance_channels},
-    {"get_sample_instance_depth", lg_get_sample_instance_depth},
-    {"get_sample_instance_frequency", lg_get_sample_instance_frequency},
-    {"get_sample_instance_length", lg_get_sample_instance_length},
-    {"set_sample_instance_length", lg_set_sample_instance_length},
-    {"get_sample_instance_position", lg_get_sample_instance_position},
-    {"set_sample_instance_position", lg_set_sample_instance_position},
-    {"get_sample_instance_position", lg_get_sample_instance_position},
-    {"get_sample_instance_speed", lg_get_sample_instance_speed},
-    {"set_sample_instance_speed", lg_set_sample_instance_speed},
-    {"get_sample_instance_gain", lg_get_sample_instance_gain},
-    {"set_sample_instance_gain", lg_set_sample_instance_gain},
-    {"get_sample_instance_pan", lg_get_sample_instance_pan},
-    {"set_sample_instance_pan", lg_set_sample_instance_pan},
-    {"get_sample_instance_time", lg_get_sample_instance_time},
-    {"get_sample_instance_playmode", lg_get_sample_instance_playmode},
-    {"set_sample_instance_playmode", lg_set_sample_instance_playmode},
-    {"get_sample_instance_playing", lg_get_sample_instance_playing},
-    {"set_sample_instance_playing", lg_set_sample_instance_playing},
-    {"get_sample_instance_attached", lg_get_sample_instance_attached},
-    {"detach_sample_instance", lg_detach_sample_instance},
-    {"get_sample", lg_get_sample},
-    {"set_sample", lg_set_sample},
-    
-    {"create_mixer", lg_create_mixer},
-    {"destroy_mixer", lg_destroy_mixer},
-    {"get_default_mixer", lg_get_default_mixer},
-    {"set_default_mixer", lg_set_default_mixer},
-    {"restore_default_mixer", lg_restore_default_mixer},
-    {"attach_mixer_to_mixer", lg_attach_mixer_to_mixer},
-    {"attach_sample_instance_to_mixer", lg_attach_sample_instance_to_mixer},
-    {"attach_audio_stream_to_mixer", lg_attach_audio_stream_to_mixer},
-    {"get_mixer_frequency", lg_get_mixer_frequency},
-    {"set_mixer_frequency", lg_set_mixer_frequency},
-    {"get_mixer_channels", lg_get_mixer_channels},
-    {"get_mixer_depth", lg_get_mixer_depth},
-    {"get_mixer_gain", lg_get_mixer_gain},
-    {"set_mixer_gain", lg_set_mixer_gain},
-    {"get_mixer_quality", lg_get_mixer_quality},
-    {"set_mixer_quality", lg_set_mixer_quality},
-    {"get_mixer_playing", lg_get_mixer_playing},
-    {"set_mixer_playing", lg_set_mixer_playing},
-    {"get_mixer_attached", lg_get_mixer_attached},
-    {"detach_mixer", lg_detach_mixer},
+/*
+================================================================================
 
-    {"destroy_audio_stream", lg_destroy_audio_stream},
-    {"drain_audio_stream", lg_drain_audio_stream},
-    {"rewind_audio_stream", lg_rewind_audio_stream},
-    {"get_audio_stream_frequency", lg_get_audio_stream_frequency},
-    {"get_audio_stream_channels", lg_get_audio_stream_channels},
-    {"get_audio_stream_depth", lg_get_audio_stream_depth},
-    {"get_audio_stream_length", lg_get_audio_stream_length},
-    {"get_audio_stream_speed", lg_get_audio_stream_speed},
-    {"set_audio_stream_speed", lg_set_audio_stream_speed},
-    {"get_audio_stream_gain", lg_get_audio_stream_gain},
-    {"set_audio_stream_gain", lg_set_audio_stream_gain},
-    {"get_audio_stream_pan", lg_get_audio_stream_pan},
-    {"set_audio_stream_pan", lg_set_audio_stream_pan},
-    {"get_audio_stream_playing", lg_get_audio_stream_playing},
-    {"set_audio_stream_playing", lg_set_audio_stream_playing},
-    {"get_audio_stream_playmode", lg_get_audio_stream_playmode},
-    {"set_audio_stream_playmode", lg_set_audio_stream_playmode},
-    {"get_audio_stream_attached", lg_get_audio_stream_attached},
-    {"get_detach_audio_stream", lg_detach_audio_stream},
-    {"seek_audio_stream_secs", lg_seek_audio_stream_secs},
-    {"get_audio_stream_position_secs", lg_get_audio_stream_position_secs},
-    {"get_audio_stream_length_secs", lg_get_audio_stream_length_secs},
-    {"set_audio_stream_loop_secs", lg_set_audio_stream_loop_secs},
+                Joystick
+
+================================================================================
+*/
+static ALLEGRO_JOYSTICK *to_joystick( lua_State *L, const int idx ) {
+    return (ALLEGRO_JOYSTICK*) to_object(L, idx, LEGATO_JOYSTICK);
+}
+
+static int joystick__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_JOYSTICK, to_joystick(L, 1));
+    return 1;
+}
+
+static const luaL_Reg joystick__methods[] = {
+    {"__tostring", joystick__tostring},
+    {"get_active", lg_get_joystick_active},
+    {"get_name", lg_get_joystick_name},
+    {"get_stick_name", lg_get_joystick_stick_name},
+    {"get_axis_name", lg_get_joystick_axis_name},
+    {"get_button_name", lg_get_joystick_button_name},
+    {"get_stick_flags", lg_get_joystick_stick_flags},
+    {"get_num_sticks", lg_get_joystick_num_sticks},
+    {"get_num_axes", lg_get_joystick_num_axes},
+    {"get_num_buttons", lg_get_joystick_num_buttons},
+    {"get_state", lg_get_joystick_state},
+    {NULL, NULL}
+};
+
+/*
+================================================================================
+
+                Joystick State
+
+================================================================================
+*/
+static ALLEGRO_JOYSTICK_STATE *to_joystick_state( lua_State *L, const int idx ) {
+    return (ALLEGRO_JOYSTICK_STATE*) luaL_checkudata(L, idx, LEGATO_JOYSTICK_STATE);
+}
+
+static int joystick_state__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_JOYSTICK_STATE, to_joystick_state(L, 1));
+    return 1;
+}
+
+static int joystick_state_get_button( lua_State *L ) {
+    int button = luaL_checkint(L, 2);
+    luaL_argcheck(L, button >= 0 && button < _AL_MAX_JOYSTICK_BUTTONS, 2, "invalid button");
+    lua_pushinteger(L, to_joystick_state(L, 1)->button[button]);
+    return 1;
+}
+
+static int joystick_state_get_axis( lua_State *L ) {
+    int stick, axis;
+    stick = luaL_checkint(L, 2);
+    axis = luaL_checkint(L, 3);
+    luaL_argcheck(L, stick >= 0 && stick < _AL_MAX_JOYSTICK_STICKS, 2, "invalid stick");
+    luaL_argcheck(L, axis >= 0 && axis < _AL_MAX_JOYSTICK_AXES, 3, "invalid axis");
+    lua_pushnumber(L, to_joystick_state(L, 1)->stick[stick].axis[axis]);
+    return 1;
+}
+
+static const luaL_Reg joystick_state__methods[] = {
+    {"__tostring", joystick_state__tostring},
+    {"get_button", joystick_state_get_button},
+    {"get_axis", joystick_state_get_axis},
+    {NULL, NULL}
+};
+
+/*
+================================================================================
+
+                Keyboard State
+
+================================================================================
+*/
+static ALLEGRO_KEYBOARD_STATE *to_keyboard_state( lua_State *L, const int idx ) {
+    return (ALLEGRO_KEYBOARD_STATE*) luaL_checkudata(L, idx, LEGATO_KEYBOARD_STATE);
+}
+
+static int keyboard_state__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_KEYBOARD_STATE, to_keyboard_state(L, 1));
+    return 1;
+}
 
-    {"load_sample", lg_load_sample},
-    {"load_audio_stream", lg_load_audio_stream},
+static const luaL_Reg keyboard_state__methods[] = {
+    {"__tostring", keyboard_state__tostring},
+    {"get_state", lg_get_keyboard_state},
+    {"key_down", lg_key_down},
+    {NULL, NULL}
+};
 
-    {"color_cmyk", lg_color_cmyk},
-    {"color_hsl", lg_color_hsl},
-    {"color_hsv", lg_color_hsv},
-    {"color_html", lg_color_html},
-    {"color_name", lg_color_name},
-    {"color_yuv", lg_color_yuv},
+/*
+================================================================================
 
-    {"load_font", lg_load_font},
-    {"destroy_font", lg_destroy_font},
-    {"get_font_line_height", lg_get_font_line_height},
-    {"get_font_ascent", lg_get_font_ascent},
-    {"get_font_descent", lg_get_font_descent},
-    {"get_text_width", lg_get_text_width},
-    {"draw_text", lg_draw_text},
-    {"draw_justified_text", lg_draw_justified_text},
-    {"get_text_dimensions", lg_get_text_dimensions},
-    {"grab_font_from_bitmap", lg_grab_font_from_bitmap},
-    {"load_bitmap_font", lg_load_bitmap_font},
-    {"create_builtin_font", lg_create_builtin_font},
-    {"load_ttf_font", lg_load_ttf_font},
-    {"load_ttf_font_stretch", lg_load_ttf_font_stretch},
+                Mouse State
 
-    {"draw_line", lg_draw_line},
-    {"draw_triangle", lg_draw_triangle},
-    {"draw_filled_triangle", lg_draw_filled_triangle},
-    {"draw_rectangle", lg_draw_rectangle},
-    {"draw_filled_rectangle", lg_draw_filled_rectangle},
-    {"draw_rounded_rectangle", lg_draw_rounded_rectangle},
-    {"draw_filled_rounded_rectangle", lg_draw_filled_rounded_rectangle},
-    {"draw_pieslice", lg_draw_pieslice},
-    {"draw_filled_pieslice", lg_draw_filled_pieslice},
-    {"draw_ellipse", lg_draw_ellipse},
-    {"draw_filled_ellipse", lg_draw_filled_ellipse},
-    {"draw_circle", lg_draw_circle},
-    {"draw_filled_circle", lg_draw_filled_circle},
-    {"draw_arc", lg_draw_arc},
-    {"draw_elliptical_arc", lg_draw_elliptical_arc},
+================================================================================
+*/
+static ALLEGRO_MOUSE_STATE *to_mouse_state( lua_State *L, const int idx ) {
+    return (ALLEGRO_MOUSE_STATE*) luaL_checkudata(L, idx, LEGATO_MOUSE_STATE);
+}
+
+static int mouse_state__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_MOUSE_STATE, to_mouse_state(L, 1));
+    return 1;
+}
 
+static const luaL_Reg mouse_state__methods[] = {
+    {"__tostring", mouse_state__tostring},
+    {"get_state", lg_get_mouse_state},
+    {"get_axis", lg_get_mouse_state_axis},
+    {"button_down", lg_mouse_button_down},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                ALLEGRO 5 - OBJECTS
+                Mouse Cursor
 
 ================================================================================
 */
+static ALLEGRO_MOUSE_CURSOR *to_mouse_cursor( lua_State *L, const int idx ) {
+    return (ALLEGRO_MOUSE_CURSOR*) to_object(L, 1, LEGATO_MOUSE_CURSOR);
+}
+
+static int mouse_cursor__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_MOUSE_CURSOR, to_mouse_cursor(L, 1));
+    return 1;
+}
+
+static int mouse_cursor__gc( lua_State *L ) {
+    al_destroy_mouse_cursor(to_mouse_cursor(L, 1));
+    clear_object(L, 1);
+    return 0;
+}
+
+static const luaL_Reg mouse_cursor__methods[] = {
+    {"__tostring", mouse_cursor__tostring},
+    {"__gc", mouse_cursor__gc},
+    {NULL, NULL}
+};
+
 /*
 ================================================================================
 
-                Configuration files
+                Path
 
 ================================================================================
 */
-static ALLEGRO_CONFIG *to_config( lua_State *L, const int idx ) {
-    return (ALLEGRO_CONFIG*) to_object(L, idx, LEGATO_CONFIG);
+static ALLEGRO_PATH *to_path( lua_State *L, const int idx ) {
+    return (ALLEGRO_PATH*) to_object(L, idx, LEGATO_PATH);
 }
 
-static int config__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_CONFIG, to_object_gc(L, 1, LEGATO_CONFIG));
+static int path__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_PATH, to_object_gc(L, 1, LEGATO_PATH));
     return 1;
 }
 
 /*
-static int config__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_CONFIG);
+static int path__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_PATH);
 }
 */
 
-static const luaL_Reg config__methods[] = {
-    {"__gc", lg_destroy_config},
-    {"__tostring", config__tostring},
-    /*{"__eq", config__eq},*/
-    {"destroy", lg_destroy_config},
-    {"save_file", lg_save_config_file},
-    {"add_section", lg_add_config_section},
-    {"add_comment", lg_add_config_comment},
-    {"get_value", lg_get_config_value},
-    {"set_value", lg_set_config_value},
-    {"get_sections", lg_get_config_sections},
-    {"get_entries", lg_get_config_entries},
-    {"merge", lg_merge_config},
-    {"merge_into", lg_merge_config_into},
+static const luaL_Reg path__methods[] = {
+    {"__tostring", path__tostring},
+    /*{"__eq", path__eq},*/
+    {"__gc", lg_destroy_path},
+    {"destroy", lg_destroy_path},
+    {"clone", lg_clone_path},
+    {"join_path", lg_join_paths},
+    {"rebase", lg_rebase_path},
+    {"get_drive", lg_get_path_drive},
+    {"get_num_components", lg_get_path_num_components},
+    {"get_components", lg_get_path_components},
+    {"get_tail", lg_get_path_tail},
+    {"get_filename", lg_get_path_filename},
+    {"get_basename", lg_get_path_basename},
+    {"get_extension", lg_get_path_extension},
+    {"set_drive", lg_set_path_drive},
+    {"append_component", lg_append_path_component},
+    {"insert_component", lg_insert_path_component},
+    {"replace_component", lg_replace_path_component},
+    {"remove_component", lg_remove_path_component},
+    {"drop_tail", lg_drop_path_tail},
+    {"set_filename", lg_set_path_filename},
+    {"set_extension", lg_set_path_extension},
+    {"str", lg_path_str},
+    {"make_canonical", lg_make_path_canonical},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Display
+                State
 
 ================================================================================
 */
-static ALLEGRO_DISPLAY *to_display( lua_State *L, const int idx ) {
-    return (ALLEGRO_DISPLAY*) to_object(L, idx, LEGATO_DISPLAY);
+static ALLEGRO_STATE *to_state( lua_State *L, const int idx ) {
+    return (ALLEGRO_STATE*) luaL_checkudata(L, idx, LEGATO_STATE);
 }
 
-static int display__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_DISPLAY, to_object_gc(L, 1, LEGATO_DISPLAY));
+static int state__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_STATE, to_state(L, 1));
     return 1;
 }
 
+static const luaL_Reg state__methods[] = {
+    {"__tostring", state__tostring},
+    {"restore", lg_restore_state},
+    {NULL, NULL}
+};
+
 /*
-static int display__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_DISPLAY);
+================================================================================
+
+                Timers
+
+================================================================================
+*/
+static ALLEGRO_TIMER *to_timer( lua_State *L, const int idx ) {
+    return (ALLEGRO_TIMER*) to_object(L, idx, LEGATO_TIMER);
+}
+
+static int timer__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_TIMER, to_object_gc(L, 1, LEGATO_TIMER));
+    return 1;
+}
+
+/*
+static int timer__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_TIMER);
 }
 */
 
-static const luaL_Reg display__methods[] = {
-    {"__gc", lg_destroy_display},
-    {"__tostring", display__tostring},
-    /*{"__eq", display__eq},*/
-    {"get_backbuffer", lg_get_backbuffer},
-    {"get_width", lg_get_display_width},
-    {"get_height", lg_get_display_height},
-    {"get_size", lg_get_display_size},
-    {"resize", lg_resize_display},
-    {"acknowledge_resize", lg_acknowledge_resize},
-    {"get_position", lg_get_window_position},
-    {"set_position", lg_set_window_position},
-    {"get_flags", lg_get_display_flags},
-    {"set_flag", lg_set_display_flag},
-    {"get_option", lg_get_display_option},
-    {"get_format", lg_get_display_format},
-    {"get_refresh_rate", lg_get_display_refresh_rate},
-    {"set_title", lg_set_window_title},
-    {"set_icon", lg_set_display_icon},
-    {"set_icons", lg_set_display_icons},
-    {"set_target", lg_set_target_backbuffer},
+static const luaL_Reg timer__methods[] = {
+    {"__gc", lg_destroy_timer},
+    {"__tostring", timer__tostring},
+    /*{"__eq", timer__eq},*/
+    {"start", lg_start_timer},
+    {"stop", lg_stop_timer},
+    {"get_started", lg_get_timer_started},
+    {"get_count", lg_get_timer_count},
+    {"set_count", lg_set_timer_count},
+    {"add_count", lg_add_timer_count},
+    {"get_speed", lg_get_timer_speed},
+    {"set_speed", lg_set_timer_speed},
+    {NULL, NULL}
+};
+
+/*
+================================================================================
+
+                Transformations
+
+================================================================================
+*/
+static ALLEGRO_TRANSFORM *to_transform( lua_State *L, const int idx ) {
+    return (ALLEGRO_TRANSFORM*) luaL_checkudata(L, idx, LEGATO_TRANSFORM);
+}
+
+static int transform__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_TRANSFORM, to_transform(L, 1));
+    return 1;
+}
+
+static const luaL_Reg transform__methods[] = {
+    {"__tostring", transform__tostring},
+    {"copy", lg_copy_transform},
+    {"use", lg_use_transform},
+    {"invert", lg_invert_transform},
+    {"check_inverse", lg_check_inverse},
+    {"identity", lg_identity_transform},
+    {"translate", lg_translate_transform},
+    {"rotate", lg_rotate_transform},
+    {"scale", lg_scale_transform},
+    {"transform", lg_transform_coordinates},
+    {"transform_points", lg_transform_points},
+    {"compose", lg_compose_transform},
+    {NULL, NULL}
+};
+
+/*
+================================================================================
+
+                Audio Voice
+
+================================================================================
+*/
+static ALLEGRO_VOICE *to_voice( lua_State *L, const int idx ) {
+    return (ALLEGRO_VOICE*) to_object(L, idx, LEGATO_VOICE);
+}
+
+static int voice__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_VOICE, to_voice(L, 1));
+    return 1;
+}
+
+/*
+static int voice__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_VOICE);
+}
+*/
+
+static const luaL_Reg voice__methods[] = {
+    {"__gc", lg_destroy_voice},
+    {"__tostring", voice__tostring},
+    /*{"__eq", voice__eq},*/
+    {"get_frequency", lg_get_voice_frequency},
+    {"get_channels", lg_get_voice_channels},
+    {"get_depth", lg_get_voice_depth},
+    {"get_playing", lg_get_voice_playing},
+    {"set_playing", lg_set_voice_playing},
+    {"get_position", lg_get_voice_position},
+    {"set_position", lg_set_voice_position},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Color
+                Audio Mixer
 
 ================================================================================
 */
-static ALLEGRO_COLOR to_color( lua_State *L, const int idx ) {
-    return *((ALLEGRO_COLOR*) luaL_checkudata(L, idx, LEGATO_COLOR));
+static ALLEGRO_MIXER *to_mixer( lua_State *L, const int idx ) {
+    return (ALLEGRO_MIXER*) to_object(L, idx, LEGATO_MIXER);
 }
 
-static int color__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s", LEGATO_COLOR);
+static int mixer__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_MIXER, to_mixer(L, 1));
     return 1;
 }
 
-static const luaL_Reg color__methods[] = {
-    {"__tostring", color__tostring},
-    {"unmap_rgb", lg_unmap_rgb},
-    {"unmap_rgb_f", lg_unmap_rgb_f},
+/*
+static int mixer__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_MIXER);
+}
+*/
+
+static const luaL_Reg mixer__methods[] = {
+    {"__tostring", mixer__tostring},
+    /*{"__eq", mixer__eq},*/
+    {"__gc", lg_destroy_mixer},
+    {"attach_to_mixer", lg_attach_mixer_to_mixer},
+    {"get_frequency", lg_get_mixer_frequency},
+    {"set_frequency", lg_set_mixer_frequency},
+    {"get_channels", lg_get_mixer_channels},
+    {"get_depth", lg_get_mixer_depth},
+    {"get_gain", lg_get_mixer_gain},
+    {"set_gain", lg_set_mixer_gain},
+    {"get_quality", lg_get_mixer_quality},
+    {"set_quality", lg_set_mixer_quality},
+    {"get_playing", lg_get_mixer_playing},
+    {"set_playing", lg_set_mixer_playing},
+    {"get_attached", lg_get_mixer_attached},
+    {"detach", lg_detach_mixer},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Bitmap
+                Audio Sample
 
 ================================================================================
 */
-static ALLEGRO_BITMAP *to_bitmap( lua_State *L, const int idx ) {
-    return (ALLEGRO_BITMAP*) to_object(L, idx, LEGATO_BITMAP);
+static ALLEGRO_SAMPLE *to_audio_sample( lua_State *L, const int idx ) {
+    return (ALLEGRO_SAMPLE*) to_object(L, idx, LEGATO_AUDIO_SAMPLE);
 }
 
-static int bitmap__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_BITMAP, to_object_gc(L, 1, LEGATO_BITMAP));
+static int audio_sample__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_AUDIO_SAMPLE, to_audio_sample(L, 1));
     return 1;
 }
 
 /*
-static int bitmap__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_BITMAP);
+static int audio_sample__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_AUDIO_SAMPLE);
 }
 */
 
-static const luaL_Reg bitmap__methods[] = {
-    {"__gc", lg_destroy_bitmap},
-    {"__tostring", bitmap__tostring},
-    /*{"__eq", bitmap__eq},*/
-    {"lock", lg_lock_bitmap},
-    {"lock_region", lg_lock_bitmap_region},
-    {"unlock", lg_unlock_bitmap},
-    {"create_sub_bitmap", lg_create_sub_bitmap},
-    {"clone", lg_clone_bitmap},
-    {"destroy", lg_destroy_bitmap},
-    {"get_flags", lg_get_bitmap_flags},
-    {"get_format", lg_get_bitmap_format},
-    {"get_height", lg_get_bitmap_height},
-    {"get_width", lg_get_bitmap_width},
-    {"get_size", lg_get_bitmap_size},
-    {"get_pixel", lg_get_pixel},
-    {"is_locked", lg_is_bitmap_locked},
-    {"is_compatible", lg_is_compatible_bitmap},
-    {"is_sub_bitmap", lg_is_sub_bitmap},
-    {"get_parent", lg_get_parent_bitmap},
-    {"draw", lg_draw_bitmap},
-    {"draw_tinted", lg_draw_tinted_bitmap},
-    {"draw_region", lg_draw_bitmap_region},
-    {"draw_tinted_region", lg_draw_tinted_bitmap_region},
-    {"draw_rotated", lg_draw_rotated_bitmap},
-    {"draw_tinted_rotated", lg_draw_tinted_rotated_bitmap},
-    {"draw_scaled_rotated", lg_draw_scaled_rotated_bitmap},
-    {"draw_tinted_scaled_rotated", lg_draw_tinted_scaled_rotated_bitmap},
-    {"draw_tinted_scaled_rotated_region", lg_draw_tinted_scaled_rotated_bitmap_region},
-    {"draw_scaled", lg_draw_scaled_bitmap},
-    {"draw_tinted_scaled", lg_draw_tinted_scaled_bitmap},
-    {"set_target", lg_set_target_bitmap},
-    {"convert_mask_to_alpha", lg_convert_mask_to_alpha},
+static const luaL_Reg audio_sample__methods[] = {
+    {"__tostring", audio_sample__tostring},
+    /*{"__eq", audio_sample__eq},*/
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Event queue
+                Audio Sample ID
 
 ================================================================================
 */
-static ALLEGRO_EVENT_QUEUE *to_event_queue( lua_State *L, const int idx ) {
-    return (ALLEGRO_EVENT_QUEUE*) to_object(L, idx, LEGATO_EVENT_QUEUE);
+static ALLEGRO_SAMPLE_ID *to_sample_id( lua_State *L, const int idx ) {
+    return (ALLEGRO_SAMPLE_ID*) luaL_checkudata(L, idx, LEGATO_SAMPLE_ID);
 }
 
-static int event_queue__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_EVENT_QUEUE, to_object_gc(L, 1, LEGATO_EVENT_QUEUE));
+static int sample_id__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_SAMPLE_ID, to_sample_id(L, 1));
     return 1;
 }
 
-/*
-static int event_queue__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_EVENT_QUEUE);
-}
-*/
-
-static const luaL_Reg event_queue__methods[] = {
-    {"__gc", lg_destroy_event_queue},
-    {"__tostring", event_queue__tostring},
-    /*{"__eq", event_queue__eq},*/
-    {"register", lg_register_event_source},
-    {"unregister", lg_unregister_event_source},
-    {"is_empty", lg_is_event_queue_empty},
-    {"get_next_event", lg_get_next_event},
-    {"peek_next_event", lg_peek_next_event},
-    {"drop_next_event", lg_drop_next_event},
-    {"flush", lg_flush_event_queue},
-    {"wait_for_event", lg_wait_for_event},
-    {"wait_for_event_timed", lg_wait_for_event_timed},
-    {"wait_for_event_until", lg_wait_for_event_until},
+static const luaL_Reg sample_id__methods[] = {
+    {"__tostring", sample_id__tostring},
+    {"stop", lg_stop_sample},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Joystick
+                Audio Sample Instance
 
 ================================================================================
 */
-static ALLEGRO_JOYSTICK *to_joystick( lua_State *L, const int idx ) {
-    return (ALLEGRO_JOYSTICK*) to_object(L, idx, LEGATO_JOYSTICK);
+static ALLEGRO_SAMPLE_INSTANCE *to_sample_instance( lua_State *L, const int idx ) {
+    return (ALLEGRO_SAMPLE_INSTANCE*) to_object(L, idx, LEGATO_SAMPLE_INSTANCE);
 }
 
-static int joystick__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_JOYSTICK, to_joystick(L, 1));
+static int sample_instance__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_SAMPLE_INSTANCE, to_sample_instance(L, 1));
     return 1;
 }
 
-static const luaL_Reg joystick__methods[] = {
-    {"__tostring", joystick__tostring},
-    {"get_active", lg_get_joystick_active},
-    {"get_name", lg_get_joystick_name},
-    {"get_stick_name", lg_get_joystick_stick_name},
-    {"get_axis_name", lg_get_joystick_axis_name},
-    {"get_button_name", lg_get_joystick_button_name},
-    {"get_stick_flags", lg_get_joystick_stick_flags},
-    {"get_num_sticks", lg_get_joystick_num_sticks},
-    {"get_num_axes", lg_get_joystick_num_axes},
-    {"get_num_buttons", lg_get_joystick_num_buttons},
-    {"get_state", lg_get_joystick_state},
+/*
+static int sample_instance__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_SAMPLE_INSTANCE);
+}
+*/
+
+static const luaL_Reg sample_instance__methods[] = {
+    {"__tostring", sample_instance__tostring},
+    /*{"__eq", sample_instance__eq},*/
+    {"__gc", lg_destroy_sample_instance},
+    {"destroy", lg_destroy_sample_instance},
+    {"play", lg_play_sample_instance},
+    {"stop", lg_stop_sample_instance},
+    {"get_channels", lg_get_sample_instance_channels},
+    {"get_depth", lg_get_sample_instance_depth},
+    {"get_frequency", lg_get_sample_instance_frequency},
+    {"get_length", lg_get_sample_instance_length},
+    {"set_length", lg_set_sample_instance_length},
+    {"get_position", lg_get_sample_instance_position},
+    {"set_position", lg_set_sample_instance_position},
+    {"get_speed", lg_get_sample_instance_speed},
+    {"set_speed", lg_set_sample_instance_speed},
+    {"get_gain", lg_get_sample_instance_gain},
+    {"set_gain", lg_set_sample_instance_gain},
+    {"get_pan", lg_get_sample_instance_pan},
+    {"set_pan", lg_set_sample_instance_pan},
+    {"get_time", lg_get_sample_instance_time},
+    {"get_playmode", lg_get_sample_instance_playmode},
+    {"set_playmode", lg_set_sample_instance_playmode},
+    {"get_playing", lg_get_sample_instance_playing},
+    {"set_playing", lg_set_sample_instance_playing},
+    {"get_attached", lg_get_sample_instance_attached},
+    {"detach", lg_detach_sample_instance},
+    {"get_sample", lg_get_sample},
+    {"set_sample", lg_set_sample},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Joystick State
+                Audio Stream
 
 ================================================================================
 */
-static ALLEGRO_JOYSTICK_STATE *to_joystick_state( lua_State *L, const int idx ) {
-    return (ALLEGRO_JOYSTICK_STATE*) luaL_checkudata(L, idx, LEGATO_JOYSTICK_STATE);
-}
-
-static int joystick_state__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_JOYSTICK_STATE, to_joystick_state(L, 1));
-    return 1;
+static ALLEGRO_AUDIO_STREAM *to_audio_stream( lua_State *L, const int idx ) {
+    return (ALLEGRO_AUDIO_STREAM*) to_object(L, idx, LEGATO_AUDIO_STREAM);
 }
 
-static int joystick_state_get_button( lua_State *L ) {
-    int button = luaL_checkint(L, 2);
-    luaL_argcheck(L, button >= 0 && button < _AL_MAX_JOYSTICK_BUTTONS, 2, "invalid button");
-    lua_pushinteger(L, to_joystick_state(L, 1)->button[button]);
+static int audio_stream__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_AUDIO_STREAM, to_audio_stream(L, 1));
     return 1;
 }
 
-static int joystick_state_get_axis( lua_State *L ) {
-    int stick, axis;
-    stick = luaL_checkint(L, 2);
-    axis = luaL_checkint(L, 3);
-    luaL_argcheck(L, stick >= 0 && stick < _AL_MAX_JOYSTICK_STICKS, 2, "invalid stick");
-    luaL_argcheck(L, axis >= 0 && axis < _AL_MAX_JOYSTICK_AXES, 3, "invalid axis");
-    lua_pushnumber(L, to_joystick_state(L, 1)->stick[stick].axis[axis]);
-    return 1;
+/*
+static int audio_stream__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_AUDIO_STREAM);
 }
+*/
 
-static const luaL_Reg joystick_state__methods[] = {
-    {"__tostring", joystick_state__tostring},
-    {"get_button", joystick_state_get_button},
-    {"get_axis", joystick_state_get_axis},
+static const luaL_Reg audio_stream__methods[] = {
+    {"__tostring", audio_stream__tostring},
+    /*{"__eq", audio_stream__eq},*/
+    {"__gc", lg_destroy_audio_stream},
+    {"destroy", lg_destroy_audio_stream},
+    {"drain", lg_drain_audio_stream},
+    {"rewind", lg_rewind_audio_stream},
+    {"get_frequency", lg_get_audio_stream_frequency},
+    {"get_channels", lg_get_audio_stream_channels},
+    {"get_depth", lg_get_audio_stream_depth},
+    {"get_length", lg_get_audio_stream_length},
+    {"get_speed", lg_get_audio_stream_speed},
+    {"set_speed", lg_set_audio_stream_speed},
+    {"get_gain", lg_get_audio_stream_gain},
+    {"set_gain", lg_set_audio_stream_gain},
+    {"get_pan", lg_get_audio_stream_pan},
+    {"set_pan", lg_set_audio_stream_pan},
+    {"get_playing", lg_get_audio_stream_playing},
+    {"set_playing", lg_set_audio_stream_playing},
+    {"get_playmode", lg_get_audio_stream_playmode},
+    {"set_playmode", lg_set_audio_stream_playmode},
+    {"get_attached", lg_get_audio_stream_attached},
+    {"detach", lg_detach_audio_stream},
+    {"seek_secs", lg_seek_audio_stream_secs},
+    {"get_position_secs", lg_get_audio_stream_position_secs},
+    {"get_length_secs", lg_get_audio_stream_length_secs},
+    {"set_loop_secs", lg_set_audio_stream_loop_secs},
+    {"attach_to_mixer", lg_attach_audio_stream_to_mixer},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Keyboard State
+                Font
 
 ================================================================================
 */
-static ALLEGRO_KEYBOARD_STATE *to_keyboard_state( lua_State *L, const int idx ) {
-    return (ALLEGRO_KEYBOARD_STATE*) luaL_checkudata(L, idx, LEGATO_KEYBOARD_STATE);
+static ALLEGRO_FONT *to_font( lua_State *L, const int idx ) {
+    return (ALLEGRO_FONT*) to_object(L, idx, LEGATO_FONT);
 }
 
-static int keyboard_state__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_KEYBOARD_STATE, to_keyboard_state(L, 1));
+static int font__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_FONT, to_object_gc(L, 1, LEGATO_FONT));
     return 1;
 }
 
-static const luaL_Reg keyboard_state__methods[] = {
-    {"__tostring", keyboard_state__tostring},
-    {"get_state", lg_get_keyboard_state},
-    {"key_down", lg_key_down},
+/*
+static int font__eq( lua_State *L ) {
+    return push_equal_check(L, LEGATO_FONT);
+}
+*/
+
+static const luaL_Reg font__methods[] = {
+    {"__gc", lg_destroy_font},
+    {"__tostring", font__tostring},
+    /*{"__eq", font__eq},*/
+    {"get_line_height", lg_get_font_line_height},
+    {"get_ascent", lg_get_font_ascent},
+    {"get_descent", lg_get_font_descent},
+    {"get_text_width", lg_get_text_width},
+    {"draw_text", lg_draw_text},
+    {"draw_justified_text", lg_draw_justified_text},
+    {"get_text_dimensions", lg_get_text_dimensions},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Mouse State
+                Sprite Batch
 
 ================================================================================
 */
-static ALLEGRO_MOUSE_STATE *to_mouse_state( lua_State *L, const int idx ) {
-    return (ALLEGRO_MOUSE_STATE*) luaL_checkudata(L, idx, LEGATO_MOUSE_STATE);
+static sprite_batch_t *to_sprite_batch( lua_State *L, const int idx ) {
+    sprite_batch_t *batch = (sprite_batch_t*) luaL_checkudata(L, idx, LEGATO_SPRITE_BATCH);
+    if ( batch->bitmap == NULL ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_SPRITE_BATCH);
+    }
+    return batch;
 }
 
-static int mouse_state__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_MOUSE_STATE, to_mouse_state(L, 1));
+static int sprite_batch__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_SPRITE_BATCH, lua_touserdata(L, 1));
     return 1;
 }
 
-static const luaL_Reg mouse_state__methods[] = {
-    {"__tostring", mouse_state__tostring},
-    {"get_state", lg_get_mouse_state},
-    {"get_axis", lg_get_mouse_state_axis},
-    {"button_down", lg_mouse_button_down},
+static const luaL_Reg sprite_batch__methods[] = {
+    {"__gc", lg_destroy_sprite_batch},
+    {"__tostring", sprite_batch__tostring},
+    {"destroy", lg_destroy_sprite_batch},
+    {"add", lg_add_sprite},
+    {"clear", lg_clear_sprite_batch},
+    {"draw", lg_draw_sprite_batch},
+    {"get_count", lg_get_sprite_batch_count},
+    {"get_capacity", lg_get_sprite_batch_capacity},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Mouse Cursor
+                Locked Region
 
 ================================================================================
 */
-static ALLEGRO_MOUSE_CURSOR *to_mouse_cursor( lua_State *L, const int idx ) {
-    return (ALLEGRO_MOUSE_CURSOR*) to_object(L, 1, LEGATO_MOUSE_CURSOR);
+static locked_region_t *to_locked_region( lua_State *L, const int idx ) {
+    locked_region_t *lock = (locked_region_t*) luaL_checkudata(L, idx, LEGATO_LOCKED_REGION);
+    if ( lock->region == NULL ) {
+        luaL_error(L, "attempt to operate on unlocked " LUA_QS, LEGATO_LOCKED_REGION);
+    }
+    return lock;
 }
 
-static int mouse_cursor__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_MOUSE_CURSOR, to_mouse_cursor(L, 1));
-    return 1;
+/* raises an error if the lock mode does not allow the access */
+static void check_lock_access( lua_State *L, const locked_region_t *lock, const int write ) {
+    if ( lock->mode == (write ? ALLEGRO_LOCK_READONLY : ALLEGRO_LOCK_WRITEONLY) ) {
+        luaL_error(L, "cannot %s a %s locked region", write ? "write" : "read", write ? "readonly" : "writeonly");
+    }
 }
 
-static int mouse_cursor__gc( lua_State *L ) {
-    al_destroy_mouse_cursor(to_mouse_cursor(L, 1));
-    clear_object(L, 1);
+static int locked_region__gc( lua_State *L ) {
+    locked_region_t *lock = (locked_region_t*) luaL_checkudata(L, 1, LEGATO_LOCKED_REGION);
+    if ( lock->region ) {
+        ALLEGRO_BITMAP *bitmap = lock->bitmap;
+        release_locked_region(L, lock); /* the weak lock table has no entry for a finalized lock anymore */
+        al_unlock_bitmap(bitmap);
+    }
     return 0;
 }
 
-static const luaL_Reg mouse_cursor__methods[] = {
-    {"__tostring", mouse_cursor__tostring},
-    {"__gc", mouse_cursor__gc},
-    {NULL, NULL}
-};
-
-/*
-================================================================================
-
-                Path
+static int locked_region__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_LOCKED_REGION, lua_touserdata(L, 1));
+    return 1;
+}
 
-================================================================================
-*/
-static ALLEGRO_PATH *to_path( lua_State *L, const int idx ) {
-    return (ALLEGRO_PATH*) to_object(L, idx, LEGATO_PATH);
+static int locked_region_unlock( lua_State *L ) {
+    locked_region_t *lock = (locked_region_t*) luaL_checkudata(L, 1, LEGATO_LOCKED_REGION);
+    if ( lock->region ) {
+        invalidate_locked_region(L, lock->bitmap);
+    }
+    return locked_region__gc(L);
 }
 
-static int path__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_PATH, to_object_gc(L, 1, LEGATO_PATH));
+static int locked_region_is_locked( lua_State *L ) {
+    lua_pushboolean(L, ((locked_region_t*) luaL_checkudata(L, 1, LEGATO_LOCKED_REGION))->region != NULL);
     return 1;
 }
 
-/*
-static int path__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_PATH);
+static int locked_region_get_format( lua_State *L ) {
+    return push_enum_name(L, to_locked_region(L, 1)->region->format, pixel_format_mapping);
 }
-*/
-
-static const luaL_Reg path__methods[] = {
-    {"__tostring", path__tostring},
-    /*{"__eq", path__eq},*/
-    {"__gc", lg_destroy_path},
-    {"destroy", lg_destroy_path},
-    {"clone", lg_clone_path},
-    {"join_path", lg_join_paths},
-    {"rebase", lg_rebase_path},
-    {"get_drive", lg_get_path_drive},
-    {"get_num_components", lg_get_path_num_components},
-    {"get_components", lg_get_path_components},
-    {"get_tail", lg_get_path_tail},
-    {"get_filename", lg_get_path_filename},
-    {"get_basename", lg_get_path_basename},
-    {"get_extension", lg_get_path_extension},
-    {"set_drive", lg_set_path_drive},
-    {"append_component", lg_append_path_component},
-    {"insert_component", lg_insert_path_component},
-    {"replace_component", lg_replace_path_component},
-    {"remove_component", lg_remove_path_component},
-    {"drop_tail", lg_drop_path_tail},
-    {"set_filename", lg_set_path_filename},
-    {"set_extension", lg_set_path_extension},
-    {"str", lg_path_str},
-    {"make_canonical", lg_make_path_canonical},
-    {NULL, NULL}
-};
-
-/*
-================================================================================
-
-                State
 
-================================================================================
-*/
-static ALLEGRO_STATE *to_state( lua_State *L, const int idx ) {
-    return (ALLEGRO_STATE*) luaL_checkudata(L, idx, LEGATO_STATE);
+static int locked_region_get_pitch( lua_State *L ) {
+    lua_pushinteger(L, to_locked_region(L, 1)->region->pitch);
+    return 1;
 }
 
-static int state__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_STATE, to_state(L, 1));
+static int locked_region_get_pixel_size( lua_State *L ) {
+    lua_pushinteger(L, to_locked_region(L, 1)->region->pixel_size);
     return 1;
 }
 
-static const luaL_Reg state__methods[] = {
-    {"__tostring", state__tostring},
-    {"restore", lg_restore_state},
-    {NULL, NULL}
-};
-
-/*
-================================================================================
-
-                Timers
+static int locked_region_get_size( lua_State *L ) {
+    locked_region_t *lock = to_locked_region(L, 1);
+    lua_pushinteger(L, lock->width);
+    lua_pushinteger(L, lock->height);
+    return 2;
+}
 
-================================================================================
-*/
-static ALLEGRO_TIMER *to_timer( lua_State *L, const int idx ) {
-    return (ALLEGRO_TIMER*) to_object(L, idx, LEGATO_TIMER);
+static char *get_locked_row( const locked_region_t *lock, const int x, const int y ) {
+    return (char*) lock->region->data + (ptrdiff_t) y * lock->region->pitch + (ptrdiff_t) x * lock->region->pixel_size;
 }
 
-static int timer__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_TIMER, to_object_gc(L, 1, LEGATO_TIMER));
+/* read_row(y, [x, count]) -> raw pixel data of one row (0-based coordinates) */
+static int locked_region_read_row( lua_State *L ) {
+    int x, y, count;
+    locked_region_t *lock = to_locked_region(L, 1);
+    check_lock_access(L, lock, 0);
+    y = luaL_checkint(L, 2);
+    x = luaL_optint(L, 3, 0);
+    count = luaL_optint(L, 4, lock->width - x);
+    luaL_argcheck(L, y >= 0 && y < lock->height, 2, "row out of bounds");
+    luaL_argcheck(L, x >= 0 && x < lock->width, 3, "column out of bounds");
+    luaL_argcheck(L, count >= 0 && x + count <= lock->width, 4, "count out of bounds");
+    lua_pushlstring(L, get_locked_row(lock, x, y), (size_t) count * lock->region->pixel_size);
     return 1;
 }
 
-/*
-static int timer__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_TIMER);
+/* write_row(y, data, [x]) -> writes raw pixel data into one row */
+static int locked_region_write_row( lua_State *L ) {
+    int x, y;
+    size_t size;
+    const char *data;
+    locked_region_t *lock = to_locked_region(L, 1);
+    check_lock_access(L, lock, 1);
+    y = luaL_checkint(L, 2);
+    data = luaL_checklstring(L, 3, &size);
+    x = luaL_optint(L, 4, 0);
+    luaL_argcheck(L, y >= 0 && y < lock->height, 2, "row out of bounds");
+    luaL_argcheck(L, size % lock->region->pixel_size == 0, 3, "data is not a multiple of the pixel size");
+    luaL_argcheck(L, x >= 0 && x + (int) (size / lock->region->pixel_size) <= lock->width, 4, "data exceeds row");
+    memcpy(get_locked_row(lock, x, y), data, size);
+    return 0;
 }
-*/
 
-static const luaL_Reg timer__methods[] = {
-    {"__gc", lg_destroy_timer},
-    {"__tostring", timer__tostring},
-    /*{"__eq", timer__eq},*/
-    {"start", lg_start_timer},
-    {"stop", lg_stop_timer},
-    {"get_started", lg_get_timer_started},
-    {"get_count", lg_get_timer_count},
-    {"set_count", lg_set_timer_count},
-    {"add_count", lg_add_timer_count},
-    {"get_speed", lg_get_timer_speed},
-    {"set_speed", lg_set_timer_speed},
-    {NULL, NULL}
-};
-
-/*
-================================================================================
+/* encodes a color into the raw pixel layout of the common formats */
+static int encode_pixel( const int format, ALLEGRO_COLOR color, unsigned char pixel[16] ) {
+    unsigned char r, g, b, a;
+    uint32_t p32;
+    uint16_t p16;
+    al_unmap_rgba(color, &r, &g, &b, &a);
+    switch ( format ) {
+        case ALLEGRO_PIXEL_FORMAT_ARGB_8888: p32 = (a << 24) | (r << 16) | (g << 8) | b; break;
+        case ALLEGRO_PIXEL_FORMAT_XRGB_8888: p32 = (r << 16) | (g << 8) | b; break;
+        case ALLEGRO_PIXEL_FORMAT_RGBA_8888: p32 = ((uint32_t) r << 24) | (g << 16) | (b << 8) | a; break;
+        case ALLEGRO_PIXEL_FORMAT_RGBX_8888: p32 = ((uint32_t) r << 24) | (g << 16) | (b << 8); break;
+        case ALLEGRO_PIXEL_FORMAT_ABGR_8888: p32 = ((uint32_t) a << 24) | (b << 16) | (g << 8) | r; break;
+        case ALLEGRO_PIXEL_FORMAT_XBGR_8888: p32 = (b << 16) | (g << 8) | r; break;
+        case ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE:
+            pixel[0] = r; pixel[1] = g; pixel[2] = b; pixel[3] = a;
+            return 4;
+        case ALLEGRO_PIXEL_FORMAT_RGB_888:
+            pixel[0] = b; pixel[1] = g; pixel[2] = r;
+            return 3;
+        case ALLEGRO_PIXEL_FORMAT_BGR_888:
+            pixel[0] = r; pixel[1] = g; pixel[2] = b;
+            return 3;
+        case ALLEGRO_PIXEL_FORMAT_RGB_565:
+            p16 = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+            memcpy(pixel, &p16, 2);
+            return 2;
+        case ALLEGRO_PIXEL_FORMAT_BGR_565:
+            p16 = ((b >> 3) << 11) | ((g >> 2) << 5) | (r >> 3);
+            memcpy(pixel, &p16, 2);
+            return 2;
+        case ALLEGRO_PIXEL_FORMAT_ABGR_F32:
+            memcpy(pixel, &color, 16);
+            return 16;
+        default:
+            return 0;
+    }
+    memcpy(pixel, &p32, 4);
+    return 4;
+}
 
-                Transformations
+/* fill_rect(x, y, w, h, color or raw pixel string) */
+static int locked_region_fill_rect( lua_State *L ) {
+    int x, y, w, h, i, j, pixel_size;
+    size_t size;
+    unsigned char pixel[16];
+    char *row;
+    locked_region_t *lock = to_locked_region(L, 1);
+    check_lock_access(L, lock, 1);
+    x = luaL_checkint(L, 2); y = luaL_checkint(L, 3);
+    w = luaL_checkint(L, 4); h = luaL_checkint(L, 5);
+    pixel_size = lock->region->pixel_size;
+    if ( lua_type(L, 6) == LUA_TSTRING ) {
+        const char *data = lua_tolstring(L, 6, &size);
+        luaL_argcheck(L, (int) size == pixel_size, 6, "pixel has wrong size");
+        memcpy(pixel, data, size);
+    } else {
+        luaL_argcheck(L, encode_pixel(lock->region->format, to_color(L, 6), pixel) == pixel_size, 6, "unsupported pixel format for colors");
+    }
+    if ( x < 0 ) { w += x; x = 0; } /* clip rectangle to the locked region */
+    if ( y < 0 ) { h += y; y = 0; }
+    if ( x + w > lock->width ) { w = lock->width - x; }
+    if ( y + h > lock->height ) { h = lock->height - y; }
+    for ( j = 0; j < h; ++j ) {
+        row = get_locked_row(lock, x, y + j);
+        for ( i = 0; i < w; ++i, row += pixel_size ) {
+            memcpy(row, pixel, pixel_size);
+        }
+    }
+    return 0;
+}
 
-================================================================================
-*/
-static ALLEGRO_TRANSFORM *to_transform( lua_State *L, const int idx ) {
-    return (ALLEGRO_TRANSFORM*) luaL_checkudata(L, idx, LEGATO_TRANSFORM);
+/* copy_from_string(data) -> fills the whole region with tightly packed rows */
+static int locked_region_copy_from_string( lua_State *L ) {
+    int y;
+    size_t size, row_size;
+    const char *data;
+    locked_region_t *lock = to_locked_region(L, 1);
+    check_lock_access(L, lock, 1);
+    data = luaL_checklstring(L, 2, &size);
+    row_size = (size_t) lock->width * lock->region->pixel_size;
+    luaL_argcheck(L, size == row_size * lock->height, 2, "data size does not match region");
+    for ( y = 0; y < lock->height; ++y, data += row_size ) {
+        memcpy(get_locked_row(lock, 0, y), data, row_size);
+    }
+    return 0;
 }
 
-static int transform__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_TRANSFORM, to_transform(L, 1));
+/* copy_to_string() -> the whole region as tightly packed rows */
+static int locked_region_copy_to_string( lua_State *L ) {
+    int y;
+    size_t row_size;
+    luaL_Buffer buffer;
+    locked_region_t *lock = to_locked_region(L, 1);
+    check_lock_access(L, lock, 0);
+    row_size = (size_t) lock->width * lock->region->pixel_size;
+    luaL_buffinit(L, &buffer);
+    for ( y = 0; y < lock->height; ++y ) {
+        luaL_addlstring(&buffer, get_locked_row(lock, 0, y), row_size);
+    }
+    luaL_pushresult(&buffer);
     return 1;
 }
 
-static const luaL_Reg transform__methods[] = {
-    {"__tostring", transform__tostring},
-    {"copy", lg_copy_transform},
-    {"use", lg_use_transform},
-    {"invert", lg_invert_transform},
-    {"check_inverse", lg_check_inverse},
-    {"identity", lg_identity_transform},
-    {"translate", lg_translate_transform},
-    {"rotate", lg_rotate_transform},
-    {"scale", lg_scale_transform},
-    {"transform", lg_transform_coordinates},
-    {"compose", lg_compose_transform},
+static const luaL_Reg locked_region__methods[] = {
+    {"__gc", locked_region__gc},
+    {"__tostring", locked_region__tostring},
+    {"unlock", locked_region_unlock},
+    {"is_locked", locked_region_is_locked},
+    {"get_format", locked_region_get_format},
+    {"get_pitch", locked_region_get_pitch},
+    {"get_pixel_size", locked_region_get_pixel_size},
+    {"get_size", locked_region_get_size},
+    {"read_row", locked_region_read_row},
+    {"write_row", locked_region_write_row},
+    {"fill_rect", locked_region_fill_rect},
+    {"copy_from_string", locked_region_copy_from_string},
+    {"copy_to_string", locked_region_copy_to_string},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Audio Voice
+                Atlas
 
 ================================================================================
 */
-static ALLEGRO_VOICE *to_voice( lua_State *L, const int idx ) {
-    return (ALLEGRO_VOICE*) to_object(L, idx, LEGATO_VOICE);
+static atlas_t *to_atlas( lua_State *L, const int idx ) {
+    atlas_t *atlas = (atlas_t*) luaL_checkudata(L, idx, LEGATO_ATLAS);
+    if ( atlas->bitmap == NULL ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_ATLAS);
+    }
+    return atlas;
 }
 
-static int voice__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_VOICE, to_voice(L, 1));
+static int atlas__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_ATLAS, lua_touserdata(L, 1));
     return 1;
 }
 
-/*
-static int voice__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_VOICE);
-}
-*/
-
-static const luaL_Reg voice__methods[] = {
-    {"__gc", lg_destroy_voice},
-    {"__tostring", voice__tostring},
-    /*{"__eq", voice__eq},*/
-    {"get_frequency", lg_get_voice_frequency},
-    {"get_channels", lg_get_voice_channels},
-    {"get_depth", lg_get_voice_depth},
-    {"get_playing", lg_get_voice_playing},
-    {"set_playing", lg_set_voice_playing},
-    {"get_position", lg_get_voice_position},
-    {"set_position", lg_set_voice_position},
+static const luaL_Reg atlas__methods[] = {
+    {"__gc", lg_destroy_atlas},
+    {"__tostring", atlas__tostring},
+    {"destroy", lg_destroy_atlas},
+    {"add", lg_add_to_atlas},
+    {"get_bitmap", lg_get_atlas_bitmap},
+    {"get_occupancy", lg_get_atlas_occupancy},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Audio Mixer
+                Vertex Array
 
 ================================================================================
 */
-static ALLEGRO_MIXER *to_mixer( lua_State *L, const int idx ) {
-    return (ALLEGRO_MIXER*) to_object(L, idx, LEGATO_MIXER);
-}
-
-static int mixer__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_MIXER, to_mixer(L, 1));
-    return 1;
-}
-
-/*
-static int mixer__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_MIXER);
+static vertex_array_t *to_vertex_array( lua_State *L, const int idx ) {
+    vertex_array_t *array = (vertex_array_t*) luaL_checkudata(L, idx, LEGATO_VERTEX_ARRAY);
+    if ( array->vertices == NULL ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_VERTEX_ARRAY);
+    }
+    return array;
 }
-*/
 
-static const luaL_Reg mixer__methods[] = {
-    {"__tostring", mixer__tostring},
-    /*{"__eq", mixer__eq},*/
-    {"__gc", lg_destroy_mixer},
-    {"attach_to_mixer", lg_attach_mixer_to_mixer},
-    {"get_frequency", lg_get_mixer_frequency},
-    {"set_frequency", lg_set_mixer_frequency},
-    {"get_channels", lg_get_mixer_channels},
-    {"get_depth", lg_get_mixer_depth},
-    {"get_gain", lg_get_mixer_gain},
-    {"set_gain", lg_set_mixer_gain},
-    {"get_quality", lg_get_mixer_quality},
-    {"set_quality", lg_set_mixer_quality},
-    {"get_playing", lg_get_mixer_playing},
-    {"set_playing", lg_set_mixer_playing},
-    {"get_attached", lg_get_mixer_attached},
-    {"detach", lg_detach_mixer},
+static int vertex_array__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_VERTEX_ARRAY, lua_touserdata(L, 1));
+    return 1;
+}
+
+static const luaL_Reg vertex_array__methods[] = {
+    {"__gc", lg_destroy_vertex_array},
+    {"__tostring", vertex_array__tostring},
+    {"destroy", lg_destroy_vertex_array},
+    {"set_vertex", lg_set_vertex},
+    {"get_vertex", lg_get_vertex},
+    {"set_vertex_color", lg_set_vertex_color},
+    {"set_vertices", lg_set_vertices},
+    {"set_indices", lg_set_indices},
+    {"set_count", lg_set_vertex_count},
+    {"get_count", lg_get_vertex_count},
+    {"get_capacity", lg_get_vertex_capacity},
+    {"draw", lg_draw_vertex_array},
+    {"draw_indexed", lg_draw_indexed_vertex_array},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Audio Sample
+                Command List
 
 ================================================================================
 */
-static ALLEGRO_SAMPLE *to_audio_sample( lua_State *L, const int idx ) {
-    return (ALLEGRO_SAMPLE*) to_object(L, idx, LEGATO_AUDIO_SAMPLE);
+static command_list_t *to_command_list( lua_State *L, const int idx ) {
+    command_list_t *list = (command_list_t*) luaL_checkudata(L, idx, LEGATO_COMMAND_LIST);
+    if ( list->objects_ref == LUA_NOREF ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_COMMAND_LIST);
+    }
+    return list;
 }
 
-static int audio_sample__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_AUDIO_SAMPLE, to_audio_sample(L, 1));
+static int command_list__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_COMMAND_LIST, lua_touserdata(L, 1));
     return 1;
 }
 
-/*
-static int audio_sample__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_AUDIO_SAMPLE);
-}
-*/
-
-static const luaL_Reg audio_sample__methods[] = {
-    {"__tostring", audio_sample__tostring},
-    /*{"__eq", audio_sample__eq},*/
+static const luaL_Reg command_list__methods[] = {
+    {"__gc", lg_destroy_command_list},
+    {"__tostring", command_list__tostring},
+    {"destroy", lg_destroy_command_list},
+    {"draw", lg_draw_command_list},
+    {"get_size", lg_get_command_list_size},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Audio Sample ID
+                Text Object
 
 ================================================================================
 */
-static ALLEGRO_SAMPLE_ID *to_sample_id( lua_State *L, const int idx ) {
-    return (ALLEGRO_SAMPLE_ID*) luaL_checkudata(L, idx, LEGATO_SAMPLE_ID);
+static text_object_t *to_text_object( lua_State *L, const int idx ) {
+    text_object_t *obj = (text_object_t*) luaL_checkudata(L, idx, LEGATO_TEXT_OBJECT);
+    if ( obj->font_ref == LUA_NOREF ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_TEXT_OBJECT);
+    }
+    return obj;
 }
 
-static int sample_id__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_SAMPLE_ID, to_sample_id(L, 1));
+static int text_object__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_TEXT_OBJECT, lua_touserdata(L, 1));
     return 1;
 }
 
-static const luaL_Reg sample_id__methods[] = {
-    {"__tostring", sample_id__tostring},
-    {"stop", lg_stop_sample},
+static const luaL_Reg text_object__methods[] = {
+    {"__gc", lg_destroy_text_object},
+    {"__tostring", text_object__tostring},
+    {"destroy", lg_destroy_text_object},
+    {"draw", lg_draw_text_object},
+    {"set_text", lg_set_text_object_text},
+    {"get_width", lg_get_text_object_width},
+    {"get_dimensions", lg_get_text_object_dimensions},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Audio Sample Instance
+                Render Target Pool
 
 ================================================================================
 */
-static ALLEGRO_SAMPLE_INSTANCE *to_sample_instance( lua_State *L, const int idx ) {
-    return (ALLEGRO_SAMPLE_INSTANCE*) to_object(L, idx, LEGATO_SAMPLE_INSTANCE);
+static render_target_pool_t *to_render_target_pool( lua_State *L, const int idx ) {
+    render_target_pool_t *pool = (render_target_pool_t*) luaL_checkudata(L, idx, LEGATO_RENDER_TARGET_POOL);
+    if ( pool->destroyed ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_RENDER_TARGET_POOL);
+    }
+    return pool;
 }
 
-static int sample_instance__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_SAMPLE_INSTANCE, to_sample_instance(L, 1));
+static int render_target_pool__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_RENDER_TARGET_POOL, lua_touserdata(L, 1));
     return 1;
 }
 
-/*
-static int sample_instance__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_SAMPLE_INSTANCE);
-}
-*/
-
-static const luaL_Reg sample_instance__methods[] = {
-    {"__tostring", sample_instance__tostring},
-    /*{"__eq", sample_instance__eq},*/
-    {"__gc", lg_destroy_sample_instance},
-    {"destroy", lg_destroy_sample_instance},
-    {"play", lg_play_sample_instance},
-    {"stop", lg_stop_sample_instance},
-    {"get_channels", lg_get_sample_instance_channels},
-    {"get_depth", lg_get_sample_instance_depth},
-    {"get_frequency", lg_get_sample_instance_frequency},
-    {"get_length", lg_get_sample_instance_length},
-    {"set_length", lg_set_sample_instance_length},
-    {"get_position", lg_get_sample_instance_position},
-    {"set_position", lg_set_sample_instance_position},
-    {"get_speed", lg_get_sample_instance_speed},
-    {"set_speed", lg_set_sample_instance_speed},
-    {"get_gain", lg_get_sample_instance_gain},
-    {"set_gain", lg_set_sample_instance_gain},
-    {"get_pan", lg_get_sample_instance_pan},
-    {"set_pan", lg_set_sample_instance_pan},
-    {"get_time", lg_get_sample_instance_time},
-    {"get_playmode", lg_get_sample_instance_playmode},
-    {"set_playmode", lg_set_sample_instance_playmode},
-    {"get_playing", lg_get_sample_instance_playing},
-    {"set_playing", lg_set_sample_instance_playing},
-    {"get_attached", lg_get_sample_instance_attached},
-    {"detach", lg_detach_sample_instance},
-    {"get_sample", lg_get_sample},
-    {"set_sample", lg_set_sample},
+static const luaL_Reg render_target_pool__methods[] = {
+    {"__gc", lg_destroy_render_target_pool},
+    {"__tostring", render_target_pool__tostring},
+    {"destroy", lg_destroy_render_target_pool},
+    {"acquire", lg_acquire_render_target},
+    {"release", lg_release_render_target},
+    {"update", lg_update_render_target_pool},
+    {"clear", lg_clear_render_target_pool},
+    {"get_stats", lg_get_render_target_pool_stats},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Audio Stream
+                Animation
 
 ================================================================================
 */
-static ALLEGRO_AUDIO_STREAM *to_audio_stream( lua_State *L, const int idx ) {
-    return (ALLEGRO_AUDIO_STREAM*) to_object(L, idx, LEGATO_AUDIO_STREAM);
+static animation_t *to_animation( lua_State *L, const int idx ) {
+    animation_t *animation = (animation_t*) luaL_checkudata(L, idx, LEGATO_ANIMATION);
+    if ( animation->bitmap == NULL ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_ANIMATION);
+    }
+    return animation;
 }
 
-static int audio_stream__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_AUDIO_STREAM, to_audio_stream(L, 1));
+static int animation__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_ANIMATION, lua_touserdata(L, 1));
     return 1;
 }
 
+static const luaL_Reg animation__methods[] = {
+    {"__gc", lg_destroy_animation},
+    {"__tostring", animation__tostring},
+    {"destroy", lg_destroy_animation},
+    {"get_length", lg_get_animation_length},
+    {NULL, NULL}
+};
+
 /*
-static int audio_stream__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_AUDIO_STREAM);
-}
-*/
+================================================================================
 
-static const luaL_Reg audio_stream__methods[] = {
-    {"__tostring", audio_stream__tostring},
-    /*{"__eq", audio_stream__eq},*/
-    {"__gc", lg_destroy_audio_stream},
-    {"destroy", lg_destroy_audio_stream},
-    {"drain", lg_drain_audio_stream},
-    {"rewind", lg_rewind_audio_stream},
-    {"get_frequency", lg_get_audio_stream_frequency},
-    {"get_channels", lg_get_audio_stream_channels},
-    {"get_depth", lg_get_audio_stream_depth},
-    {"get_length", lg_get_audio_stream_length},
-    {"get_speed", lg_get_audio_stream_speed},
-    {"set_speed", lg_set_audio_stream_speed},
-    {"get_gain", lg_get_audio_stream_gain},
-    {"set_gain", lg_set_audio_stream_gain},
-    {"get_pan", lg_get_audio_stream_pan},
-    {"set_pan", lg_set_audio_stream_pan},
-    {"get_playing", lg_get_audio_stream_playing},
-    {"set_playing", lg_set_audio_stream_playing},
-    {"get_playmode", lg_get_audio_stream_playmode},
-    {"set_playmode", lg_set_audio_stream_playmode},
-    {"get_attached", lg_get_audio_stream_attached},
-    {"detach", lg_detach_audio_stream},
-    {"seek_secs", lg_seek_audio_stream_secs},
-    {"get_position_secs", lg_get_audio_stream_position_secs},
-    {"get_length_secs", lg_get_audio_stream_length_secs},
-    {"set_loop_secs", lg_set_audio_stream_loop_secs},
-    {"attach_to_mixer", lg_attach_audio_stream_to_mixer},
+                Animator
+
+================================================================================
+*/
+static animator_t *to_animator( lua_State *L, const int idx ) {
+    animator_t *animator = (animator_t*) luaL_checkudata(L, idx, LEGATO_ANIMATOR);
+    if ( animator->animations_ref == LUA_NOREF ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_ANIMATOR);
+    }
+    return animator;
+}
+
+static int animator__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_ANIMATOR, lua_touserdata(L, 1));
+    return 1;
+}
+
+static const luaL_Reg animator__methods[] = {
+    {"__gc", lg_destroy_animator},
+    {"__tostring", animator__tostring},
+    {"destroy", lg_destroy_animator},
+    {"add", lg_add_to_animator},
+    {"remove", lg_remove_from_animator},
+    {"clear", lg_clear_animator},
+    {"set_animation", lg_set_animator_animation},
+    {"set_position", lg_set_animator_position},
+    {"set_speed", lg_set_animator_speed},
+    {"set_flags", lg_set_animator_flags},
+    {"set_tint", lg_set_animator_tint},
+    {"get_frame", lg_get_animator_frame},
+    {"get_count", lg_get_animator_count},
+    {"update", lg_update_animator},
+    {"update_ticks", lg_update_animator_ticks},
+    {"draw", lg_draw_animator},
     {NULL, NULL}
 };
 
 /*
 ================================================================================
 
-                Font
+                Input Snapshot
 
 ================================================================================
 */
-static ALLEGRO_FONT *to_font( lua_State *L, const int idx ) {
-    return (ALLEGRO_FONT*) to_object(L, idx, LEGATO_FONT);
+static input_snapshot_t *to_input_snapshot( lua_State *L, const int idx ) {
+    return (input_snapshot_t*) luaL_checkudata(L, idx, LEGATO_INPUT_SNAPSHOT);
 }
 
-static int font__tostring( lua_State *L ) {
-    lua_pushfstring(L, "%s: %p", LEGATO_FONT, to_object_gc(L, 1, LEGATO_FONT));
+static int input_snapshot__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_INPUT_SNAPSHOT, to_input_snapshot(L, 1));
     return 1;
 }
 
-/*
-static int font__eq( lua_State *L ) {
-    return push_equal_check(L, LEGATO_FONT);
-}
-*/
-
-static const luaL_Reg font__methods[] = {
-    {"__gc", lg_destroy_font},
-    {"__tostring", font__tostring},
-    /*{"__eq", font__eq},*/
-    {"get_line_height", lg_get_font_line_height},
-    {"get_ascent", lg_get_font_ascent},
-    {"get_descent", lg_get_font_descent},
-    {"get_text_width", lg_get_text_width},
-    {"draw_text", lg_draw_text},
-    {"draw_justified_text", lg_draw_justified_text},
-    {"get_text_dimensions", lg_get_text_dimensions},
+static const luaL_Reg input_snapshot__methods[] = {
+    {"__tostring", input_snapshot__tostring},
+    {"update", lg_update_input_snapshot},
+    {"pressed", lg_input_snapshot_pressed},
+    {"released", lg_input_snapshot_released},
+    {"held", lg_input_snapshot_held},
+    {"bind", lg_bind_input_action},
+    {"get_mouse", lg_get_input_snapshot_mouse},
+    {"get_axis", lg_get_input_snapshot_axis},
     {NULL, NULL}
 };
 
@@ -5763,8 +11126,20 @@ static int util_create_number_map( lua_State *L ) {
     return 1;
 }
 
+static int util_create_float_buffer( lua_State *L ) {
+    int size;
+    float_buffer_t *buffer;
+    size = luaL_checkint(L, 1);
+    luaL_argcheck(L, size > 0, 1, "invalid size");
+    buffer = (float_buffer_t*) push_data(L, LEGATO_FLOAT_BUFFER, sizeof(float_buffer_t) + sizeof(float) * (size - 1));
+    buffer->size = size;
+    memset(buffer->data, 0, sizeof(float) * size);
+    return 1;
+}
+
 static const luaL_Reg util__functions[] = {
     {"create_number_map", util_create_number_map},
+    {"create_float_buffer", util_create_float_buffer},
     {NULL, NULL}
 };
 
@@ -5881,6 +11256,421 @@ static const luaL_Reg number_map__methods[] = {
     {NULL, NULL}
 };
 
+/*
+================================================================================
+
+                Float Buffer
+
+================================================================================
+*/
+static float_buffer_t *to_float_buffer( lua_State *L, const int idx ) {
+    return (float_buffer_t*) luaL_checkudata(L, idx, LEGATO_FLOAT_BUFFER);
+}
+
+static int float_buffer__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_FLOAT_BUFFER, to_float_buffer(L, 1));
+    return 1;
+}
+
+static int float_buffer__len( lua_State *L ) {
+    lua_pushinteger(L, to_float_buffer(L, 1)->size);
+    return 1;
+}
+
+static int float_buffer_get_size( lua_State *L ) {
+    lua_pushinteger(L, to_float_buffer(L, 1)->size);
+    return 1;
+}
+
+/* get(i, [count]) -> count values starting at i */
+static int float_buffer_get( lua_State *L ) {
+    int i, first, count;
+    float_buffer_t *buffer = to_float_buffer(L, 1);
+    first = luaL_checkint(L, 2);
+    count = luaL_optint(L, 3, 1);
+    luaL_argcheck(L, first >= 1 && count >= 0 && first - 1 + count <= buffer->size, 2, "index out of range");
+    luaL_checkstack(L, count, "too many values");
+    for ( i = first - 1; i < first - 1 + count; ++i ) {
+        lua_pushnumber(L, buffer->data[i]);
+    }
+    return count;
+}
+
+/* set(i, value, ...) - sets consecutive values starting at i */
+static int float_buffer_set( lua_State *L ) {
+    int i, first, count;
+    float_buffer_t *buffer = to_float_buffer(L, 1);
+    first = luaL_checkint(L, 2);
+    count = lua_gettop(L) - 2;
+    luaL_argcheck(L, first >= 1 && first - 1 + count <= buffer->size, 2, "index out of range");
+    for ( i = 0; i < count; ++i ) {
+        buffer->data[first - 1 + i] = (float) luaL_checknumber(L, i + 3);
+    }
+    return 0;
+}
+
+static int float_buffer_fill( lua_State *L ) {
+    int i;
+    float_buffer_t *buffer = to_float_buffer(L, 1);
+    float value = (float) luaL_checknumber(L, 2);
+    for ( i = 0; i < buffer->size; ++i ) {
+        buffer->data[i] = value;
+    }
+    return 0;
+}
+
+static const luaL_Reg float_buffer__methods[] = {
+    {"__tostring", float_buffer__tostring},
+    {"__len", float_buffer__len},
+    {"get_size", float_buffer_get_size},
+    {"get", float_buffer_get},
+    {"set", float_buffer_set},
+    {"fill", float_buffer_fill},
+    {NULL, NULL}
+};
+
+/*
+================================================================================
+
+                PARTICLE EFFECTS
+
+    Particles are kept in separate float arrays (structure of arrays) and
+    updated with plain loops over these arrays. Dead particles are replaced
+    by the last living one, so the living particles are always packed at
+    the front and drawn with a single al_draw_prim call.
+
+================================================================================
+*/
+static emitter_t *to_emitter( lua_State *L, const int idx ) {
+    emitter_t *emitter = (emitter_t*) luaL_checkudata(L, idx, LEGATO_EMITTER);
+    if ( emitter->bitmap == NULL ) {
+        luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_EMITTER);
+    }
+    return emitter;
+}
+
+/* xorshift32, returns a float in [0, 1) */
+static float emitter_random( emitter_t *emitter ) {
+    uint32_t x = emitter->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    emitter->seed = x;
+    return (float) (x >> 8) / 16777216.0f;
+}
+
+/* create_emitter(capacity, bitmap, [region]) */
+static int fx_create_emitter( lua_State *L ) {
+    int capacity;
+    float *data;
+    emitter_t *emitter;
+    ALLEGRO_BITMAP *bitmap;
+    capacity = luaL_checkint(L, 1);
+    luaL_argcheck(L, capacity > 0, 1, "invalid capacity");
+    bitmap = to_bitmap(L, 2);
+    emitter = (emitter_t*) push_data(L, LEGATO_EMITTER, sizeof(emitter_t) + sizeof(float) * capacity * 12);
+    memset(emitter, 0, sizeof(emitter_t));
+    emitter->bitmap = bitmap;
+    lua_pushvalue(L, 2); /* keep the bitmap alive as long as the emitter */
+    emitter->bitmap_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    get_region(L, 3, bitmap, emitter->region);
+    emitter->capacity = capacity;
+    emitter->spread = (float) ALLEGRO_PI * 2.0f;
+    emitter->speed_min = emitter->speed_max = 50.0f;
+    emitter->life_min = emitter->life_max = 1.0f;
+    emitter->scale_start = emitter->scale_end = 1.0f;
+    emitter->ramp_count = 1;
+    emitter->ramp[0] = al_map_rgba_f(1.0, 1.0, 1.0, 1.0);
+    emitter->seed = 0x2545f491;
+    data = (float*) (emitter + 1);
+    emitter->px = data; data += capacity;
+    emitter->py = data; data += capacity;
+    emitter->vx = data; data += capacity;
+    emitter->vy = data; data += capacity;
+    emitter->age = data; data += capacity;
+    emitter->inv_life = data; data += capacity;
+    emitter->scale = data; data += capacity;
+    emitter->r = data; data += capacity;
+    emitter->g = data; data += capacity;
+    emitter->b = data; data += capacity;
+    emitter->a = data; data += capacity;
+    emitter->t = data;
+    return 1;
+}
+
+static int emitter_destroy( lua_State *L ) {
+    emitter_t *emitter = (emitter_t*) luaL_checkudata(L, 1, LEGATO_EMITTER);
+    luaL_unref(L, LUA_REGISTRYINDEX, emitter->bitmap_ref);
+    emitter->bitmap_ref = LUA_NOREF;
+    emitter->bitmap = NULL;
+    emitter->count = 0;
+    return 0;
+}
+
+static int emitter__tostring( lua_State *L ) {
+    lua_pushfstring(L, "%s: %p", LEGATO_EMITTER, lua_touserdata(L, 1));
+    return 1;
+}
+
+static void spawn_particles( emitter_t *emitter, int n ) {
+    int i;
+    float angle, speed;
+    if ( n > emitter->capacity - emitter->count ) {
+        n = emitter->capacity - emitter->count;
+    }
+    for ( i = emitter->count; n > 0; --n, ++i ) {
+        angle = emitter->direction + (emitter_random(emitter) - 0.5f) * emitter->spread;
+        speed = emitter->speed_min + emitter_random(emitter) * (emitter->speed_max - emitter->speed_min);
+        emitter->px[i] = emitter->x;
+        emitter->py[i] = emitter->y;
+        emitter->vx[i] = cosf(angle) * speed;
+        emitter->vy[i] = sinf(angle) * speed;
+        emitter->age[i] = 0.0f;
+        emitter->inv_life[i] = 1.0f / (emitter->life_min + emitter_random(emitter) * (emitter->life_max - emitter->life_min));
+    }
+    emitter->count = i;
+}
+
+/* computes scale and color of all particles from their relative age */
+static void update_particle_looks( emitter_t *emitter ) {
+    int i, k, count = emitter->count, last = emitter->ramp_count - 1;
+    float f, s0 = emitter->scale_start, ds = emitter->scale_end - emitter->scale_start;
+    float *t = emitter->t, *scale = emitter->scale;
+    const ALLEGRO_COLOR *c;
+    for ( i = 0; i < count; ++i ) {
+        t[i] = emitter->age[i] * emitter->inv_life[i];
+    }
+    for ( i = 0; i < count; ++i ) {
+        scale[i] = s0 + ds * t[i];
+    }
+    if ( last == 0 ) {
+        c = emitter->ramp;
+        for ( i = 0; i < count; ++i ) {
+            emitter->r[i] = c->r; emitter->g[i] = c->g; emitter->b[i] = c->b; emitter->a[i] = c->a;
+        }
+        return;
+    }
+    for ( i = 0; i < count; ++i ) {
+        f = t[i] * last;
+        k = (int) f;
+        if ( k >= last ) {
+            k = last - 1;
+        }
+        f -= k;
+        c = emitter->ramp + k;
+        emitter->r[i] = c[0].r + (c[1].r - c[0].r) * f;
+        emitter->g[i] = c[0].g + (c[1].g - c[0].g) * f;
+        emitter->b[i] = c[0].b + (c[1].b - c[0].b) * f;
+        emitter->a[i] = c[0].a + (c[1].a - c[0].a) * f;
+    }
+}
+
+static void move_particle( emitter_t *emitter, const int dst, const int src ) {
+    emitter->px[dst] = emitter->px[src];
+    emitter->py[dst] = emitter->py[src];
+    emitter->vx[dst] = emitter->vx[src];
+    emitter->vy[dst] = emitter->vy[src];
+    emitter->age[dst] = emitter->age[src];
+    emitter->inv_life[dst] = emitter->inv_life[src];
+}
+
+/* update(dt) -> number of living particles */
+static int emitter_update( lua_State *L ) {
+    int i, n, count;
+    emitter_t *emitter = to_emitter(L, 1);
+    float dt = (float) luaL_checknumber(L, 2);
+    float gx = emitter->gravity_x * dt, gy = emitter->gravity_y * dt;
+    float *px = emitter->px, *py = emitter->py, *vx = emitter->vx, *vy = emitter->vy, *age = emitter->age;
+    count = emitter->count;
+    for ( i = 0; i < count; ++i ) {
+        age[i] += dt;
+    }
+    for ( i = 0; i < count; ++i ) {
+        vx[i] += gx;
+        vy[i] += gy;
+    }
+    for ( i = 0; i < count; ++i ) {
+        px[i] += vx[i] * dt;
+        py[i] += vy[i] * dt;
+    }
+    for ( i = 0; i < count; ) { /* remove dead particles */
+        if ( age[i] * emitter->inv_life[i] >= 1.0f ) {
+            move_particle(emitter, i, --count);
+        } else {
+            ++i;
+        }
+    }
+    emitter->count = count;
+    if ( emitter->rate > 0.0f ) {
+        emitter->accumulator += emitter->rate * dt;
+        n = (int) emitter->accumulator;
+        emitter->accumulator -= n;
+        spawn_particles(emitter, n);
+    }
+    update_particle_looks(emitter);
+    lua_pushinteger(L, emitter->count);
+    return 1;
+}
+
+/* emit(n) - spawns a burst of n particles */
+static int emitter_emit( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    spawn_particles(emitter, luaL_checkint(L, 2));
+    update_particle_looks(emitter);
+    lua_pushinteger(L, emitter->count);
+    return 1;
+}
+
+static int emitter_draw( lua_State *L ) {
+    int i;
+    float hw, hh;
+    ALLEGRO_VERTEX *vertices;
+    ALLEGRO_BITMAP *bitmap;
+    emitter_t *emitter = to_emitter(L, 1);
+    const float *region = emitter->region;
+    NOT_RECORDABLE_MACRO("emitter:draw");
+    if ( emitter->count == 0 ) {
+        return 0;
+    }
+    bitmap = (ALLEGRO_BITMAP*) get_ref_object(L, emitter->bitmap_ref); /* bitmap:destroy() frees it despite the reference */
+    if ( bitmap == NULL ) {
+        return luaL_error(L, "attempt to operate on destroyed " LUA_QS, LEGATO_BITMAP);
+    }
+    vertices = get_scratch_vertices(L, emitter->count * 6);
+    for ( i = 0; i < emitter->count; ++i ) {
+        hw = region[2] * emitter->scale[i] * 0.5f;
+        hh = region[3] * emitter->scale[i] * 0.5f;
+        set_quad_vertices(vertices + i * 6, emitter->px[i] - hw, emitter->py[i] - hh, emitter->px[i] + hw, emitter->py[i] + hh,
+                region[0], region[1], region[0] + region[2], region[1] + region[3],
+                al_map_rgba_f(emitter->r[i], emitter->g[i], emitter->b[i], emitter->a[i]));
+    }
+    mark_dirty_vertices(vertices, emitter->count * 6);
+    al_draw_prim(vertices, NULL, bitmap, 0, emitter->count * 6, ALLEGRO_PRIM_TRIANGLE_LIST);
+    return 0;
+}
+
+static int emitter_clear( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    emitter->count = 0;
+    emitter->accumulator = 0.0f;
+    return 0;
+}
+
+static int emitter_get_count( lua_State *L ) {
+    lua_pushinteger(L, to_emitter(L, 1)->count);
+    return 1;
+}
+
+static int emitter_get_capacity( lua_State *L ) {
+    lua_pushinteger(L, to_emitter(L, 1)->capacity);
+    return 1;
+}
+
+static int emitter_set_position( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    emitter->x = (float) luaL_checknumber(L, 2);
+    emitter->y = (float) luaL_checknumber(L, 3);
+    return 0;
+}
+
+/* set_rate(particles per second) */
+static int emitter_set_rate( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    const float rate = (float) luaL_checknumber(L, 2);
+    luaL_argcheck(L, rate >= 0.0f, 2, "invalid rate");
+    emitter->rate = rate;
+    return 0;
+}
+
+/* set_direction(angle, spread) - both in radians */
+static int emitter_set_direction( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    emitter->direction = (float) luaL_checknumber(L, 2);
+    emitter->spread = (float) luaL_optnumber(L, 3, 0.0);
+    return 0;
+}
+
+static int emitter_set_speed( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    emitter->speed_min = (float) luaL_checknumber(L, 2);
+    emitter->speed_max = (float) luaL_optnumber(L, 3, emitter->speed_min);
+    return 0;
+}
+
+static int emitter_set_life( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    const float life_min = (float) luaL_checknumber(L, 2);
+    const float life_max = (float) luaL_optnumber(L, 3, life_min);
+    luaL_argcheck(L, life_min > 0.0f, 2, "invalid life time");
+    luaL_argcheck(L, life_max >= life_min, 3, "invalid life time");
+    emitter->life_min = life_min;
+    emitter->life_max = life_max;
+    return 0;
+}
+
+static int emitter_set_scale( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    emitter->scale_start = (float) luaL_checknumber(L, 2);
+    emitter->scale_end = (float) luaL_optnumber(L, 3, emitter->scale_start);
+    return 0;
+}
+
+static int emitter_set_gravity( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    emitter->gravity_x = (float) luaL_checknumber(L, 2);
+    emitter->gravity_y = (float) luaL_checknumber(L, 3);
+    return 0;
+}
+
+/* set_colors(color1, [color2, ...]) - colors are evenly spread over the life time */
+static int emitter_set_colors( lua_State *L ) {
+    int i, n;
+    emitter_t *emitter = to_emitter(L, 1);
+    n = lua_gettop(L) - 1;
+    luaL_argcheck(L, n >= 1 && n <= LEGATO_EMITTER_RAMP_SIZE, 2, "invalid number of colors");
+    for ( i = 0; i < n; ++i ) {
+        emitter->ramp[i] = to_color(L, i + 2);
+    }
+    emitter->ramp_count = n;
+    return 0;
+}
+
+static int emitter_set_seed( lua_State *L ) {
+    emitter_t *emitter = to_emitter(L, 1);
+    emitter->seed = (uint32_t) luaL_checkinteger(L, 2);
+    if ( emitter->seed == 0 ) { /* xorshift would get stuck at 0 */
+        emitter->seed = 0x2545f491;
+    }
+    return 0;
+}
+
+static const luaL_Reg emitter__methods[] = {
+    {"__gc", emitter_destroy},
+    {"__tostring", emitter__tostring},
+    {"destroy", emitter_destroy},
+    {"update", emitter_update},
+    {"emit", emitter_emit},
+    {"draw", emitter_draw},
+    {"clear", emitter_clear},
+    {"get_count", emitter_get_count},
+    {"get_capacity", emitter_get_capacity},
+    {"set_position", emitter_set_position},
+    {"set_rate", emitter_set_rate},
+    {"set_direction", emitter_set_direction},
+    {"set_speed", emitter_set_speed},
+    {"set_life", emitter_set_life},
+    {"set_scale", emitter_set_scale},
+    {"set_gravity", emitter_set_gravity},
+    {"set_colors", emitter_set_colors},
+    {"set_seed", emitter_set_seed},
+    {NULL, NULL}
+};
+
+static const luaL_Reg fx__functions[] = {
+    {"create_emitter", fx_create_emitter},
+    {NULL, NULL}
+};
+
 /*
 ================================================================================
 
@@ -5910,6 +11700,16 @@ static int luaopen_legato( lua_State *L ) {
     create_meta(L, LEGATO_SAMPLE_INSTANCE, sample_instance__methods);
     create_meta(L, LEGATO_AUDIO_STREAM, audio_stream__methods);
     create_meta(L, LEGATO_FONT, font__methods);
+    create_meta(L, LEGATO_SPRITE_BATCH, sprite_batch__methods);
+    create_meta(L, LEGATO_LOCKED_REGION, locked_region__methods);
+    create_meta(L, LEGATO_ATLAS, atlas__methods);
+    create_meta(L, LEGATO_VERTEX_ARRAY, vertex_array__methods);
+    create_meta(L, LEGATO_COMMAND_LIST, command_list__methods);
+    create_meta(L, LEGATO_TEXT_OBJECT, text_object__methods);
+    create_meta(L, LEGATO_RENDER_TARGET_POOL, render_target_pool__methods);
+    create_meta(L, LEGATO_ANIMATION, animation__methods);
+    create_meta(L, LEGATO_ANIMATOR, animator__methods);
+    create_meta(L, LEGATO_INPUT_SNAPSHOT, input_snapshot__methods);
     create_meta(L, LEGATO_FILE, file__methods);
     create_meta(L, LEGATO_ADDRESS, address__methods);
     create_meta(L, LEGATO_HOST, host__methods);
@@ -5917,6 +11717,8 @@ static int luaopen_legato( lua_State *L ) {
     create_meta(L, LEGATO_RAND_LCG, rand_lcg__methods);
     create_meta(L, LEGATO_RAND_MT, rand_mt__methods);
     create_meta(L, LEGATO_NUMBER_MAP, number_map__methods);
+    create_meta(L, LEGATO_FLOAT_BUFFER, float_buffer__methods);
+    create_meta(L, LEGATO_EMITTER, emitter__methods);
     lua_newtable(L);
     luaL_newlib(L, core__functions);
     lua_setfield(L, -2, "core");
@@ -5924,6 +11726,9 @@ static int luaopen_legato( lua_State *L ) {
     lua_newtable(L);
     register_mapping(L, keycode_mapping);
     lua_setfield(L, -2, "keys");
+    lua_newtable(L);
+    register_mapping(L, event_type_mapping);
+    lua_setfield(L, -2, "event_types");
     lua_setfield(L, -2, "al");
     luaL_newlib(L, fs__functions);
     lua_setfield(L, -2, "fs");
@@ -5935,6 +11740,8 @@ static int luaopen_legato( lua_State *L ) {
     lua_setfield(L, -2, "rand");
     luaL_newlib(L, util__functions);
     lua_setfield(L, -2, "util");
+    luaL_newlib(L, fx__functions);
+    lua_setfield(L, -2, "fx");
     return 1;
 }
 
@@ -6005,6 +11812,10 @@ int main( int argc, char *argv[] ) {
         show_error(lua_tostring(L, -1));
     }
     lua_close(L);
+    shutdown_async_loader();
+    shutdown_frame_capture();
+    stop_input_recording();
+    stop_input_replay();
 
     al_shutdown_primitives_addon();
     al_shutdown_ttf_addon();
@@ -6012,6 +11823,7 @@ int main( int argc, char *argv[] ) {
     al_shutdown_image_addon();
     al_uninstall_audio();
     al_uninstall_system();
+    free(scratch_vertices);
 
     enet_deinitialize();
     PHYSFS_deinit();